@@ -0,0 +1,339 @@
+#include "bulkMath.h"
+#include "jobs.h"
+#include <vector>
+#include <algorithm>
+#include <math.h>
+#include <string.h>
+
+using namespace das;
+using namespace std;
+
+// arrays smaller than this are processed by the calling thread
+#define BULK_PARALLEL_MIN_FLOATS (64 << 10)
+#define BULK_PARALLEL_MIN_QUERIES 1024
+// multiple of 4 (SIMD width) and of 2 and 3 (components), so every chunk starts at the same pattern phase
+#define BULK_PATTERN_FLOATS 12
+
+
+static void madd_floats(float * dst, const float * src, float scale, int begin, int end)
+{
+  vec4f s = v_splats(scale);
+  int i = begin;
+  for (; i + 4 <= end; i += 4)
+    v_stu(dst + i, v_madd(v_ldu(src + i), s, v_ldu(dst + i)));
+  for (; i < end; i++)
+    dst[i] += src[i] * scale;
+}
+
+static void add_pattern_floats(float * dst, const float * pattern, int begin, int end)
+{
+  vec4f p0 = v_ldu(pattern);
+  vec4f p1 = v_ldu(pattern + 4);
+  vec4f p2 = v_ldu(pattern + 8);
+  int i = begin;
+  for (; i + BULK_PATTERN_FLOATS <= end; i += BULK_PATTERN_FLOATS)
+  {
+    v_stu(dst + i, v_add(v_ldu(dst + i), p0));
+    v_stu(dst + i + 4, v_add(v_ldu(dst + i + 4), p1));
+    v_stu(dst + i + 8, v_add(v_ldu(dst + i + 8), p2));
+  }
+  for (; i < end; i++)
+    dst[i] += pattern[i % BULK_PATTERN_FLOATS];
+}
+
+template <typename F>
+static void for_float_ranges(int count, const F & fn)
+{
+  if (count < BULK_PARALLEL_MIN_FLOATS)
+  {
+    fn(0, count);
+    return;
+  }
+
+  int chunk = count / (jobs::get_worker_count() + 1) + 1;
+  chunk = (chunk + BULK_PATTERN_FLOATS - 1) / BULK_PATTERN_FLOATS * BULK_PATTERN_FLOATS;
+  jobs::parallel_for(count, chunk, fn);
+}
+
+static void add_scaled(Array & dst, const Array & src, int components, float scale, const char * name,
+  Context * context, LineInfoArg * at)
+{
+  if (dst.size != src.size)
+    context->throw_error_at(*at, "%s: arrays have different sizes, %d and %d", name, int(dst.size), int(src.size));
+
+  float * d = (float *)dst.data;
+  const float * s = (const float *)src.data;
+  for_float_ranges(int(dst.size) * components, [=](int begin, int end) { madd_floats(d, s, scale, begin, end); });
+}
+
+static void add_value(Array & dst, const float * value, int components)
+{
+  float pattern[BULK_PATTERN_FLOATS];
+  for (int i = 0; i < BULK_PATTERN_FLOATS; i++)
+    pattern[i] = value[i % components];
+
+  float * d = (float *)dst.data;
+  for_float_ranges(int(dst.size) * components, [&](int begin, int end) { add_pattern_floats(d, pattern, begin, end); });
+}
+
+
+void array_add_scaled_float(TArray<float> & dst, const TArray<float> & src, float scale, Context * context,
+  LineInfoArg * at)
+{
+  add_scaled(dst, src, 1, scale, "add_scaled", context, at);
+}
+
+void array_add_scaled_float2(TArray<float2> & dst, const TArray<float2> & src, float scale, Context * context,
+  LineInfoArg * at)
+{
+  add_scaled(dst, src, 2, scale, "add_scaled", context, at);
+}
+
+void array_add_scaled_float3(TArray<float3> & dst, const TArray<float3> & src, float scale, Context * context,
+  LineInfoArg * at)
+{
+  add_scaled(dst, src, 3, scale, "add_scaled", context, at);
+}
+
+void array_add_float(TArray<float> & dst, float value)
+{
+  add_value(dst, &value, 1);
+}
+
+void array_add_float2(TArray<float2> & dst, float2 value)
+{
+  add_value(dst, &value.x, 2);
+}
+
+void array_add_float3(TArray<float3> & dst, float3 value)
+{
+  add_value(dst, &value.x, 3);
+}
+
+
+//----- geometry -----
+
+// result arrays are overwritten
+static void set_array(Array & arr, const void * data, int count, int stride, Context * context, LineInfoArg * at)
+{
+  array_resize(*context, arr, uint32_t(count), uint32_t(stride), false, at);
+  if (count)
+    memcpy(arr.data, data, size_t(count) * stride);
+}
+
+// m * float4(x, y, 0, 1), two points per vector
+void transform_points(TArray<float2> & dst, const TArray<float2> & src, const float4x4 & m, Context * context,
+  LineInfoArg * at)
+{
+  if (dst.size != src.size)
+    context->throw_error_at(*at, "transform_points: arrays have different sizes, %d and %d", int(dst.size),
+      int(src.size));
+
+  vec4f ax = v_make_vec4f(m.m[0].x, m.m[0].y, m.m[0].x, m.m[0].y);
+  vec4f ay = v_make_vec4f(m.m[1].x, m.m[1].y, m.m[1].x, m.m[1].y);
+  vec4f t = v_make_vec4f(m.m[3].x, m.m[3].y, m.m[3].x, m.m[3].y);
+  float * d = (float *)dst.data;
+  const float * s = (const float *)src.data;
+  int count = int(src.size);
+
+  for_float_ranges(count * 2, [=](int begin, int end)
+  {
+    // ranges are aligned to BULK_PATTERN_FLOATS, so they start at whole points
+    int i = begin;
+    for (; i + 4 <= end; i += 4)
+    {
+      vec4f xx = v_make_vec4f(s[i], s[i], s[i + 2], s[i + 2]);
+      vec4f yy = v_make_vec4f(s[i + 1], s[i + 1], s[i + 3], s[i + 3]);
+      v_stu(d + i, v_madd(xx, ax, v_madd(yy, ay, t)));
+    }
+    for (; i < end; i += 2)
+    {
+      float x = s[i];
+      float y = s[i + 1];
+      d[i] = m.m[0].x * x + m.m[1].x * y + m.m[3].x;
+      d[i + 1] = m.m[0].y * x + m.m[1].y * y + m.m[3].y;
+    }
+  });
+}
+
+void query_circles(const TArray<float2> & centers, const TArray<float> & radii, float2 center, float radius,
+  TArray<int> & result, Context * context, LineInfoArg * at)
+{
+  if (radii.size && radii.size != centers.size)
+    context->throw_error_at(*at, "query_circles: %d radii for %d centers", int(radii.size), int(centers.size));
+
+  vector<int> found;
+  for (int i = 0, n = int(centers.size); i < n; i++)
+  {
+    float dx = centers[i].x - center.x;
+    float dy = centers[i].y - center.y;
+    float r = radius + (radii.size ? radii[i] : 0.0f);
+    if (dx * dx + dy * dy < r * r)
+      found.push_back(i);
+  }
+  set_array(result, found.data(), int(found.size()), sizeof(int), context, at);
+}
+
+// boxes are float4(min.x, min.y, max.x, max.y), with negated max both tests of the overlap are 'less or equal'
+void query_boxes(const TArray<float4> & boxes, float4 box, TArray<int> & result, Context * context, LineInfoArg * at)
+{
+  vec4f sign = v_make_vec4f(1.0f, 1.0f, -1.0f, -1.0f);
+  vec4f q = v_make_vec4f(box.z, box.w, -box.x, -box.y);
+  const float * b = (const float *)boxes.data;
+
+  vector<int> found;
+  for (int i = 0, n = int(boxes.size); i < n; i++)
+    if (!v_signmask(v_cmp_gt(v_mul(v_ldu(b + i * 4), sign), q)))
+      found.push_back(i);
+  set_array(result, found.data(), int(found.size()), sizeof(int), context, at);
+}
+
+
+// uniform grid of 'b' with the cell of the largest diameter of both sets, cells are hashed to a table of buckets
+struct CircleGrid
+{
+  float cellSize = 1.0f;
+  float maxRadius = 0.0f;
+  uint32_t mask = 0;
+  vector<int> bucketStart; // mask + 2 entries, items of the bucket k are [bucketStart[k], bucketStart[k + 1])
+  vector<int> items;
+
+  uint32_t bucket(int cx, int cy) const
+  {
+    return (uint32_t(cx) * 73856093u ^ uint32_t(cy) * 19349663u) & mask;
+  }
+
+  // NaN and huge coordinates go to the border cells, converting them to int is undefined
+  int cell(float v) const
+  {
+    float c = floorf(v / cellSize);
+    if (!(c > -1073741824.0f))
+      return -1073741824;
+    return c < 1073741824.0f ? int(c) : 1073741824;
+  }
+
+  void build(const TArray<float2> & centers, const TArray<float> & radii, float query_max_radius)
+  {
+    int n = int(centers.size);
+    for (int i = 0; i < n; i++)
+      maxRadius = max(maxRadius, radii[i]);
+    cellSize = max(max(maxRadius, query_max_radius) * 2.0f, 1e-3f);
+
+    uint32_t tableSize = 16;
+    while (tableSize < uint32_t(n) * 2)
+      tableSize *= 2;
+    mask = tableSize - 1;
+
+    vector<uint32_t> itemBucket(n);
+    bucketStart.assign(tableSize + 1, 0);
+    for (int i = 0; i < n; i++)
+    {
+      itemBucket[i] = bucket(cell(centers[i].x), cell(centers[i].y));
+      bucketStart[itemBucket[i] + 1]++;
+    }
+    for (uint32_t k = 0; k < tableSize; k++)
+      bucketStart[k + 1] += bucketStart[k];
+
+    vector<int> fill(bucketStart.begin(), bucketStart.end() - 1);
+    items.resize(n);
+    for (int i = 0; i < n; i++)
+      items[fill[itemBucket[i]]++] = i;
+  }
+};
+
+static void query_grid(const CircleGrid & grid, const TArray<float2> & b_centers, const TArray<float> & b_radii,
+  int a, float2 pos, float radius, vector<int2> & pairs, vector<uint32_t> & visited)
+{
+  size_t from = pairs.size();
+  auto testBucket = [&](uint32_t k)
+  {
+    for (int j = grid.bucketStart[k]; j < grid.bucketStart[k + 1]; j++)
+    {
+      int b = grid.items[j];
+      float dx = b_centers[b].x - pos.x;
+      float dy = b_centers[b].y - pos.y;
+      float r = radius + b_radii[b];
+      if (dx * dx + dy * dy < r * r)
+        pairs.push_back(int2(a, b));
+    }
+  };
+
+  float reach = radius + grid.maxRadius;
+  float side = reach * 2.0f / grid.cellSize + 2.0f;
+  if (!(side * side <= float(grid.mask + 1)))
+  {
+    for (uint32_t k = 0; k <= grid.mask; k++)
+      testBucket(k);
+  }
+  else
+  {
+    int x0 = grid.cell(pos.x - reach);
+    int x1 = grid.cell(pos.x + reach);
+    int y0 = grid.cell(pos.y - reach);
+    int y1 = grid.cell(pos.y + reach);
+
+    // different cells can share a bucket, each bucket is tested once
+    visited.clear();
+    for (int cy = y0; cy <= y1; cy++)
+      for (int cx = x0; cx <= x1; cx++)
+      {
+        uint32_t k = grid.bucket(cx, cy);
+        if (std::find(visited.begin(), visited.end(), k) == visited.end())
+        {
+          visited.push_back(k);
+          testBucket(k);
+        }
+      }
+  }
+  std::sort(pairs.begin() + from, pairs.end(), [](const int2 & l, const int2 & r) { return l.y < r.y; });
+}
+
+// pairs (index in a, index in b) of overlapping circles, sorted by a, then by b
+void find_overlapping_circles(const TArray<float2> & a_centers, const TArray<float> & a_radii,
+  const TArray<float2> & b_centers, const TArray<float> & b_radii, TArray<int2> & pairs, Context * context,
+  LineInfoArg * at)
+{
+  if (a_radii.size != a_centers.size || b_radii.size != b_centers.size)
+    context->throw_error_at(*at, "find_overlapping_circles: number of radii differs from number of centers");
+
+  float maxRadius = 0.0f;
+  for (uint32_t i = 0; i < a_radii.size; i++)
+    maxRadius = max(maxRadius, a_radii[i]);
+  CircleGrid grid;
+  grid.build(b_centers, b_radii, maxRadius);
+
+  int count = int(a_centers.size);
+  int chunk = count >= BULK_PARALLEL_MIN_QUERIES ? count / (jobs::get_worker_count() + 1) + 1 : count;
+  int chunkCount = count ? (count + chunk - 1) / chunk : 0;
+  vector<vector<int2>> found(chunkCount);
+  jobs::parallel_for(count, chunk, [&](int begin, int end)
+  {
+    vector<int2> & res = found[begin / chunk];
+    vector<uint32_t> visited;
+    for (int a = begin; a < end; a++)
+      query_grid(grid, b_centers, b_radii, a, a_centers[a], a_radii[a], res, visited);
+  });
+
+  vector<int2> all;
+  for (auto && res : found)
+    all.insert(all.end(), res.begin(), res.end());
+  set_array(pairs, all.data(), int(all.size()), sizeof(int2), context, at);
+}
+
+int find_nearest_point(const TArray<float2> & points, float2 pos)
+{
+  int best = -1;
+  float bestDist = INFINITY;
+  for (int i = 0, n = int(points.size); i < n; i++)
+  {
+    float dx = points[i].x - pos.x;
+    float dy = points[i].y - pos.y;
+    float d = dx * dx + dy * dy;
+    if (d < bestDist)
+    {
+      bestDist = d;
+      best = i;
+    }
+  }
+  return best;
+}
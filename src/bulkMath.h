@@ -0,0 +1,28 @@
+#pragma once
+
+#include <daScript/daScript.h>
+
+// operations over whole arrays of components, large arrays are split between the worker threads
+
+void array_add_scaled_float(das::TArray<float> & dst, const das::TArray<float> & src, float scale,
+  das::Context * context, das::LineInfoArg * at);
+void array_add_scaled_float2(das::TArray<das::float2> & dst, const das::TArray<das::float2> & src, float scale,
+  das::Context * context, das::LineInfoArg * at);
+void array_add_scaled_float3(das::TArray<das::float3> & dst, const das::TArray<das::float3> & src, float scale,
+  das::Context * context, das::LineInfoArg * at);
+
+void array_add_float(das::TArray<float> & dst, float value);
+void array_add_float2(das::TArray<das::float2> & dst, das::float2 value);
+void array_add_float3(das::TArray<das::float3> & dst, das::float3 value);
+
+void transform_points(das::TArray<das::float2> & dst, const das::TArray<das::float2> & src, const das::float4x4 & m,
+  das::Context * context, das::LineInfoArg * at);
+
+void query_circles(const das::TArray<das::float2> & centers, const das::TArray<float> & radii, das::float2 center,
+  float radius, das::TArray<int> & result, das::Context * context, das::LineInfoArg * at);
+void query_boxes(const das::TArray<das::float4> & boxes, das::float4 box, das::TArray<int> & result,
+  das::Context * context, das::LineInfoArg * at);
+void find_overlapping_circles(const das::TArray<das::float2> & a_centers, const das::TArray<float> & a_radii,
+  const das::TArray<das::float2> & b_centers, const das::TArray<float> & b_radii, das::TArray<das::int2> & pairs,
+  das::Context * context, das::LineInfoArg * at);
+int find_nearest_point(const das::TArray<das::float2> & points, das::float2 pos);
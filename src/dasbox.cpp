@@ -8,6 +8,9 @@
 #include <algorithm>
 #include <iostream>
 #include <string>
+#include <atomic>
+#include <chrono>
+#include <mutex>
 #include <stdarg.h>
 #include <stdlib.h>
 #include <math.h>
@@ -19,9 +22,13 @@
 #include "globals.h"
 #include "fileSystem.h"
 #include "sound.h"
+#include "jobs.h"
+#include "profiler.h"
+#include "localStorage.h"
+#include "frameArena.h"
+#include "parallel.h"
 
 #ifdef _WIN32
-#include <../SFML/extlibs/headers/glad/include/glad/gl.h>
 #define WIN32_LEAN_AND_MEAN
 #define NOMINMAX
 #include <Windows.h>
@@ -43,6 +50,7 @@ bool exec_script_scheduled = false;
 bool trust_mode = false;
 bool run_for_plugin = false;
 bool log_to_console = false;
+bool log_console_to_stderr = false;
 string plugin_main_function = "main";
 
 locale * g_locale;
@@ -74,6 +82,32 @@ bool window_is_active = true;
 float cur_dt = 0.001f;
 double time_after_start = 0.0;
 
+#define MAX_FIXED_STEPS_PER_FRAME 8
+
+static float fixed_timestep = 0.0f; // 0 - act() is called once per frame with variable dt
+static double fixed_time_accumulator = 0.0;
+static float interpolation_alpha = 1.0f;
+static int frame_rate_limit = 0;
+static chrono::steady_clock::time_point next_frame_time;
+static bool idle_mode = false;
+static bool redraw_requested = true;
+static void reset_frame_pacing();
+
+static bool startup_trace = false;
+static chrono::steady_clock::time_point startup_time = chrono::steady_clock::now();
+static chrono::steady_clock::time_point startup_phase_time = startup_time;
+
+static void trace_startup_phase(const char * phase)
+{
+  if (!startup_trace)
+    return;
+  auto now = chrono::steady_clock::now();
+  print_note("startup: %-24s %8.1f ms  (total %.1f ms)", phase,
+    chrono::duration<float, milli>(now - startup_phase_time).count(),
+    chrono::duration<float, milli>(now - startup_time).count());
+  startup_phase_time = now;
+}
+
 sf::RenderTarget * g_render_target = nullptr;
 sf::RenderWindow * g_window = nullptr;
 sf::RenderTexture * render_texture = nullptr;
@@ -85,11 +119,13 @@ pair<bool, bool> delayed_cursor_grabbed = make_pair(true, false);
 pair<bool, bool> delayed_vsync = make_pair(true, true);
 pair<bool, sf::Vector2i> delayed_resolution = make_pair(false, sf::Vector2i(1280, 720));
 pair<bool, int> delayed_upscale = make_pair(false, 0);
+pair<bool, bool> delayed_upscale_view = make_pair(false, false);
 pair<bool, int> delayed_window_antialiasing = make_pair(false, 0);
 
 static bool delayed_window_antialiasing_set = false;
 static bool delayed_resolution_set = false;
 static bool delayed_upscale_set = false;
+static bool delayed_upscale_view_set = false;
 
 
 void schedule_pause()
@@ -118,6 +154,129 @@ float get_delta_time()
   return cur_dt;
 }
 
+void set_fixed_timestep(float steps_per_second)
+{
+  fixed_timestep = steps_per_second > 0.0f ? 1.0f / steps_per_second : 0.0f;
+  fixed_time_accumulator = 0.0;
+  interpolation_alpha = 1.0f;
+}
+
+float get_fixed_timestep()
+{
+  return fixed_timestep;
+}
+
+float get_interpolation_alpha()
+{
+  return interpolation_alpha;
+}
+
+
+//-------------------------------- script heap -------------------------------------------
+
+static bool persistent_heap = false;
+static profiler::HeapStats heap_stats;
+static float gc_budget_ms = -1.0f; // negative - collection is not requested
+#define GC_INITIAL_MS_PER_MB 2.0 // pessimistic until the first collection is measured
+#define GC_SKIP_DECAY 0.8 // the estimate could be stale, each skip lowers it
+#define GC_MAX_SKIPPED_COLLECTIONS 10 // then the heap is collected regardless of the budget
+
+static double gc_ms_per_mb = GC_INITIAL_MS_PER_MB;  // measured by the last collection
+static int gc_skipped_in_row = 0;
+static bool gc_not_persistent_reported = false;
+
+profiler::HeapStats get_heap_stats()
+{
+  return heap_stats;
+}
+
+void collect_garbage(float budget_ms)
+{
+  gc_budget_ms = max(budget_ms, 0.0f);
+}
+
+static void update_heap_stats(Context * ctx)
+{
+  if (!ctx)
+    return;
+  int64_t heapBytes = int64_t(ctx->heap->bytesAllocated());
+  int64_t stringBytes = int64_t(ctx->stringHeap->bytesAllocated());
+  heap_stats.frameHeapGrowth = heapBytes - heap_stats.heapBytes;
+  heap_stats.frameStringGrowth = stringBytes - heap_stats.stringBytes;
+  heap_stats.heapBytes = heapBytes;
+  heap_stats.stringBytes = stringBytes;
+  heap_stats.heapReserved = int64_t(ctx->heap->totalAlignedMemoryAllocated());
+  heap_stats.stringReserved = int64_t(ctx->stringHeap->totalAlignedMemoryAllocated());
+  heap_stats.heapPeak = max(heap_stats.heapPeak, heapBytes);
+  heap_stats.stringPeak = max(heap_stats.stringPeak, stringBytes);
+}
+
+static void reset_heap_stats()
+{
+  heap_stats = profiler::HeapStats();
+  gc_budget_ms = -1.0f;
+  gc_skipped_in_row = 0;
+}
+
+// between act() and draw(), after parallel::barrier(), when nothing of the script is on the stack
+// and no job uses the heap
+static void run_requested_garbage_collection(Context * ctx)
+{
+  if (gc_budget_ms < 0.0f || !ctx)
+    return;
+  float budget = gc_budget_ms;
+  gc_budget_ms = -1.0f;
+
+  if (!ctx->persistent)
+  {
+    if (!gc_not_persistent_reported)
+      print_error("collect_garbage: heap of the script is not collectable, start dasbox with --persistent-heap "
+        "or add 'options persistent_heap = true'");
+    gc_not_persistent_reported = true;
+    return;
+  }
+
+  double mb = double(ctx->heap->bytesAllocated() + ctx->stringHeap->bytesAllocated()) / (1 << 20);
+  if (budget > 0.0f && gc_ms_per_mb * mb > budget && gc_skipped_in_row < GC_MAX_SKIPPED_COLLECTIONS)
+  {
+    heap_stats.skippedCollections++;
+    gc_skipped_in_row++;
+    gc_ms_per_mb *= GC_SKIP_DECAY;
+    return;
+  }
+  gc_skipped_in_row = 0;
+
+  int64_t before = int64_t(ctx->heap->bytesAllocated() + ctx->stringHeap->bytesAllocated());
+  profiler::begin_marker("collect_garbage");
+  auto start = chrono::steady_clock::now();
+  ctx->collectHeap(nullptr, true, false);
+  float ms = chrono::duration<float, milli>(chrono::steady_clock::now() - start).count();
+  profiler::end_marker();
+
+  gc_ms_per_mb = ms / max(mb, 1.0);
+  heap_stats.collections++;
+  heap_stats.lastCollectionMs = ms;
+  heap_stats.lastCollectionFreed =
+    before - int64_t(ctx->heap->bytesAllocated() + ctx->stringHeap->bytesAllocated());
+}
+
+void set_frame_rate_limit(int fps)
+{
+  frame_rate_limit = max(fps, 0);
+  next_frame_time = chrono::steady_clock::now();
+}
+
+void set_idle_mode(bool enable)
+{
+  idle_mode = enable;
+  redraw_requested = true;
+}
+
+void request_redraw()
+{
+  redraw_requested = true;
+}
+
 bool is_window_active()
 {
   return window_is_active;
@@ -178,6 +337,18 @@ void set_rendering_upscale(int upscale)
   }
 }
 
+// upscaled frame is rasterized directly into the window with a scaled view instead of the blit of a render texture
+void set_upscale_with_view(bool enable)
+{
+  delayed_upscale_view_set = true;
+
+  if (enable != delayed_upscale_view.second)
+  {
+    delayed_upscale_view = make_pair(true, enable);
+    recreate_window = true;
+  }
+}
+
 void disable_auto_upscale()
 {
   set_rendering_upscale(1);
@@ -222,6 +393,7 @@ void set_vsync_enabled(bool enable)
     reinterpret_error_as_note(true);
     g_window->setVerticalSyncEnabled(enable);
     vsync_enabled = enable;
+    reset_frame_pacing();
     fetch_cerr();
     reinterpret_error_as_note(false);
     delayed_vsync.first = false;
@@ -236,6 +408,7 @@ void prepare_delayed_variables()
   delayed_window_antialiasing_set = false;
   delayed_resolution_set = false;
   delayed_upscale_set = false;
+  delayed_upscale_view_set = false;
 }
 
 void check_delayed_variables()
@@ -251,6 +424,9 @@ void check_delayed_variables()
     set_rendering_upscale(0);
     delayed_upscale.first = true;
   }
+
+  if (!delayed_upscale_view_set)
+    set_upscale_with_view(false);
 }
 //-------------------------------------------------------------------------------------
 
@@ -276,12 +452,13 @@ struct PlaygroundContext final : das::Context
 struct DasFile
 {
   das::smart_ptr<PlaygroundContext> ctx;
-  ModuleGroup dummyLibGroup;
+  shared_ptr<ModuleGroup> libGroup; // modules compiled for the program, can be shared with the next version
   das::smart_ptr<fs::DasboxFsFileAccess> fAccess;
   ProgramPtr program;
 
   DasFile()
   {
+    libGroup = make_shared<ModuleGroup>();
     fAccess = make_smart<fs::DasboxFsFileAccess>();
   }
 };
@@ -308,6 +485,17 @@ Context * dasbox_get_clone_context(Context * ctx, uint32_t category) {
 
 static DasFile * das_file = new DasFile();
 static DasFile * das_live_file = new DasFile();
+
+// Compilation adds the modules it creates to the module list of the bound daScriptEnvironment and deleting
+// a program removes them, the list is shared with the background compilation on the worker thread.
+// Programs are compiled and deleted only while holding this mutex.
+static mutex program_modules_mutex;
+
+static void delete_das_file(DasFile * file)
+{
+  lock_guard<mutex> lock(program_modules_mutex);
+  delete file;
+}
 static float time_to_check = 1.0f;
 
 SimFunction * fn_act = nullptr;
@@ -379,9 +567,41 @@ void exec_function(SimFunction * fn, vec4f * args)
 }
 
 
+// when dasbox is linked with the AOT generated code, simulate() replaces interpreted functions with native ones
+static bool aot_enabled = true;
+
+static CodeOfPolicies get_script_policies()
+{
+  CodeOfPolicies policies;
+#if DASBOX_AOT
+  policies.aot = aot_enabled;
+#endif
+  policies.persistent_heap = persistent_heap;
+  return policies;
+}
+
+
+static string get_compilation_errors(const string & file_name, DasFile * das_file)
+{
+  string s;
+  s += "Failed to compile: '";
+  s += file_name;
+  s += "'\n";
+
+  for (Error & e : das_file->program->errors)
+  {
+    s += "\n";
+    s += reportError(e.at, e.what, e.extra, e.fixme, e.cerr);
+    s += "\n";
+  }
+  return s;
+}
+
+static bool simulate_module(const string & file_name, DasFile ** das_file);
+
 bool load_module(const string & file_name, DasFile ** das_file)
 {
-  delete *das_file;
+  delete_das_file(*das_file);
   *das_file = new DasFile;
 
   fn_act = nullptr;
@@ -395,24 +615,23 @@ bool load_module(const string & file_name, DasFile ** das_file)
 
   print_note("Executing file '%s'", file_name.c_str());
 
-  (*das_file)->program = compileDaScript(file_name, (*das_file)->fAccess, logger, (*das_file)->dummyLibGroup);
+  {
+    lock_guard<mutex> lock(program_modules_mutex);
+    (*das_file)->program = compileDaScript(file_name, (*das_file)->fAccess, logger, *(*das_file)->libGroup,
+      get_script_policies());
+  }
   if ((*das_file)->program->failed())
   {
-    string s;
-    s += "Failed to compile: '";
-    s += file_name;
-    s += "'\n";
-
-    for (Error & e : (*das_file)->program->errors)
-    {
-      s += "\n";
-      s += reportError(e.at, e.what, e.extra, e.fixme, e.cerr);
-      s += "\n";
-    }
-    print_error("%s\n", s.c_str());
+    print_error("%s\n", get_compilation_errors(file_name, *das_file).c_str());
     return false;
   }
 
+  return simulate_module(file_name, das_file);
+}
+
+// global variables of the script are initialized here, so it runs on the main thread
+static bool simulate_module(const string & file_name, DasFile ** das_file)
+{
   // create daScript context
   (*das_file)->ctx = make_smart<PlaygroundContext>((*das_file)->program->getContextStackSize());
   if (!(*das_file)->program->simulate(*(*das_file)->ctx, logger))
@@ -461,24 +680,262 @@ void initialize_das_file(bool hard_reload)
     find_dasbox_api_functions(hard_reload);
     inside_initialization = false;
     check_delayed_variables();
+    arena::reset_frame_arena(); // temporaries of init() are not kept until the end of the first frame
   }
 }
 
-void das_file_manual_reload(bool hard_reload)
+//----- module group reuse -----
+
+// Modules required by the script stay compiled between reloads while their sources are unchanged,
+// so a reload after editing the main file compiles only the main file.
+
+static shared_ptr<ModuleGroup> cached_module_group;
+static vector<pair<string, int64_t>> cached_module_files;
+
+static bool has_cached_module_file(const string & file_name)
+{
+  for (auto & f : cached_module_files)
+    if (f.first == file_name)
+      return true;
+  return false;
+}
+
+static shared_ptr<ModuleGroup> get_module_group(bool hard_reload)
+{
+  bool changed = hard_reload || !cached_module_group;
+  for (auto & f : cached_module_files)
+    if (!changed && f.second != fs::get_file_time(f.first.c_str()))
+      changed = true;
+
+  if (!changed)
+    return cached_module_group;
+
+  cached_module_group.reset();
+  cached_module_files.clear();
+  return make_shared<ModuleGroup>();
+}
+
+// called on the main thread when compilation is finished
+static void update_module_group_cache(const string & file_name, DasFile * file)
 {
+  if (!file->program)
+    return;
+
+  if (file->libGroup != cached_module_group)
+  {
+    cached_module_group = file->libGroup;
+    cached_module_files.clear();
+  }
+
+  // files of the reused modules were not opened this time, but their changes still should be noticed
+  vector<pair<string, int64_t>> & opened = file->fAccess->filesOpened;
+  for (auto & f : cached_module_files)
+  {
+    bool found = false;
+    for (auto & o : opened)
+      found |= o.first == f.first;
+    if (!found)
+      opened.push_back(f);
+  }
+
+  // includes of the main file cannot be told apart from the modules, so changing them also resets the group
+  for (auto & o : opened)
+    if (o.first != file_name && !has_cached_module_file(o.first))
+      cached_module_files.push_back(o);
+
+  if (file->program->failed())
+  {
+    cached_module_group.reset();
+    cached_module_files.clear();
+  }
+}
+
+
+//----- background compilation -----
+
+// Reload compiles the program on a worker thread while the previous version keeps running. Resources of the previous
+// version are released and the new context is simulated only after the compilation succeeded.
+
+struct BackgroundCompile
+{
+  DasFile * file = new DasFile;
+  string fileName;
+  TextWriter log;
+  bool hardReload = false;
+  atomic<bool> done;
+
+  BackgroundCompile() : done(false) {}
+};
+
+static BackgroundCompile * background_compile = nullptr;
+static bool reload_after_background_compile = false;
+static bool hard_reload_after_background_compile = false;
+static bool compilation_failed_banner = false;
+
+static void start_background_compile(bool hard_reload)
+{
+  if (background_compile)
+  {
+    // sources changed during compilation, compile them again when the current job is finished
+    reload_after_background_compile = true;
+    hard_reload_after_background_compile |= hard_reload;
+    return;
+  }
+
+  if (!fs::is_file_exists(main_das_file_name.c_str()))
+  {
+    print_error("File not found: '%s'", main_das_file_name.c_str());
+    return;
+  }
+
+  BackgroundCompile * bc = new BackgroundCompile;
+  bc->fileName = main_das_file_name;
+  bc->hardReload = hard_reload;
+  bc->file->libGroup = get_module_group(hard_reload);
+  bc->file->fAccess->deferErrors = true;
+  background_compile = bc;
+
+  daScriptEnvironment * env = daScriptEnvironment::bound;
+  CodeOfPolicies policies = get_script_policies();
+  jobs::add_job([bc, env, policies]()
+  {
+    // the running program only executes simulated code, it doesn't read the module list or the AST of the shared
+    // module group, so the main thread keeps running while modules are compiled here
+    lock_guard<mutex> lock(program_modules_mutex);
+    daScriptEnvironment * prevEnv = daScriptEnvironment::bound;
+    daScriptEnvironment::bound = env;
+    bc->file->program = compileDaScript(bc->fileName, bc->file->fAccess, bc->log, *bc->file->libGroup, policies);
+    daScriptEnvironment::bound = prevEnv;
+    bc->done.store(true, memory_order_release);
+  });
+}
+
+static void wait_background_compile()
+{
+  while (background_compile && !background_compile->done.load(memory_order_acquire))
+    builtin_sleep(1);
+}
+
+static void discard_background_compile()
+{
+  wait_background_compile();
+  if (background_compile)
+  {
+    delete_das_file(background_compile->file);
+    delete background_compile;
+    background_compile = nullptr;
+  }
+  reload_after_background_compile = false;
+  hard_reload_after_background_compile = false;
+}
+
+// without OS notifications file times are polled while the window is not active
+static void watch_script_files()
+{
+  fs::watch_files(das_file->fAccess->filesOpened);
+}
+
+static void release_script_resources()
+{
+  parallel::release_contexts();
   sound::stop_all_sounds();
   builtin_sleep(50);
   graphics::delete_allocated_images();
   sound::delete_allocated_sounds();
+  fs::delete_mapped_files();
+  storage::finalize();
   set_font_name(nullptr);
   set_font_size_i(16);
 
   set_application_screen();
+  set_fixed_timestep(0.0f);
+  set_frame_rate_limit(0);
+  idle_mode = false;
+  redraw_requested = true;
   logger.clear();
   input::reset_input();
   reset_time_after_start();
+  reset_heap_stats();
+}
+
+static void finish_background_compile()
+{
+  BackgroundCompile * bc = background_compile;
+  background_compile = nullptr;
+  DasFile * newFile = bc->file;
+  newFile->fAccess->deferErrors = false;
+  if (bc->fileName == main_das_file_name)
+    update_module_group_cache(bc->fileName, newFile);
+
+  if (newFile->program->failed() || bc->fileName != main_das_file_name)
+  {
+    if (bc->fileName == main_das_file_name)
+    {
+      logger << bc->log.str();
+      logger.setState(LOGGER_ERROR);
+      logger << newFile->fAccess->deferredErrors;
+      logger << get_compilation_errors(bc->fileName, newFile) << "\n";
+      logger.setState(LOGGER_NORMAL);
+      print_note("Compilation failed, previous version of the program is still running");
+      compilation_failed_banner = true;
+
+      // do not try to compile the same broken sources again
+      das_file->fAccess->filesOpened = newFile->fAccess->filesOpened;
+    }
+    delete_das_file(newFile);
+  }
+  else
+  {
+    release_script_resources();
+    compilation_failed_banner = false;
+    logger << bc->log.str();
+
+    // the previous program is deleted only after the new one is simulated
+    DasFile * prevFile = das_file;
+    das_file = newFile;
+    fn_act = nullptr;
+    fn_draw = nullptr;
+    print_note("Executing file '%s'", bc->fileName.c_str());
+    if (simulate_module(bc->fileName, &das_file))
+    {
+      delete_das_file(prevFile);
+      initialize_das_file(bc->hardReload);
+    }
+    else
+    {
+      // resources of the previous version are already released, so it starts again with a new context
+      print_note("Simulation failed, previous version of the program is restarted");
+      compilation_failed_banner = true;
+      prevFile->fAccess->filesOpened = newFile->fAccess->filesOpened;
+      das_file = prevFile;
+      delete_das_file(newFile);
+      release_script_resources();
+      if (simulate_module(bc->fileName, &das_file))
+        initialize_das_file(true);
+    }
+  }
+
+  delete bc;
+  watch_script_files();
+
+  if (reload_after_background_compile)
+  {
+    bool hardReload = hard_reload_after_background_compile;
+    reload_after_background_compile = false;
+    hard_reload_after_background_compile = false;
+    start_background_compile(hardReload);
+  }
+}
+
+void das_file_manual_reload(bool hard_reload)
+{
+  discard_background_compile();
+  compilation_failed_banner = false;
+  release_script_resources();
   load_module(main_das_file_name, &das_file);
+  update_module_group_cache(main_das_file_name, das_file);
   initialize_das_file(hard_reload);
+  watch_script_files();
 }
 
 void das_file_reload_update(float dt)
@@ -498,18 +955,28 @@ void das_file_reload_update(float dt)
     hardReload = true;
   }
 
+  if (background_compile && background_compile->done.load(memory_order_acquire))
+    finish_background_compile();
+
   if (reload)
   {
     if (!main_das_file_name.empty())
     {
-      das_file_manual_reload(hardReload);
+      start_background_compile(hardReload);
       time_to_check += 0.1f;
       return;
     }
   }
 
+  if (fs::is_watching_files())
+  {
+    if (fs::poll_file_changes())
+      start_background_compile(false);
+    return;
+  }
+
   time_to_check -= dt;
-  if (time_to_check < 0)
+  if (time_to_check < 0 && !background_compile)
   {
     time_to_check = is_window_active() ? 999999.0f : 0.4f;
     reload = false;
@@ -521,7 +988,7 @@ void das_file_reload_update(float dt)
       }
 
     if (reload)
-      das_file_manual_reload(false);
+      start_background_compile(false);
   }
 }
 
@@ -555,6 +1022,397 @@ void set_application_screen()
 
 
 
+//-------------------------------- overlays -------------------------------------------
+
+void disable_alpha_blend();
+void enable_alpha_blend();
+void set_font_name(const char *);
+void set_font_size_i(int size);
+int  get_font_size_i();
+void stash_font();
+void restore_font();
+void text_out_i(int x, int y, const char * str, uint32_t color);
+void fill_rect_i(int x, int y, int width, int height, uint32_t color);
+
+static bool audio_stats_overlay = false;
+static bool frame_profiler_overlay = false;
+
+void update_overlays()
+{
+  bool ctrl = input::get_key(sf::Keyboard::LControl) || input::get_key(sf::Keyboard::RControl);
+  if (ctrl && input::get_key_down(sf::Keyboard::F9))
+    audio_stats_overlay = !audio_stats_overlay;
+  if (ctrl && input::get_key_down(sf::Keyboard::F10))
+    frame_profiler_overlay = !frame_profiler_overlay;
+}
+
+static void draw_audio_stats_overlay()
+{
+  sound::AudioStats st = sound::get_audio_stats();
+  char lines[7][128];
+  snprintf(lines[0], sizeof(lines[0]), "mix: %.3f ms avg, %.3f ms max", st.mixTimeAvgMs, st.mixTimeMaxMs);
+  snprintf(lines[1], sizeof(lines[1]), "load: %.1f%%  buffer: %.1f ms", st.mixLoad * 100.0f, st.bufferMs);
+  snprintf(lines[2], sizeof(lines[2]), "voices: %d  music: %d", st.activeVoices, st.activeMusic);
+  snprintf(lines[3], sizeof(lines[3]), "underruns: %d  overloads: %d", st.underruns, st.overloads);
+  snprintf(lines[4], sizeof(lines[4]), "commands: %d max per mix, %d pending", st.commandsPerCallbackMax, st.commandsPending);
+  snprintf(lines[5], sizeof(lines[5]), "commands dropped: %d", st.commandsDropped);
+  snprintf(lines[6], sizeof(lines[6]), "device: %d Hz, %d x %d frames, %.1f ms", st.deviceSampleRate, st.devicePeriods,
+    st.devicePeriodFrames, st.latencyMs);
+
+  const int lineHeight = 16;
+  const int width = 300;
+  int x = screen_width - width - 4;
+  int y = 4;
+
+  enable_alpha_blend();
+  stash_font();
+  set_font_name(nullptr);
+  int savedFontSize = get_font_size_i();
+  set_font_size_i(lineHeight - 3);
+  fill_rect_i(x, y, width, lineHeight * 7 + 6, 0xC0000000);
+  for (int i = 0; i < 7; i++)
+  {
+    bool bad = (i == 3 && st.underruns + st.overloads > 0) || (i == 5 && st.commandsDropped > 0);
+    text_out_i(x + 6, y + 3 + i * lineHeight, lines[i], bad ? 0xFFFF6060 : 0xFFE0E0E0);
+  }
+  restore_font();
+  set_font_size_i(savedFontSize);
+}
+
+static const uint32_t frame_phase_colors[profiler::FRAME_PHASE_COUNT] =
+{
+  0xFF808080, // events
+  0xFFC060C0, // update
+  0xFF40C040, // act
+  0xFF4080FF, // draw
+  0xFFFFA030, // render
+  0xFF505050, // display
+  0xFF303030  // sleep
+};
+
+// stacked bars of the last PROFILER_FRAMES frames, 3 pixels per millisecond
+static void draw_frame_profiler_overlay()
+{
+  const int graphHeight = 100;
+  const float pixelsPerMs = 3.0f;
+  const int lineHeight = 16;
+  const int legendWidth = 190;
+  const int markersWidth = 250;
+  const int maxMarkers = 6;
+  const int avgFrames = 60;
+  int frameCount = profiler::get_profiled_frame_count();
+  int x = 4;
+  int y = screen_height - graphHeight - 4 - (compilation_failed_banner ? 20 : 0);
+
+  enable_alpha_blend();
+  fill_rect_i(x, y, PROFILER_FRAMES + legendWidth + markersWidth + 8, graphHeight, 0xC0000000);
+  for (int i = 0; i < frameCount; i++)
+  {
+    int column = x + PROFILER_FRAMES - 1 - i;
+    float bottom = float(y + graphHeight);
+    for (int phase = 0; phase < profiler::FRAME_PHASE_COUNT && bottom > y; phase++)
+    {
+      float h = profiler::get_phase_time(i, phase) * pixelsPerMs;
+      float top = std::max(bottom - h, float(y));
+      if (bottom - top >= 0.5f)
+        fill_rect_i(column, int(top), 1, int(bottom) - int(top), frame_phase_colors[phase]);
+      bottom = top;
+    }
+  }
+
+  // 60 and 30 fps
+  fill_rect_i(x, y + graphHeight - int(16.67f * pixelsPerMs), PROFILER_FRAMES, 1, 0x80FFFFFF);
+  fill_rect_i(x, y + graphHeight - int(33.33f * pixelsPerMs), PROFILER_FRAMES, 1, 0x80FFFFFF);
+
+  float avg[profiler::FRAME_PHASE_COUNT] = { 0 };
+  float avgTotal = 0.0f;
+  float maxTotal = 0.0f;
+  int n = std::min(frameCount, avgFrames);
+  for (int i = 0; i < n; i++)
+  {
+    for (int phase = 0; phase < profiler::FRAME_PHASE_COUNT; phase++)
+      avg[phase] += profiler::get_phase_time(i, phase) / n;
+    avgTotal += profiler::get_frame_time(i) / n;
+    maxTotal = std::max(maxTotal, profiler::get_frame_time(i));
+  }
+
+  stash_font();
+  set_font_name(nullptr);
+  int savedFontSize = get_font_size_i();
+  set_font_size_i(lineHeight - 4);
+  int lx = x + PROFILER_FRAMES + 8;
+  char buf[128];
+  snprintf(buf, sizeof(buf), "frame: %.2f ms, max %.2f", avgTotal, maxTotal);
+  text_out_i(lx, y + 2, buf, 0xFFE0E0E0);
+  for (int phase = 0; phase < profiler::FRAME_PHASE_COUNT; phase++)
+  {
+    int ly = y + 2 + (phase + 1) * (lineHeight - 4);
+    fill_rect_i(lx, ly + 3, 8, 8, frame_phase_colors[phase] | 0xFF000000);
+    snprintf(buf, sizeof(buf), "%s: %.2f ms", profiler::get_phase_name(phase), avg[phase]);
+    text_out_i(lx + 12, ly, buf, 0xFFE0E0E0);
+  }
+
+  // render counters and script markers of the last frame
+  int mx = lx + legendWidth;
+  RenderStats rs = get_render_stats();
+  snprintf(buf, sizeof(buf), "draws %d, vtx %d, binds %d, up %d/%dK", rs.drawCalls, rs.vertices, rs.textureBinds,
+    rs.textureUploads, int(rs.uploadedBytes / 1024));
+  text_out_i(mx, y + 2, buf, 0xFFE0E0E0);
+
+  const float mb = 1.0f / (1 << 20);
+  snprintf(buf, sizeof(buf), "heap %.1fM %+dK, str %.1fM %+dK, gc %d", heap_stats.heapBytes * mb,
+    int(heap_stats.frameHeapGrowth / 1024), heap_stats.stringBytes * mb, int(heap_stats.frameStringGrowth / 1024),
+    heap_stats.collections);
+  text_out_i(mx, y + 2 + lineHeight - 4, buf, heap_stats.frameHeapGrowth > 0 ? 0xFFFFC060 : 0xFFE0E0E0);
+
+  profiler::MarkerSummary markers[64];
+  int markerCount = profiler::get_marker_summary(markers, 64);
+  for (int i = 0; i < markerCount && i < maxMarkers; i++)
+  {
+    snprintf(buf, sizeof(buf), "%*s%.24s: %.2f ms (%d)", std::min(markers[i].depth, 4) * 2, "", markers[i].name,
+      markers[i].totalMs, markers[i].count);
+    text_out_i(mx, y + 2 + (i + 2) * (lineHeight - 4), buf, 0xFFE0E0E0);
+  }
+  if (markerCount == 0)
+    text_out_i(mx, y + 2 + (lineHeight - 4) * 2, "no profile markers", 0xFF909090);
+
+  restore_font();
+  set_font_size_i(savedFontSize);
+}
+
+static void draw_compilation_failed_banner()
+{
+  const char * text = "Compilation failed, previous version is running. Press Tab to see the log.";
+  enable_alpha_blend();
+  stash_font();
+  set_font_name(nullptr);
+  int savedFontSize = get_font_size_i();
+  set_font_size_i(13);
+  fill_rect_i(0, screen_height - 20, screen_width, 20, 0xD0800000);
+  text_out_i(6, screen_height - 17, text, 0xFFFFFFFF);
+  restore_font();
+  set_font_size_i(savedFontSize);
+}
+
+void draw_overlays()
+{
+  if (audio_stats_overlay)
+    draw_audio_stats_overlay();
+  if (frame_profiler_overlay)
+    draw_frame_profiler_overlay();
+  if (compilation_failed_banner && screen_mode == SM_USER_APPLICATION)
+    draw_compilation_failed_banner();
+}
+
+
+//-------------------------------- AOT ------------------------------------------------
+
+static string aot_output_file_name;
+static string log_file_name;
+static string pak_file_name;
+static string make_pak_file_name;
+static string make_pak_dir;
+static int input_thread_rate = 0;
+
+// 'dasbox <file_name.das> --aot <output.cpp>' writes C++ code of the script and all modules it requires,
+// this code is linked into dasbox_aot executable (see DASBOX_AOT_SCRIPTS in src/CMakeLists.txt)
+static bool generate_aot_cpp(const string & file_name, const string & output_file_name)
+{
+  auto access = make_smart<fs::DasboxFsFileAccess>(false);
+  ModuleGroup dummyGroup;
+  CodeOfPolicies policies;
+  policies.aot = false;
+  ProgramPtr program = compileDaScript(file_name, access, logger, dummyGroup, policies);
+  if (program->failed())
+  {
+    for (Error & e : program->errors)
+      logger << reportError(e.at, e.what, e.extra, e.fixme, e.cerr);
+    print_error("Failed to compile: '%s'\n", file_name.c_str());
+    return false;
+  }
+
+  Context ctx(program->getContextStackSize());
+  if (!program->simulate(ctx, logger))
+  {
+    for (Error & e : program->errors)
+      logger << reportError(e.at, e.what, e.extra, e.fixme, e.cerr);
+    print_error("Failed to simulate '%s'\n", file_name.c_str());
+    return false;
+  }
+
+  TextWriter tw;
+  tw << "// generated by 'dasbox " << file_name << " --aot', do not edit\n\n";
+  tw << "#include \"daScript/misc/platform.h\"\n\n";
+  tw << "#include \"daScript/simulate/simulate.h\"\n";
+  tw << "#include \"daScript/simulate/aot.h\"\n";
+  tw << "#include \"daScript/simulate/aot_library.h\"\n\n";
+  program->library.foreach([&](Module * mod)
+  {
+    if (!mod->name.empty())
+      mod->aotRequire(tw);
+    return true;
+  }, "*");
+
+  tw << "\n";
+  tw << "#if defined(_MSC_VER)\n";
+  tw << "#pragma warning(disable:4100 4101 4102 4189 4244 4458)\n";
+  tw << "#elif defined(__GNUC__)\n";
+  tw << "#pragma GCC diagnostic ignored \"-Wunused-parameter\"\n";
+  tw << "#pragma GCC diagnostic ignored \"-Wunused-variable\"\n";
+  tw << "#pragma GCC diagnostic ignored \"-Wunused-label\"\n";
+  tw << "#endif\n\n";
+
+  tw << "namespace das\n{\nnamespace\n{\n";
+  program->aotCpp(ctx, tw);
+  tw << "\n";
+  program->registerAotCpp(tw, ctx);
+  tw << "}\n}\n";
+
+  FILE * f = fopen(output_file_name.c_str(), "wb");
+  if (!f)
+  {
+    print_error("Cannot write AOT output to '%s'\n", output_file_name.c_str());
+    return false;
+  }
+
+  string code = tw.str();
+  bool ok = fwrite(code.c_str(), 1, code.length(), f) == code.length();
+  fclose(f);
+  if (!ok)
+  {
+    print_error("Cannot write AOT output to '%s'\n", output_file_name.c_str());
+    return false;
+  }
+
+  print_note("AOT code of '%s' is written to '%s'", file_name.c_str(), output_file_name.c_str());
+  return true;
+}
+
+
+//-------------------------------- benchmark ------------------------------------------
+
+static int benchmark_frames = 0;
+static bool benchmark_offscreen = false;
+
+void create_window();
+
+static void print_benchmark_json(vector<float> & frame_ms, const vector<int> & draw_calls)
+{
+  int n = int(frame_ms.size());
+  double sum = 0.0;
+  for (float t : frame_ms)
+    sum += t;
+  double drawCallsSum = 0.0;
+  int drawCallsMax = 0;
+  for (int c : draw_calls)
+  {
+    drawCallsSum += c;
+    drawCallsMax = max(drawCallsMax, c);
+  }
+
+  sort(frame_ms.begin(), frame_ms.end());
+  auto percentile = [&](float p) { return n > 0 ? frame_ms[min(n - 1, int(p * n))] : 0.0f; };
+
+  fetch_cerr();
+  logger.flushConsole();
+  string fileName;
+  profiler::append_json_string(fileName, main_das_file_name.c_str());
+  printf("{\n");
+  printf("  \"file\": %s,\n", fileName.c_str());
+  printf("  \"frames\": %d,\n", n);
+  printf("  \"offscreen\": %s,\n", benchmark_offscreen ? "true" : "false");
+  printf("  \"mean_ms\": %.4f,\n", n > 0 ? sum / n : 0.0);
+  printf("  \"p50_ms\": %.4f,\n", percentile(0.5f));
+  printf("  \"p99_ms\": %.4f,\n", percentile(0.99f));
+  printf("  \"max_ms\": %.4f,\n", n > 0 ? frame_ms.back() : 0.0f);
+  printf("  \"draw_calls_mean\": %.2f,\n", n > 0 ? drawCallsSum / n : 0.0);
+  printf("  \"draw_calls_max\": %d\n", drawCallsMax);
+  printf("}\n");
+  fflush(stdout);
+}
+
+// 'dasbox <file_name.das> --benchmark N' runs act() and draw() for N frames with the fixed dt and without vsync,
+// then prints frame time statistics as JSON, returns 1 on errors in the script
+static int run_das_benchmark(int frame_count)
+{
+  if (!load_module(main_das_file_name, &das_file))
+    return 1;
+  initialize_das_file(true);
+
+  if (benchmark_offscreen)
+  {
+    sf::Vector2i resolution = delayed_resolution.second;
+    screen_width = resolution.x;
+    screen_height = resolution.y;
+    render_texture = new sf::RenderTexture();
+    if (!render_texture->create(resolution.x, resolution.y))
+    {
+      print_error("Cannot create offscreen render target %dx%d", resolution.x, resolution.y);
+      return 1;
+    }
+    g_render_target = render_texture;
+  }
+  else
+  {
+    create_window();
+    g_window->setVerticalSyncEnabled(false);
+    vsync_enabled = false;
+  }
+
+  vector<float> frameMs;
+  vector<int> drawCalls;
+  frameMs.reserve(frame_count);
+  drawCalls.reserve(frame_count);
+
+  const float dt = 1.0f / 60.0f;
+  for (int frame = 0; frame < frame_count && logger.topErrorLine < 0 && !is_quit_scheduled; frame++)
+  {
+    if (g_window)
+    {
+      sf::Event event;
+      input::begin_window_events();
+      while (g_window->pollEvent(event))
+        ;
+      input::end_window_events();
+    }
+
+    auto start = chrono::steady_clock::now();
+    time_after_start += double(dt);
+    cur_dt = dt;
+    graphics::reset_frame_render_stats();
+    vec4f arg = v_make_vec4f(dt, 0, 0, 0);
+    exec_function(fn_act, &arg);
+    input::consume_input_events();
+    parallel::barrier();
+    run_requested_garbage_collection(das_file->ctx.get());
+
+    graphics::on_graphics_frame_start();
+    exec_function(fn_draw, nullptr);
+    update_heap_stats(das_file->ctx.get());
+    graphics::on_graphics_frame_end();
+
+    if (g_window)
+      g_window->display();
+    else
+      render_texture->display();
+
+    auto end = chrono::steady_clock::now();
+    frameMs.push_back(chrono::duration<float, milli>(end - start).count());
+    drawCalls.push_back(get_render_stats().drawCalls);
+    fetch_cerr();
+  }
+
+  if (logger.topErrorLine >= 0)
+  {
+    print_error("Benchmark is stopped after %d frames", int(frameMs.size()));
+    return 1;
+  }
+
+  print_benchmark_json(frameMs, drawCalls);
+  return 0;
+}
+
+
 //-------------------------------------------------------------------------------------
 
 void process_args(int argc, char **argv)
@@ -624,6 +1482,88 @@ void process_args(int argc, char **argv)
       if (arg == "--dasbox-console" || arg == "--")
         log_to_console = true;
 
+      if (arg == "--aot" && i < argc - 1)
+      {
+        // path is relative to the initial directory, not to the directory of the script
+        aot_output_file_name = argv[i + 1];
+        bool absolute = aot_output_file_name[0] == '/' || aot_output_file_name[0] == '\\' ||
+          (aot_output_file_name.length() > 1 && aot_output_file_name[1] == ':');
+        if (!absolute)
+          aot_output_file_name = fs::combine_path(fs::get_current_dir(), aot_output_file_name);
+        log_to_console = true;
+        i++;
+      }
+
+      if (arg == "--no-aot")
+        aot_enabled = false;
+
+      if (arg == "--persistent-heap")
+        persistent_heap = true;
+
+      if (arg == "--input-thread")
+      {
+        input_thread_rate = 1000;
+        if (i < argc - 1 && atoi(argv[i + 1]) > 0)
+        {
+          input_thread_rate = atoi(argv[i + 1]);
+          i++;
+        }
+      }
+
+      if (arg == "--log-file" && i < argc - 1)
+      {
+        log_file_name = argv[i + 1];
+        bool absolute = log_file_name[0] == '/' || log_file_name[0] == '\\' ||
+          (log_file_name.length() > 1 && log_file_name[1] == ':');
+        if (!absolute)
+          log_file_name = fs::combine_path(fs::get_current_dir(), log_file_name);
+        i++;
+      }
+
+      if (arg == "--pak" && i < argc - 1)
+      {
+        pak_file_name = argv[i + 1];
+        bool absolute = pak_file_name[0] == '/' || pak_file_name[0] == '\\' ||
+          (pak_file_name.length() > 1 && pak_file_name[1] == ':');
+        if (!absolute)
+          pak_file_name = fs::combine_path(fs::get_current_dir(), pak_file_name);
+        i++;
+      }
+
+      if (arg == "--make-pak" && i < argc - 2)
+      {
+        make_pak_file_name = argv[i + 1];
+        make_pak_dir = argv[i + 2];
+        log_to_console = true;
+        i += 2;
+      }
+
+      if (arg == "--benchmark" && i < argc - 1)
+      {
+        benchmark_frames = max(atoi(argv[i + 1]), 1);
+        log_to_console = true;
+        log_console_to_stderr = true;
+        i++;
+      }
+
+      if (arg == "--startup-trace")
+      {
+        startup_trace = true;
+        log_to_console = true;
+      }
+
+      if (arg == "--benchmark-offscreen")
+        benchmark_offscreen = true;
+
+      if (arg == "--audio-low-latency")
+        sound::set_audio_low_latency(true);
+
+      if (arg == "--audio-config" && i < argc - 3)
+      {
+        sound::set_audio_device_config(atoi(argv[i + 1]), atoi(argv[i + 2]), atoi(argv[i + 3]));
+        i += 3;
+      }
+
       if (arg == "--")
         break;
     }
@@ -691,7 +1631,9 @@ void create_window()
       screen_global_scale = 1;
   }
 
-  use_separate_render_target = (screen_global_scale != 1);
+  // integer scale of the view keeps the pixel grid of the screen aligned with the window pixels
+  bool upscaleWithView = delayed_upscale_view.second && screen_global_scale != 1;
+  use_separate_render_target = (screen_global_scale != 1 && !upscaleWithView) || graphics::get_post_effect_shader();
 
   if (!use_separate_render_target)
     windowSettings.antialiasingLevel = delayed_window_antialiasing.second;
@@ -736,12 +1678,15 @@ void create_window()
   else
   {
     g_render_target = g_window;
+    if (screen_global_scale != 1)
+      g_window->setView(sf::View(sf::FloatRect(0.0f, 0.0f, float(resolution.x), float(resolution.y))));
   }
 
   g_window->setVerticalSyncEnabled(true);
 
   delayed_window_antialiasing.first = false;
   delayed_upscale.first = false;
+  delayed_upscale_view.first = false;
   delayed_resolution.first = false;
 
   recreate_window = false;
@@ -826,7 +1771,7 @@ void run_das_for_plugin(const string & file_name, const string & main_func_name)
 {
   auto access = make_smart<fs::DasboxFsFileAccess>();
   ModuleGroup dummyGroup;
-  if (auto program = compileDaScript(file_name, access, logger, dummyGroup))
+  if (auto program = compileDaScript(file_name, access, logger, dummyGroup, get_script_policies()))
   {
     if (program->failed())
     {
@@ -866,25 +1811,170 @@ void run_das_for_plugin(const string & file_name, const string & main_func_name)
 }
 
 
+// sleeps most of the remaining time and yields only for the last couple of milliseconds, the OS timer is not precise
+static void sleep_until(chrono::steady_clock::time_point deadline)
+{
+  auto now = chrono::steady_clock::now();
+  const auto spinMargin = chrono::microseconds(2000);
+  while (now + spinMargin < deadline)
+  {
+    builtin_sleep(uint32_t(chrono::duration_cast<chrono::milliseconds>(deadline - now - spinMargin).count()) + 1);
+    now = chrono::steady_clock::now();
+  }
+  while (now < deadline)
+  {
+    builtin_sleep(0);
+    now = chrono::steady_clock::now();
+  }
+}
+
+static void wait_for_next_frame()
+{
+  auto period = chrono::nanoseconds(1000000000LL / frame_rate_limit);
+  auto now = chrono::steady_clock::now();
+  if (next_frame_time + period < now)
+    next_frame_time = now;
+  sleep_until(next_frame_time);
+  next_frame_time += period;
+}
+
+
+//--- frame pacing ---
+
+// With vsync display() blocks until the next refresh. Instead of waiting there, the frame is started as late
+// as possible: the refresh period and the work time of the frame are measured, and the loop sleeps until
+// the last display + period - work - margin.
+
+#define PACER_MARGIN_US 2000.0
+#define IDLE_SLEEP_MS 10
+
+static chrono::steady_clock::time_point last_display_time;
+static chrono::steady_clock::time_point frame_work_start;
+static double display_period_us = 0.0; // 0 - not measured yet
+static double frame_work_us = 0.0; // from the end of the sleep to display(), smoothed
+
+static double elapsed_us(chrono::steady_clock::time_point from, chrono::steady_clock::time_point to)
+{
+  return chrono::duration<double, micro>(to - from).count();
+}
+
+static void reset_frame_pacing()
+{
+  display_period_us = 0.0;
+  frame_work_us = 0.0;
+}
+
+static void pace_vsync_frame()
+{
+  if (display_period_us <= 0.0)
+    return;
+  double sleep_us = display_period_us - frame_work_us - PACER_MARGIN_US;
+  if (sleep_us > 0.0)
+    sleep_until(last_display_time + chrono::microseconds(int64_t(sleep_us)));
+}
+
+static void on_frame_work_done()
+{
+  double work = elapsed_us(frame_work_start, chrono::steady_clock::now());
+  // grows at once to not miss the next refresh, shrinks slowly
+  frame_work_us = work > frame_work_us ? work : frame_work_us * 0.95 + work * 0.05;
+}
+
+static void on_frame_displayed()
+{
+  auto now = chrono::steady_clock::now();
+  double interval = elapsed_us(last_display_time, now);
+  last_display_time = now;
+  if (!vsync_enabled || interval < 2000.0 || interval > 100000.0)
+    return;
+
+  if (display_period_us <= 0.0)
+    display_period_us = interval;
+  else if (interval < display_period_us * 1.5) // missed refreshes are not the period
+    display_period_us = display_period_us * 0.95 + interval * 0.05;
+}
+
+// in idle mode the frame is drawn only after window events and input, script reload or request_redraw()
+static bool is_idle_frame(bool had_window_events)
+{
+  static Context * last_ctx = nullptr;
+  Context * ctx = das_file->ctx.get();
+  bool changed = ctx != last_ctx;
+  last_ctx = ctx;
+
+  if (!idle_mode || redraw_requested || changed || had_window_events || screen_mode != SM_USER_APPLICATION ||
+      input::get_input_event_count() > 0 || audio_stats_overlay || frame_profiler_overlay ||
+      background_compile || is_quit_scheduled || exec_script_scheduled)
+    return false;
+  return true;
+}
+
+static void act_fixed_steps(float dt)
+{
+  fixed_time_accumulator += double(dt);
+  int steps = 0;
+  while (fixed_time_accumulator >= fixed_timestep && steps < MAX_FIXED_STEPS_PER_FRAME)
+  {
+    cur_dt = fixed_timestep;
+    vec4f arg = v_make_vec4f(fixed_timestep, 0, 0, 0);
+    exec_function(fn_act, &arg);
+    input::consume_input_events();
+    fixed_time_accumulator -= fixed_timestep;
+    steps++;
+    if (logger.topErrorLine >= 0)
+      break;
+  }
+
+  // the simulation can't keep up, drop the time instead of accumulating it
+  if (fixed_time_accumulator >= fixed_timestep)
+    fixed_time_accumulator = fmod(fixed_time_accumulator, double(fixed_timestep));
+
+  interpolation_alpha = float(fixed_time_accumulator / fixed_timestep);
+  cur_dt = dt;
+}
+
+// on every exit after the subsystems are initialized, joinable worker threads terminate the process at exit
+static void finalize_subsystems()
+{
+  parallel::release_contexts();
+  jobs::finalize();
+  storage::finalize();
+  arena::finalize();
+  sound::finalize();
+  graphics::finalize();
+}
+
 void run_das_for_ui()
 {
   if (!main_das_file_name.empty())
   {
     load_module(main_das_file_name, &das_file);
+    update_module_group_cache(main_das_file_name, das_file);
+    trace_startup_phase("compile main script");
     initialize_das_file(true);
+    watch_script_files();
+    trace_startup_phase("initialize main script");
   }
 
   /////////////////////////////////////////////////////////
   create_window();
+  if (input_thread_rate > 0)
+    input::start_input_thread(input_thread_rate);
+  trace_startup_phase("create window");
 
   sf::Clock deltaClock;
 
   while (g_window->isOpen())
   {
+    profiler::begin_frame();
+    profiler::begin_phase(profiler::PHASE_EVENTS);
     fetch_cerr();
     sf::Event event;
+    bool hadWindowEvents = false;
+    input::begin_window_events();
     while (g_window->pollEvent(event))
     {
+      hadWindowEvents = true;
       switch (event.type)
       {
       case sf::Event::Closed:
@@ -927,32 +2017,35 @@ void run_das_for_ui()
           input::gkc_symbol_entered(event.text.unicode);
         break;
 
+      // with the input thread gamepads are sampled in update_gamepads()
+      case sf::Event::JoystickConnected:
+      case sf::Event::JoystickDisconnected:
+        if (!input::is_input_thread_running())
+          input::joy_connected(event.joystickConnect.joystickId, event.type == sf::Event::JoystickConnected);
+        break;
+
       case sf::Event::JoystickButtonPressed:
-        if (event.joystickButton.joystickId == 0)
-          input::joy_button_down(event.joystickButton.button);
+        if (!input::is_input_thread_running())
+          input::joy_button_down(event.joystickButton.joystickId, event.joystickButton.button);
         break;
 
       case sf::Event::JoystickButtonReleased:
-        if (event.joystickButton.joystickId == 0)
-          input::joy_button_up(event.joystickButton.button);
+        if (!input::is_input_thread_running())
+          input::joy_button_up(event.joystickButton.joystickId, event.joystickButton.button);
         break;
 
       case sf::Event::JoystickMoved:
-        if (event.joystickMove.joystickId == 0)
-        {
-          if (event.joystickMove.axis == sf::Joystick::Axis::PovX)
-            event.joystickMove.position = sign(event.joystickMove.position) * (fabs(event.joystickMove.position) < 50.0f ? 0.0f : 100.0f);
-          if (event.joystickMove.axis == sf::Joystick::Axis::PovY)
-            event.joystickMove.position = sign(event.joystickMove.position) * (fabs(event.joystickMove.position) < 50.0f ? 0.0f : -100.0f);
-
-          input::joy_axis_position(event.joystickMove.axis, event.joystickMove.position);
-        }
+        if (!input::is_input_thread_running())
+          input::joy_axis_position(event.joystickMove.joystickId, event.joystickMove.axis, event.joystickMove.position);
         break;
 
       default: break;
       }
     }
+    input::end_window_events();
+    input::update_gamepads();
 
+    profiler::begin_phase(profiler::PHASE_UPDATE);
     float dt = deltaClock.restart().asSeconds();
     time_after_start += double(dt);
 
@@ -963,20 +2056,49 @@ void run_das_for_ui()
 
     das_file_reload_update(dt);
     update_switch_screens();
+    update_overlays();
     if (screen_mode == SM_LOG)
       update_log_screen(dt);
 
+    profiler::begin_phase(profiler::PHASE_SLEEP);
+    if (is_idle_frame(hadWindowEvents))
+    {
+      builtin_sleep(IDLE_SLEEP_MS);
+      input::post_update_input();
+      profiler::end_frame();
+      logger.flushConsole();
+      continue;
+    }
+    redraw_requested = false;
+
     if (!window_is_active)
       builtin_sleep(8);
+    else if (frame_rate_limit > 0)
+      wait_for_next_frame();
+    else if (vsync_enabled)
+      pace_vsync_frame();
     else
       builtin_sleep(0);
+    frame_work_start = chrono::steady_clock::now();
+    graphics::reset_frame_render_stats();
 
     if (screen_mode == SM_USER_APPLICATION)
     {
-      vec4f arg = v_make_vec4f(dt, 0, 0, 0);
-      exec_function(fn_act, &arg);
+      profiler::begin_phase(profiler::PHASE_ACT);
+      if (fixed_timestep > 0.0f)
+        act_fixed_steps(dt);
+      else
+      {
+        interpolation_alpha = 1.0f;
+        vec4f arg = v_make_vec4f(dt, 0, 0, 0);
+        exec_function(fn_act, &arg);
+        input::consume_input_events();
+      }
       fetch_cerr();
     }
+    else
+      input::consume_input_events();
+    profiler::begin_phase(profiler::PHASE_UPDATE);
 
     if (logger.topErrorLine >= 0)
     {
@@ -998,28 +2120,50 @@ void run_das_for_ui()
       set_vsync_enabled(delayed_vsync.second);
 
 
+    parallel::barrier();
+    if (screen_mode == SM_USER_APPLICATION)
+      run_requested_garbage_collection(das_file->ctx.get());
+
+
     // render
 
+    profiler::begin_phase(profiler::PHASE_DRAW);
     graphics::on_graphics_frame_start();
 
     if (screen_mode == SM_USER_APPLICATION)
+    {
       exec_function(fn_draw, nullptr);
+      update_heap_stats(das_file->ctx.get());
+    }
     else
       draw_log_screen();
 
+    profiler::begin_phase(profiler::PHASE_RENDER);
+    reset_shader();
+    draw_overlays();
+
+    graphics::on_graphics_frame_end();
+
     if (use_separate_render_target)
     {
       render_texture->display();
-      g_window->draw(*render_texture_sprite, sf::BlendNone);
+      sf::RenderStates blitStates(sf::BlendNone);
+      if (screen_mode == SM_USER_APPLICATION)
+        blitStates.shader = graphics::get_post_effect_shader();
+      g_window->draw(*render_texture_sprite, blitStates);
     }
 
-#ifdef _WIN32
-    // Workaround unstable vsync on Windows 10
-    if (vsync_enabled)
-      glFinish();
-#endif
+    profiler::begin_phase(profiler::PHASE_DISPLAY);
+    on_frame_work_done();
     g_window->display();
+    on_frame_displayed();
+    if (startup_trace)
+    {
+      trace_startup_phase("first frame");
+      startup_trace = false;
+    }
 
+    profiler::begin_phase(profiler::PHASE_UPDATE);
     input::post_update_input();
 
     if (is_quit_scheduled && !return_to_file_name.empty())
@@ -1028,6 +2172,10 @@ void run_das_for_ui()
     if (exec_script_scheduled)
       exec_script_impl();
 
+    // post effect is applied to the blit of the separate render target
+    if (graphics::get_post_effect_shader() && !use_separate_render_target)
+      recreate_window = true;
+
     if (recreate_window)
     {
       print_note("Window recreated");
@@ -1036,11 +2184,16 @@ void run_das_for_ui()
 
     if (is_quit_scheduled)
       g_window->close();
+
+    profiler::end_frame();
+    logger.flushConsole();
   }
 
 
-  sound::finalize();
-  graphics::finalize();
+  input::stop_input_thread();
+  discard_background_compile();
+  fs::stop_watching_files();
+  finalize_subsystems();
 
   delete render_texture;
   delete render_texture_sprite;
@@ -1069,6 +2222,21 @@ int main(int argc, char **argv)
   if (!log_to_console)
     hide_console();
 
+  if (!log_file_name.empty())
+    start_log_file(log_file_name.c_str());
+  trace_startup_phase("process arguments");
+
+  if (!make_pak_file_name.empty())
+    return fs::make_pak(make_pak_file_name.c_str(), make_pak_dir.c_str()) ? 0 : 1;
+
+  if (!pak_file_name.empty())
+  {
+    if (!fs::mount_pak(pak_file_name.c_str()))
+      return 1;
+    if (main_das_file_name.empty() && fs::is_file_exists("main.das"))
+      main_das_file_name = "main.das";
+  }
+
   locale utf8Locale("en_US.UTF-8");
   g_locale = &utf8Locale;
 
@@ -1097,15 +2265,19 @@ int main(int argc, char **argv)
     }
   }
 
-  fs::initialize();
+  trace_startup_phase("mount pak, locale");
+
   graphics::initialize();
   sound::initialize();
+  jobs::initialize();
+  trace_startup_phase("initialize subsystems");
 
   if (!run_for_plugin)
   {
     if (!fs::change_dir(root_dir))
     {
       print_error("Cannot change directory to '%s'\n", root_dir.c_str());
+      finalize_subsystems();
       return 1;
     }
 
@@ -1131,15 +2303,32 @@ int main(int argc, char **argv)
   NEED_MODULE(ModuleGraphics);
   NEED_MODULE(ModuleDasbox);
   NEED_MODULE(ModuleSound);
+  trace_startup_phase("register modules");
+
+  if (!aot_output_file_name.empty())
+  {
+    bool ok = generate_aot_cpp(main_das_file_name, aot_output_file_name);
+    finalize_subsystems();
+    return ok ? 0 : 1;
+  }
 
   das_live_file = new DasFile();
   load_module("daslib/live.das", &das_live_file);
   find_dasbox_live_api_fnctions();
+  trace_startup_phase("compile live module");
 
 
+  if (benchmark_frames > 0)
+  {
+    int res = run_das_benchmark(benchmark_frames);
+    finalize_subsystems();
+    return res;
+  }
+
   if (run_for_plugin && trust_mode)
   {
     run_das_for_plugin(fs::combine_path(root_dir, main_das_file_name), plugin_main_function);
+    finalize_subsystems();
     return 0;
   }
   else
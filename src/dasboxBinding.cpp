@@ -1,7 +1,12 @@
+#include "dasboxBinding.h"
+#include "profiler.h"
 #include "input.h"
 #include "sound.h"
 #include "logger.h"
 #include "fileSystem.h"
+#include "localStorage.h"
+#include "parallel.h"
+#include "graphics.h"
 #include "buildDate.h"
 #include <daScript/daScript.h>
 #include <daScript/ast/ast.h>
@@ -37,6 +42,37 @@ bool das_get_mouse_button(int button_code) { return input::get_mouse_button(butt
 bool das_get_mouse_button_up(int button_code) { return input::get_mouse_button_up(button_code - MOUSE_CODE_OFFSET); }
 bool das_get_mouse_button_down(int button_code) { return input::get_mouse_button_down(button_code - MOUSE_CODE_OFFSET); }
 float das_get_axis(int axis_code) { return input::get_axis(axis_code); }
+float das_get_gamepad_axis(int gamepad, int axis_code) { return input::get_gamepad_axis(gamepad, axis_code); }
+bool das_get_gamepad_button(int gamepad, int button_code)
+{
+  return input::get_gamepad_button(gamepad, button_code - KEY_CODE_OFFSET - 256);
+}
+bool das_get_gamepad_button_down(int gamepad, int button_code)
+{
+  return input::get_gamepad_button_down(gamepad, button_code - KEY_CODE_OFFSET - 256);
+}
+bool das_get_gamepad_button_up(int gamepad, int button_code)
+{
+  return input::get_gamepad_button_up(gamepad, button_code - KEY_CODE_OFFSET - 256);
+}
+
+input::InputEvent das_get_input_event(int index, das::Context * context, das::LineInfoArg * at)
+{
+  const input::InputEvent * e = input::get_input_event(index);
+  if (!e)
+    context->throw_error_at(*at, "get_input_event: index %d is out of range [0, %d)", index,
+      input::get_input_event_count());
+  return *e;
+}
+
+void das_for_each_input_event(const das::TBlock<void, const input::InputEvent &> & block, das::Context * context,
+  das::LineInfoArg * at)
+{
+  // events are not added while script is running
+  int count = input::get_input_event_count();
+  for (int i = 0; i < count; i++)
+    das::das_invoke<void>::invoke<const input::InputEvent &>(context, at, block, *input::get_input_event(i));
+}
 
 int das_get_pressed_key_index()
 {
@@ -48,24 +84,6 @@ int das_get_pressed_key_index()
 }
 
 
-void set_window_title(const char * title);
-void set_antialiasing(int a);
-void set_resolution(int width, int height);
-void set_rendering_upscale(int upscale);
-void disable_auto_upscale();
-
-void schedule_pause();
-void schedule_quit_game();
-void reset_time_after_start();
-float get_time_after_start();
-float get_delta_time();
-bool is_window_active();
-void set_vsync_enabled(bool enalbe);
-void set_mouse_cursor_visible(bool visible);
-void set_mouse_cursor_grabbed(bool grabbed);
-void dasbox_execute(const char * file_name);
-
-
 const char * das_get_key_name(int key_code)
 {
   auto it = code_to_key_name.find(key_code);
@@ -97,14 +115,6 @@ float move_to(float from, float to, float dt, float vel)
     return from + d;
 }
 
-template <typename T> T approach(T from, T to, float dt, float viscosity)
-{
-  if (viscosity < 1e-9f)
-    return to;
-  else
-    return from + (1.0f - expf(-dt / viscosity)) * (to - from);
-}
-
 float cvt(float v, float i0, float i1, float o0, float o1)
 {
   if (i0 < i1)
@@ -115,22 +125,22 @@ float cvt(float v, float i0, float i1, float o0, float o1)
 
 
 
-static unordered_map<std::string, std::string> inmemory_local_storage;
-
 void local_storage_set(const char * key, const char * value)
 {
-  if (!key)
-    return;
-  if (!value)
-    value = "";
-  inmemory_local_storage[std::string(key)] = std::string(value);
+  storage::set(key, value);
 }
 
-const char * local_storage_get(const char * key)
+// the value is copied, the storage can change or be unloaded while the script keeps the string
+char * local_storage_get(const char * key, das::Context * context, das::LineInfoArg * at)
 {
-  if (!key)
-    return "";
-  return inmemory_local_storage[std::string(key)].c_str();
+  const char * value = storage::get(key);
+  uint32_t length = uint32_t(strlen(value));
+  return length ? context->allocateString(value, length, at) : nullptr;
+}
+
+void local_storage_flush()
+{
+  storage::flush();
 }
 
 
@@ -218,6 +228,209 @@ const char * get_dasbox_initial_dir()
 }
 
 
+void das_profile_begin(const char * name)
+{
+  profiler::begin_marker(name);
+}
+
+void das_profile_end(das::Context * context, das::LineInfoArg * at)
+{
+  if (!profiler::end_marker())
+    context->throw_error_at(*at, "profile_end() without profile_begin()");
+}
+
+// the marker is closed when the block throws too, otherwise the following markers would nest into it
+struct ProfileMarkerScope
+{
+  ProfileMarkerScope(const char * name)
+  {
+    profiler::begin_marker(name);
+  }
+
+  ~ProfileMarkerScope()
+  {
+    profiler::end_marker();
+  }
+};
+
+void das_profile(const char * name, const das::TBlock<void> & block, das::Context * context, das::LineInfoArg * at)
+{
+  ProfileMarkerScope marker(name);
+  das::das_invoke<void>::invoke(context, at, block);
+}
+
+bool das_profile_capture_trace(const char * file_name, int frames)
+{
+  return profiler::capture_trace(file_name, frames);
+}
+
+
+fs::MappedFile das_open_mapped_file(const char * file_name)
+{
+  return fs::open_mapped_file(file_name);
+}
+
+// bytes are not copied, the array is locked and valid only inside the block
+void das_with_mapped_file_bytes(const fs::MappedFile & file, int64_t offset, int64_t length,
+  const das::TBlock<void, const das::TTemporary<das::TArray<uint8_t>>> & block, das::Context * context,
+  das::LineInfoArg * at)
+{
+  if (!file.isValid())
+    context->throw_error_at(*at, "with_mapped_file_bytes: file is not opened");
+  if (offset < 0 || length < 0 || offset > file.getSize() || length > file.getSize() - offset)
+    context->throw_error_at(*at, "with_mapped_file_bytes: range [%lld, %lld) is out of file size %lld",
+      (long long)offset, (long long)(offset + length), (long long)file.getSize());
+  if (length > int64_t(UINT32_MAX))
+    context->throw_error_at(*at, "with_mapped_file_bytes: length %lld is greater than 4 GB, use several views",
+      (long long)length);
+
+  das::Array arr;
+  memset(&arr, 0, sizeof(arr));
+  arr.data = (char *)file.getData() + offset;
+  arr.size = uint32_t(length);
+  arr.capacity = uint32_t(length);
+  arr.lock = 1;
+  das::das_invoke<void>::invoke<das::Array &>(context, at, block, arr);
+}
+
+char * das_mapped_file_string(const fs::MappedFile & file, int64_t offset, int64_t length, das::Context * context,
+  das::LineInfoArg * at)
+{
+  if (!file.isValid())
+    context->throw_error_at(*at, "mapped_file_string: file is not opened");
+  if (offset < 0 || length < 0 || offset > file.getSize() || length > file.getSize() - offset ||
+      length >= int64_t(UINT32_MAX))
+    context->throw_error_at(*at, "mapped_file_string: range [%lld, %lld) is out of file size %lld",
+      (long long)offset, (long long)(offset + length), (long long)file.getSize());
+  if (length == 0)
+    return nullptr;
+  return context->allocateString((const char *)file.getData() + offset, uint32_t(length), at);
+}
+
+
+MAKE_TYPE_FACTORY(FrameProfile, profiler::FrameProfile)
+MAKE_TYPE_FACTORY(InputEvent, input::InputEvent)
+MAKE_TYPE_FACTORY(MappedFile, fs::MappedFile)
+MAKE_TYPE_FACTORY(HeapStats, profiler::HeapStats)
+
+struct FrameProfileAnnotation : ManagedStructureAnnotation<profiler::FrameProfile, true, true>
+{
+  FrameProfileAnnotation(ModuleLibrary & ml) : ManagedStructureAnnotation("FrameProfile", ml)
+  {
+    cppName = " ::profiler::FrameProfile";
+    addField<DAS_BIND_MANAGED_FIELD(events)>("events");
+    addField<DAS_BIND_MANAGED_FIELD(update)>("update");
+    addField<DAS_BIND_MANAGED_FIELD(act)>("act");
+    addField<DAS_BIND_MANAGED_FIELD(draw)>("draw");
+    addField<DAS_BIND_MANAGED_FIELD(render)>("render");
+    addField<DAS_BIND_MANAGED_FIELD(display)>("display");
+    addField<DAS_BIND_MANAGED_FIELD(sleep)>("sleep");
+    addField<DAS_BIND_MANAGED_FIELD(total)>("total");
+  }
+
+  virtual bool isLocal() const override { return true; }
+  virtual bool canCopy() const override { return true; }
+  virtual bool canMove() const override { return true; }
+  virtual bool canBePlacedInContainer() const override { return true; }
+};
+
+
+struct HeapStatsAnnotation : ManagedStructureAnnotation<profiler::HeapStats, true, true>
+{
+  HeapStatsAnnotation(ModuleLibrary & ml) : ManagedStructureAnnotation("HeapStats", ml)
+  {
+    cppName = " ::profiler::HeapStats";
+    addField<DAS_BIND_MANAGED_FIELD(heapBytes)>("heapBytes");
+    addField<DAS_BIND_MANAGED_FIELD(heapReserved)>("heapReserved");
+    addField<DAS_BIND_MANAGED_FIELD(stringBytes)>("stringBytes");
+    addField<DAS_BIND_MANAGED_FIELD(stringReserved)>("stringReserved");
+    addField<DAS_BIND_MANAGED_FIELD(heapPeak)>("heapPeak");
+    addField<DAS_BIND_MANAGED_FIELD(stringPeak)>("stringPeak");
+    addField<DAS_BIND_MANAGED_FIELD(frameHeapGrowth)>("frameHeapGrowth");
+    addField<DAS_BIND_MANAGED_FIELD(frameStringGrowth)>("frameStringGrowth");
+    addField<DAS_BIND_MANAGED_FIELD(collections)>("collections");
+    addField<DAS_BIND_MANAGED_FIELD(skippedCollections)>("skippedCollections");
+    addField<DAS_BIND_MANAGED_FIELD(lastCollectionMs)>("lastCollectionMs");
+    addField<DAS_BIND_MANAGED_FIELD(lastCollectionFreed)>("lastCollectionFreed");
+  }
+
+  virtual bool isLocal() const override { return true; }
+  virtual bool canCopy() const override { return true; }
+  virtual bool canMove() const override { return true; }
+  virtual bool canBePlacedInContainer() const override { return true; }
+};
+
+
+struct InputEventAnnotation : ManagedStructureAnnotation<input::InputEvent, true, true>
+{
+  InputEventAnnotation(ModuleLibrary & ml) : ManagedStructureAnnotation("InputEvent", ml)
+  {
+    cppName = " ::input::InputEvent";
+    addField<DAS_BIND_MANAGED_FIELD(type)>("type");
+    addField<DAS_BIND_MANAGED_FIELD(code)>("code");
+    addField<DAS_BIND_MANAGED_FIELD(value)>("value");
+    addField<DAS_BIND_MANAGED_FIELD(device)>("device");
+    addField<DAS_BIND_MANAGED_FIELD(time)>("time");
+  }
+
+  virtual bool isLocal() const override { return true; }
+  virtual bool canCopy() const override { return true; }
+  virtual bool canMove() const override { return true; }
+  virtual bool canBePlacedInContainer() const override { return true; }
+};
+
+
+struct SimNode_DeleteMappedFile : SimNode_Delete
+{
+  SimNode_DeleteMappedFile( const LineInfo & a, SimNode * s, uint32_t t )
+    : SimNode_Delete(a, s, t) {}
+
+  virtual SimNode * visit(SimVisitor & vis) override
+  {
+    V_BEGIN();
+    V_OP(DeleteMappedFile);
+    V_ARG(total);
+    V_SUB(subexpr);
+    V_END();
+  }
+
+  virtual vec4f eval(Context & context) override
+  {
+    DAS_PROFILE_NODE
+    auto pH = (fs::MappedFile *)subexpr->evalPtr(context);
+    for (uint32_t i = 0; i != total; ++i, pH++)
+      *pH = fs::MappedFile();
+    return v_zero();
+  }
+};
+
+
+struct MappedFileAnnotation : ManagedStructureAnnotation<fs::MappedFile, true, true>
+{
+  MappedFileAnnotation(ModuleLibrary & ml) : ManagedStructureAnnotation("MappedFile", ml)
+  {
+    cppName = " ::fs::MappedFile";
+    addProperty<DAS_BIND_MANAGED_PROP(getSize)>("size");
+    addProperty<DAS_BIND_MANAGED_PROP(isValid)>("valid");
+  }
+
+  bool canCopy() const override { return false; }
+  virtual bool hasNonTrivialCtor() const override { return false; }
+  virtual bool isLocal() const override { return true; }
+  virtual bool canClone() const override { return false; }
+  virtual bool canMove() const override { return true; }
+  virtual bool canNew() const override { return true; }
+  virtual bool canDelete() const override { return true; }
+  virtual bool needDelete() const override { return true; }
+  virtual bool canBePlacedInContainer() const override { return true; }
+
+  virtual SimNode * simulateDelete(Context & context, const LineInfo & at, SimNode * sube, uint32_t count) const override
+  {
+    return context.code->makeNode<SimNode_DeleteMappedFile>(at, sube, count);
+  }
+};
+
+
 static char utils_das[] =
 #include "utils.das.inl"
 ;
@@ -231,6 +444,12 @@ public:
     lib.addModule(this);
     lib.addBuiltInModule();
 
+    addAnnotation(das::make_smart<FrameProfileAnnotation>(lib));
+    addAnnotation(das::make_smart<InputEventAnnotation>(lib));
+    addAnnotation(das::make_smart<HeapStatsAnnotation>(lib));
+    addAnnotation(das::make_smart<MappedFileAnnotation>(lib));
+    addCtorAndUsing<fs::MappedFile>(*this, lib, "MappedFile", "fs::MappedFile");
+
 #define DECL_KEYS() \
     DECL_KEY_CODE(VK_ESCAPE, Escape) \
     DECL_KEY_CODE(VK_RETURN, Enter) \
@@ -439,6 +658,51 @@ public:
       (*this, lib, "get_axis", SideEffects::accessExternal, "das_get_axis")
       ->args({"axis_code"});
 
+    addConstant(*this, "MAX_GAMEPADS", int(MAX_GAMEPADS));
+
+    addExtern<DAS_BIND_FUN(das_get_gamepad_axis)>
+      (*this, lib, "get_gamepad_axis", SideEffects::accessExternal, "das_get_gamepad_axis")
+      ->args({"gamepad", "axis_code"});
+
+    addExtern<DAS_BIND_FUN(das_get_gamepad_button)>
+      (*this, lib, "get_gamepad_button", SideEffects::accessExternal, "das_get_gamepad_button")
+      ->args({"gamepad", "button_code"});
+
+    addExtern<DAS_BIND_FUN(das_get_gamepad_button_down)>
+      (*this, lib, "get_gamepad_button_down", SideEffects::accessExternal, "das_get_gamepad_button_down")
+      ->args({"gamepad", "button_code"});
+
+    addExtern<DAS_BIND_FUN(das_get_gamepad_button_up)>
+      (*this, lib, "get_gamepad_button_up", SideEffects::accessExternal, "das_get_gamepad_button_up")
+      ->args({"gamepad", "button_code"});
+
+    addExtern<DAS_BIND_FUN(input::is_gamepad_connected)>
+      (*this, lib, "is_gamepad_connected", SideEffects::accessExternal, "input::is_gamepad_connected")
+      ->args({"gamepad"});
+
+    addConstant(*this, "INPUT_EVENT_KEY_DOWN", int(input::INPUT_EVENT_KEY_DOWN));
+    addConstant(*this, "INPUT_EVENT_KEY_UP", int(input::INPUT_EVENT_KEY_UP));
+    addConstant(*this, "INPUT_EVENT_MOUSE_DOWN", int(input::INPUT_EVENT_MOUSE_DOWN));
+    addConstant(*this, "INPUT_EVENT_MOUSE_UP", int(input::INPUT_EVENT_MOUSE_UP));
+    addConstant(*this, "INPUT_EVENT_MOUSE_WHEEL", int(input::INPUT_EVENT_MOUSE_WHEEL));
+    addConstant(*this, "INPUT_EVENT_GAMEPAD_DOWN", int(input::INPUT_EVENT_GAMEPAD_DOWN));
+    addConstant(*this, "INPUT_EVENT_GAMEPAD_UP", int(input::INPUT_EVENT_GAMEPAD_UP));
+    addConstant(*this, "INPUT_EVENT_AXIS", int(input::INPUT_EVENT_AXIS));
+
+    addExtern<DAS_BIND_FUN(input::get_input_time)>
+      (*this, lib, "get_input_time", SideEffects::accessExternal, "input::get_input_time");
+
+    addExtern<DAS_BIND_FUN(input::get_input_event_count)>
+      (*this, lib, "get_input_event_count", SideEffects::accessExternal, "input::get_input_event_count");
+
+    addExtern<DAS_BIND_FUN(das_get_input_event), SimNode_ExtFuncCallAndCopyOrMove>
+      (*this, lib, "get_input_event", SideEffects::accessExternal, "das_get_input_event")
+      ->args({"index", "context", "at"});
+
+    addExtern<DAS_BIND_FUN(das_for_each_input_event)>
+      (*this, lib, "for_each_input_event", SideEffects::invoke, "das_for_each_input_event")
+      ->args({"block", "context", "at"});
+
     addExtern<DAS_BIND_FUN(set_clipboard_text)>
       (*this, lib, "set_clipboard_text", SideEffects::accessExternal, "set_clipboard_text")
       ->args({"text"});
@@ -459,6 +723,50 @@ public:
       (*this, lib, "cvt", SideEffects::accessExternal, "cvt")
       ->args({"value", "from_range_1", "from_range_2", "to_range_1", "to_range_2"});
 
+    accept_temporary_arrays(addExtern<DAS_BIND_FUN(array_add_scaled_float)>
+      (*this, lib, "add_scaled", SideEffects::modifyArgument, "array_add_scaled_float")
+      ->args({"dst", "src", "scale", "context", "at"}), {0, 1});
+
+    accept_temporary_arrays(addExtern<DAS_BIND_FUN(array_add_scaled_float2)>
+      (*this, lib, "add_scaled", SideEffects::modifyArgument, "array_add_scaled_float2")
+      ->args({"dst", "src", "scale", "context", "at"}), {0, 1});
+
+    accept_temporary_arrays(addExtern<DAS_BIND_FUN(array_add_scaled_float3)>
+      (*this, lib, "add_scaled", SideEffects::modifyArgument, "array_add_scaled_float3")
+      ->args({"dst", "src", "scale", "context", "at"}), {0, 1});
+
+    accept_temporary_arrays(addExtern<DAS_BIND_FUN(array_add_float)>
+      (*this, lib, "add_to_all", SideEffects::modifyArgument, "array_add_float")
+      ->args({"dst", "value"}), {0});
+
+    accept_temporary_arrays(addExtern<DAS_BIND_FUN(array_add_float2)>
+      (*this, lib, "add_to_all", SideEffects::modifyArgument, "array_add_float2")
+      ->args({"dst", "value"}), {0});
+
+    accept_temporary_arrays(addExtern<DAS_BIND_FUN(array_add_float3)>
+      (*this, lib, "add_to_all", SideEffects::modifyArgument, "array_add_float3")
+      ->args({"dst", "value"}), {0});
+
+    accept_temporary_arrays(addExtern<DAS_BIND_FUN(transform_points)>
+      (*this, lib, "transform_points", SideEffects::modifyArgument, "transform_points")
+      ->args({"dst", "src", "m", "context", "at"}), {0, 1});
+
+    accept_temporary_arrays(addExtern<DAS_BIND_FUN(query_circles)>
+      (*this, lib, "query_circles", SideEffects::modifyArgument, "query_circles")
+      ->args({"centers", "radii", "center", "radius", "result", "context", "at"}), {0, 1});
+
+    accept_temporary_arrays(addExtern<DAS_BIND_FUN(query_boxes)>
+      (*this, lib, "query_boxes", SideEffects::modifyArgument, "query_boxes")
+      ->args({"boxes", "box", "result", "context", "at"}), {0});
+
+    accept_temporary_arrays(addExtern<DAS_BIND_FUN(find_overlapping_circles)>
+      (*this, lib, "find_overlapping_circles", SideEffects::modifyArgument, "find_overlapping_circles")
+      ->args({"a_centers", "a_radii", "b_centers", "b_radii", "pairs", "context", "at"}), {0, 1, 2, 3});
+
+    accept_temporary_arrays(addExtern<DAS_BIND_FUN(find_nearest_point)>
+      (*this, lib, "find_nearest_point", SideEffects::none, "find_nearest_point")
+      ->args({"points", "pos"}), {0});
+
     addExtern<DAS_BIND_FUN(move_to)>
       (*this, lib, "move_to", SideEffects::accessExternal, "move_to")
       ->args({"from", "to", "dt", "vel"});
@@ -483,6 +791,10 @@ public:
       (*this, lib, "set_resolution", SideEffects::modifyExternal, "set_resolution")
       ->args({"width", "height"});
 
+    addExtern<DAS_BIND_FUN(set_upscale_with_view)>
+      (*this, lib, "set_upscale_with_view", SideEffects::modifyExternal, "set_upscale_with_view")
+      ->args({"enable"});
+
     addExtern<DAS_BIND_FUN(set_rendering_upscale)>
       (*this, lib, "set_rendering_upscale", SideEffects::modifyExternal, "set_rendering_upscale")
       ->args({"upscale"});
@@ -496,7 +808,10 @@ public:
 
     addExtern<DAS_BIND_FUN(local_storage_get)>
       (*this, lib, "local_storage_get", SideEffects::modifyExternal, "local_storage_get")
-      ->args({"key"});
+      ->args({"key", "context", "at"});
+
+    addExtern<DAS_BIND_FUN(local_storage_flush)>
+      (*this, lib, "local_storage_flush", SideEffects::modifyExternal, "local_storage_flush");
 
     addExtern<DAS_BIND_FUN(schedule_pause)>
       (*this, lib, "schedule_pause", SideEffects::modifyExternal, "schedule_pause");
@@ -510,6 +825,27 @@ public:
       (*this, lib, "get_delta_time", SideEffects::modifyExternal, "get_delta_time");
     addExtern<DAS_BIND_FUN(is_window_active)>
       (*this, lib, "is_window_active", SideEffects::modifyExternal, "is_window_active");
+    addExtern<DAS_BIND_FUN(set_fixed_timestep)>
+      (*this, lib, "set_fixed_timestep", SideEffects::modifyExternal, "set_fixed_timestep")
+      ->args({"steps_per_second"});
+
+    addExtern<DAS_BIND_FUN(get_fixed_timestep)>
+      (*this, lib, "get_fixed_timestep", SideEffects::accessExternal, "get_fixed_timestep");
+
+    addExtern<DAS_BIND_FUN(get_interpolation_alpha)>
+      (*this, lib, "get_interpolation_alpha", SideEffects::accessExternal, "get_interpolation_alpha");
+
+    addExtern<DAS_BIND_FUN(set_frame_rate_limit)>
+      (*this, lib, "set_frame_rate_limit", SideEffects::modifyExternal, "set_frame_rate_limit")
+      ->args({"fps"});
+
+    addExtern<DAS_BIND_FUN(set_idle_mode)>
+      (*this, lib, "set_idle_mode", SideEffects::modifyExternal, "set_idle_mode")
+      ->args({"enable"});
+
+    addExtern<DAS_BIND_FUN(request_redraw)>
+      (*this, lib, "request_redraw", SideEffects::modifyExternal, "request_redraw");
+
     addExtern<DAS_BIND_FUN(set_vsync_enabled)>
       (*this, lib, "set_vsync_enabled", SideEffects::modifyExternal, "set_vsync_enabled")
       ->args({"vsync"});
@@ -526,6 +862,18 @@ public:
       SideEffects::modifyExternal, "fs::is_file_exists")
       ->arg("file_name");
 
+    addExtern<DAS_BIND_FUN(das_open_mapped_file), SimNode_ExtFuncCallAndCopyOrMove>(*this, lib, "open_mapped_file",
+      SideEffects::modifyExternal, "das_open_mapped_file")
+      ->arg("file_name");
+
+    addExtern<DAS_BIND_FUN(das_with_mapped_file_bytes)>(*this, lib, "with_mapped_file_bytes",
+      SideEffects::invoke, "das_with_mapped_file_bytes")
+      ->args({"file", "offset", "length", "block", "context", "at"});
+
+    addExtern<DAS_BIND_FUN(das_mapped_file_string)>(*this, lib, "mapped_file_string",
+      SideEffects::none, "das_mapped_file_string")
+      ->args({"file", "offset", "length", "context", "at"});
+
     addExtern<DAS_BIND_FUN(dasbox_execute)>(*this, lib, "dasbox_execute",
       SideEffects::modifyExternal, "dasbox_execute")
       ->arg("file_name");
@@ -544,6 +892,50 @@ public:
 
     addExtern<DAS_BIND_FUN(dasbox_execute_editor)>
       (*this, lib, "dasbox_execute_editor", SideEffects::modifyExternal, "dasbox_execute_editor");
+
+    addConstant(*this, "PROFILER_FRAMES", int(PROFILER_FRAMES));
+
+    addExtern<DAS_BIND_FUN(profiler::get_profiled_frame_count)>
+      (*this, lib, "get_profiled_frame_count", SideEffects::accessExternal, "profiler::get_profiled_frame_count");
+
+    addExtern<DAS_BIND_FUN(profiler::get_frame_profile), SimNode_ExtFuncCallAndCopyOrMove>
+      (*this, lib, "get_frame_profile", SideEffects::accessExternal, "profiler::get_frame_profile")
+      ->args({"frames_ago"});
+
+    addExtern<DAS_BIND_FUN(get_heap_stats), SimNode_ExtFuncCallAndCopyOrMove>
+      (*this, lib, "get_heap_stats", SideEffects::accessExternal, "get_heap_stats");
+
+    addExtern<DAS_BIND_FUN(collect_garbage)>
+      (*this, lib, "collect_garbage", SideEffects::modifyExternal, "collect_garbage")
+      ->args({"budget_ms"});
+
+    addExtern<DAS_BIND_FUN(parallel::parallel_for)>
+      (*this, lib, "parallel_for", SideEffects::invoke, "parallel::parallel_for")
+      ->args({"count", "chunk", "fn", "context", "at"});
+
+    addExtern<DAS_BIND_FUN(parallel::parallel_for_async)>
+      (*this, lib, "parallel_for_async", SideEffects::invoke, "parallel::parallel_for_async")
+      ->args({"count", "chunk", "fn", "context", "at"});
+
+    addExtern<DAS_BIND_FUN(parallel::wait)>
+      (*this, lib, "wait_parallel_for", SideEffects::modifyExternal, "parallel::wait")
+      ->args({"context", "at"});
+
+    addExtern<DAS_BIND_FUN(das_profile_begin)>
+      (*this, lib, "profile_begin", SideEffects::modifyExternal, "das_profile_begin")
+      ->args({"name"});
+
+    addExtern<DAS_BIND_FUN(das_profile_end)>
+      (*this, lib, "profile_end", SideEffects::modifyExternal, "das_profile_end")
+      ->args({"context", "at"});
+
+    addExtern<DAS_BIND_FUN(das_profile)>
+      (*this, lib, "profile", SideEffects::worstDefault, "das_profile")
+      ->args({"name", "block", "context", "at"});
+
+    addExtern<DAS_BIND_FUN(das_profile_capture_trace)>
+      (*this, lib, "profile_capture_trace", SideEffects::modifyExternal, "das_profile_capture_trace")
+      ->args({"file_name", "frames"});
     
 
     compileBuiltinModule("utils.das", (unsigned char *)utils_das, sizeof(utils_das));
@@ -554,7 +946,7 @@ public:
 
   virtual ModuleAotType aotRequire(TextWriter & tw) const override
   {
-    //tw << "#include \"test_profile.h\"\n";
+    tw << "#include \"dasboxBinding.h\"\n";
     return ModuleAotType::cpp;
   }
 };
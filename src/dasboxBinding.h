@@ -0,0 +1,91 @@
+#pragma once
+
+#include "globals.h"
+#include "input.h"
+#include "fileSystem.h"
+#include "profiler.h"
+#include "parallel.h"
+#include "bulkMath.h"
+#include <math.h>
+
+// functions bound to script are declared here for the AOT generated code
+
+bool das_get_key(int key_code);
+bool das_get_key_down(int key_code);
+bool das_get_key_up(int key_code);
+bool das_get_key_press(int key_code);
+bool das_get_mouse_button(int button_code);
+bool das_get_mouse_button_up(int button_code);
+bool das_get_mouse_button_down(int button_code);
+float das_get_axis(int axis_code);
+float das_get_gamepad_axis(int gamepad, int axis_code);
+bool das_get_gamepad_button(int gamepad, int button_code);
+bool das_get_gamepad_button_down(int gamepad, int button_code);
+bool das_get_gamepad_button_up(int gamepad, int button_code);
+int das_get_pressed_key_index();
+const char * das_get_key_name(int key_code);
+int das_get_key_code(const char * key_name);
+
+void set_window_title(const char * title);
+void set_antialiasing(int a);
+void set_resolution(int width, int height);
+void set_rendering_upscale(int upscale);
+void disable_auto_upscale();
+void set_upscale_with_view(bool enable);
+
+void schedule_pause();
+void schedule_quit_game();
+void reset_time_after_start();
+float get_time_after_start();
+float get_delta_time();
+void set_fixed_timestep(float steps_per_second);
+float get_fixed_timestep();
+float get_interpolation_alpha();
+void set_frame_rate_limit(int fps);
+void set_idle_mode(bool enable);
+void request_redraw();
+bool is_window_active();
+void set_vsync_enabled(bool enalbe);
+void set_mouse_cursor_visible(bool visible);
+void set_mouse_cursor_grabbed(bool grabbed);
+void dasbox_execute(const char * file_name);
+void dasbox_execute_editor(const char * dir, const char * file_name);
+
+float move_to(float from, float to, float dt, float vel);
+float cvt(float v, float i0, float i1, float o0, float o1);
+
+template <typename T> T approach(T from, T to, float dt, float viscosity)
+{
+  if (viscosity < 1e-9f)
+    return to;
+  else
+    return from + (1.0f - expf(-dt / viscosity)) * (to - from);
+}
+
+void local_storage_set(const char * key, const char * value);
+char * local_storage_get(const char * key, das::Context * context, das::LineInfoArg * at);
+void local_storage_flush();
+void set_clipboard_text(const char * text);
+
+const char * get_dasbox_version();
+const char * get_dasbox_build_date();
+const char * get_dasbox_initial_dir();
+const char * get_dasbox_exe_path();
+
+input::InputEvent das_get_input_event(int index, das::Context * context, das::LineInfoArg * at);
+void das_for_each_input_event(const das::TBlock<void, const input::InputEvent &> & block, das::Context * context,
+  das::LineInfoArg * at);
+
+void das_profile_begin(const char * name);
+void das_profile_end(das::Context * context, das::LineInfoArg * at);
+void das_profile(const char * name, const das::TBlock<void> & block, das::Context * context, das::LineInfoArg * at);
+bool das_profile_capture_trace(const char * file_name, int frames);
+profiler::HeapStats get_heap_stats();
+void collect_garbage(float budget_ms);
+
+fs::MappedFile das_open_mapped_file(const char * file_name);
+void das_with_mapped_file_bytes(const fs::MappedFile & file, int64_t offset, int64_t length,
+  const das::TBlock<void, const das::TTemporary<das::TArray<uint8_t>>> & block, das::Context * context,
+  das::LineInfoArg * at);
+char * das_mapped_file_string(const fs::MappedFile & file, int64_t offset, int64_t length, das::Context * context,
+  das::LineInfoArg * at);
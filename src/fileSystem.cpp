@@ -1,14 +1,36 @@
 #include "fileSystem.h"
 
 #include <algorithm>
+#include <memory>
+#include <chrono>
+#include <unordered_set>
+#include <mutex>
+#include <atomic>
 
 #ifdef _WIN32
 #include <direct.h>
+#include <sys/stat.h>
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
 #define chdir _chdir
 #define getcwd _getcwd
+#define mkdir(dir, mode) _mkdir(dir)
+#define FILE_WATCH_WIN32 1
 #else
 #include "unistd.h"
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <dirent.h>
+#endif
+
+#if defined(__linux__)
+#include <sys/inotify.h>
+#define FILE_WATCH_INOTIFY 1
+#elif defined(__APPLE__)
+#include <sys/event.h>
+#define FILE_WATCH_KQUEUE 1
 #endif
 
 using namespace std;
@@ -20,14 +42,98 @@ namespace fs
 
 // TODO: free at 'finalize'
 static unordered_map<std::string, das::TextFileInfo *> daslib_inc_files;
+static once_flag daslib_inc_files_once;
 
-
-void initialize()
+// embedded daslib files are registered at the first lookup, it can be on the background compilation thread
+static void register_daslib_inc_files()
 {
 #include "resources/daslib_str/daslib_init.cpp.inl"
 }
 
 
+//----- file mapping -----
+
+struct FileMapping
+{
+  const uint8_t * data = nullptr;
+  uint64_t size = 0;
+#ifdef _WIN32
+  HANDLE file = INVALID_HANDLE_VALUE;
+  HANDLE mapping = nullptr;
+#else
+  int fd = -1;
+#endif
+};
+
+static bool open_mapping(const char * file_name, FileMapping & mf)
+{
+#ifdef _WIN32
+  mf.file = CreateFileA(file_name, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (mf.file == INVALID_HANDLE_VALUE)
+    return false;
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(mf.file, &size) || size.QuadPart == 0)
+  {
+    CloseHandle(mf.file);
+    mf.file = INVALID_HANDLE_VALUE;
+    return false;
+  }
+  mf.size = uint64_t(size.QuadPart);
+  mf.mapping = CreateFileMappingA(mf.file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  if (mf.mapping)
+    mf.data = (const uint8_t *)MapViewOfFile(mf.mapping, FILE_MAP_READ, 0, 0, 0);
+  if (!mf.data)
+  {
+    if (mf.mapping)
+      CloseHandle(mf.mapping);
+    CloseHandle(mf.file);
+    mf = FileMapping();
+    return false;
+  }
+  return true;
+#else
+  mf.fd = open(file_name, O_RDONLY);
+  if (mf.fd < 0)
+    return false;
+  struct stat buf;
+  if (fstat(mf.fd, &buf) != 0 || buf.st_size == 0)
+  {
+    close(mf.fd);
+    mf.fd = -1;
+    return false;
+  }
+  mf.size = uint64_t(buf.st_size);
+  void * p = mmap(nullptr, size_t(mf.size), PROT_READ, MAP_PRIVATE, mf.fd, 0);
+  if (p == MAP_FAILED)
+  {
+    close(mf.fd);
+    mf = FileMapping();
+    return false;
+  }
+  mf.data = (const uint8_t *)p;
+  return true;
+#endif
+}
+
+static void close_mapping(FileMapping & mf)
+{
+#ifdef _WIN32
+  if (mf.data)
+    UnmapViewOfFile(mf.data);
+  if (mf.mapping)
+    CloseHandle(mf.mapping);
+  if (mf.file != INVALID_HANDLE_VALUE)
+    CloseHandle(mf.file);
+#else
+  if (mf.data)
+    munmap((void *)mf.data, size_t(mf.size));
+  if (mf.fd >= 0)
+    close(mf.fd);
+#endif
+  mf = FileMapping();
+}
+
+
 bool read_whole_file(const char * file_name, std::vector<uint8_t> & bytes)
 {
   if (!file_name || !file_name[0])
@@ -42,6 +148,23 @@ bool read_whole_file(const char * file_name, std::vector<uint8_t> & bytes)
     return false;
   }
 
+  const uint8_t * pakData = nullptr;
+  uint64_t pakSize = 0;
+  if (find_pak_file(file_name, pakData, pakSize))
+  {
+    bytes.assign(pakData, pakData + pakSize);
+    return true;
+  }
+
+  FileMapping mapping;
+  if (open_mapping(file_name, mapping))
+  {
+    bytes.assign(mapping.data, mapping.data + mapping.size);
+    close_mapping(mapping);
+    return true;
+  }
+
+  // empty files and files that cannot be mapped
   FILE * f = fopen(file_name, "rb");
   if (!f)
   {
@@ -49,11 +172,13 @@ bool read_whole_file(const char * file_name, std::vector<uint8_t> & bytes)
     return false;
   }
 
-  fseek(f, 0, SEEK_END);
-  const uint32_t fileLength = uint32_t(ftell(f));
-  fseek(f, 0, SEEK_SET);
-  bytes.resize(fileLength);
-  if (fread((void*)&bytes[0], 1, fileLength, f) != fileLength)
+  bytes.clear();
+  uint8_t buf[65536];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+    bytes.insert(bytes.end(), buf, buf + n);
+
+  if (ferror(f))
   {
     fclose(f);
     bytes.clear();
@@ -66,6 +191,129 @@ bool read_whole_file(const char * file_name, std::vector<uint8_t> & bytes)
 }
 
 
+struct MappedFileData
+{
+  FileMapping mapping; // not opened for the files of the pak
+  const uint8_t * data;
+  uint64_t size;
+  int refCount;
+};
+
+static unordered_set<MappedFileData *> mapped_file_pointers;
+
+static MappedFileData * add_mapped_file_ref(MappedFileData * file)
+{
+  if (file)
+    file->refCount++;
+  return file;
+}
+
+static void release_mapped_file(MappedFileData * file)
+{
+  if (!file || --file->refCount > 0)
+    return;
+  mapped_file_pointers.erase(file);
+  close_mapping(file->mapping);
+  delete file;
+}
+
+int64_t MappedFile::getSize() const
+{
+  return file ? int64_t(file->size) : 0;
+}
+
+const uint8_t * MappedFile::getData() const
+{
+  return file ? file->data : nullptr;
+}
+
+MappedFile::MappedFile(const MappedFile & b)
+{
+  file = add_mapped_file_ref(b.file);
+}
+
+MappedFile& MappedFile::operator=(const MappedFile & b)
+{
+  MappedFileData * prev = file;
+  file = add_mapped_file_ref(b.file);
+  release_mapped_file(prev);
+  return *this;
+}
+
+MappedFile& MappedFile::operator=(MappedFile && b)
+{
+  if (this != &b)
+  {
+    release_mapped_file(file);
+    file = b.file;
+    b.file = nullptr;
+  }
+  return *this;
+}
+
+MappedFile::~MappedFile()
+{
+  release_mapped_file(file);
+  file = nullptr;
+}
+
+MappedFile open_mapped_file(const char * file_name)
+{
+  MappedFile res;
+  if (!file_name || !file_name[0])
+  {
+    print_error("Cannot open file. File name is empty.");
+    return res;
+  }
+
+  if (!is_path_string_valid(file_name))
+  {
+    print_error("Cannot open file '%s'. Absolute paths or access to the parent directory is prohibited.", file_name);
+    return res;
+  }
+
+  MappedFileData * file = new MappedFileData;
+  file->data = nullptr;
+  file->size = 0;
+  file->refCount = 1;
+  if (!find_pak_file(file_name, file->data, file->size))
+  {
+    if (open_mapping(file_name, file->mapping))
+    {
+      file->data = file->mapping.data;
+      file->size = file->mapping.size;
+    }
+    else
+    {
+      struct stat buf;
+      if (stat(file_name, &buf) != 0 || buf.st_size != 0)
+      {
+        print_error("Cannot open file '%s'", file_name);
+        delete file;
+        return res;
+      }
+      file->data = (const uint8_t *)""; // empty files cannot be mapped
+    }
+  }
+
+  mapped_file_pointers.insert(file);
+  res.file = file;
+  return res;
+}
+
+void delete_mapped_files()
+{
+  // the data can still be referenced by handles, it is freed when the last handle is released
+  for (auto && file : mapped_file_pointers)
+  {
+    close_mapping(file->mapping);
+    file->data = nullptr;
+    file->size = 0;
+  }
+  mapped_file_pointers.clear();
+}
+
+
 DasboxFsFileAccess::DasboxFsFileAccess(const char * pak, bool allow_hot_reload) :
   das::ModuleFileAccess(pak, das::make_smart<DasboxFsFileAccess>(false)), storeOpenedFiles(allow_hot_reload)
 {
@@ -95,6 +343,20 @@ DasboxFsFileAccess::~DasboxFsFileAccess()
     context = nullptr;
 }
 
+void DasboxFsFileAccess::reportError(const char * format, const char * file_name)
+{
+  if (!deferErrors)
+  {
+    print_error(format, file_name);
+    return;
+  }
+
+  char buf[1024];
+  snprintf(buf, sizeof(buf), format, file_name);
+  deferredErrors += buf;
+  deferredErrors += "\n";
+}
+
 das::FileInfo * DasboxFsFileAccess::getNewFileInfo(const das::string & fname)
 {
   /*{
@@ -106,6 +368,14 @@ das::FileInfo * DasboxFsFileAccess::getNewFileInfo(const das::string & fname)
     }
   }*/
 
+  const uint8_t * pakData = nullptr;
+  uint64_t pakSize = 0;
+  if (find_pak_file(fname.c_str(), pakData, pakSize))
+  {
+    // files of the pak are never changed, so they are not stored to 'filesOpened'
+    auto info = das::make_unique<das::TextFileInfo>((const char *)pakData, uint32_t(pakSize), false);
+    return setFileInfo(fname, std::move(info));
+  }
 
   FILE * f = fopen(fname.c_str(), "rb");
   if (!f)
@@ -115,11 +385,12 @@ das::FileInfo * DasboxFsFileAccess::getNewFileInfo(const das::string & fname)
       ptr = std::max(strrchr(ptr, '/'), strrchr(ptr, '\\')) + 1;
 
     std::string key(ptr);
+    call_once(daslib_inc_files_once, register_daslib_inc_files);
     auto it = daslib_inc_files.find(key);
     if (it != daslib_inc_files.end())
       return it->second;
 
-    print_error("Script file '%s' not found", fname.c_str());
+    reportError("Script file '%s' not found", fname.c_str());
     return nullptr;
   }
 
@@ -132,7 +403,7 @@ das::FileInfo * DasboxFsFileAccess::getNewFileInfo(const das::string & fname)
   {
     fclose(f);
     free(source);
-    print_error("Cannot read file '%s'", fname.c_str());
+    reportError("Cannot read file '%s'", fname.c_str());
     return nullptr;
   }
 
@@ -241,19 +512,694 @@ bool is_file_exists(const char * file_name)
   if (!strcmp(file_name, "daslib/live.das"))  // TODO: FIX ME !!!
     return true;
 
+  const uint8_t * pakData = nullptr;
+  uint64_t pakSize = 0;
+  if (find_pak_file(file_name, pakData, pakSize))
+    return true;
+
   struct stat buffer;
   return stat(file_name, &buffer) == 0;
 }
 
+static uint64_t get_pak_file_time(const char * file_name, uint64_t & size);
+
 uint64_t get_file_time(const char * file_name)
 {
   if (!file_name)
     return 0;
+  uint64_t pakSize = 0;
+  if (uint64_t pakTime = get_pak_file_time(file_name, pakSize))
+    return pakTime;
   struct stat buf;
   if (!stat(file_name, &buf))
     return uint64_t(buf.st_mtime);
   return 0;
 }
 
+uint64_t get_file_size(const char * file_name)
+{
+  if (!file_name)
+    return 0;
+  uint64_t pakSize = 0;
+  if (get_pak_file_time(file_name, pakSize))
+    return pakSize;
+  struct stat buf;
+  if (!stat(file_name, &buf))
+    return uint64_t(buf.st_size);
+  return 0;
+}
+
+std::string get_worker_file_path(const char * file_name)
+{
+  const uint8_t * pakData = nullptr;
+  uint64_t pakSize = 0;
+  if (find_pak_file(file_name, pakData, pakSize))
+    return string(file_name);
+  return combine_path(get_current_dir(), file_name);
+}
+
+std::string get_unique_temp_name(const std::string & file_name)
+{
+  static std::atomic<unsigned> serial(0);
+#ifdef _WIN32
+  unsigned long pid = GetCurrentProcessId();
+#else
+  unsigned long pid = (unsigned long)getpid();
+#endif
+  char suffix[48];
+  snprintf(suffix, sizeof(suffix), ".%lu.%u.tmp", pid, serial.fetch_add(1));
+  return file_name + suffix;
+}
+
+bool replace_file(const char * from, const char * to)
+{
+#ifdef _WIN32
+  return MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+  return rename(from, to) == 0;
+#endif
+}
+
+void trim_dir_files(const char * dir, uint64_t max_bytes)
+{
+  struct DirFile
+  {
+    string path;
+    uint64_t size;
+    uint64_t time;
+  };
+  vector<DirFile> files;
+  uint64_t total = 0;
+
+#ifdef _WIN32
+  WIN32_FIND_DATAA fd;
+  HANDLE h = FindFirstFileA(combine_path(dir, "*").c_str(), &fd);
+  if (h == INVALID_HANDLE_VALUE)
+    return;
+  do
+  {
+    string name = fd.cFileName;
+#else
+  DIR * d = opendir(dir);
+  if (!d)
+    return;
+  while (dirent * ent = readdir(d))
+  {
+    string name = ent->d_name;
+#endif
+    string path = combine_path(dir, name);
+    struct stat buf;
+    if (name == "." || name == ".." || stat(path.c_str(), &buf) != 0 || (buf.st_mode & S_IFMT) != S_IFREG)
+      continue;
+    files.push_back(DirFile{path, uint64_t(buf.st_size), uint64_t(buf.st_mtime)});
+    total += uint64_t(buf.st_size);
+#ifdef _WIN32
+  } while (FindNextFileA(h, &fd));
+  FindClose(h);
+#else
+  }
+  closedir(d);
+#endif
+
+  if (total <= max_bytes)
+    return;
+
+  std::sort(files.begin(), files.end(), [](const DirFile & a, const DirFile & b) { return a.time < b.time; });
+  for (auto && f : files)
+  {
+    if (total <= max_bytes)
+      break;
+    if (remove(f.path.c_str()) == 0)
+      total -= f.size;
+  }
+}
+
+bool make_dir(const char * dir)
+{
+  if (!dir || !dir[0])
+    return false;
+  if (is_file_exists(dir))
+    return true;
+  return mkdir(dir, 0755) == 0;
+}
+
+
+//----- pak archive -----
+
+// Layout: PakHeader, data of the files (each is aligned to PAK_DATA_ALIGNMENT and followed by '\0'),
+// index at 'indexOffset': for each file PakIndexEntry and 'nameLength' bytes of the name.
+
+#define PAK_MAGIC "DASBPAK1"
+#define PAK_DATA_ALIGNMENT 16
+
+struct PakHeader
+{
+  char magic[8];
+  uint32_t fileCount;
+  uint32_t reserved;
+  uint64_t indexOffset;
+};
+
+struct PakIndexEntry
+{
+  uint64_t offset;
+  uint64_t size;
+  uint64_t fileTime;
+  uint32_t nameLength;
+};
+
+struct PakFile
+{
+  const uint8_t * data;
+  uint64_t size;
+  uint64_t fileTime;
+};
+
+static FileMapping pak_mapping;
+static unordered_map<string, PakFile> pak_files;
+static string pak_name;
+
+
+static string normalize_pak_name(const char * file_name)
+{
+  string res;
+  res.reserve(strlen(file_name));
+  for (const char * p = file_name; *p; p++)
+  {
+    char c = is_slash(*p) ? '/' : *p;
+    if (c == '/' && (res.empty() || res.back() == '/'))
+      continue;
+    if (c == '.' && (res.empty() || res.back() == '/') && (is_slash(p[1]) || !p[1]))
+      continue; // "./"
+    res += c;
+  }
+  return res;
+}
+
+bool mount_pak(const char * pak_file_name)
+{
+  unmount_pak();
+
+  if (!open_mapping(pak_file_name, pak_mapping))
+  {
+    print_error("Cannot open pak '%s'", pak_file_name);
+    return false;
+  }
+
+  const uint8_t * base = pak_mapping.data;
+  const uint64_t total = pak_mapping.size;
+  const PakHeader * header = (const PakHeader *)base;
+  if (total < sizeof(PakHeader) || memcmp(header->magic, PAK_MAGIC, sizeof(header->magic)) != 0 ||
+      header->indexOffset > total)
+  {
+    print_error("File '%s' is not a dasbox pak", pak_file_name);
+    close_mapping(pak_mapping);
+    return false;
+  }
+
+  uint64_t pos = header->indexOffset;
+  for (uint32_t i = 0; i < header->fileCount; i++)
+  {
+    PakIndexEntry e;
+    if (pos + sizeof(e) > total)
+      break;
+    memcpy(&e, base + pos, sizeof(e));
+    pos += sizeof(e);
+    if (pos + e.nameLength > total || e.offset + e.size + 1 > header->indexOffset)
+      break;
+
+    PakFile & f = pak_files[string((const char *)base + pos, e.nameLength)];
+    f.data = base + e.offset;
+    f.size = e.size;
+    f.fileTime = e.fileTime;
+    pos += e.nameLength;
+  }
+
+  if (pak_files.size() != header->fileCount)
+  {
+    print_error("Index of pak '%s' is corrupted", pak_file_name);
+    unmount_pak();
+    return false;
+  }
+
+  pak_name = pak_file_name;
+  print_note("Mounted pak '%s', %d files", pak_file_name, int(pak_files.size()));
+  return true;
+}
+
+void unmount_pak()
+{
+  pak_files.clear();
+  pak_name.clear();
+  close_mapping(pak_mapping);
+}
+
+bool is_pak_mounted()
+{
+  return pak_mapping.data != nullptr;
+}
+
+static const PakFile * find_pak_entry(const char * file_name)
+{
+  if (pak_files.empty() || !file_name || !file_name[0])
+    return nullptr;
+  auto it = pak_files.find(normalize_pak_name(file_name));
+  return it != pak_files.end() ? &it->second : nullptr;
+}
+
+bool find_pak_file(const char * file_name, const uint8_t * & data, uint64_t & size)
+{
+  const PakFile * f = find_pak_entry(file_name);
+  if (!f)
+    return false;
+  data = f->data;
+  size = f->size;
+  return true;
+}
+
+static uint64_t get_pak_file_time(const char * file_name, uint64_t & size)
+{
+  const PakFile * f = find_pak_entry(file_name);
+  if (!f)
+    return 0;
+  size = f->size;
+  return max(f->fileTime, uint64_t(1));
+}
+
+static void list_files_recursive(const string & dir, const string & prefix, vector<string> & out)
+{
+#ifdef _WIN32
+  WIN32_FIND_DATAA fd;
+  HANDLE h = FindFirstFileA(combine_path(dir, "*").c_str(), &fd);
+  if (h == INVALID_HANDLE_VALUE)
+    return;
+  do
+  {
+    string name = fd.cFileName;
+    bool isDir = (fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+#else
+  DIR * d = opendir(dir.c_str());
+  if (!d)
+    return;
+  while (dirent * ent = readdir(d))
+  {
+    string name = ent->d_name;
+    struct stat buf;
+    bool isDir = stat(combine_path(dir, name).c_str(), &buf) == 0 && S_ISDIR(buf.st_mode);
+#endif
+    if (name == "." || name == "..")
+      continue;
+    if (isDir)
+      list_files_recursive(combine_path(dir, name), prefix + name + "/", out);
+    else
+      out.push_back(prefix + name);
+#ifdef _WIN32
+  } while (FindNextFileA(h, &fd));
+  FindClose(h);
+#else
+  }
+  closedir(d);
+#endif
+}
+
+bool make_pak(const char * pak_file_name, const char * dir)
+{
+  vector<string> names;
+  list_files_recursive(dir, "", names);
+  std::sort(names.begin(), names.end());
+
+  FILE * out = fopen(pak_file_name, "wb");
+  if (!out)
+  {
+    print_error("Cannot create pak '%s'", pak_file_name);
+    return false;
+  }
+
+  PakHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, PAK_MAGIC, sizeof(header.magic));
+  fwrite(&header, sizeof(header), 1, out);
+
+  vector<PakIndexEntry> entries;
+  vector<string> packedNames;
+  vector<uint8_t> bytes;
+  uint64_t pos = sizeof(header);
+  const uint8_t zeros[PAK_DATA_ALIGNMENT] = { 0 };
+  bool ok = true;
+  for (const string & name : names)
+  {
+    const char * ext = strrchr(name.c_str(), '.');
+    if (ext && !strcmp(ext, ".pak"))
+      continue;
+
+    string path = combine_path(dir, name);
+    FILE * f = fopen(path.c_str(), "rb");
+    if (!f)
+    {
+      print_error("Cannot open file '%s'", path.c_str());
+      ok = false;
+      break;
+    }
+    bytes.clear();
+    uint8_t buf[65536];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+      bytes.insert(bytes.end(), buf, buf + n);
+    fclose(f);
+
+    uint64_t pad = (PAK_DATA_ALIGNMENT - pos % PAK_DATA_ALIGNMENT) % PAK_DATA_ALIGNMENT;
+    fwrite(zeros, 1, size_t(pad), out);
+    pos += pad;
+
+    PakIndexEntry e;
+    memset(&e, 0, sizeof(e));
+    e.offset = pos;
+    e.size = bytes.size();
+    e.fileTime = get_file_time(path.c_str());
+    e.nameLength = uint32_t(name.length());
+    if (!bytes.empty())
+      fwrite(bytes.data(), 1, bytes.size(), out);
+    fwrite(zeros, 1, 1, out);
+    pos += e.size + 1;
+    entries.push_back(e);
+    packedNames.push_back(name);
+  }
+
+  header.fileCount = uint32_t(entries.size());
+  header.indexOffset = pos;
+  for (size_t i = 0; i < entries.size(); i++)
+  {
+    fwrite(&entries[i], sizeof(PakIndexEntry), 1, out);
+    fwrite(packedNames[i].c_str(), 1, packedNames[i].length(), out);
+  }
+
+  fseek(out, 0, SEEK_SET);
+  fwrite(&header, sizeof(header), 1, out);
+  ok = ok && !ferror(out);
+  ok = fclose(out) == 0 && ok;
+
+  if (!ok)
+  {
+    remove(pak_file_name);
+    print_error("Cannot write pak '%s'", pak_file_name);
+    return false;
+  }
+
+  print_note("Pak '%s' created, %d files", pak_file_name, int(entries.size()));
+  return true;
+}
+
+
+//----- file watching -----
+
+// Directories of the watched files are subscribed to OS notifications, editors often save files by renaming
+// a temporary file, so watching the files themselves is not enough. Changes are reported after a short silence
+// to get a single reload from the series of events produced by one save.
+
+#define FILE_WATCH_DEBOUNCE_SEC 0.05
+#define FILE_WATCH_BUFFER_SIZE 16384
+
+struct WatchedDir
+{
+  string path;
+  vector<string> names;
+  vector<int64_t> times;
+#if FILE_WATCH_INOTIFY
+  int wd = -1;
+#elif FILE_WATCH_WIN32
+  HANDLE handle = INVALID_HANDLE_VALUE;
+  OVERLAPPED overlapped = {};
+  bool reading = false; // ReadDirectoryChangesW is pending on 'overlapped'
+  DWORD buffer[FILE_WATCH_BUFFER_SIZE / sizeof(DWORD)];
+#elif FILE_WATCH_KQUEUE
+  int fd = -1;
+  vector<int> fileFds;
+#endif
+
+  bool hasName(const char * name, size_t len) const
+  {
+    for (const string & n : names)
+#if _WIN32
+      if (n.length() == len && !_strnicmp(n.c_str(), name, len))
+#else
+      if (n.length() == len && !strncmp(n.c_str(), name, len))
+#endif
+        return true;
+    return false;
+  }
+};
+
+static vector<unique_ptr<WatchedDir>> watched_dirs;
+static bool watching_files = false;
+static bool watched_files_changed = false;
+static chrono::steady_clock::time_point last_file_event;
+
+#if FILE_WATCH_INOTIFY
+static int inotify_fd = -1;
+#elif FILE_WATCH_KQUEUE
+static int kqueue_fd = -1;
+#endif
+
+
+#if FILE_WATCH_WIN32
+static bool start_dir_read(WatchedDir & d)
+{
+  d.reading = ReadDirectoryChangesW(d.handle, d.buffer, sizeof(d.buffer), FALSE,
+    FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_SIZE,
+    nullptr, &d.overlapped, nullptr) != FALSE;
+  return d.reading;
+}
+#endif
+
+static bool open_dir_watch(WatchedDir & d)
+{
+  const char * dir = d.path.empty() ? "." : d.path.c_str();
+#if FILE_WATCH_INOTIFY
+  d.wd = inotify_add_watch(inotify_fd, dir, IN_CLOSE_WRITE | IN_MODIFY | IN_MOVED_TO | IN_MOVED_FROM | IN_CREATE | IN_DELETE);
+  return d.wd >= 0;
+#elif FILE_WATCH_WIN32
+  d.handle = CreateFileA(dir, FILE_LIST_DIRECTORY, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr,
+    OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, nullptr);
+  if (d.handle == INVALID_HANDLE_VALUE)
+    return false;
+  memset(&d.overlapped, 0, sizeof(d.overlapped));
+  d.overlapped.hEvent = CreateEventA(nullptr, TRUE, FALSE, nullptr);
+  return d.overlapped.hEvent && start_dir_read(d);
+#elif FILE_WATCH_KQUEUE
+  // directory events only tell that some entry changed, so file times are compared then
+  d.fd = open(dir, O_EVTONLY);
+  if (d.fd < 0)
+    return false;
+
+  struct kevent ev;
+  EV_SET(&ev, d.fd, EVFILT_VNODE, EV_ADD | EV_CLEAR, NOTE_WRITE, 0, &d);
+  kevent(kqueue_fd, &ev, 1, nullptr, 0, nullptr);
+  for (const string & n : d.names)
+  {
+    int fd = open(combine_path(dir, n).c_str(), O_EVTONLY);
+    if (fd < 0)
+      continue;
+    EV_SET(&ev, fd, EVFILT_VNODE, EV_ADD | EV_CLEAR, NOTE_WRITE | NOTE_EXTEND | NOTE_DELETE | NOTE_RENAME | NOTE_ATTRIB, 0,
+      nullptr);
+    kevent(kqueue_fd, &ev, 1, nullptr, 0, nullptr);
+    d.fileFds.push_back(fd);
+  }
+  return true;
+#else
+  G_UNUSED(dir);
+  return false;
+#endif
+}
+
+static void close_dir_watch(WatchedDir & d)
+{
+#if FILE_WATCH_INOTIFY
+  if (d.wd >= 0)
+    inotify_rm_watch(inotify_fd, d.wd);
+#elif FILE_WATCH_WIN32
+  if (d.handle != INVALID_HANDLE_VALUE)
+  {
+    if (d.reading)
+    {
+      CancelIo(d.handle);
+      DWORD bytes = 0;
+      GetOverlappedResult(d.handle, &d.overlapped, &bytes, TRUE);
+    }
+    CloseHandle(d.handle);
+  }
+  if (d.overlapped.hEvent)
+    CloseHandle(d.overlapped.hEvent);
+  d.handle = INVALID_HANDLE_VALUE;
+  d.overlapped.hEvent = nullptr;
+  d.reading = false;
+#elif FILE_WATCH_KQUEUE
+  for (int fd : d.fileFds)
+    close(fd);
+  if (d.fd >= 0)
+    close(d.fd);
+#else
+  G_UNUSED(d);
+#endif
+}
+
+void stop_watching_files()
+{
+  for (auto & d : watched_dirs)
+    close_dir_watch(*d);
+  watched_dirs.clear();
+  watching_files = false;
+  watched_files_changed = false;
+}
+
+bool watch_files(const vector<pair<string, int64_t>> & files)
+{
+  stop_watching_files();
+
+#if FILE_WATCH_INOTIFY
+  if (inotify_fd < 0)
+    inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (inotify_fd < 0)
+    return false;
+#elif FILE_WATCH_KQUEUE
+  if (kqueue_fd < 0)
+    kqueue_fd = kqueue();
+  if (kqueue_fd < 0)
+    return false;
+#endif
+
+  for (const auto & f : files)
+  {
+    if (!is_file_exists(f.first.c_str()))
+      continue; // embedded daslib files
+
+    string dir = extract_dir(f.first);
+    WatchedDir * d = nullptr;
+    for (auto & wd : watched_dirs)
+      if (wd->path == dir)
+        d = wd.get();
+
+    if (!d)
+    {
+      watched_dirs.emplace_back(new WatchedDir);
+      d = watched_dirs.back().get();
+      d->path = dir;
+    }
+    d->names.push_back(extract_file_name(f.first));
+    d->times.push_back(f.second);
+  }
+
+  for (auto & d : watched_dirs)
+    if (!open_dir_watch(*d))
+    {
+      print_note("Cannot watch directory '%s', falling back to polling of file times", d->path.c_str());
+      stop_watching_files();
+      return false;
+    }
+
+  watching_files = !watched_dirs.empty();
+  return watching_files;
+}
+
+bool is_watching_files()
+{
+  return watching_files;
+}
+
+static bool is_watched_file_event(WatchedDir & d, const char * name, size_t len)
+{
+  return len == 0 || d.hasName(name, len); // empty name means lost events
+}
+
+static bool read_file_events()
+{
+  bool changed = false;
+#if FILE_WATCH_INOTIFY
+  alignas(inotify_event) char buf[FILE_WATCH_BUFFER_SIZE];
+  for (;;)
+  {
+    ssize_t len = read(inotify_fd, buf, sizeof(buf));
+    if (len <= 0)
+      break;
+
+    for (char * p = buf; p < buf + len;)
+    {
+      const inotify_event * ev = (const inotify_event *)p;
+      p += sizeof(inotify_event) + ev->len;
+      if (ev->mask & IN_Q_OVERFLOW)
+      {
+        changed = true;
+        continue;
+      }
+      for (auto & d : watched_dirs)
+        if (d->wd == ev->wd && ev->len > 0 && is_watched_file_event(*d, ev->name, strlen(ev->name)))
+          changed = true;
+    }
+  }
+#elif FILE_WATCH_WIN32
+  for (auto & d : watched_dirs)
+  {
+    DWORD bytes = 0;
+    if (!d->reading || !GetOverlappedResult(d->handle, &d->overlapped, &bytes, FALSE))
+      continue; // still pending
+
+    if (bytes == 0)
+      changed = true; // buffer overflow
+    for (const uint8_t * p = (const uint8_t *)d->buffer; bytes > 0;)
+    {
+      const FILE_NOTIFY_INFORMATION * info = (const FILE_NOTIFY_INFORMATION *)p;
+      char name[MAX_PATH * 3];
+      int len = WideCharToMultiByte(CP_UTF8, 0, info->FileName, int(info->FileNameLength / sizeof(WCHAR)),
+        name, sizeof(name), nullptr, nullptr);
+      if (len > 0 && is_watched_file_event(*d, name, size_t(len)))
+        changed = true;
+      if (!info->NextEntryOffset)
+        break;
+      p += info->NextEntryOffset;
+    }
+
+    ResetEvent(d->overlapped.hEvent);
+    start_dir_read(*d);
+  }
+#elif FILE_WATCH_KQUEUE
+  struct kevent events[64];
+  struct timespec timeout = { 0, 0 };
+  int n;
+  while ((n = kevent(kqueue_fd, nullptr, 0, events, 64, &timeout)) > 0)
+    for (int i = 0; i < n; i++)
+    {
+      WatchedDir * d = (WatchedDir *)events[i].udata;
+      if (!d)
+      {
+        changed = true; // watched file itself
+        continue;
+      }
+      for (size_t k = 0; k < d->names.size(); k++)
+        if (int64_t(get_file_time(combine_path(d->path.empty() ? "." : d->path, d->names[k]).c_str())) != d->times[k])
+          changed = true;
+    }
+#endif
+  return changed;
+}
+
+bool poll_file_changes()
+{
+  if (!watching_files)
+    return false;
+
+  auto now = chrono::steady_clock::now();
+  if (read_file_events())
+  {
+    watched_files_changed = true;
+    last_file_event = now;
+  }
+
+  if (watched_files_changed && chrono::duration<double>(now - last_file_event).count() >= FILE_WATCH_DEBOUNCE_SEC)
+  {
+    watched_files_changed = false;
+    return true;
+  }
+  return false;
+}
+
 
 }
@@ -11,7 +11,6 @@
 namespace fs
 {
 
-void initialize();
 bool is_path_string_valid(const char * path);
 bool read_whole_file(const char * file_name, std::vector<uint8_t> & bytes);
 std::string combine_path(const std::string & path1, const std::string & path2);
@@ -21,6 +20,69 @@ bool change_dir(const std::string & dir);
 bool is_file_exists(const char *  file_name);
 std::string get_current_dir();
 uint64_t get_file_time(const char * file_name);
+uint64_t get_file_size(const char * file_name);
+bool make_dir(const char * dir);
+// name for worker threads: files of the mounted pak keep the relative name, the others get the full path,
+// so jobs do not depend on the current directory at the time they run
+std::string get_worker_file_path(const char * file_name);
+// name to write 'file_name' under before renaming, unique for the process and the call
+std::string get_unique_temp_name(const std::string & file_name);
+// renames 'from' to 'to' replacing the existing file atomically, so 'to' is never missing
+bool replace_file(const char * from, const char * to);
+// deletes the oldest files of the directory (by modification time) until their total size fits 'max_bytes',
+// subdirectories are not touched, thread safe
+void trim_dir_files(const char * dir, uint64_t max_bytes);
+
+// Files of the mounted pak archive take priority over the files on disk, they are served from a memory mapping.
+// Names are relative to the directory the pak was made from.
+bool mount_pak(const char * pak_file_name);
+void unmount_pak();
+bool is_pak_mounted();
+bool find_pak_file(const char * file_name, const uint8_t * & data, uint64_t & size); // data is followed by '\0'
+bool make_pak(const char * pak_file_name, const char * dir);
+
+
+struct MappedFileData;
+
+// read-only view of the whole file, mapped by OS or pointing into the mounted pak
+struct MappedFile
+{
+  MappedFileData * file;
+
+  bool isValid() const
+  {
+    return !!file;
+  }
+
+  int64_t getSize() const;
+  const uint8_t * getData() const;
+
+  MappedFile()
+  {
+    file = nullptr;
+  }
+
+  MappedFile(const MappedFile & b);
+
+  MappedFile(MappedFile && b)
+  {
+    file = b.file;
+    b.file = nullptr;
+  }
+
+  MappedFile& operator=(const MappedFile & b);
+  MappedFile& operator=(MappedFile && b);
+  ~MappedFile();
+};
+
+MappedFile open_mapped_file(const char * file_name);
+void delete_mapped_files(); // at script reload, all views become empty
+
+// OS notifications about changes of the files, returns false if they are not available and file times should be polled
+bool watch_files(const std::vector<std::pair<std::string, int64_t>> & files);
+bool is_watching_files();
+bool poll_file_changes(); // true once per series of changes
+void stop_watching_files();
 
 
 
@@ -31,6 +93,8 @@ public:
   std::vector<std::pair<std::string, int64_t>> filesOpened;
   bool storeOpenedFiles = true;
   bool derivedAccess = false;
+  bool deferErrors = false;   // collect errors to 'deferredErrors' instead of the log, for compilation on worker thread
+  std::string deferredErrors;
   DasboxFsFileAccess(const char * pak, bool allow_hot_reload = true);
   DasboxFsFileAccess(bool allow_hot_reload = true);
   DasboxFsFileAccess(DasboxFsFileAccess * modAccess, bool allow_hot_reload = true);
@@ -38,6 +102,9 @@ public:
   virtual ~DasboxFsFileAccess() override;
   virtual das::FileInfo * getNewFileInfo(const das::string & fname) override;
   virtual das::ModuleInfo getModuleInfo(const das::string & req, const das::string & from) const override;
+
+private:
+  void reportError(const char * format, const char * file_name);
 };
 
 }
@@ -0,0 +1,150 @@
+#include "frameArena.h"
+#include <daScript/daScript.h>
+#include <vector>
+#include <algorithm>
+
+using namespace std;
+
+namespace arena
+{
+
+#define FRAME_ARENA_INITIAL_SIZE (1 << 20)
+#define FRAME_ARENA_MAX_SIZE (256 << 20)
+#define FRAME_ARENA_SHRINK_FRAMES 300 // frames that use at most a quarter of the arena before it shrinks
+
+struct ArenaBlock
+{
+  uint8_t * data;
+  size_t size;
+  size_t used;
+};
+
+// the frame starts in 'blocks[0]', extra blocks are allocated when it is full and merged at reset
+static vector<ArenaBlock> blocks;
+static size_t frame_used = 0;
+static int frame_allocations = 0;
+static size_t recent_peak = 0; // high-water mark of the frames since the arena became oversized
+static int frames_under_budget = 0;
+static FrameArenaStats stats = { 0, 0, 0, 0, 0 };
+
+
+static bool add_block(size_t size)
+{
+  ArenaBlock b;
+  b.data = (uint8_t *)das_aligned_alloc16(size);
+  if (!b.data)
+    return false;
+  b.size = size;
+  b.used = 0;
+  blocks.push_back(b);
+  return true;
+}
+
+static void free_blocks()
+{
+  for (auto && b : blocks)
+    das_aligned_free16(b.data);
+  blocks.clear();
+}
+
+static size_t get_arena_size_for(size_t bytes)
+{
+  size_t size = FRAME_ARENA_INITIAL_SIZE;
+  while (size < bytes)
+    size *= 2;
+  return min(size, size_t(FRAME_ARENA_MAX_SIZE));
+}
+
+void * frame_alloc(size_t size, size_t align)
+{
+  if (align < 16)
+    align = 16;
+  if (size == 0)
+    size = 1;
+  if (frame_used + size + align > FRAME_ARENA_MAX_SIZE)
+    return nullptr;
+
+  if (blocks.empty() && !add_block(FRAME_ARENA_INITIAL_SIZE))
+    return nullptr;
+
+  ArenaBlock * b = &blocks.back();
+  size_t offset = (b->used + align - 1) & ~(align - 1);
+  if (offset + size > b->size)
+  {
+    size_t next = b->size * 2;
+    while (next < size + align)
+      next *= 2;
+    if (!add_block(next))
+      return nullptr;
+    b = &blocks.back();
+    offset = 0;
+  }
+
+  frame_used += offset + size - b->used;
+  b->used = offset + size;
+  frame_allocations++;
+  return b->data + offset;
+}
+
+void reset_frame_arena()
+{
+  stats.used = int64_t(frame_used);
+  stats.peak = max(stats.peak, stats.used);
+  stats.allocations = frame_allocations;
+
+  if (blocks.size() > 1)
+  {
+    // one block that fits the whole frame, so the next frames are linear again
+    size_t total = 0;
+    for (auto && b : blocks)
+      total += b.size;
+    free_blocks();
+    add_block(get_arena_size_for(total));
+    stats.overflows++;
+    recent_peak = 0;
+    frames_under_budget = 0;
+  }
+  else if (!blocks.empty())
+  {
+    blocks[0].used = 0;
+
+    // a single big frame should not keep the memory for the rest of the session
+    size_t size = blocks[0].size;
+    if (size > FRAME_ARENA_INITIAL_SIZE && frame_used * 4 <= size)
+    {
+      recent_peak = max(recent_peak, frame_used);
+      if (++frames_under_budget >= FRAME_ARENA_SHRINK_FRAMES)
+      {
+        free_blocks();
+        add_block(get_arena_size_for(recent_peak * 2));
+        recent_peak = 0;
+        frames_under_budget = 0;
+      }
+    }
+    else
+    {
+      recent_peak = 0;
+      frames_under_budget = 0;
+    }
+  }
+
+  stats.capacity = blocks.empty() ? 0 : int64_t(blocks[0].size);
+  frame_used = 0;
+  frame_allocations = 0;
+}
+
+FrameArenaStats get_frame_arena_stats()
+{
+  return stats;
+}
+
+void finalize()
+{
+  free_blocks();
+  frame_used = 0;
+  frame_allocations = 0;
+  recent_peak = 0;
+  frames_under_budget = 0;
+}
+
+}
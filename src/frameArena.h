@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+
+namespace arena
+{
+  // counters of the last finished frame, 'peak' and 'overflows' are kept for the whole session
+  struct FrameArenaStats
+  {
+    int64_t used;
+    int64_t peak;
+    int64_t capacity;
+    int allocations;
+    int overflows; // frames that did not fit into the arena, it grows for the next frame
+  };
+
+  // Linear allocator for temporaries of the frame, memory is valid until reset_frame_arena(). It grows when
+  // a frame does not fit and shrinks back to the recent high-water mark when the frames stay small.
+  // Main thread only, returns nullptr if the frame takes more than FRAME_ARENA_MAX_SIZE.
+  void * frame_alloc(size_t size, size_t align = 16);
+  void reset_frame_arena(); // after draw() and init()
+  FrameArenaStats get_frame_arena_stats();
+  void finalize();
+}
@@ -24,6 +24,7 @@ extern int screen_height;
 extern bool has_errors;
 extern bool trust_mode;
 extern bool log_to_console;
+extern bool log_console_to_stderr; // stdout is reserved for the output of the command, e.g. benchmark JSON
 extern const char * initial_dir;
 
 void print_error(const char * format, ...);
@@ -1,13 +1,33 @@
 #include "globals.h"
 #include "graphics.h"
 #include "fileSystem.h"
+#include "jobs.h"
+#include "frameArena.h"
 #include <unordered_map>
+#include <vector>
+#include <list>
+#include <cmath>
+#include <memory>
+#include <atomic>
 #include <SFML/Graphics.hpp>
+#include <stb_image.h> // implemented in sfml-graphics
+#include <stb_image_write.h>
 #include <daScript/daScript.h>
+#include <daScript/ast/ast.h>
 #include <daScript/simulate/interop.h>
 #include <daScript/simulate/simulate_visit_op.h>
 #include <string>
 
+// DASBOX_NO_PIXEL_SIMD - scalar pixel loops only, see samples/benchmarks/pixel_kernels_4k.das
+#if defined(DASBOX_NO_PIXEL_SIMD)
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+  #include <emmintrin.h>
+  #define PIXEL_KERNELS_SSE2 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+  #include <arm_neon.h>
+  #define PIXEL_KERNELS_NEON 1
+#endif
+
 using namespace das;
 
 #define SWAP_RB(c) (((c) & 0xFF00FF00) | (((c) & 0x000000FF) << 16) | (((c) & 0x00FF0000) >> 16))
@@ -18,6 +38,7 @@ static sf::Font * font_sans = nullptr;
 static sf::Font * current_font = nullptr;
 static int current_font_size = 16;
 static sf::Font * saved_font = nullptr;
+static sf::Font * get_current_font();
 
 
 const sf::BlendMode BlendPremultipliedAlpha(sf::BlendMode::One, sf::BlendMode::OneMinusSrcAlpha, sf::BlendMode::Add,
@@ -49,20 +70,162 @@ sf::Color conv_color(uint32_t c)
   return sf::Color((c >> 16) & 0xFF, (c >> 8) & 0xFF, c & 0xFF, c >> 24);
 }
 
+
+//------------------------------- primitive batch -------------------------------------
+
+#define MAX_BATCH_VERTICES 65536
+
+static std::vector<sf::Vertex> batch_vertices;
+static sf::PrimitiveType batch_primitive = sf::Triangles;
+static sf::RenderStates batch_rs;
+static RenderStats frame_render_stats;
+static RenderStats last_frame_render_stats;
+static const sf::Texture * last_bound_texture = nullptr;
+
+// world to screen transform of set_view(), applied to the whole batch when it is drawn
+static bool view_enabled = false;
+static das::float2 view_offset(0.0f, 0.0f);
+static float view_zoom = 1.0f;
+static sf::Transform view_transform;
+
+static void add_texture_upload(int width, int height)
+{
+  frame_render_stats.textureUploads++;
+  frame_render_stats.uploadedBytes += int64_t(width) * height * 4;
+}
+
+static void count_draw_call(const sf::Texture * tex, int vertex_count)
+{
+  frame_render_stats.drawCalls++;
+  frame_render_stats.vertices += vertex_count;
+  if (tex != last_bound_texture)
+  {
+    frame_render_stats.textureBinds++;
+    last_bound_texture = tex;
+  }
+}
+
+static void flush_batch()
+{
+  if (batch_vertices.empty())
+    return;
+
+  if (g_render_target)
+  {
+    if (view_enabled)
+    {
+      sf::RenderStates rs = batch_rs;
+      rs.transform = view_transform;
+      g_render_target->draw(batch_vertices.data(), batch_vertices.size(), batch_primitive, rs);
+    }
+    else
+      g_render_target->draw(batch_vertices.data(), batch_vertices.size(), batch_primitive, batch_rs);
+    count_draw_call(batch_rs.texture, int(batch_vertices.size()));
+  }
+
+  batch_vertices.clear();
+}
+
+// returns pointer to 'count' new vertices, they are valid until the next append or flush
+static sf::Vertex * append_to_batch(sf::PrimitiveType type, const sf::RenderStates & rs, int count)
+{
+  if (type != batch_primitive || rs.blendMode != batch_rs.blendMode || rs.texture != batch_rs.texture ||
+      rs.shader != batch_rs.shader || batch_vertices.size() + count > MAX_BATCH_VERTICES)
+  {
+    flush_batch();
+    batch_primitive = type;
+    batch_rs = rs;
+  }
+
+  size_t from = batch_vertices.size();
+  batch_vertices.resize(from + count);
+  return &batch_vertices[from];
+}
+
+// must be called before texture content, parameters or lifetime changes
+static void flush_batch_if_uses(const sf::Texture * tex)
+{
+  if (tex && batch_rs.texture == tex)
+    flush_batch();
+}
+
+//----- view -----
+
+void set_view(das::float2 offset, float zoom)
+{
+  flush_batch();
+  view_enabled = true;
+  view_offset = offset;
+  view_zoom = std::max(zoom, 1e-6f);
+  view_transform = sf::Transform::Identity;
+  view_transform.scale(view_zoom, view_zoom);
+  view_transform.translate(-offset.x, -offset.y);
+}
+
+void reset_view()
+{
+  flush_batch();
+  view_enabled = false;
+  view_offset = das::float2(0.0f, 0.0f);
+  view_zoom = 1.0f;
+  view_transform = sf::Transform::Identity;
+}
+
+das::float2 get_view_offset()
+{
+  return view_offset;
+}
+
+float get_view_zoom()
+{
+  return view_zoom;
+}
+
+das::float2 screen_to_world(das::float2 p)
+{
+  return das::float2(p.x / view_zoom + view_offset.x, p.y / view_zoom + view_offset.y);
+}
+
+das::float2 world_to_screen(das::float2 p)
+{
+  return das::float2((p.x - view_offset.x) * view_zoom, (p.y - view_offset.y) * view_zoom);
+}
+
+// bounds in world coordinates, one pixel margin covers lines and points
+static bool is_outside_view(float x0, float y0, float x1, float y1)
+{
+  if (!g_render_target)
+    return false;
+  const sf::Vector2f & size = g_render_target->getView().getSize();
+  float margin = 1.0f / view_zoom;
+  return std::max(x0, x1) < view_offset.x - margin || std::max(y0, y1) < view_offset.y - margin ||
+    std::min(x0, x1) > view_offset.x + size.x / view_zoom + margin ||
+    std::min(y0, y1) > view_offset.y + size.y / view_zoom + margin;
+}
+
+static bool is_quad_outside_view(const sf::Vector2f * p)
+{
+  float x0 = std::min(std::min(p[0].x, p[1].x), std::min(p[2].x, p[3].x));
+  float y0 = std::min(std::min(p[0].y, p[1].y), std::min(p[2].y, p[3].y));
+  float x1 = std::max(std::max(p[0].x, p[1].x), std::max(p[2].x, p[3].x));
+  float y1 = std::max(std::max(p[0].y, p[1].y), std::max(p[2].y, p[3].y));
+  return is_outside_view(x0, y0, x1, y1);
+}
+
+//-------------------------------------------------------------------------------------
+
 void fill_rect(float x, float y, float width, float height, uint32_t color)
 {
+  if (is_outside_view(x, y, x + width, y + height))
+    return;
   sf::Color c = conv_color(color);
-  sf::VertexArray v(sf::TriangleStrip, 4);
-  v[0].position = sf::Vector2f(x, y);
-  v[0].color = c;
-  v[1].position = sf::Vector2f(x, y + height);
-  v[1].color = c;
-  v[2].position = sf::Vector2f(x + width, y);
-  v[2].color = c;
-  v[3].position = sf::Vector2f(x + width, y + height);
-  v[3].color = c;
-  if (g_render_target)
-    g_render_target->draw(v, primitive_rs);
+  sf::Vertex * v = append_to_batch(sf::Triangles, primitive_rs, 6);
+  v[0] = sf::Vertex(sf::Vector2f(x, y), c);
+  v[1] = sf::Vertex(sf::Vector2f(x, y + height), c);
+  v[2] = sf::Vertex(sf::Vector2f(x + width, y), c);
+  v[3] = v[2];
+  v[4] = v[1];
+  v[5] = sf::Vertex(sf::Vector2f(x + width, y + height), c);
 }
 
 void fill_rect_i(int x, int y, int width, int height, uint32_t color)
@@ -76,22 +239,22 @@ void rect(float x, float y, float width, float height, uint32_t color)
   y += 0.5f;
   width -= 1.0f;
   height -= 1.0f;
-  if (width < 0 || height < 0)
+  if (width < 0 || height < 0 || is_outside_view(x, y, x + width, y + height))
     return;
   sf::Color c = conv_color(color);
-  sf::VertexArray v(sf::LineStrip, 5);
-  v[0].position = sf::Vector2f(x, y);
-  v[0].color = c;
-  v[1].position = sf::Vector2f(x, y + height);
-  v[1].color = c;
-  v[2].position = sf::Vector2f(x + width, y + height);
-  v[2].color = c;
-  v[3].position = sf::Vector2f(x + width, y);
-  v[3].color = c;
-  v[4].position = sf::Vector2f(x, y);
-  v[4].color = c;
-  if (g_render_target)
-    g_render_target->draw(v, primitive_rs);
+  sf::Vector2f p0(x, y);
+  sf::Vector2f p1(x, y + height);
+  sf::Vector2f p2(x + width, y + height);
+  sf::Vector2f p3(x + width, y);
+  sf::Vertex * v = append_to_batch(sf::Lines, primitive_rs, 8);
+  v[0] = sf::Vertex(p0, c);
+  v[1] = sf::Vertex(p1, c);
+  v[2] = v[1];
+  v[3] = sf::Vertex(p2, c);
+  v[4] = v[3];
+  v[5] = sf::Vertex(p3, c);
+  v[6] = v[5];
+  v[7] = v[0];
 }
 
 void rect_i(int x, int y, int width, int height, uint32_t color)
@@ -99,16 +262,14 @@ void rect_i(int x, int y, int width, int height, uint32_t color)
   rect((float)x, (float)y, (float)width, (float)height, color);
 }
 
-void line(float x0, float y0, float x1, float y1, uint32_t color)  // TODO: cache
+void line(float x0, float y0, float x1, float y1, uint32_t color)
 {
+  if (is_outside_view(x0, y0, x1, y1))
+    return;
   sf::Color c = conv_color(color);
-  sf::VertexArray v(sf::Lines, 2);
-  v[0].position = sf::Vector2f(x0 + 0.5f, y0 + 0.5f);
-  v[0].color = c;
-  v[1].position = sf::Vector2f(x1 + 0.5f, y1 + 0.5f);
-  v[1].color = c;
-  if (g_render_target)
-    g_render_target->draw(v, primitive_rs);
+  sf::Vertex * v = append_to_batch(sf::Lines, primitive_rs, 2);
+  v[0] = sf::Vertex(sf::Vector2f(x0 + 0.5f, y0 + 0.5f), c);
+  v[1] = sf::Vertex(sf::Vector2f(x1 + 0.5f, y1 + 0.5f), c);
 }
 
 void line_i(int x0, int y0, int x1, int y1, uint32_t color)
@@ -116,14 +277,12 @@ void line_i(int x0, int y0, int x1, int y1, uint32_t color)
   line((float)x0, (float)y0, (float)x1, (float)y1, color);
 }
 
-void set_pixel(float x, float y, uint32_t color) // TODO: cache
+void set_pixel(float x, float y, uint32_t color)
 {
-  sf::Color c = conv_color(color);
-  sf::VertexArray v(sf::Points, 1);
-  v[0].position = sf::Vector2f(x, y);// + 0.5f, y + 0.5f);
-  v[0].color = c;
-  if (g_render_target)
-    g_render_target->draw(v, primitive_rs);
+  if (is_outside_view(x, y, x, y))
+    return;
+  sf::Vertex * v = append_to_batch(sf::Points, primitive_rs, 1);
+  v[0] = sf::Vertex(sf::Vector2f(x, y), conv_color(color));
 }
 
 void set_pixel_i(int x, int y, uint32_t color)
@@ -131,9 +290,40 @@ void set_pixel_i(int x, int y, uint32_t color)
   set_pixel((float)x, (float)y, color);
 }
 
+#define MAX_CIRCLE_SEGMENTS 100
+
+// (sin, cos) of 'segments' + 1 angles around the circle, computed once per segment count
+static sf::Vector2f unit_circle_points[MAX_CIRCLE_SEGMENTS + 1][MAX_CIRCLE_SEGMENTS + 1];
+static bool unit_circle_ready[MAX_CIRCLE_SEGMENTS + 1] = { false };
+
+static const sf::Vector2f * get_unit_circle(int segments)
+{
+  sf::Vector2f * points = unit_circle_points[segments];
+  if (!unit_circle_ready[segments])
+  {
+    float angleStep = float(M_PI) * 2.0f / segments;
+    for (int i = 0; i <= segments; i++)
+      points[i] = sf::Vector2f(sinf(angleStep * i), cosf(angleStep * i));
+    points[segments] = points[0];
+    unit_circle_ready[segments] = true;
+  }
+  return points;
+}
+
+// result is always a valid index of unit_circle_points, also for NaN and infinite radius
+static int get_circle_segments(float radius)
+{
+  float segments = 8.0f + (radius - 2.0f) * 0.6f;
+  if (!(segments > 8.0f))
+    return 8;
+  if (!(segments < float(MAX_CIRCLE_SEGMENTS)))
+    return MAX_CIRCLE_SEGMENTS;
+  return int(segments);
+}
+
 void circle(float x, float y, float radius, uint32_t color)
 {
-  if (radius < 0)
+  if (!(radius >= 0) || !std::isfinite(radius) || is_outside_view(x - radius, y - radius, x + radius, y + radius))
     return;
 
   if (radius <= 0.5f)
@@ -145,27 +335,20 @@ void circle(float x, float y, float radius, uint32_t color)
   x += 0.5f;
   y += 0.5f;
 
-  int n = int(std::min(8.0f + std::max(radius - 2.0f, 0.0f) * 0.6f, 100.0f));
+  int n = get_circle_segments(radius);
+  const sf::Vector2f * unit = get_unit_circle(n);
 
   sf::Color sfColor = conv_color(color);
-  sf::VertexArray v(sf::LinesStrip, n + 1);
-
-  float angleStep = float(M_PI) * 2.0f / n;
+  sf::Vertex * v = append_to_batch(sf::Lines, primitive_rs, n * 2);
 
   for (int i = 0; i < n; i++)
   {
-    float angle = angleStep * i;
-    float s = sinf(angle);
-    float c = cosf(angle);
-
-    v[i].position = sf::Vector2f(x + s * radius, y + c * radius);
-    v[i].color = sfColor;
+    v[i * 2] = sf::Vertex(sf::Vector2f(x + unit[i].x * radius, y + unit[i].y * radius), sfColor);
+    if (i > 0)
+      v[i * 2 - 1] = v[i * 2];
   }
 
-  v[n] = v[0];
-
-  if (g_render_target)
-    g_render_target->draw(v, primitive_rs);
+  v[n * 2 - 1] = v[0];
 }
 
 void circle_i(int x, int y, int radius, uint32_t color)
@@ -173,41 +356,59 @@ void circle_i(int x, int y, int radius, uint32_t color)
   circle((float)x, (float)y, (float)radius, color);
 }
 
-void fill_circle(float x, float y, float radius, uint32_t color)
+static void append_fill_circle(float x, float y, float radius, sf::Color sfColor)
 {
-  if (radius < 0)
+  if (!(radius >= 0) || !std::isfinite(radius) || is_outside_view(x - radius, y - radius, x + radius, y + radius))
     return;
 
   if (radius < 0.5f)
   {
-    set_pixel(x, y, color);
+    sf::Vertex * v = append_to_batch(sf::Points, primitive_rs, 1);
+    v[0] = sf::Vertex(sf::Vector2f(x, y), sfColor);
     return;
   }
 
-  int n = int(std::min(8.0f + std::max(radius - 2.0f, 0.0f) * 0.6f, 100.0f));
+  int n = get_circle_segments(radius);
+  const sf::Vector2f * unit = get_unit_circle(n);
 
-  sf::Color sfColor = conv_color(color);
-  sf::VertexArray v(sf::TriangleFan, n + 2);
-
-  float angleStep = float(M_PI) * 2.0f / n;
+  sf::Vertex * v = append_to_batch(sf::Triangles, primitive_rs, n * 3);
 
-  v[0].position = sf::Vector2f(x, y);
-  v[0].color = sfColor;
+  sf::Vertex center(sf::Vector2f(x, y), sfColor);
+  sf::Vertex prev(sf::Vector2f(x, y + radius), sfColor);
 
-  for (int i = 1; i <= n; i++)
+  for (int i = 1; i <= n; i++, v += 3)
   {
-    float angle = angleStep * i;
-    float s = sinf(angle);
-    float c = cosf(angle);
-
-    v[i].position = sf::Vector2f(x + s * radius, y + c * radius);
-    v[i].color = sfColor;
+    v[0] = center;
+    v[1] = prev;
+    v[2] = sf::Vertex(sf::Vector2f(x + unit[i].x * radius, y + unit[i].y * radius), sfColor);
+    prev = v[2];
   }
+}
+
+void fill_circle(float x, float y, float radius, uint32_t color)
+{
+  append_fill_circle(x, y, radius, conv_color(color));
+}
 
-  v[n + 1] = v[1];
+// one call for many circles, they get into the same batch unless it overflows
+void fill_circle_instanced(const das::TArray<das::float2> & positions, const das::TArray<float> & radii,
+  const das::TArray<uint32_t> & colors)
+{
+  int count = std::min(positions.size, radii.size);
+  const das::float2 * p = (const das::float2 *)positions.data;
+  const float * r = (const float *)radii.data;
+  const uint32_t * c = (const uint32_t *)colors.data;
+  sf::Color white = sf::Color::White;
+  for (int i = 0; i < count; i++)
+    append_fill_circle(p[i].x, p[i].y, r[i], i < int(colors.size) ? conv_color(c[i]) : white);
+}
 
-  if (g_render_target)
-    g_render_target->draw(v, primitive_rs);
+void fill_circle_instanced_rc(const das::TArray<das::float2> & positions, float radius, uint32_t color)
+{
+  const das::float2 * p = (const das::float2 *)positions.data;
+  sf::Color sfColor = conv_color(color);
+  for (int i = 0; i < int(positions.size); i++)
+    append_fill_circle(p[i].x, p[i].y, radius, sfColor);
 }
 
 void fill_circle_i(int x, int y, int radius, uint32_t color)
@@ -261,21 +462,208 @@ int get_font_size_i()
   return int(current_font_size + 0.5f);
 }
 
+//----- text cache -----
+
+#define TEXT_CACHE_SIZE 1024
+
+static const char * decode_utf8(const char * s, uint32_t & out_char)
+{
+  uint8_t c = uint8_t(*s++);
+  int tail = 0;
+  if (c < 0x80)
+    out_char = c;
+  else if ((c & 0xE0) == 0xC0)
+  {
+    out_char = c & 0x1F;
+    tail = 1;
+  }
+  else if ((c & 0xF0) == 0xE0)
+  {
+    out_char = c & 0x0F;
+    tail = 2;
+  }
+  else if ((c & 0xF8) == 0xF0)
+  {
+    out_char = c & 0x07;
+    tail = 3;
+  }
+  else
+  {
+    out_char = '?';
+    return s;
+  }
+
+  for (; tail > 0; tail--, s++)
+  {
+    if ((uint8_t(*s) & 0xC0) != 0x80)
+    {
+      out_char = '?';
+      return s;
+    }
+    out_char = (out_char << 6) | (uint8_t(*s) & 0x3F);
+  }
+  return s;
+}
+
+struct TextRun
+{
+  const sf::Font * font;
+  int size;
+  uint64_t hash;
+  std::string str;
+  std::vector<sf::Vertex> vertices; // relative to the text position, color is set at draw
+};
+
+static std::list<TextRun> text_runs; // most recently used first
+static std::unordered_map<uint64_t, std::list<TextRun>::iterator> text_run_by_hash;
+static int text_cache_hits = 0;
+static int text_cache_misses = 0;
+
+static uint64_t text_run_hash(const sf::Font * font, int size, const char * str, size_t & out_len)
+{
+  uint64_t h = 14695981039346656037ULL;
+  const char * s = str;
+  for (; *s; s++)
+    h = (h ^ uint8_t(*s)) * 1099511628211ULL;
+  out_len = s - str;
+  h = (h ^ uint64_t(uintptr_t(font))) * 1099511628211ULL;
+  h = (h ^ uint64_t(size)) * 1099511628211ULL;
+  return h;
+}
+
+// same layout as sf::Text
+static void layout_text(const sf::Font & font, int size, const char * str, std::vector<sf::Vertex> & out)
+{
+  const float padding = 1.0f;
+  float whitespaceWidth = font.getGlyph(' ', size, false).advance;
+  float lineSpacing = font.getLineSpacing(size);
+  float x = 0.0f;
+  float y = float(size);
+  uint32_t prevChar = 0;
+
+  while (*str)
+  {
+    uint32_t curChar = 0;
+    str = decode_utf8(str, curChar);
+    if (curChar == '\r')
+      continue;
+
+    x += font.getKerning(prevChar, curChar, size);
+    prevChar = curChar;
+
+    if (curChar == ' ' || curChar == '\t' || curChar == '\n')
+    {
+      if (curChar == ' ')
+        x += whitespaceWidth;
+      else if (curChar == '\t')
+        x += whitespaceWidth * 4;
+      else
+      {
+        y += lineSpacing;
+        x = 0;
+      }
+      continue;
+    }
+
+    const sf::Glyph & glyph = font.getGlyph(curChar, size, false);
+    float left = x + glyph.bounds.left - padding;
+    float top = y + glyph.bounds.top - padding;
+    float right = x + glyph.bounds.left + glyph.bounds.width + padding;
+    float bottom = y + glyph.bounds.top + glyph.bounds.height + padding;
+    float u1 = float(glyph.textureRect.left) - padding;
+    float v1 = float(glyph.textureRect.top) - padding;
+    float u2 = float(glyph.textureRect.left + glyph.textureRect.width) + padding;
+    float v2 = float(glyph.textureRect.top + glyph.textureRect.height) + padding;
+
+    sf::Color c = sf::Color::White;
+    out.push_back(sf::Vertex(sf::Vector2f(left, top), c, sf::Vector2f(u1, v1)));
+    out.push_back(sf::Vertex(sf::Vector2f(right, top), c, sf::Vector2f(u2, v1)));
+    out.push_back(sf::Vertex(sf::Vector2f(left, bottom), c, sf::Vector2f(u1, v2)));
+    out.push_back(sf::Vertex(sf::Vector2f(left, bottom), c, sf::Vector2f(u1, v2)));
+    out.push_back(sf::Vertex(sf::Vector2f(right, top), c, sf::Vector2f(u2, v1)));
+    out.push_back(sf::Vertex(sf::Vector2f(right, bottom), c, sf::Vector2f(u2, v2)));
+
+    x += glyph.advance;
+  }
+}
+
+static const TextRun & get_text_run(const sf::Font * font, int size, const char * str)
+{
+  size_t len = 0;
+  uint64_t hash = text_run_hash(font, size, str, len);
+  auto it = text_run_by_hash.find(hash);
+  if (it != text_run_by_hash.end())
+  {
+    TextRun & run = *it->second;
+    if (run.font == font && run.size == size && run.str.length() == len && !memcmp(run.str.c_str(), str, len))
+    {
+      text_cache_hits++;
+      text_runs.splice(text_runs.begin(), text_runs, it->second);
+      return run;
+    }
+    text_runs.erase(it->second);
+    text_run_by_hash.erase(it);
+  }
+
+  text_cache_misses++;
+  if (text_runs.size() >= TEXT_CACHE_SIZE)
+  {
+    text_run_by_hash.erase(text_runs.back().hash);
+    text_runs.pop_back();
+  }
+
+  text_runs.emplace_front();
+  TextRun & run = text_runs.front();
+  run.font = font;
+  run.size = size;
+  run.hash = hash;
+  run.str.assign(str, len);
+  layout_text(*font, size, str, run.vertices);
+  text_run_by_hash[hash] = text_runs.begin();
+  return run;
+}
+
+RenderStats get_render_stats()
+{
+  return last_frame_render_stats;
+}
+
+int get_text_cache_hits()
+{
+  return text_cache_hits;
+}
+
+int get_text_cache_misses()
+{
+  return text_cache_misses;
+}
+
 void text_out(float x, float y, const char * str, uint32_t color)
 {
-  if (!str || !str[0])
+  if (!str || !str[0] || !get_current_font())
     return;
   sf::Color sfColor = conv_color(color);
   if (primitive_rs.blendMode == sf::BlendNone)
     sfColor.a = 255;
-  sf::Text text;
-  text.setFont(*current_font);
-  text.setFillColor(sfColor);
-  text.setPosition(x, y);
-  text.setCharacterSize(current_font_size);
-  text.setString(sf::String::fromUtf8(str, str + strlen(str)));
-  if (g_render_target)
-    g_render_target->draw(text, primitive_rs.blendMode == sf::BlendNone ? sf::BlendAlpha : primitive_rs.blendMode);
+
+  const TextRun & run = get_text_run(current_font, current_font_size, str);
+  int count = int(run.vertices.size());
+  if (!count)
+    return;
+
+  sf::RenderStates states = primitive_rs;
+  if (states.blendMode == sf::BlendNone)
+    states.blendMode = sf::BlendAlpha;
+  states.texture = &current_font->getTexture(current_font_size);
+
+  sf::Vertex * v = append_to_batch(sf::Triangles, states, count);
+  sf::Vector2f offset(x, y);
+  for (int i = 0; i < count; i++)
+  {
+    v[i].position = run.vertices[i].position + offset;
+    v[i].color = sfColor;
+    v[i].texCoords = run.vertices[i].texCoords;
+  }
 }
 
 void text_out_i(int x, int y, const char * str, uint32_t color)
@@ -283,56 +671,168 @@ void text_out_i(int x, int y, const char * str, uint32_t color)
   text_out((float)x, (float)y, str, color);
 }
 
-static std::unordered_map<int, std::pair<float2, float2>> cached_char_size; // font_size / char_size, additional_size
+namespace graphics
+{
 
-das::float2 get_text_size(const char * str)
+struct TextBlock
 {
-  if (!str || !str[0])
-    return float2(0);
+  const sf::Font * font = nullptr;
+  int size = 0;
+  std::vector<sf::Vertex> vertices;
+};
 
-  float2 charSize = float2(0);
-  float2 charBase = float2(0);
-  auto it = cached_char_size.find(current_font_size);
-  if (it == cached_char_size.end())
-  {
-    sf::Text text;
-    text.setFont(*current_font);
-    text.setCharacterSize(current_font_size);
-    text.setPosition(0, 0);
-    text.setString("W");
-    sf::Vector2f base = text.findCharacterPos(0);
-    text.setString("W\nWWW");
-    sf::Vector2f last = text.findCharacterPos(3);
-    charSize = float2(last.x - base.x, last.y - base.y);
-    charBase = float2(base.x, base.y);
-    cached_char_size[current_font_size] = std::make_pair(charSize, charBase);
+TextBlock * create_text_block()
+{
+  return new TextBlock;
+}
+
+void delete_text_block(TextBlock * block)
+{
+  delete block;
+}
+
+void clear_text_block(TextBlock * block)
+{
+  block->font = nullptr;
+  block->vertices.clear();
+}
+
+// all text of the block must have the same font and size
+void add_text_to_block(TextBlock * block, float x, float y, const char * str, uint32_t color)
+{
+  if (!str || !str[0] || !get_current_font())
+    return;
+  if (block->font && (block->font != current_font || block->size != current_font_size))
+  {
+    print_error("add_text_to_block: font of the text block is changed");
+    return;
   }
-  else
+
+  block->font = current_font;
+  block->size = current_font_size;
+  size_t from = block->vertices.size();
+  layout_text(*current_font, current_font_size, str, block->vertices);
+
+  sf::Color sfColor = conv_color(color);
+  sfColor.a = 255;
+  sf::Vector2f offset(x, y);
+  for (size_t i = from; i < block->vertices.size(); i++)
+  {
+    block->vertices[i].position = block->vertices[i].position + offset;
+    block->vertices[i].color = sfColor;
+  }
+}
+
+void draw_text_block(const TextBlock * block)
+{
+  if (!block->font || block->vertices.empty() || !g_render_target)
+    return;
+
+  flush_batch();
+  sf::RenderStates states = primitive_rs;
+  if (states.blendMode == sf::BlendNone)
+    states.blendMode = sf::BlendAlpha;
+  states.texture = &block->font->getTexture(block->size);
+  if (view_enabled)
+    states.transform = view_transform;
+  g_render_target->draw(block->vertices.data(), block->vertices.size(), sf::Triangles, states);
+  count_draw_call(states.texture, int(block->vertices.size()));
+}
+
+}
+
+// advance and kerning tables for one font size, to measure text without sf::Text
+struct FontMetrics
+{
+  const sf::Font * font;
+  int size;
+  float lineSpacing;
+  float advance[128];
+  std::vector<float> kerning; // 128 x 128, NAN - not requested yet
+  std::unordered_map<uint32_t, float> otherAdvance;
+
+  FontMetrics(const sf::Font * font_, int size_) : font(font_), size(size_)
+  {
+    lineSpacing = font->getLineSpacing(size);
+    for (int i = 0; i < 128; i++)
+      advance[i] = font->getGlyph(i, size, false).advance;
+    advance[int('\t')] = advance[int(' ')] * 4;
+    kerning.resize(128 * 128, NAN);
+  }
+
+  float getAdvance(uint32_t c)
+  {
+    if (c < 128)
+      return advance[c];
+    auto it = otherAdvance.find(c);
+    if (it != otherAdvance.end())
+      return it->second;
+    float a = font->getGlyph(c, size, false).advance;
+    otherAdvance[c] = a;
+    return a;
+  }
+
+  float getKerning(uint32_t a, uint32_t b)
   {
-    charSize = it->second.first;
-    charBase = it->second.second;
+    if (!a)
+      return 0;
+    if (a >= 128 || b >= 128)
+      return font->getKerning(a, b, size);
+    float & k = kerning[a * 128 + b];
+    if (std::isnan(k))
+      k = font->getKerning(a, b, size);
+    return k;
   }
+};
+
+static std::unordered_map<uint64_t, FontMetrics *> font_metrics;
+static FontMetrics * last_font_metrics = nullptr;
+
+static FontMetrics * get_font_metrics(const sf::Font * font, int size)
+{
+  FontMetrics * last = last_font_metrics;
+  if (last && last->font == font && last->size == size)
+    return last;
+
+  uint64_t key = (uint64_t(uintptr_t(font)) << 16) ^ uint64_t(size & 0xFFFF);
+  FontMetrics *& m = font_metrics[key];
+  if (!m)
+    m = new FontMetrics(font, size);
+  last_font_metrics = m;
+  return m;
+}
+
+das::float2 get_text_size(const char * str)
+{
+  if (!str || !str[0] || !get_current_font())
+    return float2(0);
 
-  int len = int(strlen(str));
+  FontMetrics * m = get_font_metrics(current_font, current_font_size);
   int lines = 1;
-  int maxLineLen = 0;
-  int curLineLen = 0;
-  for (int i = 0; i < len; i++)
+  float maxWidth = 0;
+  float x = 0;
+  uint32_t prevChar = 0;
+  while (*str)
   {
-    if ((str[i] >= 32 && str[i] <= 127) || ((str[i] & 0xC0) == 0xC0))
-      curLineLen++;
-    else if (str[i] == '\n')
+    uint32_t curChar = 0;
+    str = decode_utf8(str, curChar);
+    if (curChar == '\r')
+      continue;
+
+    x += m->getKerning(prevChar, curChar);
+    prevChar = curChar;
+    if (curChar == '\n')
     {
-      maxLineLen = std::max(curLineLen, maxLineLen);
-      curLineLen = 0;
+      maxWidth = std::max(maxWidth, x);
+      x = 0;
       lines++;
     }
-    else if (str[i] == '\t')
-      curLineLen += 4;
+    else
+      x += m->getAdvance(curChar);
   }
-  maxLineLen = std::max(curLineLen, maxLineLen);
+  maxWidth = std::max(maxWidth, x);
 
-  return das::float2(maxLineLen * charSize.x + charBase.x + 4, lines * charSize.y + charBase.y);
+  return das::float2(maxWidth, lines * m->lineSpacing);
 }
 
 void enable_premultiplied_alpha_blend()
@@ -362,18 +862,16 @@ inline void polygon_internal(const das::float2 * points, int count, uint32_t col
   }
 
   sf::Color sfColor = conv_color(color);
-  sf::VertexArray v(sf::LinesStrip, count + 1);
+  sf::Vertex * v = append_to_batch(sf::Lines, primitive_rs, count * 2);
 
   for (int i = 0; i < count; i++)
   {
-    v[i].position = sf::Vector2f(points[i].x + 0.5f, points[i].y + 0.5f);
-    v[i].color = sfColor;
+    v[i * 2] = sf::Vertex(sf::Vector2f(points[i].x + 0.5f, points[i].y + 0.5f), sfColor);
+    if (i > 0)
+      v[i * 2 - 1] = v[i * 2];
   }
 
-  v[count] = v[0];
-
-  if (g_render_target)
-    g_render_target->draw(v, primitive_rs);
+  v[count * 2 - 1] = v[0];
 }
 
 
@@ -395,17 +893,19 @@ inline void fill_convex_polygon_internal(const das::float2 * points, int count,
     return;
   }
 
+  if (count == 2)
+    return;
+
   sf::Color sfColor = conv_color(color);
-  sf::VertexArray v(sf::TriangleFan, count);
+  sf::Vertex * v = append_to_batch(sf::Triangles, primitive_rs, (count - 2) * 3);
 
-  for (int i = 0; i < count; i++)
+  sf::Vertex first(sf::Vector2f(points[0].x, points[0].y), sfColor);
+  for (int i = 2; i < count; i++, v += 3)
   {
-    v[i].position = sf::Vector2f(points[i].x, points[i].y);
-    v[i].color = sfColor;
+    v[0] = first;
+    v[1] = sf::Vertex(sf::Vector2f(points[i - 1].x, points[i - 1].y), sfColor);
+    v[2] = sf::Vertex(sf::Vector2f(points[i].x, points[i].y), sfColor);
   }
-
-  if (g_render_target)
-    g_render_target->draw(v, primitive_rs);
 }
 
 void fill_convex_polygon(const das::TArray<das::float2> & points, uint32_t color)
@@ -414,135 +914,413 @@ void fill_convex_polygon(const das::TArray<das::float2> & points, uint32_t color
 }
 
 
-struct Image;
-static unordered_set<sf::Image *> image_pointers;
-static unordered_set<sf::Texture *> texture_pointers;
-
+//----- pixel kernels -----
 
-struct Image
+static void swap_rb_copy(uint32_t * dst, const uint32_t * src, int count)
 {
-  sf::Image * img;
-  sf::Texture * tex;
-  uint32_t * cached_pixels;
-  int width;
-  int height;
-  bool applied;
-
-  bool isValid() const
+  int i = 0;
+#if PIXEL_KERNELS_SSE2
+  const __m128i agMask = _mm_set1_epi32(0xFF00FF00);
+  const __m128i lowMask = _mm_set1_epi32(0x000000FF);
+  for (; i + 4 <= count; i += 4)
   {
-    return !!img;
+    __m128i c = _mm_loadu_si128((const __m128i *)(src + i));
+    __m128i b = _mm_slli_epi32(_mm_and_si128(c, lowMask), 16);
+    __m128i r = _mm_and_si128(_mm_srli_epi32(c, 16), lowMask);
+    _mm_storeu_si128((__m128i *)(dst + i), _mm_or_si128(_mm_and_si128(c, agMask), _mm_or_si128(r, b)));
   }
-
-  int getWidth() const
+#elif PIXEL_KERNELS_NEON
+  for (; i + 8 <= count; i += 8)
   {
-    return width;
+    uint8x8x4_t c = vld4_u8((const uint8_t *)(src + i));
+    uint8x8_t t = c.val[0];
+    c.val[0] = c.val[2];
+    c.val[2] = t;
+    vst4_u8((uint8_t *)(dst + i), c);
   }
-
-  int getHeight() const
+#endif
+  for (; i < count; i++)
   {
-    return height;
+    uint32_t c = src[i];
+    dst[i] = SWAP_RB(c);
   }
+}
 
-  Image()
+// x * a / 255 for each color channel, (t + 1 + (t >> 8)) >> 8 is exact integer division by 255 for t <= 255 * 255
+static void premultiply_alpha_pixels(uint32_t * pixels, int count)
+{
+  int i = 0;
+#if PIXEL_KERNELS_SSE2
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i one = _mm_set1_epi16(1);
+  const __m128i alphaMask = _mm_set1_epi32(0xFF000000);
+  for (; i + 4 <= count; i += 4)
   {
-    applied = false;
-    img = nullptr;
-    tex = nullptr;
-    cached_pixels = nullptr;
-    width = 0;
-    height = 0;
+    __m128i p = _mm_loadu_si128((const __m128i *)(pixels + i));
+    __m128i lo = _mm_unpacklo_epi8(p, zero);
+    __m128i hi = _mm_unpackhi_epi8(p, zero);
+    __m128i alo = _mm_shufflehi_epi16(_mm_shufflelo_epi16(lo, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+    __m128i ahi = _mm_shufflehi_epi16(_mm_shufflelo_epi16(hi, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+    lo = _mm_mullo_epi16(lo, alo);
+    hi = _mm_mullo_epi16(hi, ahi);
+    lo = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(lo, one), _mm_srli_epi16(lo, 8)), 8);
+    hi = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(hi, one), _mm_srli_epi16(hi, 8)), 8);
+    __m128i res = _mm_packus_epi16(lo, hi);
+    res = _mm_or_si128(_mm_andnot_si128(alphaMask, res), _mm_and_si128(alphaMask, p));
+    _mm_storeu_si128((__m128i *)(pixels + i), res);
   }
-
-  Image(const Image & b)
+#elif PIXEL_KERNELS_NEON
+  const uint16x8_t one = vdupq_n_u16(1);
+  for (; i + 8 <= count; i += 8)
   {
-    img = b.img ? new sf::Image(*b.img) : nullptr;
-    tex = b.tex ? new sf::Texture(*b.tex) : nullptr;
-    cached_pixels = img ? (uint32_t *)img->getPixelsPtr() : nullptr;
-    width = 0;
-    height = 0;
-    applied = false;
-    image_pointers.insert(img);
-    texture_pointers.insert(tex);
+    uint8x8x4_t p = vld4_u8((const uint8_t *)(pixels + i));
+    for (int k = 0; k < 3; k++)
+    {
+      uint16x8_t t = vmull_u8(p.val[k], p.val[3]);
+      t = vaddq_u16(vaddq_u16(t, one), vshrq_n_u16(t, 8));
+      p.val[k] = vshrn_n_u16(t, 8);
+    }
+    vst4_u8((uint8_t *)(pixels + i), p);
   }
-
-  Image(Image && b)
+#endif
+  for (; i < count; i++)
   {
-    img = b.img;
-    tex = b.tex;
-    cached_pixels = b.cached_pixels;
-    width = b.width;
-    height = b.height;
-    applied = b.applied;
-
-    b.width = 0;
-    b.height = 0;
-    b.img = nullptr;
-    b.tex = nullptr;
-    b.cached_pixels = nullptr;
+    uint32_t p = pixels[i];
+    uint32_t a = (p >> 24) & 0xFFU;
+    uint32_t b = (((p >> 0) & 0xFFU) * a) / 255U;
+    uint32_t g = (((p >> 8) & 0xFFU) * a) / 255U;
+    uint32_t r = (((p >> 16) & 0xFFU) * a) / 255U;
+    pixels[i] = (a << 24) | (r << 16) | (g << 8) | (b);
   }
+}
 
-  Image& operator=(const Image & b)
+// 'key' - color in pixel byte order without alpha
+static void make_color_transparent_pixels(uint32_t * pixels, int count, uint32_t key)
+{
+  int i = 0;
+#if PIXEL_KERNELS_SSE2
+  const __m128i rgbMask = _mm_set1_epi32(0x00FFFFFF);
+  const __m128i alphaMask = _mm_set1_epi32(0xFF000000);
+  const __m128i keyV = _mm_set1_epi32(key);
+  for (; i + 4 <= count; i += 4)
   {
-    image_pointers.erase(img);
-    texture_pointers.erase(tex);
-    delete img;
-    delete tex;
-    img = b.img ? new sf::Image(*b.img) : nullptr;
-    tex = b.tex ? new sf::Texture(*b.tex) : nullptr;
-    cached_pixels = img ? (uint32_t *)img->getPixelsPtr() : nullptr;
-    width = b.width;
-    height = b.height;
-    applied = false;
-    image_pointers.insert(img);
-    texture_pointers.insert(tex);
-    return *this;
+    __m128i p = _mm_loadu_si128((const __m128i *)(pixels + i));
+    __m128i rgb = _mm_and_si128(p, rgbMask);
+    __m128i eq = _mm_cmpeq_epi32(rgb, keyV);
+    __m128i res = _mm_or_si128(_mm_and_si128(eq, rgb), _mm_andnot_si128(eq, _mm_or_si128(p, alphaMask)));
+    _mm_storeu_si128((__m128i *)(pixels + i), res);
+  }
+#elif PIXEL_KERNELS_NEON
+  const uint32x4_t rgbMask = vdupq_n_u32(0x00FFFFFF);
+  const uint32x4_t alphaMask = vdupq_n_u32(0xFF000000);
+  const uint32x4_t keyV = vdupq_n_u32(key);
+  for (; i + 4 <= count; i += 4)
+  {
+    uint32x4_t p = vld1q_u32(pixels + i);
+    uint32x4_t rgb = vandq_u32(p, rgbMask);
+    uint32x4_t eq = vceqq_u32(rgb, keyV);
+    vst1q_u32(pixels + i, vbslq_u32(eq, rgb, vorrq_u32(p, alphaMask)));
+  }
+#endif
+  for (; i < count; i++)
+  {
+    uint32_t p = pixels[i];
+    if ((p & 0x00FFFFFF) == key)
+      p &= 0x00FFFFFF;
+    else
+      p |= 0xFF000000;
+    pixels[i] = p;
+  }
+}
+
+
+static unordered_set<sf::Image *> image_pointers;
+static unordered_set<sf::Texture *> texture_pointers;
+static unordered_set<sf::RenderTexture *> render_target_pointers;
+static unordered_set<sf::Image *> mipmapped_images; // mipmaps are generated after each upload, found by 'img'
+static void restore_screen_render_target();
+static void release_streaming_textures(Image & image);
+static void set_streaming_texture_params(Image & image, int smooth, int repeated);
+static void rebind_shader_textures(const sf::Texture * tex, const sf::Texture * replacement);
+
+
+//----- atlas -----
+
+#define ATLAS_PADDING 1
+
+struct SkylineNode
+{
+  int x;
+  int y;
+  int width;
+};
+
+// texture shared by images packed with add_image, deleted when the last reference is released
+struct AtlasTexture
+{
+  sf::Texture tex;
+  std::vector<SkylineNode> skyline;
+  int width;
+  int height;
+  int refCount;
+
+  AtlasTexture(int width_, int height_) : width(width_), height(height_), refCount(0)
+  {
+    skyline.push_back(SkylineNode{0, 0, width});
   }
 
-  Image& operator=(Image && b)
+  // skyline bottom-left packing
+  bool allocate(int w, int h, int & out_x, int & out_y)
   {
-    img = b.img;
-    tex = b.tex;
-    cached_pixels = b.cached_pixels;
-    width = b.width;
-    height = b.height;
-    applied = b.applied;
+    int bestIndex = -1;
+    int bestX = 0;
+    int bestY = height;
+    for (int i = 0; i < int(skyline.size()); i++)
+    {
+      int x = skyline[i].x;
+      if (x + w > width)
+        break;
+
+      int y = 0;
+      int left = w;
+      for (int j = i; left > 0 && j < int(skyline.size()); j++)
+      {
+        y = std::max(y, skyline[j].y);
+        left -= skyline[j].width;
+      }
+
+      if (y + h <= height && y < bestY)
+      {
+        bestIndex = i;
+        bestX = x;
+        bestY = y;
+      }
+    }
+
+    if (bestIndex < 0)
+      return false;
 
-    b.width = 0;
-    b.height = 0;
-    b.img = nullptr;
-    b.tex = nullptr;
-    b.cached_pixels = nullptr;
-    return *this;
+    skyline.insert(skyline.begin() + bestIndex, SkylineNode{bestX, bestY + h, w});
+
+    for (int i = bestIndex + 1; i < int(skyline.size());)
+    {
+      int prevEnd = skyline[i - 1].x + skyline[i - 1].width;
+      if (skyline[i].x >= prevEnd)
+        break;
+      int shrink = prevEnd - skyline[i].x;
+      skyline[i].x += shrink;
+      skyline[i].width -= shrink;
+      if (skyline[i].width > 0)
+        break;
+      skyline.erase(skyline.begin() + i);
+    }
+
+    for (int i = 0; i + 1 < int(skyline.size());)
+    {
+      if (skyline[i].y == skyline[i + 1].y)
+      {
+        skyline[i].width += skyline[i + 1].width;
+        skyline.erase(skyline.begin() + i + 1);
+      }
+      else
+        i++;
+    }
+
+    out_x = bestX;
+    out_y = bestY;
+    return true;
   }
+};
+
+static unordered_set<AtlasTexture *> atlas_pointers;
+// atlases released by delete_allocated_images while images still reference them
+static unordered_set<AtlasTexture *> orphaned_atlases;
+
+static AtlasTexture * add_atlas_ref(AtlasTexture * atlas)
+{
+  if (atlas)
+    atlas->refCount++;
+  return atlas;
+}
+
+static void release_atlas(AtlasTexture * atlas)
+{
+  if (!atlas || --atlas->refCount > 0)
+    return;
+  flush_batch_if_uses(&atlas->tex);
+  rebind_shader_textures(&atlas->tex, nullptr);
+  atlas_pointers.erase(atlas);
+  orphaned_atlases.erase(atlas);
+  delete atlas;
+}
 
-  ~Image()
+
+int ImageAtlas::getWidth() const
+{
+  return atlas ? atlas->width : 0;
+}
+
+int ImageAtlas::getHeight() const
+{
+  return atlas ? atlas->height : 0;
+}
+
+ImageAtlas::ImageAtlas(const ImageAtlas & b)
+{
+  atlas = add_atlas_ref(b.atlas);
+}
+
+ImageAtlas& ImageAtlas::operator=(const ImageAtlas & b)
+{
+  AtlasTexture * prev = atlas;
+  atlas = add_atlas_ref(b.atlas);
+  release_atlas(prev);
+  return *this;
+}
+
+ImageAtlas& ImageAtlas::operator=(ImageAtlas && b)
+{
+  if (this != &b)
   {
-    image_pointers.erase(img);
-    texture_pointers.erase(tex);
-    delete img;
-    img = nullptr;
-    delete tex;
+    release_atlas(atlas);
+    atlas = b.atlas;
+    b.atlas = nullptr;
+  }
+  return *this;
+}
+
+ImageAtlas::~ImageAtlas()
+{
+  release_atlas(atlas);
+  atlas = nullptr;
+}
+
+
+//----- image -----
+
+const sf::Texture * Image::getTexture() const
+{
+  return atlas ? &atlas->tex : tex;
+}
+
+Image& Image::operator=(Image && b)
+{
+  if (this != &b)
+  {
+    release();
+    moveFrom(b);
+  }
+  return *this;
+}
+
+// copy always gets its own texture, so modifying it will not change the atlas region of the source
+// pixel functions work with 'img', the content of a render image is only in its texture
+static void read_back_render_image(const Image & image)
+{
+  Image & b = const_cast<Image &>(image);
+  if (!b.target || !b.targetDrawn)
+    return;
+  b.targetDrawn = false;
+  if (g_render_target == b.target)
+  {
+    flush_batch();
+    b.target->display();
+  }
+  *b.img = b.target->getTexture().copyToImage();
+  b.cached_pixels = (uint32_t *)b.img->getPixelsPtr();
+}
+
+void Image::copyFrom(const Image & b)
+{
+  read_back_render_image(b);
+  img = b.img ? new sf::Image(*b.img) : nullptr;
+  if (b.tex)
+    tex = new sf::Texture(*b.tex);
+  else if (b.atlas && img)
+  {
+    tex = new sf::Texture();
+    tex->setSmooth(b.atlas->tex.isSmooth());
+    tex->loadFromImage(*img);
+    add_texture_upload(b.width, b.height);
+  }
+  else
     tex = nullptr;
+  if (tex && mipmapped_images.count(b.img) && !b.atlas)
+  {
+    mipmapped_images.insert(img);
+    tex->generateMipmap();
+  }
+  target = nullptr;
+  atlas = nullptr;
+  cached_pixels = img ? (uint32_t *)img->getPixelsPtr() : nullptr;
+  width = b.width;
+  height = b.height;
+  atlasX = 0;
+  atlasY = 0;
+  targetDrawn = false;
+  if (b.target && b.applied)
+  {
+    // the texture is copied with the rendered content, it already matches 'img'
+    applied = true;
+    resetDirtyRect();
+  }
+  else
+  {
     applied = false;
-    cached_pixels = nullptr;
-    width = 0;
-    height = 0;
+    dirtyLeft = 0;
+    dirtyTop = 0;
+    dirtyRight = width;
+    dirtyBottom = height;
   }
-};
+  image_pointers.insert(img);
+  texture_pointers.insert(tex);
+}
+
+void Image::releaseTexture()
+{
+  flush_batch_if_uses(getTexture());
+  release_streaming_textures(*this);
+  if (tex)
+    rebind_shader_textures(tex, nullptr);
+  if (target)
+  {
+    if (g_render_target == target)
+      restore_screen_render_target();
+    render_target_pointers.erase(target);
+    delete target;
+    target = nullptr;
+  }
+  else
+  {
+    texture_pointers.erase(tex);
+    delete tex;
+  }
+  tex = nullptr;
+  release_atlas(atlas);
+  atlas = nullptr;
+  atlasX = 0;
+  atlasY = 0;
+}
+
+void Image::release()
+{
+  releaseTexture();
+  image_pointers.erase(img);
+  mipmapped_images.erase(img);
+  delete img;
+  img = nullptr;
+  applied = false;
+  targetDrawn = false;
+  resetDirtyRect();
+  cached_pixels = nullptr;
+  width = 0;
+  height = 0;
+}
 
 
 void delete_image(Image * image)
 {
-  image_pointers.erase(image->img);
-  texture_pointers.erase(image->tex);
-  delete image->img;
-  image->img = nullptr;
-  delete image->tex;
-  image->tex = nullptr;
-  image->cached_pixels = nullptr;
-  image->width = 0;
-  image->height = 0;
-  image->applied = false;
+  image->release();
 }
 
 Image create_image_wh(int width, int height)
@@ -560,6 +1338,7 @@ Image create_image_wh(int width, int height)
 
   b.tex = new sf::Texture();
   b.tex->loadFromImage(*b.img);
+  add_texture_upload(b.width, b.height);
 
   image_pointers.insert(b.img);
   texture_pointers.insert(b.tex);
@@ -578,11 +1357,7 @@ Image create_image(int width, int height, const das::TArray<uint32_t> & pixels)
   b.img->create(width, height);
   uint32_t *data = (uint32_t *)b.img->getPixelsPtr();
   int size = std::min(width * height, int(pixels.size));
-  for (int i = 0; i < size; i++)
-  {
-    uint32_t c = pixels[i];
-    data[i] = SWAP_RB(c);
-  }
+  swap_rb_copy(data, (const uint32_t *)pixels.data, size);
 
   b.cached_pixels = (uint32_t *)b.img->getPixelsPtr();
   b.width = width;
@@ -590,42 +1365,23 @@ Image create_image(int width, int height, const das::TArray<uint32_t> & pixels)
 
   b.tex = new sf::Texture();
   b.tex->loadFromImage(*b.img);
+  add_texture_upload(b.width, b.height);
   texture_pointers.insert(b.tex);
 
   return b;
 }
 
-Image create_image_from_file(const char * file_name)
+static Image create_image_from_loaded(sf::Image * img)
 {
-  if (!file_name || !*file_name)
-  {
-    print_error("Cannot open image. File name is empty.");
-    return Image();
-  }
-
-  if (!fs::is_path_string_valid(file_name))
-  {
-    print_error("Cannot open image '%s'. Absolute paths or access to the parent directory is prohibited.", file_name);
-    return Image();
-  }
-
   Image b;
-  b.img = new sf::Image();
-  if (!b.img->loadFromFile(file_name))
-  {
-    fetch_cerr();
-    //print_error("Cannot create image from file '%s'", file_name);
-    delete b.img;
-    b.img = nullptr;
-    return Image();
-  }
-
+  b.img = img;
   b.cached_pixels = (uint32_t *)b.img->getPixelsPtr();
   b.width = b.img->getSize().x;
   b.height = b.img->getSize().y;
 
   b.tex = new sf::Texture();
   b.tex->loadFromImage(*b.img);
+  add_texture_upload(b.width, b.height);
 
   image_pointers.insert(b.img);
   texture_pointers.insert(b.tex);
@@ -633,339 +1389,1917 @@ Image create_image_from_file(const char * file_name)
   return b;
 }
 
-void get_image_data(const Image & b, das::TArray<uint32_t> & out_pixels)
-{
-  if (!b.img)
-    return;
 
-  uint32_t count = b.width * b.height;
-  if (count > out_pixels.size)
-    count = out_pixels.size;
+//----- image memory cache -----
 
-  if (count && b.cached_pixels)
-  {
-    int size = std::min(b.width * b.height, int(out_pixels.size));
-    for (int i = 0; i < size; i++)
-    {
-      uint32_t c = b.cached_pixels[i];
-      out_pixels.data[i] = SWAP_RB(c);
-    }
-  }
-}
+// Decoded images are kept between script reloads, so unchanged files are not decoded again.
+// Entries not requested during the whole run of the script are dropped on the next reload. Main thread only.
 
-void set_image_data(Image & b, const das::TArray<uint32_t> & pixels)
+#define IMAGE_MEMORY_CACHE_LIMIT (size_t(256) << 20)
+
+struct ImageMemoryCacheEntry
 {
-  if (!b.img)
-    return;
+  sf::Image image;
+  uint64_t fileTime = 0;
+  uint64_t fileSize = 0;
+  int generation = 0;
+};
 
-  b.applied = false;
-  uint32_t count = b.width * b.height;
-  if (count > pixels.size)
-    count = pixels.size;
+static unordered_map<string, ImageMemoryCacheEntry> image_memory_cache;
+static size_t image_memory_cache_size = 0;
+static int image_memory_cache_generation = 0;
 
-  if (count && b.cached_pixels)
-  {
-    int size = std::min(b.width * b.height, int(pixels.size));
-    for (int i = 0; i < size; i++)
-    {
-      uint32_t c = pixels[i];
-      b.cached_pixels[i] = SWAP_RB(c);
-    }
-  }
+static size_t get_image_memory_size(const sf::Image & image)
+{
+  return size_t(image.getSize().x) * image.getSize().y * 4;
 }
 
-void set_image_pixel(Image & b, int x, int y, uint32_t color)
+// the key depends on the current directory
+static string get_image_memory_cache_key(const char * file_name)
 {
-  if (x >= 0 && y >= 0 && x < b.width && y < b.height && b.cached_pixels)
-  {
-    b.applied = false;
-    b.cached_pixels[y * b.width + x] = SWAP_RB(color);
-  }
+  return fs::combine_path(fs::get_current_dir(), file_name);
 }
 
-uint32_t get_image_pixel(const Image & b, int x, int y)
+static void erase_cached_image(unordered_map<string, ImageMemoryCacheEntry>::iterator it)
 {
-  if (x >= 0 && y >= 0 && x < b.width && y < b.height && b.cached_pixels)
-  {
-    uint32_t c = b.cached_pixels[y * b.width + x];
-    return SWAP_RB(c);
-  }
-  else
-    return 0;
+  image_memory_cache_size -= get_image_memory_size(it->second.image);
+  image_memory_cache.erase(it);
 }
 
-void premultiply_alpha(Image & image)
+static const sf::Image * find_cached_image(const string & key, const char * file_name)
 {
-  if (!image.cached_pixels)
-    return;
+  auto it = image_memory_cache.find(key);
+  if (it == image_memory_cache.end())
+    return nullptr;
 
-  image.applied = false;
-  int count = image.width * image.height;
-  for (int i = 0; i < count; i++)
+  if (it->second.fileTime != fs::get_file_time(file_name) || it->second.fileSize != fs::get_file_size(file_name))
   {
-    uint32_t p = image.cached_pixels[i];
-    uint32_t a = (p >> 24) & 0xFFU;
-    uint32_t b = (((p >> 0) & 0xFFU) * a) / 255U;
-    uint32_t g = (((p >> 8) & 0xFFU) * a) / 255U;
-    uint32_t r = (((p >> 16) & 0xFFU) * a) / 255U;
-    image.cached_pixels[i] = (a << 24) | (r << 16) | (g << 8) | (b);
+    erase_cached_image(it);
+    return nullptr;
   }
+
+  it->second.generation = image_memory_cache_generation;
+  return &it->second.image;
 }
 
-void make_image_color_transparent(Image & image, uint32_t color)
+static void evict_cached_images(int older_than_generation, size_t need_size)
 {
-  if (!image.cached_pixels)
-    return;
-
-  color = color & 0x00FFFFFF;
-  color = SWAP_RB(color);
-  image.applied = false;
-  int count = image.width * image.height;
-  for (int i = 0; i < count; i++)
+  for (auto it = image_memory_cache.begin(); it != image_memory_cache.end();)
   {
-    uint32_t p = image.cached_pixels[i];
-    if ((p & 0x00FFFFFF) == color)
-      p &= 0x00FFFFFF;
-    else
-      p |= 0xFF000000;
-    image.cached_pixels[i] = p;
+    if (image_memory_cache_size + need_size <= IMAGE_MEMORY_CACHE_LIMIT && need_size)
+      break;
+    auto cur = it++;
+    if (cur->second.generation < older_than_generation)
+      erase_cached_image(cur);
   }
 }
 
-void set_image_smooth(Image & image, bool smooth)
+static void add_cached_image(const string & key, const char * file_name, const sf::Image & image)
 {
-  if (image.tex)
-    image.tex->setSmooth(smooth);
-}
+  size_t size = get_image_memory_size(image);
+  if (image_memory_cache_size + size > IMAGE_MEMORY_CACHE_LIMIT)
+    evict_cached_images(image_memory_cache_generation, size);
+  if (image_memory_cache_size + size > IMAGE_MEMORY_CACHE_LIMIT)
+    return;
 
-void set_image_clamp(Image & image, bool clamp)
-{
-  if (image.tex)
-    image.tex->setRepeated(!clamp);
+  auto it = image_memory_cache.find(key);
+  if (it != image_memory_cache.end())
+    erase_cached_image(it);
+
+  ImageMemoryCacheEntry & e = image_memory_cache[key];
+  e.image = image;
+  e.fileTime = fs::get_file_time(file_name);
+  e.fileSize = fs::get_file_size(file_name);
+  e.generation = image_memory_cache_generation;
+  image_memory_cache_size += size;
 }
 
-void flip_image_x(Image & image)
+// called on script reload
+static void on_image_memory_cache_generation_end()
 {
-  image.applied = false;
-  if (image.img)
-    image.img->flipHorizontally();
+  evict_cached_images(image_memory_cache_generation, 0);
+  image_memory_cache_generation++;
 }
 
-void flip_image_y(Image & image)
+
+// thread safe, images from the mounted pak are decoded from the memory mapping
+static bool load_image_data(sf::Image & img, const char * file_name)
 {
-  image.applied = false;
-  if (image.img)
-    image.img->flipVertically();
+  const uint8_t * data = nullptr;
+  uint64_t size = 0;
+  if (fs::find_pak_file(file_name, data, size))
+    return img.loadFromMemory(data, size_t(size));
+  return img.loadFromFile(file_name);
 }
 
-inline void apply_texture(const Image & image)
+Image create_image_from_file(const char * file_name)
 {
-  Image * b = (Image *)&image;
-  b->applied = true;
-  if (b->img->getSize() == b->tex->getSize())
-    b->tex->update(*b->img);
-  else
+  if (!file_name || !*file_name)
   {
-    bool repeat = b->tex->isRepeated();
-    bool smooth = b->tex->isSmooth();
-    texture_pointers.erase(b->tex);
-    delete b->tex;
-    b->tex = new sf::Texture();
-    texture_pointers.insert(b->tex);
-    b->tex->setRepeated(repeat);
-    b->tex->setSmooth(smooth);
-    b->tex->loadFromImage(*b->img);
+    print_error("Cannot open image. File name is empty.");
+    return Image();
   }
-}
 
+  if (!fs::is_path_string_valid(file_name))
+  {
+    print_error("Cannot open image '%s'. Absolute paths or access to the parent directory is prohibited.", file_name);
+    return Image();
+  }
 
-void draw_image_cs2(const Image & image, float x, float y, uint32_t color, das::float2 size)
-{
-  if (!image.tex)
-    return;
-  if (!image.applied)
-    apply_texture(image);
-  sf::Color c = conv_color(color);
-  sf::VertexArray v(sf::TriangleStrip, 4);
-  v[0].position = sf::Vector2f(x, y);
-  v[0].color = c;
-  v[0].texCoords = sf::Vector2f(0, 0);
-  v[1].position = sf::Vector2f(x, y + size.y);
-  v[1].color = c;
-  v[1].texCoords = sf::Vector2f(0, (float)image.height);
-  v[2].position = sf::Vector2f(x + size.x, y);
-  v[2].color = c;
-  v[2].texCoords = sf::Vector2f((float)image.width, 0);
-  v[3].position = sf::Vector2f(x + size.x, y + size.y);
-  v[3].color = c;
-  v[3].texCoords = sf::Vector2f((float)image.width, (float)image.height);
+  string memoryCacheKey = get_image_memory_cache_key(file_name);
+  if (const sf::Image * cached = find_cached_image(memoryCacheKey, file_name))
+    return create_image_from_loaded(new sf::Image(*cached));
 
-  sf::RenderStates states = primitive_rs;
-  states.texture = image.tex;
-  if (g_render_target)
-    g_render_target->draw(v, states);
-}
+  sf::Image * img = new sf::Image();
+  if (!load_image_data(*img, file_name))
+  {
+    fetch_cerr();
+    //print_error("Cannot create image from file '%s'", file_name);
+    delete img;
+    return Image();
+  }
 
-void draw_image(const Image & image, float x, float y)
-{
-  draw_image_cs2(image, x, y, 0xFFFFFFFF, das::float2(image.width, image.height));
+  add_cached_image(memoryCacheKey, file_name, *img);
+  return create_image_from_loaded(img);
 }
 
-void draw_image_c(const Image & image, float x, float y, uint32_t color)
-{
+
+//----- async loading -----
+
+// Worker threads don't use the SFML loaders, they report errors to sf::err() which is redirected to the log
+// on the main thread. Files are read to memory and decoded by stb_image, errors go to the result of the job.
+
+static bool read_file_bytes(const string & path, vector<uint8_t> & bytes)
+{
+  FILE * f = fopen(path.c_str(), "rb");
+  if (!f)
+    return false;
+  fseek(f, 0, SEEK_END);
+  long size = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  bool ok = size >= 0;
+  if (ok)
+  {
+    bytes.resize(size_t(size));
+    ok = !size || fread(bytes.data(), size_t(size), 1, f) == 1;
+  }
+  fclose(f);
+  return ok;
+}
+
+// 'path' - see fs::get_worker_file_path
+static bool decode_image_file(sf::Image & img, const string & path, string & error)
+{
+  const uint8_t * data = nullptr;
+  uint64_t size = 0;
+  vector<uint8_t> bytes;
+  if (!fs::find_pak_file(path.c_str(), data, size))
+  {
+    if (!read_file_bytes(path, bytes))
+    {
+      error = "cannot read file";
+      return false;
+    }
+    data = bytes.data();
+    size = bytes.size();
+  }
+
+  int w = 0;
+  int h = 0;
+  int channels = 0;
+  uint8_t * pixels = size && size < uint64_t(INT_MAX) ?
+    stbi_load_from_memory(data, int(size), &w, &h, &channels, STBI_rgb_alpha) : nullptr;
+  if (!pixels)
+  {
+    error = "unsupported or corrupted image data";
+    return false;
+  }
+  img.create(unsigned(w), unsigned(h), pixels);
+  stbi_image_free(pixels);
+  return true;
+}
+
+static bool save_png_file(const sf::Image & img, const string & path)
+{
+  int w = int(img.getSize().x);
+  int h = int(img.getSize().y);
+  return w > 0 && h > 0 && stbi_write_png(path.c_str(), w, h, 4, img.getPixelsPtr(), w * 4) != 0;
+}
+
+struct AsyncImageLoad
+{
+  string fileName;
+  string filePath; // resolved on the main thread
+  string memoryCacheKey; // thumbnails are cached under the name of the thumbnail file
+  bool inMemoryCache = false; // nothing to decode, image is taken from the memory cache (thumbnails copy it at once)
+  sf::Image * img = nullptr; // decoded on worker thread, owned by this struct until taken
+  string error;
+  jobs::Completion done;
+
+  ~AsyncImageLoad()
+  {
+    delete img;
+  }
+};
+
+static unordered_map<int, shared_ptr<AsyncImageLoad>> async_image_loads;
+static int async_image_last_handle = 0;
+
+int load_image_async(const char * file_name)
+{
+  if (!file_name || !*file_name)
+  {
+    print_error("Cannot open image. File name is empty.");
+    return 0;
+  }
+
+  if (!fs::is_path_string_valid(file_name))
+  {
+    print_error("Cannot open image '%s'. Absolute paths or access to the parent directory is prohibited.", file_name);
+    return 0;
+  }
+
+  shared_ptr<AsyncImageLoad> load = make_shared<AsyncImageLoad>();
+  load->fileName = file_name;
+  load->filePath = fs::get_worker_file_path(file_name);
+  load->memoryCacheKey = get_image_memory_cache_key(file_name);
+  int handle = ++async_image_last_handle;
+  async_image_loads[handle] = load;
+
+  if (find_cached_image(load->memoryCacheKey, file_name))
+  {
+    load->inMemoryCache = true;
+    load->done.set();
+    return handle;
+  }
+
+  jobs::add_job([load]()
+  {
+    sf::Image * img = new sf::Image();
+    if (decode_image_file(*img, load->filePath, load->error))
+      load->img = img;
+    else
+      delete img;
+    load->done.set();
+  });
+
+  return handle;
+}
+
+// files are decoded in parallel by the worker threads, textures are created in the order of names
+void create_images_from_files(das::TArray<Image> & images, const das::TArray<char *> & file_names,
+  das::Context * context, das::LineInfoArg * at)
+{
+  if (images.size)
+    context->throw_error_at(*at, "create_images_from_files: array of images must be empty");
+
+  vector<int> handles(file_names.size);
+  for (uint32_t i = 0; i < file_names.size; i++)
+    handles[i] = load_image_async(file_names[i]);
+
+  das::array_resize(*context, images, file_names.size, sizeof(Image), true, at);
+  for (uint32_t i = 0; i < file_names.size; i++)
+    if (handles[i])
+      images[i] = take_loaded_image(handles[i]);
+}
+
+
+bool is_image_loaded(int handle)
+{
+  auto it = async_image_loads.find(handle);
+  return it != async_image_loads.end() && it->second->done.isSet();
+}
+
+// texture is created here, on the main thread
+Image take_loaded_image(int handle)
+{
+  auto it = async_image_loads.find(handle);
+  if (it == async_image_loads.end())
+  {
+    print_error("take_loaded_image: invalid handle %d", handle);
+    return Image();
+  }
+
+  shared_ptr<AsyncImageLoad> load = it->second;
+  async_image_loads.erase(it);
+  load->done.wait();
+
+  if (load->inMemoryCache && !load->img)
+  {
+    if (const sf::Image * cached = find_cached_image(load->memoryCacheKey, load->fileName.c_str()))
+      return create_image_from_loaded(new sf::Image(*cached));
+    return create_image_from_file(load->fileName.c_str()); // file was changed after load_image_async
+  }
+
+  sf::Image * img = load->img;
+  load->img = nullptr;
+  if (!img)
+  {
+    print_error("Cannot create image from file '%s', %s", load->fileName.c_str(), load->error.c_str());
+    return Image();
+  }
+
+  if (!load->inMemoryCache)
+    add_cached_image(load->memoryCacheKey, load->fileName.c_str(), *img);
+  return create_image_from_loaded(img);
+}
+
+
+//----- thumbnails -----
+
+#define THUMBNAIL_DISK_CACHE_LIMIT (uint64_t(256) << 20) // the oldest files are deleted above this size
+
+// every pixel of 'dst' is the average of the source area it covers
+static void downscale_image(const sf::Image & src, sf::Image & dst, int width, int height)
+{
+  int sw = int(src.getSize().x);
+  int sh = int(src.getSize().y);
+  const uint8_t * s = src.getPixelsPtr();
+  vector<uint8_t> pixels(width * height * 4);
+  for (int y = 0; y < height; y++)
+  {
+    int y0 = y * sh / height;
+    int y1 = std::max((y + 1) * sh / height, y0 + 1);
+    for (int x = 0; x < width; x++)
+    {
+      int x0 = x * sw / width;
+      int x1 = std::max((x + 1) * sw / width, x0 + 1);
+      uint32_t sum[4] = { 0, 0, 0, 0 };
+      for (int sy = y0; sy < y1; sy++)
+        for (int sx = x0; sx < x1; sx++)
+          for (int c = 0; c < 4; c++)
+            sum[c] += s[(sy * sw + sx) * 4 + c];
+      uint32_t count = uint32_t((y1 - y0) * (x1 - x0));
+      for (int c = 0; c < 4; c++)
+        pixels[(y * width + x) * 4 + c] = uint8_t((sum[c] + count / 2) / count);
+    }
+  }
+  dst.create(width, height, pixels.data());
+}
+
+static string get_thumbnail_file_name(const char * file_name, int max_width, int max_height)
+{
+  // path, time and size of the source select the thumbnail, changed files get a new one
+  string path = fs::combine_path(fs::get_current_dir(), file_name);
+  char params[96];
+  snprintf(params, sizeof(params), "|%llu|%llu|%d|%d", (unsigned long long)fs::get_file_time(file_name),
+    (unsigned long long)fs::get_file_size(file_name), max_width, max_height);
+  path += params;
+  uint64_t hash = 14695981039346656037ull;
+  for (const char * c = path.c_str(); *c; c++)
+    hash = (hash ^ uint8_t(*c == '\\' ? '/' : *c)) * 1099511628211ull;
+
+  char name[32];
+  snprintf(name, sizeof(name), "%016llx.png", (unsigned long long)hash);
+  return fs::combine_path(fs::combine_path(initial_dir, ".dasbox_thumbnails"), name);
+}
+
+// the image is downscaled to fit into max_width x max_height once and stored in '.dasbox_thumbnails'
+// of the initial directory, next loads decode the small file
+int load_thumbnail_async(const char * file_name, int max_width, int max_height)
+{
+  if (!file_name || !*file_name)
+  {
+    print_error("Cannot open image. File name is empty.");
+    return 0;
+  }
+
+  if (!fs::is_path_string_valid(file_name))
+  {
+    print_error("Cannot open image '%s'. Absolute paths or access to the parent directory is prohibited.", file_name);
+    return 0;
+  }
+
+  shared_ptr<AsyncImageLoad> load = make_shared<AsyncImageLoad>();
+  load->fileName = file_name;
+  load->filePath = fs::get_worker_file_path(file_name);
+  int handle = ++async_image_last_handle;
+  async_image_loads[handle] = load;
+
+  string thumbnailName = get_thumbnail_file_name(file_name, max_width, max_height);
+  load->memoryCacheKey = thumbnailName;
+  if (const sf::Image * cached = find_cached_image(load->memoryCacheKey, file_name))
+  {
+    load->inMemoryCache = true;
+    load->img = new sf::Image(*cached);
+    load->done.set();
+    return handle;
+  }
+
+  max_width = std::max(max_width, 1);
+  max_height = std::max(max_height, 1);
+  jobs::add_job([load, thumbnailName, max_width, max_height]()
+  {
+    sf::Image * img = new sf::Image();
+    string thumbnailError;
+    if (decode_image_file(*img, thumbnailName, thumbnailError))
+      load->img = img;
+    else if (decode_image_file(*img, load->filePath, load->error))
+    {
+      int w = int(img->getSize().x);
+      int h = int(img->getSize().y);
+      if (w > max_width || h > max_height)
+      {
+        float scale = std::min(float(max_width) / w, float(max_height) / h);
+        sf::Image * small = new sf::Image();
+        downscale_image(*img, *small, std::max(int(w * scale), 1), std::max(int(h * scale), 1));
+        delete img;
+        img = small;
+      }
+
+      // smaller images are cheaper to decode from their own file
+      if (w >= max_width || h >= max_height)
+      {
+        // written under a temporary name, so other instances never read a partial file
+        string thumbnailDir = fs::extract_dir(thumbnailName);
+        string tmpName = fs::get_unique_temp_name(thumbnailName);
+        fs::make_dir(thumbnailDir.c_str());
+        if (!save_png_file(*img, tmpName) || !fs::replace_file(tmpName.c_str(), thumbnailName.c_str()))
+          remove(tmpName.c_str());
+        fs::trim_dir_files(thumbnailDir.c_str(), THUMBNAIL_DISK_CACHE_LIMIT);
+      }
+      load->img = img;
+    }
+    else
+      delete img;
+    load->done.set();
+  });
+
+  return handle;
+}
+
+
+void get_image_data(const Image & b, das::TArray<uint32_t> & out_pixels)
+{
+  if (!b.img)
+    return;
+  read_back_render_image(b);
+
+  uint32_t count = b.width * b.height;
+  if (count > out_pixels.size)
+    count = out_pixels.size;
+
+  if (count && b.cached_pixels)
+  {
+    int size = std::min(b.width * b.height, int(out_pixels.size));
+    swap_rb_copy((uint32_t *)out_pixels.data, b.cached_pixels, size);
+  }
+}
+
+void set_image_data(Image & b, const das::TArray<uint32_t> & pixels)
+{
+  if (!b.img)
+    return;
+  read_back_render_image(b); // the array can be shorter than the image
+
+  b.invalidate();
+  uint32_t count = b.width * b.height;
+  if (count > pixels.size)
+    count = pixels.size;
+
+  if (count && b.cached_pixels)
+  {
+    int size = std::min(b.width * b.height, int(pixels.size));
+    swap_rb_copy(b.cached_pixels, (const uint32_t *)pixels.data, size);
+  }
+}
+
+void set_image_pixel(Image & b, int x, int y, uint32_t color)
+{
+  if (x >= 0 && y >= 0 && x < b.width && y < b.height && b.cached_pixels)
+  {
+    read_back_render_image(b);
+    b.invalidateRect(x, y, 1, 1);
+    b.cached_pixels[y * b.width + x] = SWAP_RB(color);
+  }
+}
+
+uint32_t get_image_pixel(const Image & b, int x, int y)
+{
+  if (x >= 0 && y >= 0 && x < b.width && y < b.height && b.cached_pixels)
+  {
+    read_back_render_image(b);
+    uint32_t c = b.cached_pixels[y * b.width + x];
+    return SWAP_RB(c);
+  }
+  else
+    return 0;
+}
+
+// pixels are passed without copy, so they are in 0xAABBGGRR format
+void with_image_pixels(Image & image, const das::TBlock<void, das::TTemporary<das::TArray<uint32_t>>> & block,
+  das::Context * context, das::LineInfoArg * at)
+{
+  read_back_render_image(image);
+  das::TArray<uint32_t> arr;
+  arr.data = (char *)image.cached_pixels;
+  arr.size = arr.capacity = image.cached_pixels ? uint32_t(image.width * image.height) : 0;
+  arr.lock = 1;
+  arr.flags = 0;
+  das::das_invoke<void>::invoke<das::TArray<uint32_t> &>(context, at, block, arr);
+  if (image.cached_pixels)
+    image.invalidate();
+}
+
+// memory of the array is valid until the end of the frame, so it can be passed to the draw functions
+template <typename T>
+static void with_frame_array(int count, const das::TBlock<void, das::TTemporary<das::TArray<T>>> & block,
+  das::Context * context, das::LineInfoArg * at)
+{
+  if (count < 0)
+    context->throw_error_at(*at, "with_frame_array: negative count %d", count);
+  T * data = (T *)arena::frame_alloc(sizeof(T) * size_t(count));
+  if (!data)
+    context->throw_error_at(*at, "with_frame_array: frame arena is full, %d elements requested", count);
+  memset(data, 0, sizeof(T) * size_t(count));
+
+  das::TArray<T> arr;
+  arr.data = (char *)data;
+  arr.size = arr.capacity = uint32_t(count);
+  arr.lock = 1;
+  arr.flags = 0;
+  das::das_invoke<void>::invoke<das::TArray<T> &>(context, at, block, arr);
+}
+
+void with_frame_float2_array(int count, const das::TBlock<void, das::TTemporary<das::TArray<das::float2>>> & block,
+  das::Context * context, das::LineInfoArg * at)
+{
+  with_frame_array<das::float2>(count, block, context, at);
+}
+
+void with_frame_float_array(int count, const das::TBlock<void, das::TTemporary<das::TArray<float>>> & block,
+  das::Context * context, das::LineInfoArg * at)
+{
+  with_frame_array<float>(count, block, context, at);
+}
+
+void with_frame_uint_array(int count, const das::TBlock<void, das::TTemporary<das::TArray<uint32_t>>> & block,
+  das::Context * context, das::LineInfoArg * at)
+{
+  with_frame_array<uint32_t>(count, block, context, at);
+}
+
+void with_frame_int_array(int count, const das::TBlock<void, das::TTemporary<das::TArray<int>>> & block,
+  das::Context * context, das::LineInfoArg * at)
+{
+  with_frame_array<int>(count, block, context, at);
+}
+
+void premultiply_alpha(Image & image)
+{
+  if (!image.cached_pixels)
+    return;
+
+  read_back_render_image(image);
+  image.invalidate();
+  premultiply_alpha_pixels(image.cached_pixels, image.width * image.height);
+}
+
+void make_image_color_transparent(Image & image, uint32_t color)
+{
+  if (!image.cached_pixels)
+    return;
+
+  color = color & 0x00FFFFFF;
+  color = SWAP_RB(color);
+  read_back_render_image(image);
+  image.invalidate();
+  make_color_transparent_pixels(image.cached_pixels, image.width * image.height, color);
+}
+
+void set_image_smooth(Image & image, bool smooth)
+{
+  if (image.atlas)
+  {
+    print_error("set_image_smooth: image is in atlas, use set_atlas_smooth");
+    return;
+  }
+  flush_batch_if_uses(image.getTexture());
+  if (image.tex)
+    image.tex->setSmooth(smooth);
+  set_streaming_texture_params(image, smooth ? 1 : 0, -1);
+}
+
+// filter is shared by all images in the atlas
+void set_atlas_smooth(ImageAtlas & atlas, bool smooth)
+{
+  if (!atlas.atlas)
+    return;
+  flush_batch_if_uses(&atlas.atlas->tex);
+  atlas.atlas->tex.setSmooth(smooth);
+}
+
+void set_image_mipmap(Image & image, bool enable)
+{
+  if (!image.img || !image.tex)
+    return;
+  if (image.atlas || image.target)
+  {
+    print_error("set_image_mipmap: images in atlas and render images cannot have mipmaps");
+    return;
+  }
+
+  flush_batch_if_uses(image.tex);
+  if (enable)
+  {
+    if (image.tex->generateMipmap())
+      mipmapped_images.insert(image.img);
+    else
+      print_error("set_image_mipmap: mipmaps are not supported by the video driver");
+  }
+  else if (mipmapped_images.erase(image.img))
+  {
+    // upload of the whole texture drops its mipmaps
+    image.tex->update((const sf::Uint8 *)image.cached_pixels, image.width, image.height, 0, 0);
+    add_texture_upload(image.width, image.height);
+  }
+}
+
+void set_image_clamp(Image & image, bool clamp)
+{
+  // atlas regions are always clamped
+  flush_batch_if_uses(image.tex);
+  if (image.tex)
+    image.tex->setRepeated(!clamp);
+  set_streaming_texture_params(image, -1, clamp ? 0 : 1);
+}
+
+void flip_image_x(Image & image)
+{
+  image.invalidate();
+  if (image.img)
+    image.img->flipHorizontally();
+}
+
+void flip_image_y(Image & image)
+{
+  image.invalidate();
+  if (image.img)
+    image.img->flipVertically();
+}
+
+static std::vector<uint32_t> dirty_rect_pixels;
+
+
+//----- streaming images -----
+
+// Image changed every frame is uploaded to the next texture of the ring, so the driver doesn't wait
+// for draws of the previous frames that still read the texture. Rings are found by 'img', it stays
+// the same when the image is moved.
+
+#define MAX_STREAMING_BUFFERS 4
+
+struct StreamingTextures
+{
+  sf::Texture * textures[MAX_STREAMING_BUFFERS];
+  int count;
+  int current;
+};
+
+static unordered_map<sf::Image *, StreamingTextures> streaming_textures;
+
+static void release_streaming_textures(Image & image)
+{
+  auto it = image.img ? streaming_textures.find(image.img) : streaming_textures.end();
+  if (it == streaming_textures.end())
+    return;
+
+  for (int i = 0; i < it->second.count; i++)
+  {
+    sf::Texture * t = it->second.textures[i];
+    if (t != image.tex)
+    {
+      flush_batch_if_uses(t);
+      rebind_shader_textures(t, nullptr);
+      texture_pointers.erase(t);
+      delete t;
+    }
+  }
+  streaming_textures.erase(it);
+}
+
+void set_image_streaming(Image & image, int buffer_count)
+{
+  if (!image.img || !image.tex)
+    return;
+  if (image.atlas || image.target)
+  {
+    print_error("set_image_streaming: images in atlas and render images cannot be streamed");
+    return;
+  }
+
+  buffer_count = std::min(std::max(buffer_count, 1), MAX_STREAMING_BUFFERS);
+  release_streaming_textures(image);
+  if (buffer_count == 1)
+    return;
+
+  StreamingTextures & st = streaming_textures[image.img];
+  st.count = buffer_count;
+  st.current = 0;
+  st.textures[0] = image.tex;
+  for (int i = 1; i < buffer_count; i++)
+  {
+    sf::Texture * t = new sf::Texture();
+    t->create(image.width, image.height);
+    t->setSmooth(image.tex->isSmooth());
+    t->setRepeated(image.tex->isRepeated());
+    texture_pointers.insert(t);
+    st.textures[i] = t;
+  }
+}
+
+// whole image is uploaded, because the next texture keeps the content of several frames ago
+static bool apply_streaming_texture(Image * b)
+{
+  auto it = streaming_textures.find(b->img);
+  if (it == streaming_textures.end())
+    return false;
+
+  StreamingTextures & st = it->second;
+  st.current = (st.current + 1) % st.count;
+  rebind_shader_textures(b->tex, st.textures[st.current]);
+  b->tex = st.textures[st.current];
+  flush_batch_if_uses(b->tex);
+  b->resetDirtyRect();
+  b->tex->update((const sf::Uint8 *)b->cached_pixels, b->width, b->height, 0, 0);
+  add_texture_upload(b->width, b->height);
+  return true;
+}
+
+static void set_streaming_texture_params(Image & image, int smooth, int repeated)
+{
+  auto it = image.img ? streaming_textures.find(image.img) : streaming_textures.end();
+  if (it == streaming_textures.end())
+    return;
+
+  for (int i = 0; i < it->second.count; i++)
+  {
+    sf::Texture * t = it->second.textures[i];
+    flush_batch_if_uses(t);
+    if (smooth >= 0)
+      t->setSmooth(smooth != 0);
+    if (repeated >= 0)
+      t->setRepeated(repeated != 0);
+  }
+}
+
+
+// texture of a render target is stored upside down after display(), so changed pixels of a render image are
+// drawn into the target instead of being written to its texture
+static void draw_pixels_to_render_target(sf::RenderTexture * target, const uint32_t * src, int left, int top, int w, int h)
+{
+  if (g_render_target == target)
+    flush_batch();
+
+  sf::Texture pixels;
+  if (!pixels.create(unsigned(w), unsigned(h)))
+    return;
+  pixels.update((const sf::Uint8 *)src);
+
+  sf::View view = target->getView();
+  target->setView(target->getDefaultView());
+  sf::Sprite sprite(pixels);
+  sprite.setPosition(float(left), float(top));
+  target->draw(sprite, sf::RenderStates(sf::BlendNone));
+  target->setView(view);
+  target->display();
+}
+
+inline void apply_texture(const Image & image)
+{
+  Image * b = (Image *)&image;
+  b->applied = true;
+  if (b->tex && !b->atlas && b->img && apply_streaming_texture(b))
+  {
+    if (mipmapped_images.count(b->img))
+      b->tex->generateMipmap();
+    return;
+  }
+
+  flush_batch_if_uses(b->getTexture());
+
+  int left = std::max(b->dirtyLeft, 0);
+  int top = std::max(b->dirtyTop, 0);
+  int w = std::min(b->dirtyRight, b->width) - left;
+  int h = std::min(b->dirtyBottom, b->height) - top;
+  b->resetDirtyRect();
+
+  sf::Texture * tex = b->atlas ? &b->atlas->tex : b->tex;
+  if (b->atlas || b->img->getSize() == tex->getSize())
+  {
+    if (w <= 0 || h <= 0)
+      return;
+
+    // full rows are contiguous in 'cached_pixels', other regions are copied to keep upload size minimal
+    const uint32_t * src = b->cached_pixels + top * b->width + left;
+    if (w != b->width)
+    {
+      dirty_rect_pixels.resize(w * h);
+      for (int y = 0; y < h; y++)
+        memcpy(&dirty_rect_pixels[y * w], src + y * b->width, w * sizeof(uint32_t));
+      src = dirty_rect_pixels.data();
+    }
+    if (b->target)
+      draw_pixels_to_render_target(b->target, src, left, top, w, h);
+    else
+      tex->update((const sf::Uint8 *)src, w, h, b->atlasX + left, b->atlasY + top);
+    add_texture_upload(w, h);
+  }
+  else
+  {
+    bool repeat = b->tex->isRepeated();
+    bool smooth = b->tex->isSmooth();
+    sf::Texture * prev = b->tex;
+    texture_pointers.erase(b->tex);
+    delete b->tex;
+    b->tex = new sf::Texture();
+    texture_pointers.insert(b->tex);
+    rebind_shader_textures(prev, b->tex);
+    b->tex->setRepeated(repeat);
+    b->tex->setSmooth(smooth);
+    b->tex->loadFromImage(*b->img);
+    add_texture_upload(b->width, b->height);
+  }
+
+  if (!b->atlas && mipmapped_images.count(b->img))
+    b->tex->generateMipmap();
+}
+
+
+ImageAtlas create_image_atlas(int width, int height)
+{
+  int maxSize = int(sf::Texture::getMaximumSize());
+  if (width <= 0 || height <= 0 || width > maxSize || height > maxSize)
+  {
+    print_error("Cannot create image atlas %dx%d. Size must be in range 1..%d.", width, height, maxSize);
+    return ImageAtlas();
+  }
+
+  AtlasTexture * atlas = new AtlasTexture(width, height);
+  sf::Image transparent;
+  transparent.create(width, height, sf::Color::Transparent);
+  atlas->tex.loadFromImage(transparent);
+  add_texture_upload(width, height);
+  atlas_pointers.insert(atlas);
+
+  ImageAtlas res;
+  res.atlas = add_atlas_ref(atlas);
+  return res;
+}
+
+bool add_image_to_atlas(ImageAtlas & atlas, Image & image)
+{
+  if (!atlas.atlas || !image.img)
+    return false;
+  if (image.atlas == atlas.atlas)
+    return true;
+
+  int x = 0;
+  int y = 0;
+  if (!atlas.atlas->allocate(image.width + ATLAS_PADDING, image.height + ATLAS_PADDING, x, y))
+    return false;
+
+  image.releaseTexture();
+  image.atlas = add_atlas_ref(atlas.atlas);
+  image.atlasX = x;
+  image.atlasY = y;
+  image.applied = true;
+  image.invalidate();
+  apply_texture(image);
+  return true;
+}
+
+
+// 'p' - quad corners in triangle strip order: left-top, left-bottom, right-top, right-bottom
+static void append_textured_quad(const sf::Texture * tex, const sf::Vector2f * p, const sf::FloatRect & uv, sf::Color c)
+{
+  sf::RenderStates states = primitive_rs;
+  states.texture = tex;
+  sf::Vertex * v = append_to_batch(sf::Triangles, states, 6);
+  v[0] = sf::Vertex(p[0], c, sf::Vector2f(uv.left, uv.top));
+  v[1] = sf::Vertex(p[1], c, sf::Vector2f(uv.left, uv.top + uv.height));
+  v[2] = sf::Vertex(p[2], c, sf::Vector2f(uv.left + uv.width, uv.top));
+  v[3] = v[2];
+  v[4] = v[1];
+  v[5] = sf::Vertex(p[3], c, sf::Vector2f(uv.left + uv.width, uv.top + uv.height));
+}
+
+// 'uv_offset' - position of the image inside the texture (non-zero for atlas regions)
+static void append_textured_strip(const sf::Texture * tex, const das::float2 * coord, const das::float2 * uv,
+  sf::Vector2f uv_offset, const uint32_t * colors, uint32_t color, int count)
+{
+  sf::RenderStates states = primitive_rs;
+  states.texture = tex;
+  sf::Vertex * v = append_to_batch(sf::Triangles, states, (count - 2) * 3);
+
+  sf::Color c = conv_color(color);
+  for (int i = 2; i < count; i++)
+    for (int k = i - 2; k <= i; k++, v++)
+    {
+      v->position = sf::Vector2f(coord[k].x, coord[k].y);
+      v->color = colors ? conv_color(colors[k]) : c;
+      v->texCoords = sf::Vector2f(uv[k].x + uv_offset.x, uv[k].y + uv_offset.y);
+    }
+}
+
+void draw_image_cs2(const Image & image, float x, float y, uint32_t color, das::float2 size)
+{
+  if (!image.tex && !image.atlas)
+    return;
+  if (!image.applied)
+    apply_texture(image);
+  sf::Vector2f p[4] = {
+    sf::Vector2f(x, y),
+    sf::Vector2f(x, y + size.y),
+    sf::Vector2f(x + size.x, y),
+    sf::Vector2f(x + size.x, y + size.y)
+  };
+  if (is_quad_outside_view(p))
+    return;
+  append_textured_quad(image.getTexture(), p, image.getTextureRect(), conv_color(color));
+}
+
+//----- render to image -----
+
+// g_render_target of the enclosing render_to_image blocks, the bottom one is the screen
+static std::vector<sf::RenderTarget *> render_target_stack;
+
+static void restore_screen_render_target()
+{
+  if (render_target_stack.empty())
+    return;
+  flush_batch();
+  g_render_target = render_target_stack.front();
+  render_target_stack.clear();
+}
+
+Image create_render_image(int width, int height)
+{
+  int maxSize = int(sf::Texture::getMaximumSize());
+  if (width <= 0 || height <= 0 || width > maxSize || height > maxSize)
+  {
+    print_error("Cannot create render image %dx%d. Size must be in range 1..%d.", width, height, maxSize);
+    return Image();
+  }
+
+  sf::RenderTexture * target = new sf::RenderTexture();
+  if (!target->create(width, height))
+  {
+    delete target;
+    print_error("Cannot create render image %dx%d", width, height);
+    return Image();
+  }
+  target->clear(sf::Color::Transparent);
+  target->display();
+  render_target_pointers.insert(target);
+
+  Image b;
+  b.img = new sf::Image();
+  b.img->create(width, height, sf::Color::Transparent);
+  image_pointers.insert(b.img);
+  b.cached_pixels = (uint32_t *)b.img->getPixelsPtr();
+  b.width = width;
+  b.height = height;
+  b.target = target;
+  b.tex = const_cast<sf::Texture *>(&target->getTexture());
+  b.applied = true;
+  return b;
+}
+
+// draws of the block go to the image, blocks can be nested
+void render_to_image(Image & image, const das::TBlock<void> & block, das::Context * context, das::LineInfoArg * at)
+{
+  sf::RenderTexture * target = image.target;
+  if (!target)
+  {
+    print_error("render_to_image: image is not created by create_render_image()");
+    return;
+  }
+
+  flush_batch();
+  if (!image.applied)
+    apply_texture(image); // pixel changes go under the new draws
+  image.targetDrawn = true;
+  render_target_stack.push_back(g_render_target);
+  g_render_target = target;
+
+  das::das_invoke<void>::invoke(context, at, block);
+
+  flush_batch();
+  if (render_target_pointers.count(target))
+    target->display();
+  if (!render_target_stack.empty())
+  {
+    g_render_target = render_target_stack.back();
+    render_target_stack.pop_back();
+  }
+}
+
+void clear_render_image(Image & image, uint32_t color)
+{
+  if (!image.target)
+    return;
+  flush_batch_if_uses(image.tex);
+  if (g_render_target == image.target)
+    flush_batch();
+  image.target->clear(conv_color(color));
+  image.target->display();
+  image.applied = true; // pending pixel changes are cleared too
+  image.resetDirtyRect();
+  image.targetDrawn = true;
+}
+
+
+//----- shader -----
+
+struct ShaderData
+{
+  sf::Shader shader;
+  int refCount = 0;
+  vector<pair<string, const sf::Texture *>> textures; // image uniforms, sf::Shader keeps only the pointers
+};
+
+static unordered_set<ShaderData *> shader_pointers;
+static ShaderData * post_effect_shader = nullptr;
+static sf::Texture no_uniform_texture; // bound instead of the deleted textures
+
+// called before the texture is deleted (replacement is nullptr) or when the image switches to another texture
+static void rebind_shader_textures(const sf::Texture * tex, const sf::Texture * replacement)
+{
+  for (ShaderData * data : shader_pointers)
+    for (size_t i = 0; i < data->textures.size(); i++)
+    {
+      auto & uniform = data->textures[i];
+      if (uniform.second != tex)
+        continue;
+      if (batch_rs.shader == &data->shader)
+        flush_batch();
+      data->shader.setUniform(uniform.first, replacement ? *replacement : no_uniform_texture);
+      if (replacement)
+        uniform.second = replacement;
+      else
+      {
+        data->textures.erase(data->textures.begin() + i);
+        i--;
+      }
+    }
+}
+
+static ShaderData * add_shader_ref(ShaderData * shader)
+{
+  if (shader)
+    shader->refCount++;
+  return shader;
+}
+
+static void release_shader(ShaderData * shader)
+{
+  if (!shader || --shader->refCount > 0)
+    return;
+  if (batch_rs.shader == &shader->shader)
+    flush_batch();
+  if (primitive_rs.shader == &shader->shader)
+    primitive_rs.shader = nullptr;
+  shader_pointers.erase(shader);
+  delete shader;
+}
+
+Shader::Shader(const Shader & b)
+{
+  shader = add_shader_ref(b.shader);
+}
+
+Shader& Shader::operator=(const Shader & b)
+{
+  ShaderData * prev = shader;
+  shader = add_shader_ref(b.shader);
+  release_shader(prev);
+  return *this;
+}
+
+Shader& Shader::operator=(Shader && b)
+{
+  if (this != &b)
+  {
+    release_shader(shader);
+    shader = b.shader;
+    b.shader = nullptr;
+  }
+  return *this;
+}
+
+Shader::~Shader()
+{
+  release_shader(shader);
+  shader = nullptr;
+}
+
+// empty vertex source - only the fragment shader is used
+Shader create_shader(const char * vertex_source, const char * fragment_source)
+{
+  if (!sf::Shader::isAvailable())
+  {
+    print_error("Shaders are not supported by the video driver");
+    return Shader();
+  }
+
+  if (!fragment_source || !*fragment_source)
+  {
+    print_error("create_shader: fragment shader source is empty");
+    return Shader();
+  }
+
+  ShaderData * data = new ShaderData();
+  bool ok = (vertex_source && *vertex_source) ?
+    data->shader.loadFromMemory(string(vertex_source), string(fragment_source)) :
+    data->shader.loadFromMemory(string(fragment_source), sf::Shader::Fragment);
+  if (!ok)
+  {
+    delete data;
+    print_error("Cannot compile shader, see the log above");
+    return Shader();
+  }
+
+  shader_pointers.insert(data);
+  Shader res;
+  res.shader = add_shader_ref(data);
+  return res;
+}
+
+// reset at the start of each frame
+void set_shader(const Shader & shader)
+{
+  primitive_rs.shader = shader.shader ? &shader.shader->shader : nullptr;
+}
+
+void reset_shader()
+{
+  primitive_rs.shader = nullptr;
+}
+
+void set_post_effect(const Shader & shader)
+{
+  ShaderData * prev = post_effect_shader;
+  post_effect_shader = add_shader_ref(shader.shader);
+  release_shader(prev);
+}
+
+void reset_post_effect()
+{
+  release_shader(post_effect_shader);
+  post_effect_shader = nullptr;
+}
+
+// uniforms are read when the batch is drawn, so the batch with the previous values is flushed first
+static sf::Shader * prepare_shader_uniform(Shader & shader)
+{
+  if (!shader.shader)
+    return nullptr;
+  if (batch_rs.shader == &shader.shader->shader)
+    flush_batch();
+  return &shader.shader->shader;
+}
+
+void set_shader_uniform_f(Shader & shader, const char * name, float value)
+{
+  if (sf::Shader * s = prepare_shader_uniform(shader))
+    s->setUniform(name ? name : "", value);
+}
+
+void set_shader_uniform_f2(Shader & shader, const char * name, das::float2 value)
+{
+  if (sf::Shader * s = prepare_shader_uniform(shader))
+    s->setUniform(name ? name : "", sf::Glsl::Vec2(value.x, value.y));
+}
+
+void set_shader_uniform_f3(Shader & shader, const char * name, das::float3 value)
+{
+  if (sf::Shader * s = prepare_shader_uniform(shader))
+    s->setUniform(name ? name : "", sf::Glsl::Vec3(value.x, value.y, value.z));
+}
+
+void set_shader_uniform_f4(Shader & shader, const char * name, das::float4 value)
+{
+  if (sf::Shader * s = prepare_shader_uniform(shader))
+    s->setUniform(name ? name : "", sf::Glsl::Vec4(value.x, value.y, value.z, value.w));
+}
+
+void set_shader_uniform_i(Shader & shader, const char * name, int value)
+{
+  if (sf::Shader * s = prepare_shader_uniform(shader))
+    s->setUniform(name ? name : "", value);
+}
+
+// the shader follows the texture of the image until the image is deleted, then the uniform has no texture
+void set_shader_uniform_image(Shader & shader, const char * name, const Image & image)
+{
+  if (!image.tex && !image.atlas)
+    return;
+  if (!image.applied)
+    apply_texture(image);
+  sf::Shader * s = prepare_shader_uniform(shader);
+  if (!s)
+    return;
+
+  string uniformName = name ? name : "";
+  const sf::Texture * tex = image.getTexture();
+  s->setUniform(uniformName, *tex);
+  auto & textures = shader.shader->textures;
+  auto it = std::find_if(textures.begin(), textures.end(),
+    [&](const pair<string, const sf::Texture *> & t) { return t.first == uniformName; });
+  if (it != textures.end())
+    it->second = tex;
+  else
+    textures.emplace_back(uniformName, tex);
+}
+
+// texture of the drawn image, usually 'uniform sampler2D texture;'
+void set_shader_uniform_current_texture(Shader & shader, const char * name)
+{
+  if (sf::Shader * s = prepare_shader_uniform(shader))
+    s->setUniform(name ? name : "", sf::Shader::CurrentTexture);
+}
+
+
+// 'src' - (x, y, width, height) region of the image in pixels, 'origin' - point of the destination rectangle
+// in [0, 1] range that is placed at (x, y), rotation (angle in radians) and scale are around it
+void draw_image_region_t(const Image & image, float x, float y, das::float4 src, uint32_t color, das::float2 size,
+  float angle, das::float2 origin)
+{
+  if (!image.tex && !image.atlas)
+    return;
+  if (!image.applied)
+    apply_texture(image);
+
+  float ox = -origin.x * size.x;
+  float oy = -origin.y * size.y;
+  float corners[4][2] = {
+    { ox, oy },
+    { ox, oy + size.y },
+    { ox + size.x, oy },
+    { ox + size.x, oy + size.y }
+  };
+
+  sf::Vector2f p[4];
+  if (angle != 0.0f)
+  {
+    float s = sinf(angle);
+    float c = cosf(angle);
+    for (int i = 0; i < 4; i++)
+      p[i] = sf::Vector2f(x + corners[i][0] * c - corners[i][1] * s, y + corners[i][0] * s + corners[i][1] * c);
+  }
+  else
+  {
+    for (int i = 0; i < 4; i++)
+      p[i] = sf::Vector2f(x + corners[i][0], y + corners[i][1]);
+  }
+
+  if (is_quad_outside_view(p))
+    return;
+
+  // in atlas the region is limited to the image, so neighbouring images don't show up, negative size still flips
+  if (image.atlas)
+  {
+    float x0 = clamp(src.x, 0.0f, float(image.width));
+    float y0 = clamp(src.y, 0.0f, float(image.height));
+    float x1 = clamp(src.x + src.z, 0.0f, float(image.width));
+    float y1 = clamp(src.y + src.w, 0.0f, float(image.height));
+    src = das::float4(x0, y0, x1 - x0, y1 - y0);
+  }
+  sf::FloatRect uv(float(image.atlasX) + src.x, float(image.atlasY) + src.y, src.z, src.w);
+  append_textured_quad(image.getTexture(), p, uv, conv_color(color));
+}
+
+void draw_image_region_cs(const Image & image, float x, float y, das::float4 src, uint32_t color, das::float2 size)
+{
+  draw_image_region_t(image, x, y, src, color, size, 0.0f, das::float2(0.0f, 0.0f));
+}
+
+void draw_image_region(const Image & image, float x, float y, das::float4 src)
+{
+  draw_image_region_t(image, x, y, src, 0xFFFFFFFF, das::float2(src.z, src.w), 0.0f, das::float2(0.0f, 0.0f));
+}
+
+// 'positions' are centers of the images, missing colors are white and missing scales are 1
+void draw_image_instanced(const Image & image, const das::TArray<das::float2> & positions,
+  const das::TArray<uint32_t> & colors, const das::TArray<float> & scales)
+{
+  if (!image.tex && !image.atlas)
+    return;
+  if (!image.applied)
+    apply_texture(image);
+
+  const das::float2 * pos = (const das::float2 *)positions.data;
+  const uint32_t * c = (const uint32_t *)colors.data;
+  const float * s = (const float *)scales.data;
+  const sf::Texture * tex = image.getTexture();
+  sf::FloatRect uv = image.getTextureRect();
+  float hw = image.width * 0.5f;
+  float hh = image.height * 0.5f;
+  sf::Vector2f p[4];
+  for (int i = 0; i < int(positions.size); i++)
+  {
+    float scale = i < int(scales.size) ? s[i] : 1.0f;
+    float w = hw * scale;
+    float h = hh * scale;
+    p[0] = sf::Vector2f(pos[i].x - w, pos[i].y - h);
+    p[1] = sf::Vector2f(pos[i].x - w, pos[i].y + h);
+    p[2] = sf::Vector2f(pos[i].x + w, pos[i].y - h);
+    p[3] = sf::Vector2f(pos[i].x + w, pos[i].y + h);
+    if (is_outside_view(p[0].x, p[0].y, p[3].x, p[3].y))
+      continue;
+    append_textured_quad(tex, p, uv, i < int(colors.size) ? conv_color(c[i]) : sf::Color::White);
+  }
+}
+
+void draw_image(const Image & image, float x, float y)
+{
+  draw_image_cs2(image, x, y, 0xFFFFFFFF, das::float2(image.width, image.height));
+}
+
+void draw_image_c(const Image & image, float x, float y, uint32_t color)
+{
   draw_image_cs2(image, x, y, color, das::float2(image.width, image.height));
 }
 
-void draw_image_cs(const Image & image, float x, float y, uint32_t color, float size)
+void draw_image_cs(const Image & image, float x, float y, uint32_t color, float size)
+{
+  draw_image_cs2(image, x, y, color, das::float2(size, size));
+}
+
+
+void draw_image_cs2i(const Image & image, int x, int y, uint32_t color, das::int2 size)
+{
+  draw_image_cs2(image, (float)x, (float)y, color, das::float2(size.x, size.y));
+}
+
+void draw_image_i(const Image & image, int x, int y)
+{
+  draw_image_cs2(image, (float)x, (float)y, 0xFFFFFFFF, das::float2(image.width, image.height));
+}
+
+void draw_image_ci(const Image & image, int x, int y, uint32_t color)
+{
+  draw_image_cs2(image, (float)x, (float)y, color, das::float2(image.width, image.height));
+}
+
+void draw_image_csi(const Image & image, int x, int y, uint32_t color, int size)
+{
+  draw_image_cs2(image, (float)x, (float)y, color, das::float2(size, size));
+}
+
+
+
+void draw_quad(const Image & image, das::float2 p0, das::float2 p1, das::float2 p2, das::float2 p3, uint32_t color)
+{
+  if (!image.tex && !image.atlas)
+    return;
+  if (!image.applied)
+    apply_texture(image);
+  sf::Vector2f p[4] = {
+    sf::Vector2f(p0.x, p0.y),
+    sf::Vector2f(p1.x, p1.y),
+    sf::Vector2f(p3.x, p3.y),
+    sf::Vector2f(p2.x, p2.y)
+  };
+  if (is_quad_outside_view(p))
+    return;
+  append_textured_quad(image.getTexture(), p, image.getTextureRect(), conv_color(color));
+}
+
+void draw_quad_a(const Image & image, das::float2 p[4], uint32_t color)
+{
+  draw_quad(image, p[0], p[1], p[2], p[3], color);
+}
+
+void draw_triangle_strip_color(const Image & image,
+  const das::TArray<das::float2> & coord, const das::TArray<das::float2> & uv, uint32_t color)
+{
+  if (!image.tex && !image.atlas)
+    return;
+  if (!image.applied)
+    apply_texture(image);
+  int count = std::min(coord.size, uv.size);
+  if (count < 3)
+    return;
+
+  append_textured_strip(image.getTexture(), (const das::float2 *)coord.data, (const das::float2 *)uv.data,
+    sf::Vector2f((float)image.atlasX, (float)image.atlasY), nullptr, color, count);
+}
+
+void draw_triangle_strip_color_a(const Image & image,
+  const das::TArray<das::float2> & coord, const das::TArray<das::float2> & uv, const das::TArray<uint32_t> & colors)
+{
+  if (!image.tex && !image.atlas)
+    return;
+  if (!image.applied)
+    apply_texture(image);
+  int count = std::min(std::min(coord.size, uv.size), colors.size);
+  if (count < 3)
+    return;
+
+  append_textured_strip(image.getTexture(), (const das::float2 *)coord.data, (const das::float2 *)uv.data,
+    sf::Vector2f((float)image.atlasX, (float)image.atlasY), (const uint32_t *)colors.data, 0, count);
+}
+
+void draw_triangle_strip(const Image & image,
+  const das::TArray<das::float2> & coord, const das::TArray<das::float2> & uv)
+{
+  draw_triangle_strip_color(image, coord, uv, 0xFFFFFFFF);
+}
+
+
+//----- mesh -----
+
+// sf::VertexBuffer keeps the vertices in video memory, 'vertices' is the copy for drivers without VBO support
+struct MeshData
+{
+  sf::VertexBuffer vb;
+  std::vector<sf::Vertex> vertices;
+  sf::PrimitiveType primitive;
+  int vertexCount;
+  int refCount;
+  float boundRadius; // from the mesh origin, for culling
+
+  MeshData(sf::PrimitiveType primitive_, bool dynamic_usage)
+    : vb(primitive_, dynamic_usage ? sf::VertexBuffer::Dynamic : sf::VertexBuffer::Static),
+      primitive(primitive_), vertexCount(0), refCount(0), boundRadius(0.0f)
+  {
+  }
+};
+
+static unordered_set<MeshData *> mesh_pointers;
+
+static MeshData * add_mesh_ref(MeshData * mesh)
+{
+  if (mesh)
+    mesh->refCount++;
+  return mesh;
+}
+
+static void release_mesh(MeshData * mesh)
+{
+  if (!mesh || --mesh->refCount > 0)
+    return;
+  mesh_pointers.erase(mesh);
+  delete mesh;
+}
+
+int Mesh::getVertexCount() const
+{
+  return mesh ? mesh->vertexCount : 0;
+}
+
+Mesh::Mesh(const Mesh & b)
+{
+  mesh = add_mesh_ref(b.mesh);
+}
+
+Mesh& Mesh::operator=(const Mesh & b)
+{
+  MeshData * prev = mesh;
+  mesh = add_mesh_ref(b.mesh);
+  release_mesh(prev);
+  return *this;
+}
+
+Mesh& Mesh::operator=(Mesh && b)
+{
+  if (this != &b)
+  {
+    release_mesh(mesh);
+    mesh = b.mesh;
+    b.mesh = nullptr;
+  }
+  return *this;
+}
+
+Mesh::~Mesh()
+{
+  release_mesh(mesh);
+  mesh = nullptr;
+}
+
+static void upload_mesh(MeshData * mesh, const das::float2 * coord, const das::float2 * uv, const uint32_t * colors,
+  uint32_t color, int count)
+{
+  std::vector<sf::Vertex> & v = mesh->vertices;
+  v.resize(count);
+  float maxDistSq = 0.0f;
+  for (int i = 0; i < count; i++)
+  {
+    maxDistSq = std::max(maxDistSq, coord[i].x * coord[i].x + coord[i].y * coord[i].y);
+    v[i].position = sf::Vector2f(coord[i].x, coord[i].y);
+    v[i].color = conv_color(colors ? colors[i] : color);
+    v[i].texCoords = uv ? sf::Vector2f(uv[i].x, uv[i].y) : sf::Vector2f(0.0f, 0.0f);
+  }
+
+  frame_render_stats.uploadedBytes += int64_t(count) * sizeof(sf::Vertex);
+  mesh->vertexCount = count;
+  mesh->boundRadius = sqrtf(maxDistSq);
+  if (sf::VertexBuffer::isAvailable())
+  {
+    if (int(mesh->vb.getVertexCount()) != count && !mesh->vb.create(count))
+      print_error("Cannot create vertex buffer (%d vertices)", count);
+    else if (count > 0)
+      mesh->vb.update(v.data());
+
+    v.clear();
+    v.shrink_to_fit();
+  }
+}
+
+static Mesh create_mesh_internal(int primitive, const das::float2 * coord, const das::float2 * uv,
+  const uint32_t * colors, uint32_t color, int count, bool dynamic_usage)
+{
+  if (primitive < int(sf::Points) || primitive > int(sf::TriangleFan))
+  {
+    print_error("create_mesh: invalid primitive type %d", primitive);
+    return Mesh();
+  }
+
+  MeshData * mesh = new MeshData(sf::PrimitiveType(primitive), dynamic_usage);
+  mesh_pointers.insert(mesh);
+  upload_mesh(mesh, coord, uv, colors, color, count);
+
+  Mesh res;
+  res.mesh = add_mesh_ref(mesh);
+  return res;
+}
+
+Mesh create_mesh(int primitive, const das::TArray<das::float2> & coord, const das::TArray<uint32_t> & colors,
+  bool dynamic_usage)
+{
+  int count = std::min(coord.size, colors.size);
+  return create_mesh_internal(primitive, (const das::float2 *)coord.data, nullptr, (const uint32_t *)colors.data, 0,
+    count, dynamic_usage);
+}
+
+Mesh create_mesh_c(int primitive, const das::TArray<das::float2> & coord, uint32_t color, bool dynamic_usage)
+{
+  return create_mesh_internal(primitive, (const das::float2 *)coord.data, nullptr, nullptr, color, int(coord.size),
+    dynamic_usage);
+}
+
+Mesh create_mesh_uv(int primitive, const das::TArray<das::float2> & coord, const das::TArray<das::float2> & uv,
+  const das::TArray<uint32_t> & colors, bool dynamic_usage)
+{
+  int count = std::min(std::min(coord.size, uv.size), colors.size);
+  return create_mesh_internal(primitive, (const das::float2 *)coord.data, (const das::float2 *)uv.data,
+    (const uint32_t *)colors.data, 0, count, dynamic_usage);
+}
+
+void update_mesh(Mesh & mesh, const das::TArray<das::float2> & coord, const das::TArray<uint32_t> & colors)
+{
+  if (!mesh.mesh)
+    return;
+  int count = std::min(coord.size, colors.size);
+  upload_mesh(mesh.mesh, (const das::float2 *)coord.data, nullptr, (const uint32_t *)colors.data, 0, count);
+}
+
+void update_mesh_uv(Mesh & mesh, const das::TArray<das::float2> & coord, const das::TArray<das::float2> & uv,
+  const das::TArray<uint32_t> & colors)
+{
+  if (!mesh.mesh)
+    return;
+  int count = std::min(std::min(coord.size, uv.size), colors.size);
+  upload_mesh(mesh.mesh, (const das::float2 *)coord.data, (const das::float2 *)uv.data,
+    (const uint32_t *)colors.data, 0, count);
+}
+
+// angle in radians
+static void draw_mesh_internal(const sf::Texture * tex, const MeshData * mesh, float x, float y, float angle,
+  das::float2 scale)
+{
+  if (!mesh || mesh->vertexCount <= 0 || !g_render_target)
+    return;
+
+  float r = mesh->boundRadius * std::max(fabsf(scale.x), fabsf(scale.y));
+  if (is_outside_view(x - r, y - r, x + r, y + r))
+    return;
+
+  flush_batch();
+
+  sf::RenderStates states = primitive_rs;
+  states.texture = tex;
+  if (view_enabled)
+    states.transform = view_transform;
+  states.transform.translate(x, y);
+  if (angle != 0.0f)
+    states.transform.rotate(angle * float(180.0 / M_PI));
+  if (scale.x != 1.0f || scale.y != 1.0f)
+    states.transform.scale(scale.x, scale.y);
+
+  if (sf::VertexBuffer::isAvailable())
+    g_render_target->draw(mesh->vb, states);
+  else
+    g_render_target->draw(mesh->vertices.data(), mesh->vertices.size(), mesh->primitive, states);
+
+  count_draw_call(tex, mesh->vertexCount);
+}
+
+void draw_mesh(const Mesh & mesh, float x, float y)
+{
+  draw_mesh_internal(nullptr, mesh.mesh, x, y, 0.0f, das::float2(1.0f, 1.0f));
+}
+
+void draw_mesh_t(const Mesh & mesh, float x, float y, float angle, das::float2 scale)
+{
+  draw_mesh_internal(nullptr, mesh.mesh, x, y, angle, scale);
+}
+
+// texture coordinates of the mesh are in pixels of the image
+void draw_mesh_image_t(const Image & image, const Mesh & mesh, float x, float y, float angle, das::float2 scale)
+{
+  if (!image.tex && !image.atlas)
+    return;
+  if (image.atlas)
+  {
+    print_error("draw_mesh: images in atlas are not supported, texture coordinates of the mesh are not shifted");
+    return;
+  }
+  if (!image.applied)
+    apply_texture(image);
+  draw_mesh_internal(image.getTexture(), mesh.mesh, x, y, angle, scale);
+}
+
+
+//----- tilemap -----
+
+#define TILEMAP_CHUNK_SIZE 32 // in tiles
+
+// vertices of TILEMAP_CHUNK_SIZE x TILEMAP_CHUNK_SIZE tiles, rebuilt on draw when tiles of the chunk were changed
+struct TilemapChunk
+{
+  sf::VertexBuffer vb;
+  std::vector<sf::Vertex> vertices;
+  int vertexCount = 0;
+  bool dirty = true;
+
+  TilemapChunk() : vb(sf::Triangles, sf::VertexBuffer::Static)
+  {
+  }
+};
+
+struct TilemapData
+{
+  int width;
+  int height;
+  int tileWidth;
+  int tileHeight;
+  int chunksX;
+  int chunksY;
+  std::vector<int> tiles; // negative - empty
+  std::vector<TilemapChunk> chunks;
+  int refCount;
+
+  // texture coordinates of the chunks are built for this tileset placement
+  const sf::Texture * builtTexture;
+  sf::FloatRect builtRect;
+
+  TilemapData(int width_, int height_, int tile_width, int tile_height)
+    : width(width_), height(height_), tileWidth(tile_width), tileHeight(tile_height),
+      chunksX((width_ + TILEMAP_CHUNK_SIZE - 1) / TILEMAP_CHUNK_SIZE),
+      chunksY((height_ + TILEMAP_CHUNK_SIZE - 1) / TILEMAP_CHUNK_SIZE),
+      tiles(size_t(width_) * height_, -1), chunks(size_t(chunksX) * chunksY), refCount(0),
+      builtTexture(nullptr)
+  {
+  }
+
+  void invalidateAll()
+  {
+    for (auto && chunk : chunks)
+      chunk.dirty = true;
+  }
+};
+
+static unordered_set<TilemapData *> tilemap_pointers;
+
+static TilemapData * add_tilemap_ref(TilemapData * tilemap)
+{
+  if (tilemap)
+    tilemap->refCount++;
+  return tilemap;
+}
+
+static void release_tilemap(TilemapData * tilemap)
 {
-  draw_image_cs2(image, x, y, color, das::float2(size, size));
+  if (!tilemap || --tilemap->refCount > 0)
+    return;
+  tilemap_pointers.erase(tilemap);
+  delete tilemap;
 }
 
+int Tilemap::getWidth() const
+{
+  return tilemap ? tilemap->width : 0;
+}
 
-void draw_image_cs2i(const Image & image, int x, int y, uint32_t color, das::int2 size)
+int Tilemap::getHeight() const
 {
-  draw_image_cs2(image, (float)x, (float)y, color, das::float2(size.x, size.y));
+  return tilemap ? tilemap->height : 0;
 }
 
-void draw_image_i(const Image & image, int x, int y)
+int Tilemap::getTileWidth() const
 {
-  draw_image_cs2(image, (float)x, (float)y, 0xFFFFFFFF, das::float2(image.width, image.height));
+  return tilemap ? tilemap->tileWidth : 0;
 }
 
-void draw_image_ci(const Image & image, int x, int y, uint32_t color)
+int Tilemap::getTileHeight() const
 {
-  draw_image_cs2(image, (float)x, (float)y, color, das::float2(image.width, image.height));
+  return tilemap ? tilemap->tileHeight : 0;
 }
 
-void draw_image_csi(const Image & image, int x, int y, uint32_t color, int size)
+Tilemap::Tilemap(const Tilemap & b)
 {
-  draw_image_cs2(image, (float)x, (float)y, color, das::float2(size, size));
+  tilemap = add_tilemap_ref(b.tilemap);
 }
 
+Tilemap& Tilemap::operator=(const Tilemap & b)
+{
+  TilemapData * prev = tilemap;
+  tilemap = add_tilemap_ref(b.tilemap);
+  release_tilemap(prev);
+  return *this;
+}
 
+Tilemap& Tilemap::operator=(Tilemap && b)
+{
+  if (this != &b)
+  {
+    release_tilemap(tilemap);
+    tilemap = b.tilemap;
+    b.tilemap = nullptr;
+  }
+  return *this;
+}
 
-void draw_quad(const Image & image, das::float2 p0, das::float2 p1, das::float2 p2, das::float2 p3, uint32_t color)
+Tilemap::~Tilemap()
 {
-  if (!image.tex)
-    return;
-  if (!image.applied)
-    apply_texture(image);
-  sf::Color c = conv_color(color);
-  sf::VertexArray v(sf::TriangleStrip, 4);
-  v[0].position = sf::Vector2f(p0.x, p0.y);
-  v[0].color = c;
-  v[0].texCoords = sf::Vector2f(0, 0);
-  v[1].position = sf::Vector2f(p1.x, p1.y);
-  v[1].color = c;
-  v[1].texCoords = sf::Vector2f(0, (float)image.height);
-  v[2].position = sf::Vector2f(p3.x, p3.y);
-  v[2].color = c;
-  v[2].texCoords = sf::Vector2f((float)image.width, 0);
-  v[3].position = sf::Vector2f(p2.x, p2.y);
-  v[3].color = c;
-  v[3].texCoords = sf::Vector2f((float)image.width, (float)image.height);
-  sf::RenderStates states = primitive_rs;
-  states.texture = image.tex;
-  if (g_render_target)
-    g_render_target->draw(v, states);
+  release_tilemap(tilemap);
+  tilemap = nullptr;
+}
 
+Tilemap create_tilemap(int width, int height, int tile_width, int tile_height)
+{
+  if (width <= 0 || height <= 0 || tile_width <= 0 || tile_height <= 0)
+  {
+    print_error("create_tilemap: invalid size %d x %d tiles of %d x %d pixels", width, height, tile_width,
+      tile_height);
+    return Tilemap();
+  }
+
+  TilemapData * tilemap = new TilemapData(width, height, tile_width, tile_height);
+  tilemap_pointers.insert(tilemap);
+
+  Tilemap res;
+  res.tilemap = add_tilemap_ref(tilemap);
+  return res;
 }
 
-void draw_quad_a(const Image & image, das::float2 p[4], uint32_t color)
+void set_tile(Tilemap & tilemap, int x, int y, int tile)
 {
-  if (!image.tex)
+  TilemapData * t = tilemap.tilemap;
+  if (!t || x < 0 || y < 0 || x >= t->width || y >= t->height)
     return;
-  if (!image.applied)
-    apply_texture(image);
-  sf::Color c = conv_color(color);
-  sf::VertexArray v(sf::TriangleStrip, 4);
-  v[0].position = sf::Vector2f(p[0].x, p[0].y);
-  v[0].color = c;
-  v[0].texCoords = sf::Vector2f(0, 0);
-  v[1].position = sf::Vector2f(p[1].x, p[1].y);
-  v[1].color = c;
-  v[1].texCoords = sf::Vector2f(0, (float)image.height);
-  v[2].position = sf::Vector2f(p[3].x, p[3].y);
-  v[2].color = c;
-  v[2].texCoords = sf::Vector2f((float)image.width, 0);
-  v[3].position = sf::Vector2f(p[2].x, p[2].y);
-  v[3].color = c;
-  v[3].texCoords = sf::Vector2f((float)image.width, (float)image.height);
-  sf::RenderStates states = primitive_rs;
-  states.texture = image.tex;
-  if (g_render_target)
-    g_render_target->draw(v, states);
+  int & cur = t->tiles[size_t(y) * t->width + x];
+  if (cur == tile)
+    return;
+  cur = tile;
+  t->chunks[size_t(y / TILEMAP_CHUNK_SIZE) * t->chunksX + x / TILEMAP_CHUNK_SIZE].dirty = true;
+}
 
+int get_tile(const Tilemap & tilemap, int x, int y)
+{
+  const TilemapData * t = tilemap.tilemap;
+  if (!t || x < 0 || y < 0 || x >= t->width || y >= t->height)
+    return -1;
+  return t->tiles[size_t(y) * t->width + x];
 }
 
-void draw_triangle_strip_color(const Image & image,
-  const das::TArray<das::float2> & coord, const das::TArray<das::float2> & uv, uint32_t color)
+// row by row, width * height values
+void set_tiles(Tilemap & tilemap, const das::TArray<int> & tiles)
 {
-  if (!image.tex)
-    return;
-  if (!image.applied)
-    apply_texture(image);
-  sf::Color c = conv_color(color);
-  int count = std::min(coord.size, uv.size);
-  if (count < 2)
+  TilemapData * t = tilemap.tilemap;
+  if (!t)
     return;
+  size_t count = std::min(size_t(tiles.size), t->tiles.size());
+  memcpy(t->tiles.data(), tiles.data, count * sizeof(int));
+  t->invalidateAll();
+}
 
-  sf::VertexArray v(sf::TriangleStrip, count);
-  for (int i = 0; i < count; i++)
-  {
-    v[i].position = sf::Vector2f(coord[i].x, coord[i].y);
-    v[i].color = c;
-    v[i].texCoords = sf::Vector2f(uv[i].x, uv[i].y);
-  }
+// tiles of the tileset are numbered from left to right and from top to bottom
+static void build_tilemap_chunk(TilemapData * t, TilemapChunk & chunk, int cx, int cy, const sf::FloatRect & tileset)
+{
+  int columns = int(tileset.width) / t->tileWidth;
+  int rows = int(tileset.height) / t->tileHeight;
+  int tileCount = columns * rows;
+
+  int x0 = cx * TILEMAP_CHUNK_SIZE;
+  int y0 = cy * TILEMAP_CHUNK_SIZE;
+  int x1 = std::min(x0 + TILEMAP_CHUNK_SIZE, t->width);
+  int y1 = std::min(y0 + TILEMAP_CHUNK_SIZE, t->height);
+
+  std::vector<sf::Vertex> & v = chunk.vertices;
+  v.clear();
+  float tw = float(t->tileWidth);
+  float th = float(t->tileHeight);
+  for (int y = y0; y < y1; y++)
+    for (int x = x0; x < x1; x++)
+    {
+      int tile = t->tiles[size_t(y) * t->width + x];
+      if (tile < 0 || tile >= tileCount)
+        continue;
+
+      float px = x * tw;
+      float py = y * th;
+      float tu = tileset.left + (tile % columns) * tw;
+      float tv = tileset.top + (tile / columns) * th;
+      sf::Vertex q[4] = {
+        sf::Vertex(sf::Vector2f(px, py), sf::Vector2f(tu, tv)),
+        sf::Vertex(sf::Vector2f(px + tw, py), sf::Vector2f(tu + tw, tv)),
+        sf::Vertex(sf::Vector2f(px, py + th), sf::Vector2f(tu, tv + th)),
+        sf::Vertex(sf::Vector2f(px + tw, py + th), sf::Vector2f(tu + tw, tv + th))
+      };
+      v.push_back(q[0]);
+      v.push_back(q[1]);
+      v.push_back(q[2]);
+      v.push_back(q[1]);
+      v.push_back(q[3]);
+      v.push_back(q[2]);
+    }
 
-  sf::RenderStates states = primitive_rs;
-  states.texture = image.tex;
-  if (g_render_target)
-    g_render_target->draw(v, states);
+  int count = int(v.size());
+  frame_render_stats.uploadedBytes += int64_t(count) * sizeof(sf::Vertex);
+  chunk.vertexCount = count;
+  chunk.dirty = false;
+  if (sf::VertexBuffer::isAvailable())
+  {
+    if (int(chunk.vb.getVertexCount()) < count && !chunk.vb.create(count))
+      print_error("Cannot create vertex buffer (%d vertices)", count);
+    else if (count > 0)
+      chunk.vb.update(v.data(), count, 0);
 
+    v.clear();
+    v.shrink_to_fit();
+  }
 }
 
-void draw_triangle_strip_color_a(const Image & image,
-  const das::TArray<das::float2> & coord, const das::TArray<das::float2> & uv, const das::TArray<uint32_t> & colors)
+// only visible chunks are rebuilt and drawn, one draw call per chunk
+void draw_tilemap(const Image & tileset, const Tilemap & tilemap, float x, float y)
 {
-  if (!image.tex)
-    return;
-  if (!image.applied)
-    apply_texture(image);
-  int count = std::min(coord.size, uv.size);
-  if (count < 2)
+  TilemapData * t = tilemap.tilemap;
+  if (!t || !g_render_target || (!tileset.tex && !tileset.atlas))
     return;
+  if (!tileset.applied)
+    apply_texture(tileset);
 
-  sf::VertexArray v(sf::TriangleStrip, count);
-  for (int i = 0; i < count; i++)
+  const sf::Texture * tex = tileset.getTexture();
+  sf::FloatRect rect = tileset.getTextureRect();
+  if (tex != t->builtTexture || rect != t->builtRect)
   {
-    v[i].position = sf::Vector2f(coord[i].x, coord[i].y);
-    v[i].color = conv_color(colors[i]);
-    v[i].texCoords = sf::Vector2f(uv[i].x, uv[i].y);
+    t->builtTexture = tex;
+    t->builtRect = rect;
+    t->invalidateAll();
   }
 
-  sf::RenderStates states = primitive_rs;
-  states.texture = image.tex;
-  if (g_render_target)
-    g_render_target->draw(v, states);
-
-}
+  flush_batch();
 
-void draw_triangle_strip(const Image & image,
-  const das::TArray<das::float2> & coord, const das::TArray<das::float2> & uv)
-{
-  draw_triangle_strip_color(image, coord, uv, 0xFFFFFFFF);
+  sf::RenderStates states = primitive_rs;
+  states.texture = tex;
+  if (view_enabled)
+    states.transform = view_transform;
+  states.transform.translate(x, y);
+
+  float chunkW = float(TILEMAP_CHUNK_SIZE * t->tileWidth);
+  float chunkH = float(TILEMAP_CHUNK_SIZE * t->tileHeight);
+  for (int cy = 0; cy < t->chunksY; cy++)
+  {
+    float cy0 = y + cy * chunkH;
+    if (is_outside_view(x, cy0, x + t->chunksX * chunkW, cy0 + chunkH))
+      continue;
+    for (int cx = 0; cx < t->chunksX; cx++)
+    {
+      float cx0 = x + cx * chunkW;
+      if (is_outside_view(cx0, cy0, cx0 + chunkW, cy0 + chunkH))
+        continue;
+
+      TilemapChunk & chunk = t->chunks[size_t(cy) * t->chunksX + cx];
+      if (chunk.dirty)
+        build_tilemap_chunk(t, chunk, cx, cy, rect);
+      if (chunk.vertexCount <= 0)
+        continue;
+
+      if (sf::VertexBuffer::isAvailable())
+        g_render_target->draw(chunk.vb, 0, chunk.vertexCount, states);
+      else
+        g_render_target->draw(chunk.vertices.data(), chunk.vertices.size(), sf::Triangles, states);
+      count_draw_call(tex, chunk.vertexCount);
+    }
+  }
 }
 
 
-typedef das::float2 PointsType_2[2];
-typedef das::float2 PointsType_3[3];
-typedef das::float2 PointsType_4[4];
-typedef das::float2 PointsType_5[5];
-typedef das::float2 PointsType_6[6];
-typedef das::float2 PointsType_7[7];
-typedef das::float2 PointsType_8[8];
-
 void polygon2(const PointsType_2 & points, uint32_t color) { polygon_internal((const das::float2 *)&points, 2, color); }
 void polygon3(const PointsType_3 & points, uint32_t color) { polygon_internal((const das::float2 *)&points, 3, color); }
 void polygon4(const PointsType_4 & points, uint32_t color) { polygon_internal((const das::float2 *)&points, 4, color); }
@@ -979,103 +3313,406 @@ void fill_convex_polygon2(const PointsType_2 & points, uint32_t color)
   fill_convex_polygon_internal((const das::float2 *)&points, 2, color);
 }
 
-void fill_convex_polygon3(const PointsType_3 & points, uint32_t color)
-{
-  fill_convex_polygon_internal((const das::float2 *)&points, 3, color);
-}
+void fill_convex_polygon3(const PointsType_3 & points, uint32_t color)
+{
+  fill_convex_polygon_internal((const das::float2 *)&points, 3, color);
+}
+
+void fill_convex_polygon4(const PointsType_4 & points, uint32_t color)
+{
+  fill_convex_polygon_internal((const das::float2 *)&points, 4, color);
+}
+
+void fill_convex_polygon5(const PointsType_5 & points, uint32_t color)
+{
+  fill_convex_polygon_internal((const das::float2 *)&points, 5, color);
+}
+
+void fill_convex_polygon6(const PointsType_6 & points, uint32_t color)
+{
+  fill_convex_polygon_internal((const das::float2 *)&points, 6, color);
+}
+
+void fill_convex_polygon7(const PointsType_7 & points, uint32_t color)
+{
+  fill_convex_polygon_internal((const das::float2 *)&points, 7, color);
+}
+
+void fill_convex_polygon8(const PointsType_8 & points, uint32_t color)
+{
+  fill_convex_polygon_internal((const das::float2 *)&points, 8, color);
+}
+
+
+static const uint8_t font_mono_data[] =
+{
+#include "resources/font.JetBrainsMonoNL-Medium.ttf.inl"
+};
+
+static const uint8_t font_sans_data[] =
+{
+#include "resources/font.OpenSans-Regular.ttf.inl"
+};
+
+static bool font_mono_loaded = false;
+static bool font_sans_loaded = false;
+
+// embedded fonts are parsed at the first use
+static sf::Font * get_current_font()
+{
+  if (current_font == font_mono && !font_mono_loaded)
+  {
+    font_mono_loaded = true;
+    if (!font_mono->loadFromMemory((void *)font_mono_data, sizeof(font_mono_data)))
+      print_error("Cannot load default font (mono)\n");
+  }
+  else if (current_font == font_sans && !font_sans_loaded)
+  {
+    font_sans_loaded = true;
+    if (!font_sans->loadFromMemory((void *)font_sans_data, sizeof(font_sans_data)))
+      print_error("Cannot load default font (sans)\n");
+  }
+  return current_font;
+}
+
+namespace graphics
+{
+
+void initialize()
+{
+  font_mono = new sf::Font;
+  font_sans = new sf::Font;
+  saved_font = nullptr;
+  set_font_name(nullptr);
+}
+
+void delete_allocated_images()
+{
+  flush_batch();
+
+  // results of unfinished loads are deleted by the last owner
+  async_image_loads.clear();
+  on_image_memory_cache_generation_end();
+
+  // atlases still referenced by images are freed when the last reference is released
+  for (auto && atlas : atlas_pointers)
+  {
+    flush_batch_if_uses(&atlas->tex);
+    atlas->tex = sf::Texture();
+    atlas->skyline.clear();
+    orphaned_atlases.insert(atlas);
+  }
+  atlas_pointers.clear();
+
+  for (auto && mesh : mesh_pointers)
+    delete mesh;
+  mesh_pointers.clear();
+
+  for (auto && tilemap : tilemap_pointers)
+    delete tilemap;
+  tilemap_pointers.clear();
+
+  restore_screen_render_target();
+  for (auto && target : render_target_pointers)
+    delete target;
+  render_target_pointers.clear();
+
+  primitive_rs.shader = nullptr;
+  batch_rs.shader = nullptr;
+  post_effect_shader = nullptr;
+  for (auto && shader : shader_pointers)
+    delete shader;
+  shader_pointers.clear();
+
+  streaming_textures.clear();
+  mipmapped_images.clear();
+  for (auto && texture : texture_pointers)
+    delete texture;
+  texture_pointers.clear();
+
+  for (auto && image : image_pointers)
+    delete image;
+  image_pointers.clear();
+}
+
+void finalize()
+{
+  text_run_by_hash.clear();
+  text_runs.clear();
+  for (auto && m : font_metrics)
+    delete m.second;
+  font_metrics.clear();
+  last_font_metrics = nullptr;
+  delete font_mono;
+  delete font_sans;
+
+  for (auto && atlas : orphaned_atlases)
+    delete atlas;
+  orphaned_atlases.clear();
+}
+
+void reset_frame_render_stats()
+{
+  frame_render_stats = RenderStats();
+}
+
+void on_graphics_frame_start()
+{
+  batch_vertices.clear();
+  last_bound_texture = nullptr;
+  primitive_rs.shader = nullptr;
+  restore_screen_render_target();
+  reset_view();
+  text_cache_hits = 0;
+  text_cache_misses = 0;
+  g_render_target->clear();
+  g_render_target->resetGLStates();
+  disable_alpha_blend();
+}
+
+void on_graphics_frame_end()
+{
+  flush_batch();
+  last_frame_render_stats = frame_render_stats;
+  arena::reset_frame_arena();
+}
+
+const sf::Shader * get_post_effect_shader()
+{
+  return post_effect_shader ? &post_effect_shader->shader : nullptr;
+}
+
+} // namespace
+
+
+MAKE_TYPE_FACTORY(Image, Image)
+MAKE_TYPE_FACTORY(ImageAtlas, ImageAtlas)
+MAKE_TYPE_FACTORY(Mesh, Mesh)
+MAKE_TYPE_FACTORY(Shader, Shader)
+MAKE_TYPE_FACTORY(Tilemap, Tilemap)
+MAKE_TYPE_FACTORY(RenderStats, RenderStats)
+MAKE_TYPE_FACTORY(FrameArenaStats, arena::FrameArenaStats)
+
+
+struct SimNode_DeleteImage : SimNode_Delete
+{
+  SimNode_DeleteImage( const LineInfo & a, SimNode * s, uint32_t t )
+    : SimNode_Delete(a, s, t) {}
+
+  virtual SimNode * visit(SimVisitor & vis) override
+  {
+    V_BEGIN();
+    V_OP(DeleteImage);
+    V_ARG(total);
+    V_SUB(subexpr);
+    V_END();
+  }
+
+  virtual vec4f eval(Context & context) override
+  {
+    DAS_PROFILE_NODE
+    auto pH = (Image *)subexpr->evalPtr(context);
+    for (uint32_t i = 0; i != total; ++i, pH++)
+      delete_image(pH);
+    return v_zero();
+  }
+};
+
+
+struct ImageAnnotation : ManagedStructureAnnotation<Image, true, true>
+{
+  ImageAnnotation(ModuleLibrary & ml) : ManagedStructureAnnotation("Image", ml)
+  {
+    addProperty<DAS_BIND_MANAGED_PROP(getWidth)>("width");
+    addProperty<DAS_BIND_MANAGED_PROP(getHeight)>("height");
+    addProperty<DAS_BIND_MANAGED_PROP(isValid)>("valid");
+  }
+
+  bool canCopy() const override { return false; }
+  virtual bool hasNonTrivialCtor() const override { return false; }
+  virtual bool isLocal() const override { return true; }
+  virtual bool canClone() const override { return true; }
+  virtual bool canMove() const override { return true; }
+  virtual bool canNew() const override { return true; }
+  virtual bool canDelete() const override { return true; }
+  virtual bool needDelete() const override { return true; }
+  virtual bool canBePlacedInContainer() const override { return true; }
+
+  virtual SimNode * simulateDelete(Context & context, const LineInfo & at, SimNode * sube, uint32_t count) const override
+  {
+    return context.code->makeNode<SimNode_DeleteImage>(at, sube, count);
+  }
+};
+
 
-void fill_convex_polygon4(const PointsType_4 & points, uint32_t color)
+struct SimNode_DeleteImageAtlas : SimNode_Delete
 {
-  fill_convex_polygon_internal((const das::float2 *)&points, 4, color);
-}
+  SimNode_DeleteImageAtlas( const LineInfo & a, SimNode * s, uint32_t t )
+    : SimNode_Delete(a, s, t) {}
 
-void fill_convex_polygon5(const PointsType_5 & points, uint32_t color)
-{
-  fill_convex_polygon_internal((const das::float2 *)&points, 5, color);
-}
+  virtual SimNode * visit(SimVisitor & vis) override
+  {
+    V_BEGIN();
+    V_OP(DeleteImageAtlas);
+    V_ARG(total);
+    V_SUB(subexpr);
+    V_END();
+  }
 
-void fill_convex_polygon6(const PointsType_6 & points, uint32_t color)
-{
-  fill_convex_polygon_internal((const das::float2 *)&points, 6, color);
-}
+  virtual vec4f eval(Context & context) override
+  {
+    DAS_PROFILE_NODE
+    auto pH = (ImageAtlas *)subexpr->evalPtr(context);
+    for (uint32_t i = 0; i != total; ++i, pH++)
+    {
+      release_atlas(pH->atlas);
+      pH->atlas = nullptr;
+    }
+    return v_zero();
+  }
+};
 
-void fill_convex_polygon7(const PointsType_7 & points, uint32_t color)
-{
-  fill_convex_polygon_internal((const das::float2 *)&points, 7, color);
-}
 
-void fill_convex_polygon8(const PointsType_8 & points, uint32_t color)
+struct ImageAtlasAnnotation : ManagedStructureAnnotation<ImageAtlas, true, true>
 {
-  fill_convex_polygon_internal((const das::float2 *)&points, 8, color);
-}
+  ImageAtlasAnnotation(ModuleLibrary & ml) : ManagedStructureAnnotation("ImageAtlas", ml)
+  {
+    addProperty<DAS_BIND_MANAGED_PROP(getWidth)>("width");
+    addProperty<DAS_BIND_MANAGED_PROP(getHeight)>("height");
+    addProperty<DAS_BIND_MANAGED_PROP(isValid)>("valid");
+  }
 
+  bool canCopy() const override { return false; }
+  virtual bool hasNonTrivialCtor() const override { return false; }
+  virtual bool isLocal() const override { return true; }
+  virtual bool canClone() const override { return false; }
+  virtual bool canMove() const override { return true; }
+  virtual bool canNew() const override { return true; }
+  virtual bool canDelete() const override { return true; }
+  virtual bool needDelete() const override { return true; }
+  virtual bool canBePlacedInContainer() const override { return true; }
 
-static const uint8_t font_mono_data[] =
-{
-#include "resources/font.JetBrainsMonoNL-Medium.ttf.inl"
+  virtual SimNode * simulateDelete(Context & context, const LineInfo & at, SimNode * sube, uint32_t count) const override
+  {
+    return context.code->makeNode<SimNode_DeleteImageAtlas>(at, sube, count);
+  }
 };
 
-static const uint8_t font_sans_data[] =
+
+struct SimNode_DeleteMesh : SimNode_Delete
 {
-#include "resources/font.OpenSans-Regular.ttf.inl"
+  SimNode_DeleteMesh( const LineInfo & a, SimNode * s, uint32_t t )
+    : SimNode_Delete(a, s, t) {}
+
+  virtual SimNode * visit(SimVisitor & vis) override
+  {
+    V_BEGIN();
+    V_OP(DeleteMesh);
+    V_ARG(total);
+    V_SUB(subexpr);
+    V_END();
+  }
+
+  virtual vec4f eval(Context & context) override
+  {
+    DAS_PROFILE_NODE
+    auto pH = (Mesh *)subexpr->evalPtr(context);
+    for (uint32_t i = 0; i != total; ++i, pH++)
+    {
+      release_mesh(pH->mesh);
+      pH->mesh = nullptr;
+    }
+    return v_zero();
+  }
 };
 
-namespace graphics
-{
 
-void initialize()
+struct MeshAnnotation : ManagedStructureAnnotation<Mesh, true, true>
 {
-  font_mono = new sf::Font;
-  if (!font_mono->loadFromMemory((void *)font_mono_data, sizeof(font_mono_data)))
-    print_error("Cannot load default font (mono)\n");
+  MeshAnnotation(ModuleLibrary & ml) : ManagedStructureAnnotation("Mesh", ml)
+  {
+    addProperty<DAS_BIND_MANAGED_PROP(getVertexCount)>("vertexCount");
+    addProperty<DAS_BIND_MANAGED_PROP(isValid)>("valid");
+  }
 
-  font_sans = new sf::Font;
-  if (!font_sans->loadFromMemory((void *)font_sans_data, sizeof(font_sans_data)))
-    print_error("Cannot load default font (sans)\n");
+  bool canCopy() const override { return false; }
+  virtual bool hasNonTrivialCtor() const override { return false; }
+  virtual bool isLocal() const override { return true; }
+  virtual bool canClone() const override { return false; }
+  virtual bool canMove() const override { return true; }
+  virtual bool canNew() const override { return true; }
+  virtual bool canDelete() const override { return true; }
+  virtual bool needDelete() const override { return true; }
+  virtual bool canBePlacedInContainer() const override { return true; }
 
-  saved_font = nullptr;
-  set_font_name(nullptr);
-}
+  virtual SimNode * simulateDelete(Context & context, const LineInfo & at, SimNode * sube, uint32_t count) const override
+  {
+    return context.code->makeNode<SimNode_DeleteMesh>(at, sube, count);
+  }
+};
 
-void delete_allocated_images()
+
+struct SimNode_DeleteShader : SimNode_Delete
 {
-  for (auto && texture : texture_pointers)
-    delete texture;
-  texture_pointers.clear();
+  SimNode_DeleteShader( const LineInfo & a, SimNode * s, uint32_t t )
+    : SimNode_Delete(a, s, t) {}
 
-  for (auto && image : image_pointers)
-    delete image;
-  image_pointers.clear();
-}
+  virtual SimNode * visit(SimVisitor & vis) override
+  {
+    V_BEGIN();
+    V_OP(DeleteShader);
+    V_ARG(total);
+    V_SUB(subexpr);
+    V_END();
+  }
 
-void finalize()
-{
-  delete font_mono;
-  delete font_sans;
-}
+  virtual vec4f eval(Context & context) override
+  {
+    DAS_PROFILE_NODE
+    auto pH = (Shader *)subexpr->evalPtr(context);
+    for (uint32_t i = 0; i != total; ++i, pH++)
+    {
+      release_shader(pH->shader);
+      pH->shader = nullptr;
+    }
+    return v_zero();
+  }
+};
 
-void on_graphics_frame_start()
-{
-  g_render_target->clear();
-  g_render_target->resetGLStates();
-  disable_alpha_blend();
-}
 
-} // namespace
+struct ShaderAnnotation : ManagedStructureAnnotation<Shader, true, true>
+{
+  ShaderAnnotation(ModuleLibrary & ml) : ManagedStructureAnnotation("Shader", ml)
+  {
+    addProperty<DAS_BIND_MANAGED_PROP(isValid)>("valid");
+  }
 
+  bool canCopy() const override { return false; }
+  virtual bool hasNonTrivialCtor() const override { return false; }
+  virtual bool isLocal() const override { return true; }
+  virtual bool canClone() const override { return false; }
+  virtual bool canMove() const override { return true; }
+  virtual bool canNew() const override { return true; }
+  virtual bool canDelete() const override { return true; }
+  virtual bool needDelete() const override { return true; }
+  virtual bool canBePlacedInContainer() const override { return true; }
 
-MAKE_TYPE_FACTORY(Image, Image)
+  virtual SimNode * simulateDelete(Context & context, const LineInfo & at, SimNode * sube, uint32_t count) const override
+  {
+    return context.code->makeNode<SimNode_DeleteShader>(at, sube, count);
+  }
+};
 
 
-struct SimNode_DeleteImage : SimNode_Delete
+struct SimNode_DeleteTilemap : SimNode_Delete
 {
-  SimNode_DeleteImage( const LineInfo & a, SimNode * s, uint32_t t )
+  SimNode_DeleteTilemap( const LineInfo & a, SimNode * s, uint32_t t )
     : SimNode_Delete(a, s, t) {}
 
   virtual SimNode * visit(SimVisitor & vis) override
   {
     V_BEGIN();
-    V_OP(DeleteImage);
+    V_OP(DeleteTilemap);
     V_ARG(total);
     V_SUB(subexpr);
     V_END();
@@ -1084,27 +3721,32 @@ struct SimNode_DeleteImage : SimNode_Delete
   virtual vec4f eval(Context & context) override
   {
     DAS_PROFILE_NODE
-    auto pH = (Image *)subexpr->evalPtr(context);
+    auto pH = (Tilemap *)subexpr->evalPtr(context);
     for (uint32_t i = 0; i != total; ++i, pH++)
-      delete_image(pH);
+    {
+      release_tilemap(pH->tilemap);
+      pH->tilemap = nullptr;
+    }
     return v_zero();
   }
 };
 
 
-struct ImageAnnotation : ManagedStructureAnnotation<Image, true, true>
+struct TilemapAnnotation : ManagedStructureAnnotation<Tilemap, true, true>
 {
-  ImageAnnotation(ModuleLibrary & ml) : ManagedStructureAnnotation("Image", ml)
+  TilemapAnnotation(ModuleLibrary & ml) : ManagedStructureAnnotation("Tilemap", ml)
   {
     addProperty<DAS_BIND_MANAGED_PROP(getWidth)>("width");
     addProperty<DAS_BIND_MANAGED_PROP(getHeight)>("height");
+    addProperty<DAS_BIND_MANAGED_PROP(getTileWidth)>("tileWidth");
+    addProperty<DAS_BIND_MANAGED_PROP(getTileHeight)>("tileHeight");
     addProperty<DAS_BIND_MANAGED_PROP(isValid)>("valid");
   }
 
   bool canCopy() const override { return false; }
   virtual bool hasNonTrivialCtor() const override { return false; }
   virtual bool isLocal() const override { return true; }
-  virtual bool canClone() const override { return true; }
+  virtual bool canClone() const override { return false; }
   virtual bool canMove() const override { return true; }
   virtual bool canNew() const override { return true; }
   virtual bool canDelete() const override { return true; }
@@ -1113,8 +3755,53 @@ struct ImageAnnotation : ManagedStructureAnnotation<Image, true, true>
 
   virtual SimNode * simulateDelete(Context & context, const LineInfo & at, SimNode * sube, uint32_t count) const override
   {
-    return context.code->makeNode<SimNode_DeleteImage>(at, sube, count);
+    return context.code->makeNode<SimNode_DeleteTilemap>(at, sube, count);
+  }
+};
+
+
+struct RenderStatsAnnotation : ManagedStructureAnnotation<RenderStats, true, true>
+{
+  RenderStatsAnnotation(ModuleLibrary & ml) : ManagedStructureAnnotation("RenderStats", ml)
+  {
+    addField<DAS_BIND_MANAGED_FIELD(drawCalls)>("drawCalls");
+    addField<DAS_BIND_MANAGED_FIELD(vertices)>("vertices");
+    addField<DAS_BIND_MANAGED_FIELD(textureBinds)>("textureBinds");
+    addField<DAS_BIND_MANAGED_FIELD(textureUploads)>("textureUploads");
+    addField<DAS_BIND_MANAGED_FIELD(uploadedBytes)>("uploadedBytes");
+  }
+
+  virtual bool isLocal() const override { return true; }
+  virtual bool canCopy() const override { return true; }
+  virtual bool canMove() const override { return true; }
+  virtual bool canBePlacedInContainer() const override { return true; }
+};
+
+
+// arrays of with_frame_*_array and with_image_pixels are temporary, these functions do not keep the arrays
+void accept_temporary_arrays(BuiltInFunction * fn, std::initializer_list<int> args)
+{
+  for (int i : args)
+    fn->arguments[i]->type->implicit = true;
+}
+
+
+struct FrameArenaStatsAnnotation : ManagedStructureAnnotation<arena::FrameArenaStats, true, true>
+{
+  FrameArenaStatsAnnotation(ModuleLibrary & ml) : ManagedStructureAnnotation("FrameArenaStats", ml)
+  {
+    cppName = " ::arena::FrameArenaStats";
+    addField<DAS_BIND_MANAGED_FIELD(used)>("used");
+    addField<DAS_BIND_MANAGED_FIELD(peak)>("peak");
+    addField<DAS_BIND_MANAGED_FIELD(capacity)>("capacity");
+    addField<DAS_BIND_MANAGED_FIELD(allocations)>("allocations");
+    addField<DAS_BIND_MANAGED_FIELD(overflows)>("overflows");
   }
+
+  virtual bool isLocal() const override { return true; }
+  virtual bool canCopy() const override { return true; }
+  virtual bool canMove() const override { return true; }
+  virtual bool canBePlacedInContainer() const override { return true; }
 };
 
 
@@ -1134,6 +3821,23 @@ public:
 
     addAnnotation(das::make_smart<ImageAnnotation>(lib));
     addCtorAndUsing<Image>(*this, lib, "Image", "Image");
+    addAnnotation(das::make_smart<ImageAtlasAnnotation>(lib));
+    addCtorAndUsing<ImageAtlas>(*this, lib, "ImageAtlas", "ImageAtlas");
+    addAnnotation(das::make_smart<MeshAnnotation>(lib));
+    addCtorAndUsing<Mesh>(*this, lib, "Mesh", "Mesh");
+    addAnnotation(das::make_smart<ShaderAnnotation>(lib));
+    addCtorAndUsing<Shader>(*this, lib, "Shader", "Shader");
+    addAnnotation(das::make_smart<TilemapAnnotation>(lib));
+    addCtorAndUsing<Tilemap>(*this, lib, "Tilemap", "Tilemap");
+    addAnnotation(das::make_smart<RenderStatsAnnotation>(lib));
+    addAnnotation(das::make_smart<FrameArenaStatsAnnotation>(lib));
+
+    addConstant(*this, "MESH_POINTS", int(sf::Points));
+    addConstant(*this, "MESH_LINES", int(sf::Lines));
+    addConstant(*this, "MESH_LINE_STRIP", int(sf::LineStrip));
+    addConstant(*this, "MESH_TRIANGLES", int(sf::Triangles));
+    addConstant(*this, "MESH_TRIANGLE_STRIP", int(sf::TriangleStrip));
+    addConstant(*this, "MESH_TRIANGLE_FAN", int(sf::TriangleFan));
 
     addExtern<DAS_BIND_FUN(get_screen_width)>(*this, lib, "get_screen_width", SideEffects::accessExternal, "get_screen_width");
     addExtern<DAS_BIND_FUN(get_screen_height)>(*this, lib, "get_screen_height", SideEffects::accessExternal, "get_screen_height");
@@ -1145,6 +3849,21 @@ public:
     addExtern<DAS_BIND_FUN(set_pixel_i)>(*this, lib, "set_pixel", SideEffects::modifyExternal, "set_pixel_i")
       ->args({"x", "y", "color"});
 
+    addExtern<DAS_BIND_FUN(set_view)>(*this, lib, "set_view", SideEffects::modifyExternal, "set_view")
+      ->args({"offset", "zoom"});
+
+    addExtern<DAS_BIND_FUN(reset_view)>(*this, lib, "reset_view", SideEffects::modifyExternal, "reset_view");
+
+    addExtern<DAS_BIND_FUN(get_view_offset)>(*this, lib, "get_view_offset", SideEffects::accessExternal, "get_view_offset");
+
+    addExtern<DAS_BIND_FUN(get_view_zoom)>(*this, lib, "get_view_zoom", SideEffects::accessExternal, "get_view_zoom");
+
+    addExtern<DAS_BIND_FUN(screen_to_world)>(*this, lib, "screen_to_world", SideEffects::accessExternal, "screen_to_world")
+      ->args({"pos"});
+
+    addExtern<DAS_BIND_FUN(world_to_screen)>(*this, lib, "world_to_screen", SideEffects::accessExternal, "world_to_screen")
+      ->args({"pos"});
+
     addExtern<DAS_BIND_FUN(fill_rect)>(*this, lib, "fill_rect", SideEffects::modifyExternal, "fill_rect")
       ->args({"x", "y", "width", "height", "color"});
 
@@ -1163,6 +3882,15 @@ public:
     addExtern<DAS_BIND_FUN(text_out_i)>(*this, lib, "text_out", SideEffects::modifyExternal, "text_out_i")
       ->args({"x", "y", "str", "color"});
 
+    addExtern<DAS_BIND_FUN(get_text_cache_hits)>(*this, lib,
+      "get_text_cache_hits", SideEffects::accessExternal, "get_text_cache_hits");
+
+    addExtern<DAS_BIND_FUN(get_text_cache_misses)>(*this, lib,
+      "get_text_cache_misses", SideEffects::accessExternal, "get_text_cache_misses");
+
+    addExtern<DAS_BIND_FUN(get_render_stats), SimNode_ExtFuncCallAndCopyOrMove>(*this, lib,
+      "get_render_stats", SideEffects::accessExternal, "get_render_stats");
+
     addExtern<DAS_BIND_FUN(get_text_size)>(*this, lib, "get_text_size", SideEffects::modifyExternal, "get_text_size")
       ->args({"str"});
 
@@ -1184,8 +3912,16 @@ public:
     addExtern<DAS_BIND_FUN(fill_circle_i)>(*this, lib, "fill_circle", SideEffects::modifyExternal, "fill_circle_i")
       ->args({"x", "y", "radius", "color"});
 
-    addExtern<DAS_BIND_FUN(polygon)>(*this, lib, "polygon", SideEffects::modifyExternal, "polygon")
-      ->args({"points", "color"});
+    accept_temporary_arrays(addExtern<DAS_BIND_FUN(fill_circle_instanced)>(*this, lib,
+      "fill_circle_instanced", SideEffects::modifyExternal, "fill_circle_instanced")
+      ->args({"positions", "radii", "colors"}), {0, 1, 2});
+
+    accept_temporary_arrays(addExtern<DAS_BIND_FUN(fill_circle_instanced_rc)>(*this, lib,
+      "fill_circle_instanced", SideEffects::modifyExternal, "fill_circle_instanced_rc")
+      ->args({"positions", "radius", "color"}), {0});
+
+    accept_temporary_arrays(addExtern<DAS_BIND_FUN(polygon)>(*this, lib, "polygon", SideEffects::modifyExternal, "polygon")
+      ->args({"points", "color"}), {0});
 
     addExtern<DAS_BIND_FUN(polygon2)>(*this, lib, "polygon", SideEffects::modifyExternal, "polygon2");
 
@@ -1201,9 +3937,9 @@ public:
 
     addExtern<DAS_BIND_FUN(polygon8)>(*this, lib, "polygon", SideEffects::modifyExternal, "polygon8");
 
-    addExtern<DAS_BIND_FUN(fill_convex_polygon)>(*this, lib,
+    accept_temporary_arrays(addExtern<DAS_BIND_FUN(fill_convex_polygon)>(*this, lib,
       "fill_convex_polygon", SideEffects::modifyExternal, "fill_convex_polygon")
-      ->args({"points", "color"});
+      ->args({"points", "color"}), {0});
 
     addExtern<DAS_BIND_FUN(fill_convex_polygon2)>(*this, lib,
       "fill_convex_polygon", SideEffects::modifyExternal, "fill_convex_polygon2");
@@ -1242,6 +3978,9 @@ public:
     addExtern<DAS_BIND_FUN(set_image_smooth)>(*this, lib, "set_image_smooth", SideEffects::modifyExternal, "set_image_smooth")
       ->args({"image", "is_smooth"});
 
+    addExtern<DAS_BIND_FUN(set_image_mipmap)>(*this, lib, "set_image_mipmap", SideEffects::modifyExternal, "set_image_mipmap")
+      ->args({"image", "enable"});
+
     addExtern<DAS_BIND_FUN(set_image_clamp)>(*this, lib, "set_image_clamp", SideEffects::modifyExternal, "set_image_clamp")
       ->args({"image", "is_clamped"});
 
@@ -1250,31 +3989,103 @@ public:
       (*this, lib, "create_image", SideEffects::modifyExternal, "create_image_wh")
       ->args({"width", "height"});
 
-    addExtern<DAS_BIND_FUN(create_image), SimNode_ExtFuncCallAndCopyOrMove>
+    accept_temporary_arrays(addExtern<DAS_BIND_FUN(create_image), SimNode_ExtFuncCallAndCopyOrMove>
       (*this, lib, "create_image", SideEffects::modifyExternal, "create_image")
-      ->args({"width", "height", "pixels"});
+      ->args({"width", "height", "pixels"}), {2});
 
     addExtern<DAS_BIND_FUN(create_image_from_file), SimNode_ExtFuncCallAndCopyOrMove>(*this, lib,
       "create_image", SideEffects::modifyExternal, "create_image_from_file")
       ->args({"file_name"});
 
+    addExtern<DAS_BIND_FUN(create_image_atlas), SimNode_ExtFuncCallAndCopyOrMove>(*this, lib,
+      "create_image_atlas", SideEffects::modifyExternal, "create_image_atlas")
+      ->args({"width", "height"});
+
+    addExtern<DAS_BIND_FUN(add_image_to_atlas)>(*this, lib, "add_image", SideEffects::modifyExternal, "add_image_to_atlas")
+      ->args({"atlas", "image"});
+
+    addExtern<DAS_BIND_FUN(set_atlas_smooth)>(*this, lib, "set_atlas_smooth", SideEffects::modifyExternal, "set_atlas_smooth")
+      ->args({"atlas", "smooth"});
+
+    addExtern<DAS_BIND_FUN(load_image_async)>(*this, lib, "load_image_async", SideEffects::modifyExternal, "load_image_async")
+      ->args({"file_name"});
+
+    addExtern<DAS_BIND_FUN(create_images_from_files)>(*this, lib, "create_images_from_files",
+      SideEffects::modifyArgumentAndExternal, "create_images_from_files")
+      ->args({"images", "file_names", "context", "at"});
+
+    addExtern<DAS_BIND_FUN(load_thumbnail_async)>(*this, lib, "load_thumbnail_async", SideEffects::modifyExternal,
+      "load_thumbnail_async")
+      ->args({"file_name", "max_width", "max_height"});
+
+    addExtern<DAS_BIND_FUN(is_image_loaded)>(*this, lib, "is_image_loaded", SideEffects::accessExternal, "is_image_loaded")
+      ->args({"handle"});
+
+    addExtern<DAS_BIND_FUN(take_loaded_image), SimNode_ExtFuncCallAndCopyOrMove>(*this, lib,
+      "take_loaded_image", SideEffects::modifyExternal, "take_loaded_image")
+      ->args({"handle"});
+
     addExtern<DAS_BIND_FUN(draw_quad)>(*this, lib, "draw_quad", SideEffects::modifyExternal, "draw_quad")
       ->args({"image", "p0", "p1", "p2", "p3", "color"});
 
     addExtern<DAS_BIND_FUN(draw_quad_a)>(*this, lib, "draw_quad", SideEffects::modifyExternal, "draw_quad_a")
       ->args({"image", "points", "color"});
 
-    addExtern<DAS_BIND_FUN(draw_triangle_strip)>(*this, lib,
+    accept_temporary_arrays(addExtern<DAS_BIND_FUN(draw_triangle_strip)>(*this, lib,
       "draw_triangle_strip", SideEffects::modifyExternal, "draw_triangle_strip")
-      ->args({"image", "coord", "uv"});
+      ->args({"image", "coord", "uv"}), {1, 2});
 
-    addExtern<DAS_BIND_FUN(draw_triangle_strip_color)>(*this, lib,
+    accept_temporary_arrays(addExtern<DAS_BIND_FUN(draw_triangle_strip_color)>(*this, lib,
       "draw_triangle_strip", SideEffects::modifyExternal, "draw_triangle_strip_color")
-      ->args({"image", "coord", "uv", "color"});
+      ->args({"image", "coord", "uv", "color"}), {1, 2});
 
-    addExtern<DAS_BIND_FUN(draw_triangle_strip_color_a)>(*this, lib,
+    accept_temporary_arrays(addExtern<DAS_BIND_FUN(draw_triangle_strip_color_a)>(*this, lib,
       "draw_triangle_strip", SideEffects::modifyExternal, "draw_triangle_strip_color_a")
-      ->args({"image", "coord", "uv", "colors"});
+      ->args({"image", "coord", "uv", "colors"}), {1, 2, 3});
+
+    accept_temporary_arrays(addExtern<DAS_BIND_FUN(create_mesh), SimNode_ExtFuncCallAndCopyOrMove>(*this, lib,
+      "create_mesh", SideEffects::modifyExternal, "create_mesh")
+      ->args({"primitive", "coord", "colors", "dynamic_usage"}), {1, 2});
+
+    accept_temporary_arrays(addExtern<DAS_BIND_FUN(create_mesh_c), SimNode_ExtFuncCallAndCopyOrMove>(*this, lib,
+      "create_mesh", SideEffects::modifyExternal, "create_mesh_c")
+      ->args({"primitive", "coord", "color", "dynamic_usage"}), {1});
+
+    accept_temporary_arrays(addExtern<DAS_BIND_FUN(create_mesh_uv), SimNode_ExtFuncCallAndCopyOrMove>(*this, lib,
+      "create_mesh", SideEffects::modifyExternal, "create_mesh_uv")
+      ->args({"primitive", "coord", "uv", "colors", "dynamic_usage"}), {1, 2, 3});
+
+    accept_temporary_arrays(addExtern<DAS_BIND_FUN(update_mesh)>(*this, lib, "update_mesh", SideEffects::modifyArgumentAndExternal, "update_mesh")
+      ->args({"mesh", "coord", "colors"}), {1, 2});
+
+    accept_temporary_arrays(addExtern<DAS_BIND_FUN(update_mesh_uv)>(*this, lib,
+      "update_mesh", SideEffects::modifyArgumentAndExternal, "update_mesh_uv")
+      ->args({"mesh", "coord", "uv", "colors"}), {1, 2, 3});
+
+    addExtern<DAS_BIND_FUN(draw_mesh)>(*this, lib, "draw_mesh", SideEffects::modifyExternal, "draw_mesh")
+      ->args({"mesh", "x", "y"});
+
+    addExtern<DAS_BIND_FUN(draw_mesh_t)>(*this, lib, "draw_mesh", SideEffects::modifyExternal, "draw_mesh_t")
+      ->args({"mesh", "x", "y", "angle", "scale"});
+
+    addExtern<DAS_BIND_FUN(draw_mesh_image_t)>(*this, lib, "draw_mesh", SideEffects::modifyExternal, "draw_mesh_image_t")
+      ->args({"image", "mesh", "x", "y", "angle", "scale"});
+
+    addExtern<DAS_BIND_FUN(create_tilemap), SimNode_ExtFuncCallAndCopyOrMove>(*this, lib,
+      "create_tilemap", SideEffects::modifyExternal, "create_tilemap")
+      ->args({"width", "height", "tile_width", "tile_height"});
+
+    addExtern<DAS_BIND_FUN(set_tile)>(*this, lib, "set_tile", SideEffects::modifyArgumentAndExternal, "set_tile")
+      ->args({"tilemap", "x", "y", "tile"});
+
+    addExtern<DAS_BIND_FUN(get_tile)>(*this, lib, "get_tile", SideEffects::accessExternal, "get_tile")
+      ->args({"tilemap", "x", "y"});
+
+    accept_temporary_arrays(addExtern<DAS_BIND_FUN(set_tiles)>(*this, lib, "set_tiles", SideEffects::modifyArgumentAndExternal, "set_tiles")
+      ->args({"tilemap", "tiles"}), {1});
+
+    addExtern<DAS_BIND_FUN(draw_tilemap)>(*this, lib, "draw_tilemap", SideEffects::modifyExternal, "draw_tilemap")
+      ->args({"tileset", "tilemap", "x", "y"});
 
 
     addExtern<DAS_BIND_FUN(draw_image)>(*this, lib, "draw_image", SideEffects::modifyExternal, "draw_image")
@@ -1289,6 +4100,80 @@ public:
     addExtern<DAS_BIND_FUN(draw_image_cs2)>(*this, lib, "draw_image", SideEffects::modifyExternal, "draw_image_cs2")
       ->args({"image", "x", "y", "color", "size"});
 
+    addExtern<DAS_BIND_FUN(set_image_streaming)>(*this, lib,
+      "set_image_streaming", SideEffects::modifyArgumentAndExternal, "set_image_streaming")
+      ->args({"image", "buffer_count"});
+
+    addExtern<DAS_BIND_FUN(create_render_image), SimNode_ExtFuncCallAndCopyOrMove>(*this, lib,
+      "create_render_image", SideEffects::modifyExternal, "create_render_image")
+      ->args({"width", "height"});
+
+    addExtern<DAS_BIND_FUN(render_to_image)>(*this, lib, "render_to_image", SideEffects::worstDefault, "render_to_image")
+      ->args({"image", "block", "context", "at"});
+
+    addExtern<DAS_BIND_FUN(clear_render_image)>(*this, lib,
+      "clear_render_image", SideEffects::modifyArgumentAndExternal, "clear_render_image")
+      ->args({"image", "color"});
+
+    addExtern<DAS_BIND_FUN(create_shader), SimNode_ExtFuncCallAndCopyOrMove>(*this, lib,
+      "create_shader", SideEffects::modifyExternal, "create_shader")
+      ->args({"vertex_source", "fragment_source"});
+
+    addExtern<DAS_BIND_FUN(set_shader)>(*this, lib, "set_shader", SideEffects::modifyExternal, "set_shader")
+      ->args({"shader"});
+
+    addExtern<DAS_BIND_FUN(reset_shader)>(*this, lib, "reset_shader", SideEffects::modifyExternal, "reset_shader");
+
+    addExtern<DAS_BIND_FUN(set_post_effect)>(*this, lib, "set_post_effect", SideEffects::modifyExternal, "set_post_effect")
+      ->args({"shader"});
+
+    addExtern<DAS_BIND_FUN(reset_post_effect)>(*this, lib,
+      "reset_post_effect", SideEffects::modifyExternal, "reset_post_effect");
+
+    addExtern<DAS_BIND_FUN(set_shader_uniform_f)>(*this, lib,
+      "set_shader_uniform", SideEffects::modifyArgumentAndExternal, "set_shader_uniform_f")
+      ->args({"shader", "name", "value"});
+
+    addExtern<DAS_BIND_FUN(set_shader_uniform_f2)>(*this, lib,
+      "set_shader_uniform", SideEffects::modifyArgumentAndExternal, "set_shader_uniform_f2")
+      ->args({"shader", "name", "value"});
+
+    addExtern<DAS_BIND_FUN(set_shader_uniform_f3)>(*this, lib,
+      "set_shader_uniform", SideEffects::modifyArgumentAndExternal, "set_shader_uniform_f3")
+      ->args({"shader", "name", "value"});
+
+    addExtern<DAS_BIND_FUN(set_shader_uniform_f4)>(*this, lib,
+      "set_shader_uniform", SideEffects::modifyArgumentAndExternal, "set_shader_uniform_f4")
+      ->args({"shader", "name", "value"});
+
+    addExtern<DAS_BIND_FUN(set_shader_uniform_i)>(*this, lib,
+      "set_shader_uniform", SideEffects::modifyArgumentAndExternal, "set_shader_uniform_i")
+      ->args({"shader", "name", "value"});
+
+    addExtern<DAS_BIND_FUN(set_shader_uniform_image)>(*this, lib,
+      "set_shader_uniform", SideEffects::modifyArgumentAndExternal, "set_shader_uniform_image")
+      ->args({"shader", "name", "image"});
+
+    addExtern<DAS_BIND_FUN(set_shader_uniform_current_texture)>(*this, lib,
+      "set_shader_uniform_current_texture", SideEffects::modifyArgumentAndExternal, "set_shader_uniform_current_texture")
+      ->args({"shader", "name"});
+
+    addExtern<DAS_BIND_FUN(draw_image_region)>(*this, lib,
+      "draw_image_region", SideEffects::modifyExternal, "draw_image_region")
+      ->args({"image", "x", "y", "src_rect"});
+
+    addExtern<DAS_BIND_FUN(draw_image_region_cs)>(*this, lib,
+      "draw_image_region", SideEffects::modifyExternal, "draw_image_region_cs")
+      ->args({"image", "x", "y", "src_rect", "color", "size"});
+
+    addExtern<DAS_BIND_FUN(draw_image_region_t)>(*this, lib,
+      "draw_image_region", SideEffects::modifyExternal, "draw_image_region_t")
+      ->args({"image", "x", "y", "src_rect", "color", "size", "angle", "origin"});
+
+    accept_temporary_arrays(addExtern<DAS_BIND_FUN(draw_image_instanced)>(*this, lib,
+      "draw_image_instanced", SideEffects::modifyExternal, "draw_image_instanced")
+      ->args({"image", "positions", "colors", "scales"}), {1, 2, 3});
+
     addExtern<DAS_BIND_FUN(draw_image_i)>(*this, lib, "draw_image", SideEffects::modifyExternal, "draw_image_i")
       ->args({"image", "x", "y"});
 
@@ -1313,15 +4198,38 @@ public:
       "get_image_data", SideEffects::modifyArgumentAndExternal, "get_image_data")
       ->args({"image", "out_pixels"});
 
-    addExtern<DAS_BIND_FUN(set_image_data)>(*this, lib, "set_image_data", SideEffects::modifyExternal, "set_image_data")
-      ->args({"image", "pixels"});
+    accept_temporary_arrays(addExtern<DAS_BIND_FUN(set_image_data)>(*this, lib, "set_image_data", SideEffects::modifyExternal, "set_image_data")
+      ->args({"image", "pixels"}), {1});
 
-    addExtern<DAS_BIND_FUN(set_image_pixel)>(*this, lib, "set_pixel", SideEffects::modifyExternal, "set_pixel")
+    addExtern<DAS_BIND_FUN(set_image_pixel)>(*this, lib, "set_pixel", SideEffects::modifyExternal, "set_image_pixel")
       ->args({"image", "x", "y", "color"});
 
-    addExtern<DAS_BIND_FUN(get_image_pixel)>(*this, lib, "get_pixel", SideEffects::accessExternal, "get_pixel")
+    addExtern<DAS_BIND_FUN(get_image_pixel)>(*this, lib, "get_pixel", SideEffects::accessExternal, "get_image_pixel")
       ->args({"image", "x", "y"});
 
+    addExtern<DAS_BIND_FUN(with_image_pixels)>(*this, lib,
+      "with_image_pixels", SideEffects::worstDefault, "with_image_pixels")
+      ->args({"image", "block", "context", "at"});
+
+    addExtern<DAS_BIND_FUN(with_frame_float2_array)>(*this, lib,
+      "with_frame_float2_array", SideEffects::invoke, "with_frame_float2_array")
+      ->args({"count", "block", "context", "at"});
+
+    addExtern<DAS_BIND_FUN(with_frame_float_array)>(*this, lib,
+      "with_frame_float_array", SideEffects::invoke, "with_frame_float_array")
+      ->args({"count", "block", "context", "at"});
+
+    addExtern<DAS_BIND_FUN(with_frame_uint_array)>(*this, lib,
+      "with_frame_uint_array", SideEffects::invoke, "with_frame_uint_array")
+      ->args({"count", "block", "context", "at"});
+
+    addExtern<DAS_BIND_FUN(with_frame_int_array)>(*this, lib,
+      "with_frame_int_array", SideEffects::invoke, "with_frame_int_array")
+      ->args({"count", "block", "context", "at"});
+
+    addExtern<DAS_BIND_FUN(arena::get_frame_arena_stats), SimNode_ExtFuncCallAndCopyOrMove>(*this, lib,
+      "get_frame_arena_stats", SideEffects::accessExternal, "arena::get_frame_arena_stats");
+
 
     compileBuiltinModule("graphics.das", (unsigned char *)graphics_das, sizeof(graphics_das));
 
@@ -1330,6 +4238,7 @@ public:
 
   virtual ModuleAotType aotRequire(TextWriter & tw) const override
   {
+    tw << "#include \"graphics.h\"\n";
     return ModuleAotType::cpp;
   }
 };
@@ -5,8 +5,14 @@ require math
 require strings
 
 def create_image(width, height: int; pixels: string; palette: table<int; uint>&): Image
-    var p <- [{for c in pixels; palette?[c] ?? 0u}]
-    return <- create_image(width, height, p)
+    var res: Image
+    with_frame_uint_array(length(pixels)) <| $(p)
+        var i = 0
+        for c in pixels
+            p[i] = palette?[c] ?? 0u
+            i++
+        res <- create_image(width, height, p)
+    return <- res
 
 def make_color(brightness: float): uint
     let ib = uint(saturate(brightness) * 255.0 + 0.5)
@@ -102,4 +108,13 @@ def add_colors(c1, c2: uint): uint
     let a = min(a1 + a2, 255u)
     return b | (g << 8u) | (r << 16u) | (a << 24u)
 
+def create_mesh(primitive: int; coord: array<float2>; colors: array<uint>): Mesh
+    return <- create_mesh(primitive, coord, colors, false)
+
+def create_mesh(primitive: int; coord: array<float2>; color: uint): Mesh
+    return <- create_mesh(primitive, coord, color, false)
+
+def create_mesh(primitive: int; coord: array<float2>; uv: array<float2>; colors: array<uint>): Mesh
+    return <- create_mesh(primitive, coord, uv, colors, false)
+
 )X"
\ No newline at end of file
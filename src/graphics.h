@@ -1,9 +1,483 @@
 #pragma once
 
+#include <stdint.h>
+#include <algorithm>
+#include <SFML/Graphics/Rect.hpp>
+#include <daScript/daScript.h>
+
+namespace sf
+{
+  class Image;
+  class Texture;
+  class Shader;
+  class RenderTexture;
+}
+
 namespace graphics
 {
   void initialize();
   void finalize();
+  void reset_frame_render_stats(); // at the start of the frame, before act(), uploads in act() belong to the frame
   void on_graphics_frame_start();
+  void on_graphics_frame_end();
   void delete_allocated_images();
+  const sf::Shader * get_post_effect_shader(); // applied to the blit of the upscaled render target
+
+  // vertices of many lines of text kept between frames and drawn in one call, for the log screen
+  struct TextBlock;
+  TextBlock * create_text_block();
+  void delete_text_block(TextBlock * block);
+  void clear_text_block(TextBlock * block);
+  void add_text_to_block(TextBlock * block, float x, float y, const char * str, uint32_t color); // current font
+  void draw_text_block(const TextBlock * block);
 }
+
+
+// types and functions bound to script are declared here for the AOT generated code
+
+struct AtlasTexture;
+struct MeshData;
+struct ShaderData;
+struct TilemapData;
+
+struct ImageAtlas
+{
+  AtlasTexture * atlas;
+
+  bool isValid() const
+  {
+    return !!atlas;
+  }
+
+  int getWidth() const;
+  int getHeight() const;
+
+  ImageAtlas()
+  {
+    atlas = nullptr;
+  }
+
+  ImageAtlas(const ImageAtlas & b);
+
+  ImageAtlas(ImageAtlas && b)
+  {
+    atlas = b.atlas;
+    b.atlas = nullptr;
+  }
+
+  ImageAtlas& operator=(const ImageAtlas & b);
+  ImageAtlas& operator=(ImageAtlas && b);
+  ~ImageAtlas();
+};
+
+
+// vertices uploaded to the GPU once, drawn with a transform
+struct Mesh
+{
+  MeshData * mesh;
+
+  bool isValid() const
+  {
+    return !!mesh;
+  }
+
+  int getVertexCount() const;
+
+  Mesh()
+  {
+    mesh = nullptr;
+  }
+
+  Mesh(const Mesh & b);
+
+  Mesh(Mesh && b)
+  {
+    mesh = b.mesh;
+    b.mesh = nullptr;
+  }
+
+  Mesh& operator=(const Mesh & b);
+  Mesh& operator=(Mesh && b);
+  ~Mesh();
+};
+
+
+// GLSL shader applied to the following draws or to the whole screen
+struct Shader
+{
+  ShaderData * shader;
+
+  bool isValid() const
+  {
+    return !!shader;
+  }
+
+  Shader()
+  {
+    shader = nullptr;
+  }
+
+  Shader(const Shader & b);
+
+  Shader(Shader && b)
+  {
+    shader = b.shader;
+    b.shader = nullptr;
+  }
+
+  Shader& operator=(const Shader & b);
+  Shader& operator=(Shader && b);
+  ~Shader();
+};
+
+
+// grid of tile indices, drawn with tiles of a tileset image
+struct Tilemap
+{
+  TilemapData * tilemap;
+
+  bool isValid() const
+  {
+    return !!tilemap;
+  }
+
+  int getWidth() const;
+  int getHeight() const;
+  int getTileWidth() const;
+  int getTileHeight() const;
+
+  Tilemap()
+  {
+    tilemap = nullptr;
+  }
+
+  Tilemap(const Tilemap & b);
+
+  Tilemap(Tilemap && b)
+  {
+    tilemap = b.tilemap;
+    b.tilemap = nullptr;
+  }
+
+  Tilemap& operator=(const Tilemap & b);
+  Tilemap& operator=(Tilemap && b);
+  ~Tilemap();
+};
+
+
+// counters of the last finished frame, texture uploads include image creation and changes of the pixels
+struct RenderStats
+{
+  int drawCalls;
+  int vertices;
+  int textureBinds;
+  int textureUploads;
+  int64_t uploadedBytes;
+};
+
+
+// image has its own texture 'tex' or, after add_image, a region of shared 'atlas' texture
+struct Image
+{
+  sf::Image * img;
+  sf::Texture * tex;
+  sf::RenderTexture * target; // owns 'tex' of images created by create_render_image
+  AtlasTexture * atlas;
+  uint32_t * cached_pixels;
+  int width;
+  int height;
+  int atlasX;
+  int atlasY;
+  bool applied;
+  // region of 'img' that differs from the texture, valid while !applied
+  int dirtyLeft;
+  int dirtyTop;
+  int dirtyRight;
+  int dirtyBottom;
+  bool targetDrawn; // render image: 'target' was drawn to after 'img' was read back
+
+  bool isValid() const
+  {
+    return !!img;
+  }
+
+  int getWidth() const
+  {
+    return width;
+  }
+
+  int getHeight() const
+  {
+    return height;
+  }
+
+  const sf::Texture * getTexture() const;
+
+  sf::FloatRect getTextureRect() const
+  {
+    return sf::FloatRect((float)atlasX, (float)atlasY, (float)width, (float)height);
+  }
+
+  void invalidateRect(int x, int y, int w, int h)
+  {
+    if (applied)
+    {
+      applied = false;
+      dirtyLeft = x;
+      dirtyTop = y;
+      dirtyRight = x + w;
+      dirtyBottom = y + h;
+    }
+    else
+    {
+      dirtyLeft = std::min(dirtyLeft, x);
+      dirtyTop = std::min(dirtyTop, y);
+      dirtyRight = std::max(dirtyRight, x + w);
+      dirtyBottom = std::max(dirtyBottom, y + h);
+    }
+  }
+
+  void invalidate()
+  {
+    invalidateRect(0, 0, width, height);
+  }
+
+  void resetDirtyRect()
+  {
+    dirtyLeft = 0;
+    dirtyTop = 0;
+    dirtyRight = 0;
+    dirtyBottom = 0;
+  }
+
+  Image()
+  {
+    applied = false;
+    targetDrawn = false;
+    resetDirtyRect();
+    img = nullptr;
+    tex = nullptr;
+    target = nullptr;
+    atlas = nullptr;
+    cached_pixels = nullptr;
+    width = 0;
+    height = 0;
+    atlasX = 0;
+    atlasY = 0;
+  }
+
+  Image(const Image & b)
+  {
+    copyFrom(b);
+  }
+
+  Image(Image && b)
+  {
+    moveFrom(b);
+  }
+
+  Image& operator=(const Image & b)
+  {
+    if (this != &b)
+    {
+      release();
+      copyFrom(b);
+    }
+    return *this;
+  }
+
+  Image& operator=(Image && b);
+
+  ~Image()
+  {
+    release();
+  }
+
+  void copyFrom(const Image & b);
+
+  void moveFrom(Image & b)
+  {
+    img = b.img;
+    tex = b.tex;
+    target = b.target;
+    atlas = b.atlas;
+    cached_pixels = b.cached_pixels;
+    width = b.width;
+    height = b.height;
+    atlasX = b.atlasX;
+    atlasY = b.atlasY;
+    applied = b.applied;
+    dirtyLeft = b.dirtyLeft;
+    dirtyTop = b.dirtyTop;
+    dirtyRight = b.dirtyRight;
+    dirtyBottom = b.dirtyBottom;
+    targetDrawn = b.targetDrawn;
+
+    b.width = 0;
+    b.height = 0;
+    b.img = nullptr;
+    b.tex = nullptr;
+    b.target = nullptr;
+    b.atlas = nullptr;
+    b.cached_pixels = nullptr;
+  }
+
+  void releaseTexture();
+  void release();
+};
+
+
+typedef das::float2 PointsType_2[2];
+typedef das::float2 PointsType_3[3];
+typedef das::float2 PointsType_4[4];
+typedef das::float2 PointsType_5[5];
+typedef das::float2 PointsType_6[6];
+typedef das::float2 PointsType_7[7];
+typedef das::float2 PointsType_8[8];
+
+int get_screen_width();
+int get_screen_height();
+int get_desktop_width();
+int get_desktop_height();
+void set_view(das::float2 offset, float zoom);
+void reset_view();
+das::float2 get_view_offset();
+float get_view_zoom();
+das::float2 screen_to_world(das::float2 p);
+das::float2 world_to_screen(das::float2 p);
+void set_pixel(float x, float y, uint32_t color);
+void set_pixel_i(int x, int y, uint32_t color);
+void fill_rect(float x, float y, float width, float height, uint32_t color);
+void fill_rect_i(int x, int y, int width, int height, uint32_t color);
+void rect(float x, float y, float width, float height, uint32_t color);
+void rect_i(int x, int y, int width, int height, uint32_t color);
+void text_out(float x, float y, const char * str, uint32_t color);
+void text_out_i(int x, int y, const char * str, uint32_t color);
+int get_text_cache_hits();
+int get_text_cache_misses();
+RenderStats get_render_stats();
+das::float2 get_text_size(const char * str);
+void line(float x0, float y0, float x1, float y1, uint32_t color);
+void line_i(int x0, int y0, int x1, int y1, uint32_t color);
+void circle(float x, float y, float radius, uint32_t color);
+void circle_i(int x, int y, int radius, uint32_t color);
+void fill_circle(float x, float y, float radius, uint32_t color);
+void fill_circle_i(int x, int y, int radius, uint32_t color);
+void fill_circle_instanced(const das::TArray<das::float2> & positions, const das::TArray<float> & radii,
+  const das::TArray<uint32_t> & colors);
+void fill_circle_instanced_rc(const das::TArray<das::float2> & positions, float radius, uint32_t color);
+void polygon(const das::TArray<das::float2> & points, uint32_t color);
+void polygon2(const PointsType_2 & points, uint32_t color);
+void polygon3(const PointsType_3 & points, uint32_t color);
+void polygon4(const PointsType_4 & points, uint32_t color);
+void polygon5(const PointsType_5 & points, uint32_t color);
+void polygon6(const PointsType_6 & points, uint32_t color);
+void polygon7(const PointsType_7 & points, uint32_t color);
+void polygon8(const PointsType_8 & points, uint32_t color);
+void fill_convex_polygon(const das::TArray<das::float2> & points, uint32_t color);
+void fill_convex_polygon2(const PointsType_2 & points, uint32_t color);
+void fill_convex_polygon3(const PointsType_3 & points, uint32_t color);
+void fill_convex_polygon4(const PointsType_4 & points, uint32_t color);
+void fill_convex_polygon5(const PointsType_5 & points, uint32_t color);
+void fill_convex_polygon6(const PointsType_6 & points, uint32_t color);
+void fill_convex_polygon7(const PointsType_7 & points, uint32_t color);
+void fill_convex_polygon8(const PointsType_8 & points, uint32_t color);
+void set_font_name(const char * name);
+void set_font_size(float size);
+void set_font_size_i(int size);
+void enable_premultiplied_alpha_blend();
+void enable_alpha_blend();
+void disable_alpha_blend();
+void flip_image_x(Image & image);
+void flip_image_y(Image & image);
+void set_image_smooth(Image & image, bool smooth);
+void set_image_mipmap(Image & image, bool enable);
+void set_image_clamp(Image & image, bool clamp);
+Image create_image_wh(int width, int height);
+Image create_image(int width, int height, const das::TArray<uint32_t> & pixels);
+Image create_image_from_file(const char * file_name);
+ImageAtlas create_image_atlas(int width, int height);
+bool add_image_to_atlas(ImageAtlas & atlas, Image & image);
+void set_atlas_smooth(ImageAtlas & atlas, bool smooth);
+int load_image_async(const char * file_name);
+void create_images_from_files(das::TArray<Image> & images, const das::TArray<char *> & file_names,
+  das::Context * context, das::LineInfoArg * at);
+int load_thumbnail_async(const char * file_name, int max_width, int max_height);
+bool is_image_loaded(int handle);
+Image take_loaded_image(int handle);
+void draw_quad(const Image & image, das::float2 p0, das::float2 p1, das::float2 p2, das::float2 p3, uint32_t color);
+void draw_quad_a(const Image & image, das::float2 p[4], uint32_t color);
+void draw_triangle_strip(const Image & image,
+  const das::TArray<das::float2> & coord, const das::TArray<das::float2> & uv);
+void draw_triangle_strip_color(const Image & image,
+  const das::TArray<das::float2> & coord, const das::TArray<das::float2> & uv, uint32_t color);
+void draw_triangle_strip_color_a(const Image & image,
+  const das::TArray<das::float2> & coord, const das::TArray<das::float2> & uv, const das::TArray<uint32_t> & colors);
+Mesh create_mesh(int primitive, const das::TArray<das::float2> & coord, const das::TArray<uint32_t> & colors,
+  bool dynamic_usage);
+Mesh create_mesh_c(int primitive, const das::TArray<das::float2> & coord, uint32_t color, bool dynamic_usage);
+Mesh create_mesh_uv(int primitive, const das::TArray<das::float2> & coord, const das::TArray<das::float2> & uv,
+  const das::TArray<uint32_t> & colors, bool dynamic_usage);
+void update_mesh(Mesh & mesh, const das::TArray<das::float2> & coord, const das::TArray<uint32_t> & colors);
+void update_mesh_uv(Mesh & mesh, const das::TArray<das::float2> & coord, const das::TArray<das::float2> & uv,
+  const das::TArray<uint32_t> & colors);
+void draw_mesh(const Mesh & mesh, float x, float y);
+void draw_mesh_t(const Mesh & mesh, float x, float y, float angle, das::float2 scale);
+void draw_mesh_image_t(const Image & image, const Mesh & mesh, float x, float y, float angle, das::float2 scale);
+Tilemap create_tilemap(int width, int height, int tile_width, int tile_height);
+void set_tile(Tilemap & tilemap, int x, int y, int tile);
+int get_tile(const Tilemap & tilemap, int x, int y);
+void set_tiles(Tilemap & tilemap, const das::TArray<int> & tiles);
+void draw_tilemap(const Image & tileset, const Tilemap & tilemap, float x, float y);
+Shader create_shader(const char * vertex_source, const char * fragment_source);
+void set_shader(const Shader & shader);
+void reset_shader();
+void set_post_effect(const Shader & shader);
+void reset_post_effect();
+void set_shader_uniform_f(Shader & shader, const char * name, float value);
+void set_shader_uniform_f2(Shader & shader, const char * name, das::float2 value);
+void set_shader_uniform_f3(Shader & shader, const char * name, das::float3 value);
+void set_shader_uniform_f4(Shader & shader, const char * name, das::float4 value);
+void set_shader_uniform_i(Shader & shader, const char * name, int value);
+void set_shader_uniform_image(Shader & shader, const char * name, const Image & image);
+void set_shader_uniform_current_texture(Shader & shader, const char * name);
+void set_image_streaming(Image & image, int buffer_count);
+Image create_render_image(int width, int height);
+void render_to_image(Image & image, const das::TBlock<void> & block, das::Context * context, das::LineInfoArg * at);
+void clear_render_image(Image & image, uint32_t color);
+void draw_image_region_t(const Image & image, float x, float y, das::float4 src, uint32_t color, das::float2 size,
+  float angle, das::float2 origin);
+void draw_image_region_cs(const Image & image, float x, float y, das::float4 src, uint32_t color, das::float2 size);
+void draw_image_region(const Image & image, float x, float y, das::float4 src);
+void draw_image_instanced(const Image & image, const das::TArray<das::float2> & positions,
+  const das::TArray<uint32_t> & colors, const das::TArray<float> & scales);
+void draw_image(const Image & image, float x, float y);
+void draw_image_c(const Image & image, float x, float y, uint32_t color);
+void draw_image_cs(const Image & image, float x, float y, uint32_t color, float size);
+void draw_image_cs2(const Image & image, float x, float y, uint32_t color, das::float2 size);
+void draw_image_i(const Image & image, int x, int y);
+void draw_image_ci(const Image & image, int x, int y, uint32_t color);
+void draw_image_csi(const Image & image, int x, int y, uint32_t color, int size);
+void draw_image_cs2i(const Image & image, int x, int y, uint32_t color, das::int2 size);
+void premultiply_alpha(Image & image);
+void make_image_color_transparent(Image & image, uint32_t color);
+void get_image_data(const Image & b, das::TArray<uint32_t> & out_pixels);
+void set_image_data(Image & b, const das::TArray<uint32_t> & pixels);
+void set_image_pixel(Image & b, int x, int y, uint32_t color);
+uint32_t get_image_pixel(const Image & b, int x, int y);
+void with_image_pixels(Image & image, const das::TBlock<void, das::TTemporary<das::TArray<uint32_t>>> & block,
+  das::Context * context, das::LineInfoArg * at);
+
+// zeroed arrays in the frame arena, no allocations in the context heap
+void with_frame_float2_array(int count, const das::TBlock<void, das::TTemporary<das::TArray<das::float2>>> & block,
+  das::Context * context, das::LineInfoArg * at);
+void with_frame_float_array(int count, const das::TBlock<void, das::TTemporary<das::TArray<float>>> & block,
+  das::Context * context, das::LineInfoArg * at);
+void with_frame_uint_array(int count, const das::TBlock<void, das::TTemporary<das::TArray<uint32_t>>> & block,
+  das::Context * context, das::LineInfoArg * at);
+void with_frame_int_array(int count, const das::TBlock<void, das::TTemporary<das::TArray<int>>> & block,
+  das::Context * context, das::LineInfoArg * at);
+
+// marks the array arguments of the binding as implicit, so the arrays of with_frame_*_array and
+// with_image_pixels can be passed to it
+void accept_temporary_arrays(das::BuiltInFunction * fn, std::initializer_list<int> args);
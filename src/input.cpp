@@ -3,6 +3,10 @@
 #include <SFML/Graphics.hpp>
 #include <SFML/System.hpp>
 #include <vector>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
 
 using namespace das;
 using namespace std;
@@ -25,12 +29,13 @@ static vector<uint32_t> entered_symbols;
 
 static char key[KEY_COUNT] = { 0 };
 static char mouse_button[MOUSE_BUTTONS_COUNT] = { 0 };
-//static char gamepad_button[GAMEPAD_BUTTONS_COUNT] = { 0 };
-//static HumanInput::JoystickRawState cur_joystick_raw_state;
+// buttons of the first gamepad are also in key[256 + button]
+static char gamepad_button[MAX_GAMEPADS][GAMEPAD_BUTTONS_COUNT] = { { 0 } };
+static bool gamepad_connected[MAX_GAMEPADS] = { false };
 static float mouse_scroll_accum = 0;
 static int last_key_index = -1;
 static bool is_last_key_repeat = false;
-static float gamepad_axes[GAMEPAD_AXES] = { 0 };
+static float gamepad_axes[MAX_GAMEPADS][GAMEPAD_AXES] = { { 0 } };
 
 static float mouse_vel_x = 0.f;
 static float mouse_vel_y = 0.f;
@@ -39,10 +44,49 @@ static float mouse_dy = 0.f;
 static float mouse_x = 0.f;
 static float mouse_y = 0.f;
 
+static sf::Clock input_clock;
+static vector<InputEvent> input_events; // cleared after each act() in consume_input_events
+
+// time of the event is the time when it is fetched from the window, not the time of the OS event
+static void add_input_event(int type, int code, float value = 0.0f, int device = 0, double time = -1.0)
+{
+  if (input_events.size() >= MAX_INPUT_EVENTS)
+    return;
+  InputEvent e;
+  e.type = type;
+  e.code = code;
+  e.value = value;
+  e.device = device;
+  e.time = time >= 0.0 ? time : get_input_time();
+  input_events.push_back(e);
+}
+
+double get_input_time()
+{
+  return double(input_clock.getElapsedTime().asMicroseconds()) * 1e-6;
+}
+
+int get_input_event_count()
+{
+  return int(input_events.size());
+}
+
+const InputEvent * get_input_event(int index)
+{
+  if (index < 0 || index >= int(input_events.size()))
+    return nullptr;
+  return &input_events[index];
+}
+
+void consume_input_events()
+{
+  input_events.clear();
+}
+
 void reset_input()
 {
   memset(mouse_button, 0, sizeof(mouse_button));
-//  memset(gamepad_button, 0, sizeof(gamepad_button));
+  memset(gamepad_button, 0, sizeof(gamepad_button));
   memset(key, 0, sizeof(key));
   memset(gamepad_axes, 0, sizeof(gamepad_axes));
   mouse_scroll_accum = 0;
@@ -63,6 +107,7 @@ void reset_input()
   }
 
   entered_symbols.clear();
+  input_events.clear();
 }
 
 static void post_update_keys(char * keys, int count)
@@ -205,9 +250,44 @@ void set_relative_mouse_movement(bool is_relative)
 
 float get_axis(int axis)
 {
-  if (axis < AXIS_CODE_OFFSET || axis >= AXIS_CODE_OFFSET + GAMEPAD_AXES)
+  return get_gamepad_axis(0, axis);
+}
+
+float get_gamepad_axis(int gamepad, int axis)
+{
+  if (gamepad < 0 || gamepad >= MAX_GAMEPADS || axis < AXIS_CODE_OFFSET || axis >= AXIS_CODE_OFFSET + GAMEPAD_AXES)
     return 0.0f;
-  return gamepad_axes[axis - AXIS_CODE_OFFSET];
+  return gamepad_axes[gamepad][axis - AXIS_CODE_OFFSET];
+}
+
+bool get_gamepad_button_down(int gamepad, int button_idx)
+{
+  if (gamepad < 0 || gamepad >= MAX_GAMEPADS || button_idx < 0 || button_idx >= GAMEPAD_BUTTONS_COUNT)
+    return false;
+  char s = gamepad_button[gamepad][button_idx];
+  return s == K_PRESSED_THIS_FRAME || s == K_CLICKED_THIS_FRAME;
+}
+
+bool get_gamepad_button(int gamepad, int button_idx)
+{
+  if (gamepad < 0 || gamepad >= MAX_GAMEPADS || button_idx < 0 || button_idx >= GAMEPAD_BUTTONS_COUNT)
+    return false;
+  return gamepad_button[gamepad][button_idx] == K_PRESSED || get_gamepad_button_down(gamepad, button_idx);
+}
+
+bool get_gamepad_button_up(int gamepad, int button_idx)
+{
+  if (gamepad < 0 || gamepad >= MAX_GAMEPADS || button_idx < 0 || button_idx >= GAMEPAD_BUTTONS_COUNT)
+    return false;
+  char s = gamepad_button[gamepad][button_idx];
+  return s == K_RELEASED_THIS_FRAME || s == K_CLICKED_THIS_FRAME;
+}
+
+bool is_gamepad_connected(int gamepad)
+{
+  if (gamepad < 0 || gamepad >= MAX_GAMEPADS)
+    return false;
+  return gamepad_connected[gamepad];
 }
 
 
@@ -215,7 +295,7 @@ void release_input()
 {
   release_input(key, countof(key));
   release_input(mouse_button, countof(mouse_button));
-//  release_input(gamepad_button, countof(gamepad_button));
+  release_input(&gamepad_button[0][0], MAX_GAMEPADS * GAMEPAD_BUTTONS_COUNT);
 }
 
 void update_mouse_input(float dt, bool active)
@@ -285,24 +365,31 @@ void post_update_input()
   mouse_scroll_accum = 0;
   post_update_keys(key, countof(key));
   post_update_keys(mouse_button, countof(mouse_button));
-//  post_update_keys(gamepad_button, countof(gamepad_button));
+  post_update_keys(&gamepad_button[0][0], MAX_GAMEPADS * GAMEPAD_BUTTONS_COUNT);
 }
 
 void gmc_mouse_button_down(int btn_idx)
 {
   if (btn_idx >= 0 && btn_idx< MOUSE_BUTTONS_COUNT)
+  {
     mouse_button[btn_idx] = next_state_after_press(mouse_button[btn_idx]);
+    add_input_event(INPUT_EVENT_MOUSE_DOWN, btn_idx + MOUSE_CODE_OFFSET);
+  }
 }
 
 void gmc_mouse_button_up(int btn_idx)
 {
   if (btn_idx >= 0 && btn_idx < MOUSE_BUTTONS_COUNT)
+  {
     mouse_button[btn_idx] = next_state_after_release(mouse_button[btn_idx]);
+    add_input_event(INPUT_EVENT_MOUSE_UP, btn_idx + MOUSE_CODE_OFFSET);
+  }
 }
 
 void gmc_mouse_wheel(float scroll)
 {
   mouse_scroll_accum += scroll;
+  add_input_event(INPUT_EVENT_MOUSE_WHEEL, 0, scroll);
 }
 
 void gkc_button_down(int btn_idx)
@@ -312,7 +399,10 @@ void gkc_button_down(int btn_idx)
   is_any_key_down = true;
   last_key_index = btn_idx;
   if (btn_idx >= 0 && btn_idx < DKEY__MAX_BUTTONS)
+  {
     key[btn_idx] = next_state_after_press(key[btn_idx]);
+    add_input_event(INPUT_EVENT_KEY_DOWN, btn_idx + KEY_CODE_OFFSET);
+  }
 }
 
 void gkc_symbol_entered(uint32_t code)
@@ -326,31 +416,248 @@ void gkc_button_up(int btn_idx)
   if (btn_idx == last_key_index)
     last_key_index = -1;
   if (btn_idx >= 0 && btn_idx < DKEY__MAX_BUTTONS)
+  {
     key[btn_idx] = next_state_after_release(key[btn_idx]);
+    add_input_event(INPUT_EVENT_KEY_UP, btn_idx + KEY_CODE_OFFSET);
+  }
 }
 
-void joy_button_down(int btn_idx)
+void joy_connected(int gamepad, bool connected)
 {
-  if (btn_idx >= 0 && btn_idx < GAMEPAD_BUTTONS_COUNT)
-    key[btn_idx + 256] = next_state_after_press(key[btn_idx + 256]);
+  if (gamepad < 0 || gamepad >= MAX_GAMEPADS)
+    return;
+  gamepad_connected[gamepad] = connected;
+  if (connected)
+    return;
+
+  for (int i = 0; i < GAMEPAD_BUTTONS_COUNT; i++)
+    if (get_gamepad_button(gamepad, i))
+      joy_button_up(gamepad, i);
+  for (int i = 0; i < GAMEPAD_AXES; i++)
+    gamepad_axes[gamepad][i] = 0.0f;
 }
 
-void joy_button_up(int btn_idx)
+void joy_button_down(int gamepad, int btn_idx, double time)
 {
-  if (btn_idx >= 0 && btn_idx < GAMEPAD_BUTTONS_COUNT)
-    key[btn_idx + 256] = next_state_after_release(key[btn_idx + 256]);
+  if (gamepad >= 0 && gamepad < MAX_GAMEPADS && btn_idx >= 0 && btn_idx < GAMEPAD_BUTTONS_COUNT)
+  {
+    gamepad_button[gamepad][btn_idx] = next_state_after_press(gamepad_button[gamepad][btn_idx]);
+    if (gamepad == 0)
+      key[btn_idx + 256] = next_state_after_press(key[btn_idx + 256]);
+    add_input_event(INPUT_EVENT_GAMEPAD_DOWN, btn_idx + 256 + KEY_CODE_OFFSET, 0.0f, gamepad, time);
+  }
 }
 
-void joy_axis_position(int axis_idx, float axis_pos)
+void joy_button_up(int gamepad, int btn_idx, double time)
 {
-  if (axis_idx >= 0 && axis_idx < GAMEPAD_AXES)
+  if (gamepad >= 0 && gamepad < MAX_GAMEPADS && btn_idx >= 0 && btn_idx < GAMEPAD_BUTTONS_COUNT)
   {
+    gamepad_button[gamepad][btn_idx] = next_state_after_release(gamepad_button[gamepad][btn_idx]);
+    if (gamepad == 0)
+      key[btn_idx + 256] = next_state_after_release(key[btn_idx + 256]);
+    add_input_event(INPUT_EVENT_GAMEPAD_UP, btn_idx + 256 + KEY_CODE_OFFSET, 0.0f, gamepad, time);
+  }
+}
+
+void joy_axis_position(int gamepad, int axis_idx, float axis_pos, double time)
+{
+  if (gamepad >= 0 && gamepad < MAX_GAMEPADS && axis_idx >= 0 && axis_idx < GAMEPAD_AXES)
+  {
+    if (axis_idx == sf::Joystick::Axis::PovX)
+      axis_pos = sign(axis_pos) * (fabs(axis_pos) < 50.0f ? 0.0f : 100.0f);
+    if (axis_idx == sf::Joystick::Axis::PovY)
+      axis_pos = sign(axis_pos) * (fabs(axis_pos) < 50.0f ? 0.0f : -100.0f);
+
     if (fabs(axis_pos) < 1.0f)
       axis_pos = 0.0f;
     else
       axis_pos = sign(axis_pos) * (fabsf(axis_pos) - 1.0f) * (1.f / 99.f);
-    gamepad_axes[axis_idx] = ::clamp(axis_pos, -1.0f, 1.0f);
+    axis_pos = ::clamp(axis_pos, -1.0f, 1.0f);
+    if (gamepad_axes[gamepad][axis_idx] == axis_pos)
+      return;
+    gamepad_axes[gamepad][axis_idx] = axis_pos;
+    add_input_event(INPUT_EVENT_AXIS, axis_idx + AXIS_CODE_OFFSET, axis_pos, gamepad, time);
   }
 }
 
+
+//----- input thread -----
+
+struct GamepadSample
+{
+  bool connected;
+  uint32_t buttons;
+  uint8_t pressCount[GAMEPAD_BUTTONS_COUNT]; // presses shorter than a frame are not lost
+  double pressTime[GAMEPAD_BUTTONS_COUNT];
+  double releaseTime[GAMEPAD_BUTTONS_COUNT];
+  float axes[sf::Joystick::AxisCount];
+  double axisTime[sf::Joystick::AxisCount];
+};
+
+struct GamepadSnapshot
+{
+  GamepadSample pads[MAX_GAMEPADS];
+};
+
+#define SNAPSHOT_NEW 4
+
+// triple buffer: the thread writes 'snapshots[back]', the main thread reads 'snapshots[front]',
+// 'snapshot_middle' is the index of the third one, exchanged by both sides
+static GamepadSnapshot snapshots[3];
+static atomic<int> snapshot_middle(1);
+static int snapshot_back = 0;  // input thread
+static int snapshot_front = 2; // main thread
+static GamepadSnapshot applied_snapshot; // main thread
+
+static mutex joystick_mutex;
+static thread input_thread;
+static atomic<bool> input_thread_stop(false);
+static bool input_thread_running = false;
+
+static void sample_gamepads(GamepadSnapshot & s)
+{
+  lock_guard<mutex> lock(joystick_mutex);
+  sf::Joystick::update();
+  double t = get_input_time();
+  for (int d = 0; d < MAX_GAMEPADS && d < int(sf::Joystick::Count); d++)
+  {
+    GamepadSample & pad = s.pads[d];
+    pad.connected = sf::Joystick::isConnected(d);
+    if (!pad.connected)
+    {
+      pad.buttons = 0;
+      memset(pad.axes, 0, sizeof(pad.axes));
+      continue;
+    }
+
+    int buttonCount = min(int(sf::Joystick::getButtonCount(d)), GAMEPAD_BUTTONS_COUNT);
+    for (int b = 0; b < buttonCount; b++)
+    {
+      uint32_t mask = 1u << b;
+      bool pressed = sf::Joystick::isButtonPressed(d, b);
+      if (pressed && !(pad.buttons & mask))
+      {
+        pad.buttons |= mask;
+        pad.pressCount[b]++;
+        pad.pressTime[b] = t;
+      }
+      else if (!pressed && (pad.buttons & mask))
+      {
+        pad.buttons &= ~mask;
+        pad.releaseTime[b] = t;
+      }
+    }
+
+    for (int a = 0; a < int(sf::Joystick::AxisCount); a++)
+    {
+      float pos = sf::Joystick::hasAxis(d, sf::Joystick::Axis(a)) ?
+        sf::Joystick::getAxisPosition(d, sf::Joystick::Axis(a)) : 0.0f;
+      if (pos != pad.axes[a])
+      {
+        pad.axes[a] = pos;
+        pad.axisTime[a] = t;
+      }
+    }
+  }
+}
+
+static void input_thread_func(int rate_hz)
+{
+  GamepadSnapshot state;
+  memset(&state, 0, sizeof(state));
+  chrono::microseconds period(1000000 / rate_hz);
+  auto nextTime = chrono::steady_clock::now();
+  while (!input_thread_stop.load(memory_order_relaxed))
+  {
+    sample_gamepads(state);
+    snapshots[snapshot_back] = state;
+    snapshot_back = snapshot_middle.exchange(snapshot_back | SNAPSHOT_NEW, memory_order_acq_rel) & 3;
+
+    nextTime += period;
+    auto now = chrono::steady_clock::now();
+    if (nextTime < now)
+      nextTime = now;
+    this_thread::sleep_until(nextTime);
+  }
+}
+
+void start_input_thread(int rate_hz)
+{
+  stop_input_thread();
+  memset(snapshots, 0, sizeof(snapshots));
+  memset(&applied_snapshot, 0, sizeof(applied_snapshot));
+  snapshot_middle = 1;
+  snapshot_back = 0;
+  snapshot_front = 2;
+  input_thread_stop = false;
+  input_thread = thread(input_thread_func, ::clamp(rate_hz, 10, 8000));
+  input_thread_running = true;
+}
+
+void stop_input_thread()
+{
+  if (!input_thread_running)
+    return;
+  input_thread_stop = true;
+  input_thread.join();
+  input_thread_running = false;
+}
+
+bool is_input_thread_running()
+{
+  return input_thread_running;
+}
+
+void begin_window_events()
+{
+  if (input_thread_running)
+    joystick_mutex.lock();
+}
+
+void end_window_events()
+{
+  if (input_thread_running)
+    joystick_mutex.unlock();
+}
+
+void update_gamepads()
+{
+  if (!input_thread_running || !(snapshot_middle.load(memory_order_acquire) & SNAPSHOT_NEW))
+    return;
+  snapshot_front = snapshot_middle.exchange(snapshot_front, memory_order_acq_rel) & 3;
+  const GamepadSnapshot & cur = snapshots[snapshot_front];
+
+  for (int d = 0; d < MAX_GAMEPADS; d++)
+  {
+    const GamepadSample & pad = cur.pads[d];
+    GamepadSample & prev = applied_snapshot.pads[d];
+    if (pad.connected != prev.connected)
+      joy_connected(d, pad.connected);
+    if (!pad.connected)
+      continue;
+
+    for (int b = 0; b < GAMEPAD_BUTTONS_COUNT; b++)
+    {
+      bool was = (prev.buttons >> b) & 1;
+      bool now = (pad.buttons >> b) & 1;
+      if (pad.pressCount[b] != prev.pressCount[b])
+      {
+        if (was)
+          joy_button_up(d, b, pad.pressTime[b]);
+        joy_button_down(d, b, pad.pressTime[b]);
+        if (!now)
+          joy_button_up(d, b, pad.releaseTime[b]);
+      }
+      else if (was && !now)
+        joy_button_up(d, b, pad.releaseTime[b]);
+    }
+
+    for (int a = 0; a < int(sf::Joystick::AxisCount); a++)
+      if (pad.axes[a] != prev.axes[a])
+        joy_axis_position(d, a, pad.axes[a], pad.axisTime[a]);
+  }
+
+  applied_snapshot = cur;
+}
+
 }
@@ -8,14 +8,39 @@
 #define GAMEPAD_BUTTONS_COUNT 32
 #define KEY_COUNT (256 + 32)
 #define GAMEPAD_AXES 16
+#define MAX_GAMEPADS 8
 
 #define KEY_CODE_OFFSET 1000
 #define MOUSE_CODE_OFFSET 2000
 #define AXIS_CODE_OFFSET 3000
 
+#define MAX_INPUT_EVENTS 1024
+
 namespace input
 {
 
+enum InputEventType
+{
+  INPUT_EVENT_KEY_DOWN,
+  INPUT_EVENT_KEY_UP,
+  INPUT_EVENT_MOUSE_DOWN,
+  INPUT_EVENT_MOUSE_UP,
+  INPUT_EVENT_MOUSE_WHEEL,
+  INPUT_EVENT_GAMEPAD_DOWN,
+  INPUT_EVENT_GAMEPAD_UP,
+  INPUT_EVENT_AXIS,
+};
+
+// event received in this frame, 'code' is the script code (VK_*, MB_*, GP_*, AXIS_*)
+struct InputEvent
+{
+  int type;
+  int code;
+  float value; // wheel delta or axis position
+  int device;  // gamepad index
+  double time; // of get_input_time()
+};
+
 void reset_input();
 bool get_key(int key_code);
 bool get_key_down(int key_code);
@@ -31,7 +56,16 @@ das::float2 get_mouse_position_delta();
 das::float2 get_mouse_velocity();
 void set_relative_mouse_movement(bool is_relative);
 float get_axis(int axis);
+float get_gamepad_axis(int gamepad, int axis);
+bool get_gamepad_button(int gamepad, int button_idx);
+bool get_gamepad_button_down(int gamepad, int button_idx);
+bool get_gamepad_button_up(int gamepad, int button_idx);
+bool is_gamepad_connected(int gamepad);
 int get_pressed_key_index();
+double get_input_time();
+int get_input_event_count();
+const InputEvent * get_input_event(int index);
+void consume_input_events();
 
 
 void release_input();
@@ -43,8 +77,19 @@ void gmc_mouse_wheel(float scroll);
 void gkc_button_down(int btn_idx);
 void gkc_symbol_entered(uint32_t code);
 void gkc_button_up(int btn_idx);
-void joy_button_down(int btn_idx);
-void joy_button_up(int btn_idx);
-void joy_axis_position(int axis_idx, float axis_pos);
+void joy_connected(int gamepad, bool connected);
+void joy_button_down(int gamepad, int btn_idx, double time = -1.0);
+void joy_button_up(int gamepad, int btn_idx, double time = -1.0);
+void joy_axis_position(int gamepad, int axis_idx, float axis_pos, double time = -1.0); // axis_pos of sf::Joystick
+
+// gamepads are sampled by a separate thread with 'rate_hz', joystick events of the window are ignored then
+void start_input_thread(int rate_hz);
+void stop_input_thread();
+bool is_input_thread_running();
+// sf::Joystick is not thread safe, window events are fetched under the lock while the thread is running
+void begin_window_events();
+void end_window_events();
+// applies the latest sample of the input thread
+void update_gamepads();
 
 }
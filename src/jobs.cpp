@@ -0,0 +1,157 @@
+#include "jobs.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <vector>
+#include <atomic>
+#include <memory>
+#include <algorithm>
+
+using namespace std;
+
+namespace jobs
+{
+
+static vector<thread> workers;
+static deque<function<void()>> job_queue;
+static mutex queue_mutex;
+static condition_variable queue_cv;
+static bool stopping = false;
+
+
+static void worker_thread()
+{
+  for (;;)
+  {
+    function<void()> job;
+    {
+      unique_lock<mutex> lock(queue_mutex);
+      queue_cv.wait(lock, [] { return stopping || !job_queue.empty(); });
+      if (job_queue.empty())
+        return;
+      job = std::move(job_queue.front());
+      job_queue.pop_front();
+    }
+    job();
+  }
+}
+
+void initialize()
+{
+  if (!workers.empty())
+    return;
+
+  unsigned hw = thread::hardware_concurrency();
+  int count = hw > 2 ? int(hw) - 1 : 1;
+  if (count > 8)
+    count = 8;
+
+  stopping = false;
+  for (int i = 0; i < count; i++)
+    workers.emplace_back(worker_thread);
+}
+
+void finalize()
+{
+  {
+    lock_guard<mutex> lock(queue_mutex);
+    stopping = true;
+  }
+  queue_cv.notify_all();
+  for (auto && w : workers)
+    w.join();
+  workers.clear();
+}
+
+void add_job(function<void()> && job)
+{
+  if (workers.empty())
+  {
+    job();
+    return;
+  }
+
+  {
+    lock_guard<mutex> lock(queue_mutex);
+    job_queue.push_back(std::move(job));
+  }
+  queue_cv.notify_one();
+}
+
+int get_worker_count()
+{
+  return int(workers.size());
+}
+
+struct ParallelRanges
+{
+  const function<void(int, int)> * fn = nullptr;
+  int count = 0;
+  int chunk = 1;
+  int chunkCount = 0;
+  atomic<int> nextChunk;
+  atomic<int> finishedChunks;
+
+  ParallelRanges() : nextChunk(0), finishedChunks(0) {}
+
+  void run()
+  {
+    for (int idx = nextChunk.fetch_add(1); idx < chunkCount; idx = nextChunk.fetch_add(1))
+    {
+      int begin = idx * chunk;
+      (*fn)(begin, count - begin > chunk ? begin + chunk : count);
+      finishedChunks.fetch_add(1);
+    }
+  }
+};
+
+void parallel_for(int count, int chunk, const function<void(int, int)> & fn)
+{
+  if (count <= 0)
+    return;
+  if (chunk <= 0 || chunk >= count || workers.empty())
+  {
+    fn(0, count);
+    return;
+  }
+
+  auto ranges = make_shared<ParallelRanges>();
+  ranges->fn = &fn;
+  ranges->count = count;
+  ranges->chunk = chunk;
+  ranges->chunkCount = count / chunk + (count % chunk ? 1 : 0);
+
+  // jobs that start after all ranges are taken return without calling 'fn'
+  int jobCount = min(ranges->chunkCount - 1, int(workers.size()));
+  for (int i = 0; i < jobCount; i++)
+    add_job([ranges]() { ranges->run(); });
+
+  ranges->run();
+  while (ranges->finishedChunks.load() < ranges->chunkCount)
+    this_thread::yield();
+}
+
+void Completion::set()
+{
+  {
+    lock_guard<mutex> lock(doneMutex);
+    done.store(true, memory_order_release);
+  }
+  doneCv.notify_all();
+}
+
+bool Completion::isSet() const
+{
+  return done.load(memory_order_acquire);
+}
+
+void Completion::wait()
+{
+  if (isSet())
+    return;
+  unique_lock<mutex> lock(doneMutex);
+  doneCv.wait(lock, [this] { return isSet(); });
+}
+
+} // namespace jobs
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <functional>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+
+
+namespace jobs
+{
+  void initialize();
+  void finalize();
+
+  // 'job' is executed on one of the worker threads
+  void add_job(std::function<void()> && job);
+  int get_worker_count();
+
+  // 'fn(begin, end)' is called for ranges of [0, count) split by 'chunk' on the workers and on the calling thread,
+  // returns when all ranges are done
+  void parallel_for(int count, int chunk, const std::function<void(int, int)> & fn);
+
+  // set once when a job finishes, wait() blocks without spinning
+  class Completion
+  {
+  public:
+    void set();
+    bool isSet() const;
+    void wait();
+
+  private:
+    std::atomic<bool> done{false};
+    std::mutex doneMutex;
+    std::condition_variable doneCv;
+  };
+}
@@ -0,0 +1,298 @@
+#include "localStorage.h"
+#include "globals.h"
+#include "fileSystem.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <unordered_map>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+
+using namespace std;
+
+namespace storage
+{
+
+// Journal: STORAGE_MAGIC, then records { uint32 keyLength, uint32 valueLength, key, value }.
+// The last record of the key wins, empty value removes the key. Incomplete record at the end (the application
+// was killed while writing) is ignored, the journal is rewritten from the loaded data at the next write.
+
+#define STORAGE_MAGIC "DASBSTO1"
+#define STORAGE_MAGIC_SIZE 8
+#define STORAGE_COMPACT_MIN_SIZE (64 << 10)
+
+static bool loaded = false;
+static string journal_name;
+static unordered_map<string, string> values; // main thread
+
+// writer thread
+static unordered_map<string, string> written; // contents of the journal
+static uint64_t written_data_size = 0;
+static uint64_t journal_size = 0;
+static bool need_compact = false;
+
+// guarded by 'pending_mutex'
+static unordered_map<string, string> pending; // changes are coalesced by key until the writer takes them
+static bool writing = false;
+static bool stopping = false;
+static string write_error;
+
+static mutex pending_mutex;
+static condition_variable pending_cv;
+static condition_variable flushed_cv;
+static thread writer;
+
+
+static uint64_t record_size(const string & key, const string & value)
+{
+  return sizeof(uint32_t) * 2 + key.length() + value.length();
+}
+
+static void append_record(string & buf, const string & key, const string & value)
+{
+  uint32_t len[2] = { uint32_t(key.length()), uint32_t(value.length()) };
+  buf.append((const char *)len, sizeof(len));
+  buf += key;
+  buf += value;
+}
+
+static bool write_journal_file(const char * file_name, const char * mode, const string & buf, bool with_magic)
+{
+  FILE * f = fopen(file_name, mode);
+  if (!f)
+    return false;
+  bool ok = true;
+  if (with_magic)
+    ok = fwrite(STORAGE_MAGIC, 1, STORAGE_MAGIC_SIZE, f) == STORAGE_MAGIC_SIZE;
+  ok = ok && fwrite(buf.data(), 1, buf.length(), f) == buf.length();
+  ok = fclose(f) == 0 && ok;
+  return ok;
+}
+
+static bool compact_journal()
+{
+  string buf;
+  buf.reserve(size_t(written_data_size));
+  for (auto && kv : written)
+    append_record(buf, kv.first, kv.second);
+
+  string tmpName = journal_name + ".tmp";
+  if (!write_journal_file(tmpName.c_str(), "wb", buf, true))
+  {
+    remove(tmpName.c_str());
+    return false;
+  }
+
+  if (!fs::replace_file(tmpName.c_str(), journal_name.c_str()))
+  {
+    remove(tmpName.c_str());
+    return false;
+  }
+
+  journal_size = STORAGE_MAGIC_SIZE + buf.length();
+  need_compact = false;
+  return true;
+}
+
+static bool write_batch(const unordered_map<string, string> & batch)
+{
+  string buf;
+  for (auto && kv : batch)
+  {
+    append_record(buf, kv.first, kv.second);
+
+    auto it = written.find(kv.first);
+    if (it != written.end())
+    {
+      written_data_size -= record_size(it->first, it->second);
+      written.erase(it);
+    }
+    if (!kv.second.empty())
+    {
+      written.emplace(kv.first, kv.second);
+      written_data_size += record_size(kv.first, kv.second);
+    }
+  }
+
+  // most of the journal are overwritten values
+  if (need_compact || journal_size + buf.length() > max(uint64_t(STORAGE_COMPACT_MIN_SIZE), written_data_size * 4))
+    return compact_journal();
+
+  bool newFile = journal_size == 0;
+  if (!write_journal_file(journal_name.c_str(), newFile ? "wb" : "ab", buf, newFile))
+    return false;
+  journal_size += (newFile ? STORAGE_MAGIC_SIZE : 0) + buf.length();
+  return true;
+}
+
+static void writer_thread_func()
+{
+  unique_lock<mutex> lock(pending_mutex);
+  for (;;)
+  {
+    pending_cv.wait(lock, [] { return stopping || !pending.empty(); });
+    if (pending.empty())
+      break;
+
+    unordered_map<string, string> batch;
+    batch.swap(pending);
+    writing = true;
+    lock.unlock();
+    bool ok = write_batch(batch);
+    lock.lock();
+    writing = false;
+    if (!ok)
+      write_error = journal_name;
+    flushed_cv.notify_all();
+  }
+}
+
+static void report_write_error()
+{
+  string error;
+  {
+    lock_guard<mutex> lock(pending_mutex);
+    error.swap(write_error);
+  }
+  if (!error.empty())
+    print_error("Cannot write local storage '%s'", error.c_str());
+}
+
+
+static void load()
+{
+  loaded = true;
+
+  string dir = fs::combine_path(initial_dir, ".dasbox_storage");
+  if (!fs::make_dir(dir.c_str()))
+    print_error("Cannot create local storage directory '%s'", dir.c_str());
+
+  // one storage per application directory
+  string appDir = fs::get_current_dir();
+  uint64_t hash = 14695981039346656037ull;
+  for (const char * c = appDir.c_str(); *c; c++)
+    hash = (hash ^ uint8_t(*c == '\\' ? '/' : *c)) * 1099511628211ull;
+  string name = fs::extract_file_name(appDir);
+  for (char & ch : name)
+    if (!isalnum(uint8_t(ch)) && ch != '_' && ch != '-')
+      ch = '_';
+  char buf[32];
+  snprintf(buf, sizeof(buf), "_%016llx.journal", (unsigned long long)hash);
+  journal_name = fs::combine_path(dir, name + buf);
+
+  FILE * f = fopen(journal_name.c_str(), "rb");
+  if (!f)
+    return;
+  vector<uint8_t> bytes;
+  uint8_t chunk[65536];
+  size_t n;
+  while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0)
+    bytes.insert(bytes.end(), chunk, chunk + n);
+  fclose(f);
+
+  if (bytes.size() < STORAGE_MAGIC_SIZE || memcmp(bytes.data(), STORAGE_MAGIC, STORAGE_MAGIC_SIZE) != 0)
+  {
+    print_error("Local storage '%s' is corrupted, it will be overwritten", journal_name.c_str());
+    need_compact = true;
+    return;
+  }
+
+  size_t pos = STORAGE_MAGIC_SIZE;
+  while (pos + sizeof(uint32_t) * 2 <= bytes.size())
+  {
+    uint32_t len[2];
+    memcpy(len, &bytes[pos], sizeof(len));
+    if (uint64_t(len[0]) + len[1] > bytes.size() - pos - sizeof(len))
+      break;
+    const char * p = (const char *)&bytes[pos + sizeof(len)];
+    string key(p, len[0]);
+    if (len[1])
+      values[key] = string(p + len[0], len[1]);
+    else
+      values.erase(key);
+    pos += sizeof(len) + len[0] + len[1];
+  }
+
+  written = values;
+  for (auto && kv : written)
+    written_data_size += record_size(kv.first, kv.second);
+  journal_size = pos;
+  need_compact = pos != bytes.size();
+}
+
+const char * get(const char * key)
+{
+  if (!key)
+    return "";
+  if (!loaded)
+    load();
+  auto it = values.find(string(key));
+  return it != values.end() ? it->second.c_str() : "";
+}
+
+void set(const char * key, const char * value)
+{
+  if (!key)
+    return;
+  if (!value)
+    value = "";
+  if (!loaded)
+    load();
+
+  string k(key);
+  auto it = values.find(k);
+  if (it != values.end() ? it->second == value : !*value)
+    return;
+  if (*value)
+    values[k] = value;
+  else
+    values.erase(it);
+
+  report_write_error();
+  if (!writer.joinable())
+    writer = thread(writer_thread_func);
+  {
+    lock_guard<mutex> lock(pending_mutex);
+    pending[k] = value;
+  }
+  pending_cv.notify_one();
+}
+
+void flush()
+{
+  if (writer.joinable())
+  {
+    unique_lock<mutex> lock(pending_mutex);
+    flushed_cv.wait(lock, [] { return pending.empty() && !writing; });
+  }
+  report_write_error();
+}
+
+void finalize()
+{
+  if (writer.joinable())
+  {
+    {
+      lock_guard<mutex> lock(pending_mutex);
+      stopping = true;
+    }
+    pending_cv.notify_one();
+    writer.join();
+    stopping = false;
+  }
+  report_write_error();
+
+  loaded = false;
+  journal_name.clear();
+  values.clear();
+  written.clear();
+  written_data_size = 0;
+  journal_size = 0;
+  need_compact = false;
+}
+
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+
+namespace storage
+{
+  // Key-value data of the application, kept between runs in '.dasbox_storage' of the initial directory.
+  // The file is loaded at the first access, changes are appended to it by a background thread.
+  const char * get(const char * key); // "" if the key is not set, valid until the next set() or finalize()
+  void set(const char * key, const char * value); // empty value removes the key
+
+  void flush(); // waits until all changes are written
+  void finalize(); // writes all changes, the next access loads the storage of the current application again
+}
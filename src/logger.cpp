@@ -5,10 +5,18 @@
 #include <SFML/Window/Clipboard.hpp>
 #include <SFML/Window/Keyboard.hpp>
 #include <stdarg.h>
+#include <stdio.h>
+#include <time.h>
 #include <iostream>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <thread>
 
 #define LOGGER_LINES_LIMIT 10000
-#define LOGGER_LINES_ERASE_COUNT (LOGGER_LINES_LIMIT / 20 + 1)
+#define LOGGER_CONSOLE_BUFFER_SIZE 16384
+#define LOG_FILE_QUEUE_SIZE 4096 // lines, power of 2
+#define LOG_FILE_IDLE_SLEEP_MS 10
 
 #define KEY_AUTOREPEAT_START 0.25f
 #define KEY_AUTOREPEAT_PERIOD 0.03f
@@ -23,6 +31,132 @@
 
 using namespace std;
 
+
+//----- log file -----
+
+// declared before 'logger', its destructor writes the rest of the log
+
+struct LogFileRecord
+{
+  int64_t timeMs; // since epoch
+  int level;
+  string text;
+};
+
+// single producer (thread of the logger), single consumer (log_file_thread)
+static array<LogFileRecord, LOG_FILE_QUEUE_SIZE> log_file_queue;
+static atomic<uint32_t> log_file_queue_write(0);
+static atomic<uint32_t> log_file_queue_read(0);
+static atomic<bool> log_file_stop(false);
+static int log_file_dropped = 0; // producer, lines since the queue was full
+static FILE * log_file = nullptr;
+static thread log_file_thread;
+
+static const char * log_level_name(int level)
+{
+  switch (level)
+  {
+  case LOGGER_ERROR: return "ERROR";
+  case LOGGER_NOTE: return "NOTE ";
+  default: return "INFO ";
+  }
+}
+
+static void log_file_thread_func()
+{
+  for (;;)
+  {
+    uint32_t r = log_file_queue_read.load(memory_order_relaxed);
+    uint32_t w = log_file_queue_write.load(memory_order_acquire);
+    if (r == w)
+    {
+      if (log_file_stop.load(memory_order_acquire))
+        break;
+      this_thread::sleep_for(chrono::milliseconds(LOG_FILE_IDLE_SLEEP_MS));
+      continue;
+    }
+
+    for (; r != w; r++)
+    {
+      const LogFileRecord & rec = log_file_queue[r % LOG_FILE_QUEUE_SIZE];
+      time_t t = time_t(rec.timeMs / 1000);
+      char timeBuf[32] = { 0 };
+      strftime(timeBuf, sizeof(timeBuf), "%Y-%m-%d %H:%M:%S", localtime(&t));
+      fprintf(log_file, "%s.%03d %s %s", timeBuf, int(rec.timeMs % 1000), log_level_name(rec.level), rec.text.c_str());
+      if (rec.text.empty() || rec.text.back() != '\n')
+        fputc('\n', log_file);
+    }
+    log_file_queue_read.store(r, memory_order_release);
+    fflush(log_file);
+  }
+}
+
+// never blocks, lines are dropped while the queue is full
+static void push_log_file_line(int level, const string & text)
+{
+  if (!log_file)
+    return;
+
+  // blank lines around errors
+  if (text.empty() || text == "\n")
+    return;
+
+  uint32_t w = log_file_queue_write.load(memory_order_relaxed);
+  uint32_t space = LOG_FILE_QUEUE_SIZE - (w - log_file_queue_read.load(memory_order_acquire));
+  if (space < (log_file_dropped ? 2u : 1u))
+  {
+    log_file_dropped++;
+    return;
+  }
+
+  int64_t timeMs = chrono::duration_cast<chrono::milliseconds>(
+    chrono::system_clock::now().time_since_epoch()).count();
+
+  if (log_file_dropped)
+  {
+    LogFileRecord & rec = log_file_queue[w % LOG_FILE_QUEUE_SIZE];
+    rec.timeMs = timeMs;
+    rec.level = LOGGER_ERROR;
+    rec.text = to_string(log_file_dropped) + " lines are not written to the log file, the queue was full\n";
+    log_file_dropped = 0;
+    w++;
+  }
+
+  LogFileRecord & rec = log_file_queue[w % LOG_FILE_QUEUE_SIZE];
+  rec.timeMs = timeMs;
+  rec.level = level;
+  rec.text = text;
+  log_file_queue_write.store(w + 1, memory_order_release);
+}
+
+bool start_log_file(const char * file_name)
+{
+  stop_log_file();
+  log_file = fopen(file_name, "ab");
+  if (!log_file)
+  {
+    print_error("Cannot open log file '%s'", file_name);
+    return false;
+  }
+
+  log_file_stop = false;
+  log_file_dropped = 0;
+  log_file_thread = thread(log_file_thread_func);
+  return true;
+}
+
+void stop_log_file()
+{
+  if (!log_file)
+    return;
+  log_file_stop = true;
+  if (log_file_thread.joinable())
+    log_file_thread.join();
+  fclose(log_file);
+  log_file = nullptr;
+}
+
+
 Logger logger;
 static bool error_as_note = false;
 
@@ -100,10 +234,25 @@ void print_note(const char * format, ...)
 }
 
 
+Logger::~Logger()
+{
+  flushConsole();
+  if (entryCount > 0)
+  {
+    const LogEntry & last = entries[(entryStart + entryCount - 1) % LOGGER_LINES_LIMIT];
+    push_log_file_line(last.level, last.text);
+  }
+  stop_log_file();
+}
+
 void Logger::clear()
 {
-  logStrings.clear();
-  lineColors.clear();
+  firstEntry += entryCount;
+  entryStart = 0;
+  entryCount = 0;
+  lines.clear();
+  linesBuiltEntry = firstEntry;
+  linesVersion++;
   topLine = 0;
   topErrorLine = -1;
   curColor = NORMAL_LINE_COLOR;
@@ -113,7 +262,24 @@ void Logger::clear()
 void Logger::setTopErrorLine()
 {
   if (topErrorLine < 0)
-    topErrorLine = int(logger.logStrings.size());
+    topErrorLine = entryCount > 0 ? firstEntry + entryCount - 1 : firstEntry;
+}
+
+void Logger::flushConsole()
+{
+  if (consoleBuf.empty())
+    return;
+  if (consoleBufIsError || log_console_to_stderr)
+  {
+    cerr << consoleBuf;
+    cerr.flush();
+  }
+  else
+  {
+    cout << consoleBuf;
+    cout.flush();
+  }
+  consoleBuf.clear();
 }
 
 void Logger::output()
@@ -144,6 +310,37 @@ void Logger::applyStateColor()
 }
 
 
+LogEntry & Logger::appendEntry()
+{
+  if (entries.empty())
+    entries.resize(LOGGER_LINES_LIMIT);
+
+  if (entryCount == LOGGER_LINES_LIMIT)
+  {
+    entryStart = (entryStart + 1) % LOGGER_LINES_LIMIT;
+    entryCount--;
+    firstEntry++;
+    if (topErrorLine >= 0 && topErrorLine < firstEntry)
+      topErrorLine = firstEntry;
+  }
+
+  LogEntry & e = entries[(entryStart + entryCount) % LOGGER_LINES_LIMIT];
+  entryCount++;
+  e.text.clear();
+  e.color = curColor;
+  e.level = state;
+  return e;
+}
+
+const LogEntry * Logger::getEntry(int64_t entry) const
+{
+  if (entry < firstEntry || entry >= firstEntry + entryCount)
+    return nullptr;
+  return &entries[(entryStart + int(entry - firstEntry)) % LOGGER_LINES_LIMIT];
+}
+
+// console output is written in blocks, it is flushed on switch between cout and cerr and once per frame,
+// errors are written at once, so they are not lost if the application crashes
 void Logger::addString(const string & s)
 {
 #ifndef NDEBUG
@@ -153,65 +350,125 @@ void Logger::addString(const string & s)
 #endif
   if (duplicateLog)
   {
-    if (state == LOGGER_ERROR)
+    bool isError = state == LOGGER_ERROR;
+    if (isError != consoleBufIsError)
     {
-      cerr << s;
-      cerr.flush();
-    }
-    else
-    {
-      cout << s;
-      cout.flush();
+      flushConsole();
+      consoleBufIsError = isError;
     }
+    consoleBuf.append(s);
+    if (isError || consoleBuf.size() >= LOGGER_CONSOLE_BUFFER_SIZE)
+      flushConsole();
   }
 
-  if (logStrings.empty())
+  linesDirty = true;
+  LogEntry * last = entryCount > 0 ? &entries[(entryStart + entryCount - 1) % LOGGER_LINES_LIMIT] : nullptr;
+  if (!last)
+    last = &appendEntry();
+
+  size_t from = 0;
+  while (from < s.length())
   {
-    logStrings.push_back(string(""));
-    lineColors.push_back(curColor);
-  }
+    if (last->text.empty())
+    {
+      last->color = curColor;
+      last->level = state;
+    }
 
-  if (logStrings.back().empty())
-    lineColors.back() = curColor;
+    size_t pos = s.find('\n', from);
+    if (pos == string::npos)
+    {
+      last->text.append(s, from, string::npos);
+      break;
+    }
 
-  logStrings.back().append(s);
+    last->text.append(s, from, pos + 1 - from);
+    from = pos + 1;
+    push_log_file_line(last->level, last->text);
+    last = &appendEntry();
+  }
+}
 
-  for (;;)
+void Logger::wrapEntry(int64_t entry)
+{
+  const LogEntry * e = getEntry(entry);
+  if (!e)
+    return;
+  int len = int(e->text.length());
+  int offset = 0;
+  do
   {
-    size_t pos = logStrings.back().find('\n');
+    int length = min(len - offset, linesWidth);
+    lines.push_back(LogLine{entry, offset, length});
+    offset += length;
+  } while (offset < len);
+}
 
-    if (pos != string::npos)
-      pos++;
+void Logger::updateLines(int symbols_per_line)
+{
+  symbols_per_line = max(symbols_per_line, 1);
+  if (symbols_per_line != linesWidth)
+  {
+    linesWidth = symbols_per_line;
+    lines.clear();
+    linesBuiltEntry = firstEntry;
+    linesDirty = true;
+  }
 
-    if (pos != string::npos && pos >= LOG_SYMBOLS_PER_SCREEN)
-      pos = LOG_SYMBOLS_PER_SCREEN;
+  if (!linesDirty)
+    return;
+  linesDirty = false;
+  linesVersion++;
 
-    if (pos == string::npos && logStrings.back().length() >= LOG_SYMBOLS_PER_SCREEN)
-      pos = LOG_SYMBOLS_PER_SCREEN;
+  while (!lines.empty() && lines.front().entry < firstEntry)
+  {
+    lines.pop_front();
+    topLine--;
+  }
+  if (topLine < 0)
+    topLine = 0;
+
+  // the last entry could grow since it was wrapped
+  while (!lines.empty() && lines.back().entry >= linesBuiltEntry)
+    lines.pop_back();
+
+  linesBuiltEntry = max(linesBuiltEntry, firstEntry);
+  int64_t endEntry = firstEntry + entryCount;
+  for (int64_t i = linesBuiltEntry; i < endEntry; i++)
+    wrapEntry(i);
+  linesBuiltEntry = max(endEntry - 1, firstEntry);
+}
 
-    if (pos == string::npos)
-      break;
+string Logger::getLineText(int line) const
+{
+  if (line < 0 || line >= int(lines.size()))
+    return string();
+  const LogLine & l = lines[line];
+  const LogEntry * e = getEntry(l.entry);
+  if (!e || l.offset >= int(e->text.length()))
+    return string();
+  return e->text.substr(l.offset, l.length);
+}
 
-    string newString = string(logStrings.back().c_str() + pos);
-    logStrings.back().resize(pos);
-    logStrings.push_back(newString);
-    lineColors.push_back(curColor);
-  }
+uint32_t Logger::getLineColor(int line) const
+{
+  const LogEntry * e = line >= 0 && line < int(lines.size()) ? getEntry(lines[line].entry) : nullptr;
+  return e ? e->color : NORMAL_LINE_COLOR;
+}
 
-  if (logStrings.size() > LOGGER_LINES_LIMIT)
-  {
-    logStrings.erase(logStrings.begin(), logStrings.begin() + LOGGER_LINES_ERASE_COUNT);
-    lineColors.erase(lineColors.begin(), lineColors.begin() + LOGGER_LINES_ERASE_COUNT);
-    if (topErrorLine >= 0)
-    {
-      topErrorLine -= LOGGER_LINES_ERASE_COUNT;
-      if (topErrorLine < 0)
-        topErrorLine = 0;
-    }
-    topLine -= LOGGER_LINES_ERASE_COUNT;
-    if (topLine < 0)
-      topLine = 0;
-  }
+int Logger::findFirstLineOfEntry(int64_t entry) const
+{
+  auto it = lower_bound(lines.begin(), lines.end(), entry,
+    [](const LogLine & l, int64_t e) { return l.entry < e; });
+  return int(it - lines.begin());
+}
+
+string Logger::getAllText() const
+{
+  string s;
+  for (int i = 0; i < entryCount; i++)
+    s += entries[(entryStart + i) % LOGGER_LINES_LIMIT].text;
+  return s;
 }
 
 static float scroll_accum = 0.0f;
@@ -242,14 +499,13 @@ static void copy_log_to_clipboard()
 
   if (select_from_line < 0)
   {
-    for (size_t i = 0; i < logger.logStrings.size(); i++)
-      s += logger.logStrings[i];
+    s = logger.getAllText();
   }
   else if (select_from_line == select_to_line)
   {
     if (select_from_pos > select_to_pos)
       std::swap(select_from_pos, select_to_pos);
-    s = logger.logStrings[select_from_line];
+    s = logger.getLineText(select_from_line);
     s.replace("\t", "    ");
     if (int(s.getSize()) > select_from_pos)
       s = s.substring(select_from_pos, select_to_pos - select_from_pos + 1);
@@ -261,7 +517,7 @@ static void copy_log_to_clipboard()
       std::swap(select_from_line, select_to_line);
     for (int i = select_from_line; i <= select_to_line; i++)
       if (i != ignoreLine)
-        s += logger.logStrings[i];
+        s += logger.getLineText(i);
   }
 
   sf::Clipboard::setString(s);
@@ -337,14 +593,16 @@ static das::int2 mouse_pos_to_log_pos(das::float2 mouse_pos, bool allow_negative
     if (res.y < 0)
       res.y = 0;
   }
-  if (res.y >= int(logger.logStrings.size()))
-    res.y = int(logger.logStrings.size()) - 1;
+  if (res.y >= logger.getLineCount())
+    res.y = logger.getLineCount() - 1;
   return res;
 }
 
 
 void update_log_screen(float dt)
 {
+  logger.updateLines(LOG_SYMBOLS_PER_SCREEN);
+
   float scroll_delta = input::get_mouse_scroll_delta();
   scroll_accum += input::get_mouse_scroll_delta() * 4.0f;
   if (abs(int(scroll_accum)) >= 1)
@@ -388,8 +646,8 @@ void update_log_screen(float dt)
   if (input::get_key_down(sf::Keyboard::End))
     logger.topLine = INT_MAX;
 
-  if (logger.topLine > int(logger.logStrings.size()) - LOG_LINES_PER_SCREEN + 2)
-    logger.topLine = int(logger.logStrings.size()) - LOG_LINES_PER_SCREEN + 2;
+  if (logger.topLine > logger.getLineCount() - LOG_LINES_PER_SCREEN + 2)
+    logger.topLine = logger.getLineCount() - LOG_LINES_PER_SCREEN + 2;
 
   if (logger.topLine < 0)
     logger.topLine = 0;
@@ -404,7 +662,7 @@ void update_log_screen(float dt)
   if (input::get_mouse_button_down(0))
   {
     das::int2 mp = mouse_pos_to_log_pos(input::get_mouse_position());
-    if (mp.y >= logger.topLine && logger.logStrings.size() > 0)
+    if (mp.y >= logger.topLine && logger.getLineCount() > 0)
     {
       mouse_down = true;
       select_from_line = select_to_line = mp.y;
@@ -439,8 +697,36 @@ void set_font_name(const char *);
 
 
 
+// text of the visible lines is laid out again only after scroll or changes of the log
+static graphics::TextBlock * log_text_block = nullptr;
+static uint64_t log_text_version = 0;
+static int log_text_top_line = -1;
+static int log_text_screen_width = 0;
+static int log_text_screen_height = 0;
+
+static void update_log_text_block()
+{
+  if (!log_text_block)
+    log_text_block = graphics::create_text_block();
+  else if (log_text_version == logger.getLinesVersion() && log_text_top_line == logger.topLine &&
+    log_text_screen_width == screen_width && log_text_screen_height == screen_height)
+    return;
+
+  log_text_version = logger.getLinesVersion();
+  log_text_top_line = logger.topLine;
+  log_text_screen_width = screen_width;
+  log_text_screen_height = screen_height;
+
+  graphics::clear_text_block(log_text_block);
+  int y = 2 + FONT_HEIGHT * 3;
+  for (int i = logger.topLine; i < logger.getLineCount() && y <= screen_height; i++, y += FONT_HEIGHT)
+    graphics::add_text_to_block(log_text_block, float(SAFE_AREA), float(y), logger.getLineText(i).c_str(),
+      logger.getLineColor(i));
+}
+
 void draw_log_screen()
 {
+  logger.updateLines(LOG_SYMBOLS_PER_SCREEN);
   disable_alpha_blend();
   stash_font();
   set_font_name(nullptr);
@@ -452,36 +738,38 @@ void draw_log_screen()
   text_out_i(SAFE_AREA, SAFE_AREA, "Press \"Tab\" to switch back to application", 0);
   text_out_i(SAFE_AREA, SAFE_AREA + FONT_HEIGHT, "Up, Down, [Ctrl+] PgUp, [Ctrl+] PgDown - scroll", 0);
 
-  if (logger.logStrings.size() >= LOG_LINES_PER_SCREEN)
+  int lineCount = logger.getLineCount();
+  if (lineCount >= LOG_LINES_PER_SCREEN)
   {
-    float relativePos = float(logger.topLine) / max(int(logger.logStrings.size()) - LOG_LINES_PER_SCREEN + 2, 1);
+    float relativePos = float(logger.topLine) / max(lineCount - LOG_LINES_PER_SCREEN + 2, 1);
     fill_rect_i(screen_width - 4, FONT_HEIGHT * 3 + int(relativePos * (screen_height - FONT_HEIGHT * 4)), 3, FONT_HEIGHT,
       SCROLL_POSITION_COLOR);
   }
 
-  int y = 2 + FONT_HEIGHT * 3;
-  for (size_t i = logger.topLine; i < logger.logStrings.size(); i++)
+  int top = 2 + FONT_HEIGHT * 3;
+  int visibleLines = (screen_height - top) / FONT_HEIGHT + 1;
+  if (select_from_line >= 0)
   {
-    if (select_from_line >= 0 &&
-      int(i) >= min(select_from_line, select_to_line) && int(i) <= max(select_from_line, select_to_line))
+    int from = max(min(select_from_line, select_to_line), logger.topLine);
+    int to = min(max(select_from_line, select_to_line), logger.topLine + visibleLines - 1);
+    if (select_from_line == select_to_line && from == to)
     {
-      if (select_from_line == select_to_line)
-      {
-        fill_rect_i(SAFE_AREA + min(select_to_pos, select_from_pos) * FONT_WIDTH - 1, y,
-          abs(select_to_pos - select_from_pos) * FONT_WIDTH + FONT_WIDTH + 1, FONT_HEIGHT, 0xFF676767);
-      }
-      else if (int(i) != select_to_line)
-      {
-        fill_rect_i(SAFE_AREA - 1, y, LOG_SYMBOLS_PER_SCREEN * FONT_WIDTH + 1, FONT_HEIGHT, 0xFF676767);
-      }
+      fill_rect_i(SAFE_AREA + min(select_to_pos, select_from_pos) * FONT_WIDTH - 1,
+        top + (from - logger.topLine) * FONT_HEIGHT,
+        abs(select_to_pos - select_from_pos) * FONT_WIDTH + FONT_WIDTH + 1, FONT_HEIGHT, 0xFF676767);
+    }
+    else if (select_from_line != select_to_line)
+    {
+      for (int i = from; i <= to; i++)
+        if (i != select_to_line)
+          fill_rect_i(SAFE_AREA - 1, top + (i - logger.topLine) * FONT_HEIGHT, LOG_SYMBOLS_PER_SCREEN * FONT_WIDTH + 1,
+            FONT_HEIGHT, 0xFF676767);
     }
-
-    text_out_i(SAFE_AREA, y, logger.logStrings[i].c_str(), logger.lineColors[i]);
-    y += FONT_HEIGHT;
-    if (y > screen_height)
-      break;
   }
 
+  update_log_text_block();
+  graphics::draw_text_block(log_text_block);
+
   restore_font();
   set_font_size_i(savedFontSize);
 }
@@ -494,10 +782,11 @@ void on_switch_to_log_screen()
   input::reset_input();
   scroll_accum = 0.0f;
   time_to_reset_scroll_accum = 2.0f;
+  logger.updateLines(LOG_SYMBOLS_PER_SCREEN);
 
   if (logger.topErrorLine >= 0)
   {
-    logger.topLine = logger.topErrorLine;
+    logger.topLine = logger.findFirstLineOfEntry(logger.topErrorLine);
     logger.topErrorLine = -1;
   }
   else
@@ -506,6 +795,6 @@ void on_switch_to_log_screen()
   if (logger.topLine < 0)
     logger.topLine = 0;
 
-  if (logger.topLine > int(logger.logStrings.size()) - LOG_LINES_PER_SCREEN + 2)
-    logger.topLine = int(logger.logStrings.size()) - LOG_LINES_PER_SCREEN + 2;
+  if (logger.topLine > logger.getLineCount() - LOG_LINES_PER_SCREEN + 2)
+    logger.topLine = logger.getLineCount() - LOG_LINES_PER_SCREEN + 2;
 }
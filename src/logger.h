@@ -2,6 +2,7 @@
 
 #include <daScript/daScript.h>
 #include <vector>
+#include <deque>
 #include <string>
 #include <sstream>
 
@@ -18,20 +19,51 @@ enum
 };
 
 
+// raw line of the log, ends with '\n' except the last one
+struct LogEntry
+{
+  std::string text;
+  uint32_t color = NORMAL_LINE_COLOR;
+  int level = LOGGER_NORMAL;
+};
+
+// part of LogEntry that fits into the width of the log screen
+struct LogLine
+{
+  int64_t entry;
+  int offset;
+  int length;
+};
+
 class Logger : public das::TextWriter
 {
 public:
   std::stringstream cerrStream;
   std::stringstream coutStream;
-  std::vector<std::string> logStrings;
-  std::vector<uint32_t> lineColors;
-  int topErrorLine = -1;
-  int topLine = 0;
+  int64_t topErrorLine = -1; // number of the entry with the first error, -1 if there are no errors
+  int topLine = 0; // in wrapped lines
 
   virtual void output() override;
+  ~Logger();
 
   void setTopErrorLine();
   void clear();
+  void flushConsole();
+
+  // wrapped lines are updated only when the log is shown
+  void updateLines(int symbols_per_line);
+  int getLineCount() const
+  {
+    return int(lines.size());
+  }
+  uint64_t getLinesVersion() const // changes when wrapped lines are changed
+  {
+    return linesVersion;
+  }
+  std::string getLineText(int line) const;
+  uint32_t getLineColor(int line) const;
+  int findFirstLineOfEntry(int64_t entry) const;
+  std::string getAllText() const;
 
   void setState(int state_)
   {
@@ -45,14 +77,36 @@ protected:
   uint32_t curColor = NORMAL_LINE_COLOR;
   std::string buf;
 
+  // fixed capacity ring, the oldest entries are overwritten
+  std::vector<LogEntry> entries;
+  int entryStart = 0;
+  int entryCount = 0;
+  int64_t firstEntry = 0; // number of entries[entryStart]
+
+  std::deque<LogLine> lines;
+  int64_t linesBuiltEntry = 0; // lines of this entry and of the following ones are not built yet
+  int linesWidth = 0;
+  bool linesDirty = false;
+  uint64_t linesVersion = 0;
+
+  std::string consoleBuf;
+  bool consoleBufIsError = false;
+
   uint32_t setLogColor(uint32_t color);
   void addString(const std::string & s);
+  LogEntry & appendEntry();
+  const LogEntry * getEntry(int64_t entry) const;
+  void wrapEntry(int64_t entry);
 
   void applyStateColor();
 };
 
 extern Logger logger;
 
+// complete lines of the log are written to the file by a background thread, the file is appended
+bool start_log_file(const char * file_name);
+void stop_log_file();
+
 void on_switch_to_log_screen();
 void update_log_screen(float dt);
 void draw_log_screen();
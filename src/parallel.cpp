@@ -0,0 +1,238 @@
+#include "parallel.h"
+#include "jobs.h"
+#include "globals.h"
+#include "logger.h"
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <string>
+#include <vector>
+#include <string.h>
+
+using namespace das;
+using namespace std;
+
+namespace parallel
+{
+
+// the logger belongs to the main thread, output of the jobs is kept until the run is finished
+struct ParallelContext final : Context
+{
+  ParallelContext(Context & ctx, uint32_t category) : Context(ctx, category) {}
+
+  mutex outputMutex;
+  vector<pair<bool, string>> output; // is error, text
+
+  void to_out(const char * message)
+  {
+    lock_guard<mutex> lock(outputMutex);
+    output.emplace_back(false, message);
+  }
+
+  void to_err(const char * message)
+  {
+    lock_guard<mutex> lock(outputMutex);
+    output.emplace_back(true, message);
+  }
+};
+
+struct ParallelFor
+{
+  Func fn;
+  int count = 0;
+  int chunk = 1;
+  int chunkCount = 0;
+  atomic<int> nextChunk;
+  atomic<int> finishedChunks;
+  atomic<bool> failed;
+  mutex errorMutex;
+  string error;
+  Context * waiterClone = nullptr; // async run, the waiting thread takes the chunks that are still in the queue
+
+  ParallelFor() : nextChunk(0), finishedChunks(0), failed(false) {}
+};
+
+static vector<ParallelContext *> clones; // one per worker and one for the waiting thread
+static Context * clones_source = nullptr;
+static shared_ptr<ParallelFor> async_run;
+
+
+static void run_chunks(ParallelFor & pf, Context * ctx, LineInfoArg * at)
+{
+  for (;;)
+  {
+    int idx = pf.nextChunk.fetch_add(1);
+    if (idx >= pf.chunkCount)
+      return;
+
+    if (!pf.failed.load())
+    {
+      int begin = idx * pf.chunk;
+      int end = pf.count - begin > pf.chunk ? begin + pf.chunk : pf.count;
+      ctx->runWithCatch([&]()
+      {
+        das_invoke_function<void>::invoke<int, int>(ctx, at, pf.fn, begin, end);
+      });
+      if (const char * exception = ctx->getException())
+      {
+        lock_guard<mutex> lock(pf.errorMutex);
+        if (!pf.failed.load())
+          pf.error = exception;
+        pf.failed.store(true);
+      }
+    }
+    pf.finishedChunks.fetch_add(1);
+  }
+}
+
+static void prepare_clones(Context * context, int count)
+{
+  if (clones_source != context)
+    release_contexts();
+  clones_source = context;
+
+  while (int(clones.size()) < count)
+    clones.push_back(new ParallelContext(*context, 0));
+
+  for (int i = 0; i < count; i++)
+  {
+    clones[i]->restartHeaps();
+    if (context->globalsSize)
+      memcpy(clones[i]->globals, context->globals, context->globalsSize);
+  }
+}
+
+static shared_ptr<ParallelFor> start(int count, int chunk, const Func & fn, Context * context, LineInfoArg * at,
+  bool caller_works)
+{
+  if (count < 0)
+    context->throw_error_at(*at, "parallel_for: negative count %d", count);
+  if (chunk <= 0)
+    context->throw_error_at(*at, "parallel_for: chunk size must be positive, got %d", chunk);
+
+  auto pf = make_shared<ParallelFor>();
+  pf->fn = fn;
+  pf->count = count;
+  pf->chunk = chunk;
+  pf->chunkCount = count / chunk + (count % chunk ? 1 : 0);
+
+  int workers = jobs::get_worker_count();
+  int jobCount = pf->chunkCount - (caller_works ? 1 : 0);
+  if (jobCount > workers)
+    jobCount = workers;
+  if (jobCount <= 0)
+    return pf;
+
+  prepare_clones(context, caller_works ? jobCount : jobCount + 1);
+  if (!caller_works)
+    pf->waiterClone = clones[jobCount];
+
+  // jobs started after all chunks are taken do not touch their context, so the run is over
+  // when all chunks are finished, even if some of the jobs are still in the queue
+  daScriptEnvironment * env = daScriptEnvironment::bound;
+  for (int i = 0; i < jobCount; i++)
+  {
+    Context * clone = clones[i];
+    jobs::add_job([pf, clone, env]()
+    {
+      daScriptEnvironment * prevEnv = daScriptEnvironment::bound;
+      daScriptEnvironment::bound = env;
+      run_chunks(*pf, clone, nullptr);
+      daScriptEnvironment::bound = prevEnv;
+    });
+  }
+  return pf;
+}
+
+static void flush_clone_output()
+{
+  for (ParallelContext * clone : clones)
+  {
+    vector<pair<bool, string>> output;
+    {
+      lock_guard<mutex> lock(clone->outputMutex);
+      output.swap(clone->output);
+    }
+    for (auto && line : output)
+      if (line.first)
+      {
+        logger.setTopErrorLine();
+        logger.setState(LOGGER_ERROR);
+        logger << line.second << "\n";
+        logger.setState(LOGGER_NORMAL);
+      }
+      else
+        logger << line.second;
+  }
+}
+
+// the jobs of the run can stay in the queue behind unrelated jobs, so the waiting thread does not just spin
+static void wait_for_chunks(ParallelFor & pf)
+{
+  if (pf.waiterClone)
+    run_chunks(pf, pf.waiterClone, nullptr);
+  while (pf.finishedChunks.load() < pf.chunkCount)
+    this_thread::yield();
+  flush_clone_output();
+}
+
+static void finish(ParallelFor & pf, Context * context, LineInfoArg * at)
+{
+  wait_for_chunks(pf);
+
+  if (pf.failed.load())
+  {
+    lock_guard<mutex> lock(pf.errorMutex);
+    string error = pf.error;
+    context->throw_error_at(*at, "parallel_for: %s", error.c_str());
+  }
+}
+
+void parallel_for(int count, int chunk, const Func & fn, Context * context, LineInfoArg * at)
+{
+  wait(context, at);
+  shared_ptr<ParallelFor> pf = start(count, chunk, fn, context, at, true);
+  run_chunks(*pf, context, at);
+  finish(*pf, context, at);
+}
+
+void parallel_for_async(int count, int chunk, const Func & fn, Context * context, LineInfoArg * at)
+{
+  wait(context, at);
+  shared_ptr<ParallelFor> pf = start(count, chunk, fn, context, at, false);
+  if (jobs::get_worker_count() == 0)
+    run_chunks(*pf, context, at);
+  async_run = pf;
+}
+
+void wait(Context * context, LineInfoArg * at)
+{
+  if (!async_run)
+    return;
+  shared_ptr<ParallelFor> pf = async_run;
+  async_run.reset();
+  finish(*pf, context, at);
+}
+
+void barrier()
+{
+  if (!async_run)
+    return;
+  shared_ptr<ParallelFor> pf = async_run;
+  async_run.reset();
+  wait_for_chunks(*pf);
+  if (pf->failed.load())
+    print_error("parallel_for_async: %s", pf->error.c_str());
+}
+
+void release_contexts()
+{
+  barrier();
+  for (ParallelContext * ctx : clones)
+    delete ctx;
+  clones.clear();
+  clones_source = nullptr;
+}
+
+} // namespace parallel
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <daScript/daScript.h>
+
+
+namespace parallel
+{
+  // 'fn(begin, end)' is called for chunks of [0, count) on the worker threads, each worker runs it on its own
+  // clone of 'context'. Clones get a copy of the globals before the run, so arrays of the main context
+  // are shared, but new values of the globals and allocations of the job are not visible outside of it.
+  // Text printed by the clones goes to the log when the run is finished.
+  void parallel_for(int count, int chunk, const das::Func & fn, das::Context * context, das::LineInfoArg * at);
+
+  // the calling thread does not take part in the work, it is finished by 'wait' or by the barrier before 'draw',
+  // they take the chunks that no worker has started yet
+  void parallel_for_async(int count, int chunk, const das::Func & fn, das::Context * context,
+    das::LineInfoArg * at);
+  void wait(das::Context * context, das::LineInfoArg * at);
+  void barrier(); // waits for the async run outside of the script, errors are printed
+
+  void release_contexts(); // when the script is unloaded
+}
@@ -0,0 +1,396 @@
+#include "profiler.h"
+#include "globals.h"
+#include "fileSystem.h"
+#include <chrono>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <string.h>
+#include <stdio.h>
+
+using namespace std;
+
+namespace profiler
+{
+
+struct FrameTimes
+{
+  float phases[FRAME_PHASE_COUNT];
+  float total;
+};
+
+static FrameTimes frames[PROFILER_FRAMES];
+static int frames_recorded = 0;
+static FrameTimes current_frame;
+static int current_phase = -1;
+static chrono::steady_clock::time_point frame_start;
+static chrono::steady_clock::time_point phase_start;
+static chrono::steady_clock::time_point profiler_epoch = chrono::steady_clock::now();
+
+static const char * phase_names[FRAME_PHASE_COUNT] =
+{
+  "events",
+  "update",
+  "act",
+  "draw",
+  "render",
+  "display",
+  "sleep"
+};
+
+
+static float ms_between(chrono::steady_clock::time_point from, chrono::steady_clock::time_point to)
+{
+  return chrono::duration<float, milli>(to - from).count();
+}
+
+static int64_t to_ns(chrono::steady_clock::time_point t)
+{
+  return chrono::duration_cast<chrono::nanoseconds>(t - profiler_epoch).count();
+}
+
+
+//----- script markers -----
+
+// Markers and their names are written to the preallocated arena of the current frame, the arena of the previous
+// frame is kept for the overlay. Nothing is allocated while recording unless a trace is captured.
+
+#define PROFILER_MAX_MARKERS 4096
+#define PROFILER_MAX_DEPTH 64
+#define PROFILER_NAMES_ARENA (64 * 1024)
+#define PROFILER_MAX_NAME_LENGTH 127
+#define PROFILER_MAX_SEGMENTS 32
+
+struct Marker
+{
+  int nameOffset;
+  int depth;
+  int64_t startNs;
+  int64_t endNs;
+};
+
+struct PhaseSegment
+{
+  int phase;
+  int64_t startNs;
+  int64_t endNs;
+};
+
+struct MarkerFrame
+{
+  Marker markers[PROFILER_MAX_MARKERS];
+  char names[PROFILER_NAMES_ARENA];
+  PhaseSegment segments[PROFILER_MAX_SEGMENTS];
+  int markerCount = 0;
+  int namesUsed = 0;
+  int segmentCount = 0;
+  int dropped = 0;
+  int64_t startNs = 0;
+  int64_t endNs = 0;
+
+  void reset(int64_t start_ns)
+  {
+    markerCount = 0;
+    namesUsed = 0;
+    segmentCount = 0;
+    dropped = 0;
+    startNs = start_ns;
+    endNs = start_ns;
+  }
+};
+
+static MarkerFrame marker_frames[2];
+static int current_marker_frame = 0;
+static int open_markers[PROFILER_MAX_DEPTH]; // -1 for dropped markers
+static int open_marker_count = 0;
+
+static MarkerFrame & get_current_marker_frame()
+{
+  return marker_frames[current_marker_frame];
+}
+
+static void add_phase_segment(int phase, int64_t start_ns, int64_t end_ns)
+{
+  MarkerFrame & f = get_current_marker_frame();
+  if (f.segmentCount > 0 && f.segments[f.segmentCount - 1].phase == phase)
+    f.segments[f.segmentCount - 1].endNs = end_ns;
+  else if (f.segmentCount < PROFILER_MAX_SEGMENTS)
+    f.segments[f.segmentCount++] = PhaseSegment{phase, start_ns, end_ns};
+}
+
+void begin_marker(const char * name)
+{
+  MarkerFrame & f = get_current_marker_frame();
+  if (!name)
+    name = "";
+  int len = int(strlen(name));
+  if (len > PROFILER_MAX_NAME_LENGTH)
+    len = PROFILER_MAX_NAME_LENGTH;
+
+  int index = -1;
+  if (open_marker_count < PROFILER_MAX_DEPTH && f.markerCount < PROFILER_MAX_MARKERS &&
+      f.namesUsed + len + 1 <= PROFILER_NAMES_ARENA)
+  {
+    index = f.markerCount++;
+    Marker & m = f.markers[index];
+    m.nameOffset = f.namesUsed;
+    m.depth = open_marker_count;
+    memcpy(f.names + f.namesUsed, name, len);
+    f.names[f.namesUsed + len] = 0;
+    f.namesUsed += len + 1;
+    m.startNs = to_ns(chrono::steady_clock::now());
+    m.endNs = m.startNs;
+  }
+  else
+    f.dropped++;
+
+  if (open_marker_count < PROFILER_MAX_DEPTH)
+    open_markers[open_marker_count] = index;
+  open_marker_count++;
+}
+
+bool end_marker()
+{
+  if (open_marker_count <= 0)
+    return false;
+
+  open_marker_count--;
+  if (open_marker_count < PROFILER_MAX_DEPTH && open_markers[open_marker_count] >= 0)
+  {
+    MarkerFrame & f = get_current_marker_frame();
+    f.markers[open_markers[open_marker_count]].endNs = to_ns(chrono::steady_clock::now());
+  }
+  return true;
+}
+
+int get_marker_summary(MarkerSummary * out, int max_count)
+{
+  const MarkerFrame & f = marker_frames[current_marker_frame ^ 1];
+  int count = 0;
+  for (int i = 0; i < f.markerCount; i++)
+  {
+    const Marker & m = f.markers[i];
+    const char * name = f.names + m.nameOffset;
+    float ms = float(m.endNs - m.startNs) * 1e-6f;
+    bool found = false;
+    for (int j = 0; j < count && !found; j++)
+      if (out[j].depth == m.depth && !strcmp(out[j].name, name))
+      {
+        out[j].totalMs += ms;
+        out[j].count++;
+        found = true;
+      }
+
+    if (!found && count < max_count)
+      out[count++] = MarkerSummary{name, m.depth, ms, 1};
+  }
+
+  std::sort(out, out + count, [](const MarkerSummary & a, const MarkerSummary & b) { return a.totalMs > b.totalMs; });
+  return count;
+}
+
+
+//----- chrome trace -----
+
+// 'chrome://tracing' or 'ui.perfetto.dev' JSON, phases and markers of the frames are nested complete events
+
+struct TraceEvent
+{
+  string name;
+  int64_t startNs;
+  int64_t endNs;
+};
+
+static vector<TraceEvent> trace_events;
+static string trace_file_name;
+static int trace_frames_left = 0;
+
+void append_json_string(string & out, const char * str)
+{
+  out += '"';
+  for (const char * p = str; *p; p++)
+  {
+    unsigned char c = (unsigned char)*p;
+    if (c == '"' || c == '\\')
+    {
+      out += '\\';
+      out += char(c);
+    }
+    else if (c < 0x20)
+    {
+      char buf[8];
+      snprintf(buf, sizeof(buf), "\\u%04x", c);
+      out += buf;
+    }
+    else
+      out += char(c);
+  }
+  out += '"';
+}
+
+static void write_trace()
+{
+  string out = "{\"traceEvents\":[\n";
+  char buf[128];
+  for (size_t i = 0; i < trace_events.size(); i++)
+  {
+    const TraceEvent & e = trace_events[i];
+    out += "{\"name\":";
+    append_json_string(out, e.name.c_str());
+    snprintf(buf, sizeof(buf), ",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":%.3f,\"dur\":%.3f}",
+      double(e.startNs) * 1e-3, double(e.endNs - e.startNs) * 1e-3);
+    out += buf;
+    out += i + 1 < trace_events.size() ? ",\n" : "\n";
+  }
+  out += "],\"displayTimeUnit\":\"ms\"}\n";
+
+  trace_events.clear();
+  trace_events.shrink_to_fit();
+
+  FILE * f = fopen(trace_file_name.c_str(), "wb");
+  if (!f)
+  {
+    print_error("Cannot write trace to file '%s'", trace_file_name.c_str());
+    return;
+  }
+  bool ok = fwrite(out.c_str(), 1, out.length(), f) == out.length();
+  fclose(f);
+  if (ok)
+    print_note("Trace is written to '%s'", trace_file_name.c_str());
+  else
+    print_error("Cannot write trace to file '%s'", trace_file_name.c_str());
+}
+
+static void capture_frame(const MarkerFrame & f)
+{
+  char buf[32];
+  snprintf(buf, sizeof(buf), "frame %d", frames_recorded);
+  trace_events.push_back(TraceEvent{buf, f.startNs, f.endNs});
+  for (int i = 0; i < f.segmentCount; i++)
+    trace_events.push_back(TraceEvent{get_phase_name(f.segments[i].phase), f.segments[i].startNs, f.segments[i].endNs});
+  for (int i = 0; i < f.markerCount; i++)
+    trace_events.push_back(TraceEvent{f.names + f.markers[i].nameOffset, f.markers[i].startNs, f.markers[i].endNs});
+
+  if (--trace_frames_left <= 0)
+    write_trace();
+}
+
+bool capture_trace(const char * file_name, int frame_count)
+{
+  if (!file_name || !*file_name)
+  {
+    print_error("capture_trace: file name is empty");
+    return false;
+  }
+
+  if (!fs::is_path_string_valid(file_name))
+  {
+    print_error("Cannot write trace to file '%s'. Absolute paths or access to the parent directory is prohibited.",
+      file_name);
+    return false;
+  }
+
+  trace_file_name = file_name;
+  trace_frames_left = frame_count > 0 ? frame_count : 1;
+  trace_events.clear();
+  return true;
+}
+
+
+//----- frames -----
+
+void begin_frame()
+{
+  frame_start = chrono::steady_clock::now();
+  phase_start = frame_start;
+  current_phase = -1;
+  for (float & t : current_frame.phases)
+    t = 0.0f;
+  get_current_marker_frame().reset(to_ns(frame_start));
+}
+
+void begin_phase(FramePhase phase)
+{
+  auto now = chrono::steady_clock::now();
+  if (current_phase >= 0)
+  {
+    current_frame.phases[current_phase] += ms_between(phase_start, now);
+    add_phase_segment(current_phase, to_ns(phase_start), to_ns(now));
+  }
+  current_phase = phase;
+  phase_start = now;
+}
+
+void end_frame()
+{
+  auto now = chrono::steady_clock::now();
+  if (current_phase >= 0)
+  {
+    current_frame.phases[current_phase] += ms_between(phase_start, now);
+    add_phase_segment(current_phase, to_ns(phase_start), to_ns(now));
+  }
+  current_phase = -1;
+  current_frame.total = ms_between(frame_start, now);
+
+  frames[frames_recorded % PROFILER_FRAMES] = current_frame;
+  frames_recorded++;
+
+  // markers left open by an exception in the script are closed here
+  while (open_marker_count > 0)
+    end_marker();
+
+  MarkerFrame & f = get_current_marker_frame();
+  f.endNs = to_ns(now);
+  if (trace_frames_left > 0)
+    capture_frame(f);
+  current_marker_frame ^= 1;
+}
+
+int get_profiled_frame_count()
+{
+  return frames_recorded < PROFILER_FRAMES ? frames_recorded : PROFILER_FRAMES;
+}
+
+static const FrameTimes * get_frame(int frames_ago)
+{
+  if (frames_ago < 0 || frames_ago >= get_profiled_frame_count())
+    return nullptr;
+  return &frames[(frames_recorded - 1 - frames_ago) % PROFILER_FRAMES];
+}
+
+float get_phase_time(int frames_ago, int phase)
+{
+  const FrameTimes * f = get_frame(frames_ago);
+  return f && phase >= 0 && phase < FRAME_PHASE_COUNT ? f->phases[phase] : 0.0f;
+}
+
+float get_frame_time(int frames_ago)
+{
+  const FrameTimes * f = get_frame(frames_ago);
+  return f ? f->total : 0.0f;
+}
+
+const char * get_phase_name(int phase)
+{
+  return phase >= 0 && phase < FRAME_PHASE_COUNT ? phase_names[phase] : "";
+}
+
+FrameProfile get_frame_profile(int frames_ago)
+{
+  FrameProfile p;
+  const FrameTimes * f = get_frame(frames_ago);
+  if (!f)
+    return p;
+
+  p.events = f->phases[PHASE_EVENTS];
+  p.update = f->phases[PHASE_UPDATE];
+  p.act = f->phases[PHASE_ACT];
+  p.draw = f->phases[PHASE_DRAW];
+  p.render = f->phases[PHASE_RENDER];
+  p.display = f->phases[PHASE_DISPLAY];
+  p.sleep = f->phases[PHASE_SLEEP];
+  p.total = f->total;
+  return p;
+}
+
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+
+#include <stdint.h>
+#include <string>
+
+#define PROFILER_FRAMES 256
+
+namespace profiler
+{
+  enum FramePhase
+  {
+    PHASE_EVENTS,   // window events
+    PHASE_UPDATE,   // hot reload, screen switching and other work of dasbox
+    PHASE_ACT,      // script act()
+    PHASE_DRAW,     // script draw()
+    PHASE_RENDER,   // overlays, submitting batches and the render target blit
+    PHASE_DISPLAY,  // window display(), includes vsync wait
+    PHASE_SLEEP,
+    FRAME_PHASE_COUNT
+  };
+
+  // times of the frame in milliseconds
+  struct FrameProfile
+  {
+    float events = 0.0f;
+    float update = 0.0f;
+    float act = 0.0f;
+    float draw = 0.0f;
+    float render = 0.0f;
+    float display = 0.0f;
+    float sleep = 0.0f;
+    float total = 0.0f;
+  };
+
+  // context heap of the running script in bytes, peaks are kept since the script start
+  struct HeapStats
+  {
+    int64_t heapBytes = 0;
+    int64_t heapReserved = 0;   // taken from the system, including free space of the heap
+    int64_t stringBytes = 0;
+    int64_t stringReserved = 0;
+    int64_t heapPeak = 0;
+    int64_t stringPeak = 0;
+    int64_t frameHeapGrowth = 0;   // allocated during the last frame, negative after collection
+    int64_t frameStringGrowth = 0;
+    int collections = 0;
+    int skippedCollections = 0;    // did not fit into the requested time budget
+    float lastCollectionMs = 0.0f;
+    int64_t lastCollectionFreed = 0;
+  };
+
+  struct MarkerSummary
+  {
+    const char * name; // valid until the next frame
+    int depth;
+    float totalMs;
+    int count;
+  };
+
+  void begin_frame();
+  void begin_phase(FramePhase phase); // finishes the previous phase, time of the repeated phase is accumulated
+  void end_frame();
+
+  int get_profiled_frame_count();
+  float get_phase_time(int frames_ago, int phase); // frames_ago = 0 is the last finished frame
+  float get_frame_time(int frames_ago);
+  const char * get_phase_name(int phase);
+  FrameProfile get_frame_profile(int frames_ago);
+
+  // nested script markers, the unclosed ones are closed at the end of the frame
+  void begin_marker(const char * name);
+  bool end_marker(); // false if there is no open marker
+  int get_marker_summary(MarkerSummary * out, int max_count); // markers of the last finished frame by name and depth
+
+  // trace of the next 'frame_count' frames is written to 'file_name'
+  bool capture_trace(const char * file_name, int frame_count);
+
+  void append_json_string(std::string & out, const char * str); // quoted and escaped
+}
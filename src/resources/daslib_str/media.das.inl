@@ -2,6 +2,8 @@
 // AUTO-GENERATED FILE - DO NOT EDIT!!
 //
 
+"module media shared public\n"
+"\n"
 "require daslib/strings_boost public\n"
 "require daslib/random public\n"
 "require daslib/safe_addr public\n"
@@ -5,151 +5,440 @@
 #include <daScript/simulate/simulate_visit_op.h>
 #include <array>
 #include <unordered_set>
+#include <unordered_map>
+#include <memory>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <chrono>
 #include "globals.h"
 #include "fileSystem.h"
+#include "jobs.h"
 
 #define MINIAUDIO_IMPLEMENTATION
 #include <miniaudio.h>
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+  #include <emmintrin.h>
+  #define SOUND_MIX_SSE 1
+#endif
+
 
 using namespace std;
 using namespace das;
 
-#define OUTPUT_SAMPLE_RATE 48000
+#define DEFAULT_OUTPUT_SAMPLE_RATE 48000
+#define LOW_LATENCY_PERIOD_FRAMES 128
+#define LOW_LATENCY_PERIODS 2
 #define OUTPUT_CHANNELS 2
 
-#define MAX_PLAYING_SOUNDS 128 // power of 2
+#define MAX_PLAYING_SOUNDS 1024 // power of 2, voice slots including fading out voices
 #define PLAYING_SOUNDS_MASK (MAX_PLAYING_SOUNDS - 1)
+#define DEFAULT_MAX_VOICES 256
 #define ONE_DIV_256 (1.f / 256)
 #define ONE_DIV_512 (1.f / 512)
 
+#define MAX_SOUND_BUSES 8
+#define SOUND_BUS_SFX 0
+#define SOUND_BUS_MUSIC 1
+#define SOUND_BUS_UI 2
+#define MIX_BLOCK_FRAMES 256
+
 namespace sound
 {
 
-int64_t total_samples_played = 0;
-double total_time_played = 0.0;
+atomic<int64_t> total_samples_played(0);
+atomic<double> total_time_played(0.0);
 
-static sf::Mutex sound_cs;
-static volatile bool sound_cs_manual_entered = false;
-
-static float master_volume = 1.0f;
+static float master_volume = 1.0f; // owned by mixer
+static int output_sample_rate = DEFAULT_OUTPUT_SAMPLE_RATE; // changed only while device is stopped
 
 static unordered_set<float *> sound_data_pointers;
 
-struct WinAutoLock
+static void release_sound_data(float * data);
+
+// IMA-ADPCM block per channel: int16 first frame, uint8 step index, padding, 63 frames by 4 bits
+#define ADPCM_BLOCK_FRAMES 64
+#define ADPCM_BLOCK_BYTES 36
+
+// one frame after the end is a copy of the first one for interpolation, one more block is for reading ahead
+static inline int adpcm_block_count(int samples)
+{
+  return (samples + ADPCM_BLOCK_FRAMES) / ADPCM_BLOCK_FRAMES + 1;
+}
+
+
+void PcmSound::newData(size_t size_bytes)
+{
+  data = new float[(size_bytes + sizeof(float) - 1) / sizeof(float)];
+  sound_data_pointers.insert(data);
+}
+
+// data can still be used by mixer, it will be deleted after mixer stops all its voices
+void PcmSound::deleteData()
+{
+  if (data)
+    release_sound_data(data);
+  data = nullptr;
+}
+
+int PcmSound::getDataMemorySize() const
 {
-  sf::Mutex * mutex;
-  WinAutoLock(sf::Mutex * mutex_) :
-    mutex(mutex_)
+  switch (storage)
   {
-    mutex->lock();
+    case SOUND_STORAGE_INT16: return channels * (samples + 4) * sizeof(int16_t);
+    case SOUND_STORAGE_ADPCM: return channels * adpcm_block_count(samples) * ADPCM_BLOCK_BYTES;
+    default: return channels * (samples + 4) * sizeof(float);
   }
+}
+
+PcmSound::PcmSound(const PcmSound & b)
+{
+  frequency = b.frequency;
+  samples = b.samples;
+  channels = b.channels;
+  storage = b.storage;
+  data = nullptr;
+  if (b.data)
+  {
+    newData(getDataMemorySize());
+    memcpy(data, b.data, getDataMemorySize());
+  }
+}
 
-  ~WinAutoLock()
+PcmSound& PcmSound::operator=(const PcmSound & b)
+{
+  if (this == &b)
+    return *this;
+
+  deleteData();
+  frequency = b.frequency;
+  samples = b.samples;
+  channels = b.channels;
+  storage = b.storage;
+  if (b.data)
   {
-    mutex->unlock();
+    newData(getDataMemorySize());
+    memcpy(data, b.data, getDataMemorySize());
   }
+  return *this;
+}
+
+
+//----- sample storage -----
+
+static const int16_t ima_step_table[89] =
+{
+  7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+  50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190, 209, 230, 253, 279, 307,
+  337, 371, 408, 449, 494, 544, 598, 658, 724, 796, 876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066,
+  2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899,
+  15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767
 };
 
+static const int8_t ima_index_table[16] = { -1, -1, -1, -1, 2, 4, 6, 8, -1, -1, -1, -1, 2, 4, 6, 8 };
+
+#define INT16_TO_FLOAT (1.f / 32768)
 
-struct PcmSound
+static inline int16_t float_to_int16(float v)
 {
-private:
-  float * data;
-public:
-  int frequency;
-  int samples;
-  int channels;
+  return int16_t(clamp(int(floorf(v * 32767.0f + 0.5f)), -32768, 32767));
+}
+
+static inline int adpcm_decode_nibble(int nibble, int & pred, int & index)
+{
+  int step = ima_step_table[index];
+  int delta = step >> 3;
+  if (nibble & 4)
+    delta += step;
+  if (nibble & 2)
+    delta += step >> 1;
+  if (nibble & 1)
+    delta += step >> 2;
+  pred = clamp((nibble & 8) ? pred - delta : pred + delta, -32768, 32767);
+  index = clamp(index + ima_index_table[nibble], 0, 88);
+  return pred;
+}
 
-  float * getData() const
+static inline int adpcm_encode_sample(int sample, int & pred, int & index)
+{
+  int step = ima_step_table[index];
+  int diff = sample - pred;
+  int nibble = 0;
+  if (diff < 0)
   {
-    return data;
+    nibble = 8;
+    diff = -diff;
   }
-
-  void newData(size_t size)
+  if (diff >= step)
+  {
+    nibble |= 4;
+    diff -= step;
+  }
+  if (diff >= (step >> 1))
   {
-    data = new float[size];
-    sound_data_pointers.insert(data);
+    nibble |= 2;
+    diff -= step >> 1;
   }
+  if (diff >= (step >> 2))
+    nibble |= 1;
 
-  void deleteData()
+  adpcm_decode_nibble(nibble, pred, index);
+  return nibble;
+}
+
+// 'out' gets ADPCM_BLOCK_FRAMES + 1 frames, the last one is the first frame of the next block
+static void adpcm_decode_block(const uint8_t * data, int block, int channels, float * __restrict out)
+{
+  for (int ch = 0; ch < channels; ch++)
   {
-    if (data)
+    const uint8_t * blk = data + (block * channels + ch) * ADPCM_BLOCK_BYTES;
+    int pred = int16_t(blk[0] | (blk[1] << 8));
+    int index = min(int(blk[2]), 88);
+    out[ch] = pred * INT16_TO_FLOAT;
+    for (int i = 1; i < ADPCM_BLOCK_FRAMES; i++)
     {
-      sound_data_pointers.erase(data);
-      delete[] data;
+      int nibble = (blk[4 + ((i - 1) >> 1)] >> (((i - 1) & 1) * 4)) & 15;
+      out[i * channels + ch] = adpcm_decode_nibble(nibble, pred, index) * INT16_TO_FLOAT;
     }
+
+    const uint8_t * next = blk + channels * ADPCM_BLOCK_BYTES;
+    out[ADPCM_BLOCK_FRAMES * channels + ch] = int16_t(next[0] | (next[1] << 8)) * INT16_TO_FLOAT;
   }
+}
 
-  bool isValid() const
+static void adpcm_encode(uint8_t * out, const float * frames, int samples, int channels)
+{
+  int blocks = adpcm_block_count(samples);
+  for (int ch = 0; ch < channels; ch++)
   {
-    return !!data;
+    auto frameValue = [&](int f) -> int
+    {
+      if (f < samples)
+        return float_to_int16(frames[f * channels + ch]);
+      return f == samples ? float_to_int16(frames[ch]) : 0;
+    };
+
+    // start with the step that fits the first delta, otherwise the first block is smeared
+    int index = 0;
+    int firstDelta = abs(frameValue(1) - frameValue(0));
+    while (index < 88 && ima_step_table[index] < firstDelta)
+      index++;
+
+    for (int b = 0; b < blocks; b++)
+    {
+      uint8_t * blk = out + (b * channels + ch) * ADPCM_BLOCK_BYTES;
+      int first = b * ADPCM_BLOCK_FRAMES;
+      int pred = frameValue(first);
+      memset(blk, 0, ADPCM_BLOCK_BYTES);
+      blk[0] = uint8_t(pred & 0xFF);
+      blk[1] = uint8_t((pred >> 8) & 0xFF);
+      blk[2] = uint8_t(index);
+      for (int i = 1; i < ADPCM_BLOCK_FRAMES; i++)
+      {
+        int nibble = adpcm_encode_sample(frameValue(first + i), pred, index);
+        blk[4 + ((i - 1) >> 1)] |= uint8_t(nibble << (((i - 1) & 1) * 4));
+      }
+    }
   }
+}
 
-  inline int getDataMemorySize() const
+// 'frames' has s.samples interleaved frames, data of 's' must be allocated
+static void encode_sound_frames(PcmSound & s, const float * frames)
+{
+  int count = s.samples * s.channels;
+  if (s.storage == SOUND_STORAGE_INT16)
   {
-    return channels * (samples + 4) * sizeof(float);
+    int16_t * dst = (int16_t *)s.getData();
+    for (int i = 0; i < count; i++)
+      dst[i] = float_to_int16(frames[i]);
+    for (int ch = 0; ch < s.channels; ch++)
+      dst[count + ch] = dst[ch];
   }
-
-  float getDuration() const
+  else if (s.storage == SOUND_STORAGE_ADPCM)
+    adpcm_encode((uint8_t *)s.getData(), frames, s.samples, s.channels);
+  else
   {
-    return samples / float(frequency);
+    float * dst = s.getData();
+    if (dst != frames)
+      memcpy(dst, frames, count * sizeof(float));
+    for (int ch = 0; ch < s.channels; ch++)
+      dst[count + ch] = dst[ch];
   }
+}
+
+static void store_sound_frames(PcmSound & s, int storage, const float * frames)
+{
+  s.storage = (storage >= SOUND_STORAGE_FLOAT && storage <= SOUND_STORAGE_ADPCM) ? storage : SOUND_STORAGE_FLOAT;
+  s.newData(s.getDataMemorySize());
+  encode_sound_frames(s, frames);
+}
 
-  int getFrequency() const
+// 'out' gets s.samples + 1 interleaved frames
+static void decode_sound_frames(const PcmSound & s, vector<float> & out)
+{
+  int count = s.samples * s.channels;
+  out.resize(count + s.channels);
+  if (s.storage == SOUND_STORAGE_INT16)
   {
-    return frequency;
+    const int16_t * src = (const int16_t *)s.getData();
+    for (int i = 0; i < count + s.channels; i++)
+      out[i] = src[i] * INT16_TO_FLOAT;
   }
-
-  int getSamples() const
+  else if (s.storage == SOUND_STORAGE_ADPCM)
   {
-    return samples;
+    float block[(ADPCM_BLOCK_FRAMES + 1) * 2];
+    for (int b = 0; b * ADPCM_BLOCK_FRAMES <= s.samples; b++)
+    {
+      adpcm_decode_block((const uint8_t *)s.getData(), b, s.channels, block);
+      int frames = min(ADPCM_BLOCK_FRAMES, s.samples + 1 - b * ADPCM_BLOCK_FRAMES);
+      memcpy(&out[b * ADPCM_BLOCK_FRAMES * s.channels], block, frames * s.channels * sizeof(float));
+    }
   }
+  else
+    memcpy(out.data(), s.getData(), (count + s.channels) * sizeof(float));
+}
+
 
-  int getChannels() const
+//----- mixing kernels -----
+
+// fast path for voices with steady volume, 'pos' and 'advance' are 32.32 fixed point sample positions
+
+#define FIXED_POS_ONE 4294967296.0
+#define FIXED_FRAC_TO_FLOAT (1.f / 16777216) // fraction is converted with 24 bits precision
+
+static void mix_mono_steady(float * __restrict mix, int count, const float * __restrict data,
+  uint64_t & pos, uint64_t advance, float vol_l, float vol_r)
+{
+  int i = 0;
+#if SOUND_MIX_SSE
+  const __m128 fracScale = _mm_set1_ps(FIXED_FRAC_TO_FLOAT);
+  const __m128 vl = _mm_set1_ps(vol_l);
+  const __m128 vr = _mm_set1_ps(vol_r);
+  for (; i + 4 <= count; i += 4, mix += 8)
   {
-    return channels;
+    uint64_t p0 = pos;
+    uint64_t p1 = p0 + advance;
+    uint64_t p2 = p1 + advance;
+    uint64_t p3 = p2 + advance;
+    pos = p3 + advance;
+
+    const float * s0 = data + (p0 >> 32);
+    const float * s1 = data + (p1 >> 32);
+    const float * s2 = data + (p2 >> 32);
+    const float * s3 = data + (p3 >> 32);
+    __m128 a = _mm_set_ps(s3[0], s2[0], s1[0], s0[0]);
+    __m128 b = _mm_set_ps(s3[1], s2[1], s1[1], s0[1]);
+    __m128i fi = _mm_set_epi32(int(uint32_t(p3) >> 8), int(uint32_t(p2) >> 8), int(uint32_t(p1) >> 8), int(uint32_t(p0) >> 8));
+    __m128 t = _mm_mul_ps(_mm_cvtepi32_ps(fi), fracScale);
+    __m128 v = _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), t));
+
+    __m128 l = _mm_mul_ps(v, vl);
+    __m128 r = _mm_mul_ps(v, vr);
+    _mm_storeu_ps(mix, _mm_add_ps(_mm_loadu_ps(mix), _mm_unpacklo_ps(l, r)));
+    _mm_storeu_ps(mix + 4, _mm_add_ps(_mm_loadu_ps(mix + 4), _mm_unpackhi_ps(l, r)));
   }
-
-  PcmSound()
+#endif
+  for (; i < count; i++, mix += 2)
   {
-    frequency = 44100;
-    samples = 0;
-    channels = 1;
-    data = nullptr;
+    const float * s = data + (pos >> 32);
+    float t = float(uint32_t(pos) >> 8) * FIXED_FRAC_TO_FLOAT;
+    float v = lerp(s[0], s[1], t);
+    mix[0] += v * vol_l;
+    mix[1] += v * vol_r;
+    pos += advance;
   }
+}
 
-  PcmSound(const PcmSound & b)
+static void mix_stereo_steady(float * __restrict mix, int count, const float * __restrict data,
+  uint64_t & pos, uint64_t advance, float vol_l, float vol_r)
+{
+  int i = 0;
+#if SOUND_MIX_SSE
+  const __m128 fracScale = _mm_set1_ps(FIXED_FRAC_TO_FLOAT);
+  const __m128 vol = _mm_set_ps(vol_r, vol_l, vol_r, vol_l);
+  for (; i + 4 <= count; i += 4, mix += 8)
   {
-    frequency = b.frequency;
-    samples = b.samples;
-    channels = b.channels;
-    newData(getDataMemorySize());
-    memcpy(data, b.data, getDataMemorySize());
+    uint64_t p0 = pos;
+    uint64_t p1 = p0 + advance;
+    uint64_t p2 = p1 + advance;
+    uint64_t p3 = p2 + advance;
+    pos = p3 + advance;
+
+    const float * s0 = data + (p0 >> 32) * 2;
+    const float * s1 = data + (p1 >> 32) * 2;
+    const float * s2 = data + (p2 >> 32) * 2;
+    const float * s3 = data + (p3 >> 32) * 2;
+    __m128 a01 = _mm_set_ps(s1[1], s1[0], s0[1], s0[0]);
+    __m128 b01 = _mm_set_ps(s1[3], s1[2], s0[3], s0[2]);
+    __m128 a23 = _mm_set_ps(s3[1], s3[0], s2[1], s2[0]);
+    __m128 b23 = _mm_set_ps(s3[3], s3[2], s2[3], s2[2]);
+    __m128i fi = _mm_set_epi32(int(uint32_t(p3) >> 8), int(uint32_t(p2) >> 8), int(uint32_t(p1) >> 8), int(uint32_t(p0) >> 8));
+    __m128 t = _mm_mul_ps(_mm_cvtepi32_ps(fi), fracScale);
+    __m128 t01 = _mm_unpacklo_ps(t, t);
+    __m128 t23 = _mm_unpackhi_ps(t, t);
+
+    __m128 v01 = _mm_add_ps(a01, _mm_mul_ps(_mm_sub_ps(b01, a01), t01));
+    __m128 v23 = _mm_add_ps(a23, _mm_mul_ps(_mm_sub_ps(b23, a23), t23));
+    _mm_storeu_ps(mix, _mm_add_ps(_mm_loadu_ps(mix), _mm_mul_ps(v01, vol)));
+    _mm_storeu_ps(mix + 4, _mm_add_ps(_mm_loadu_ps(mix + 4), _mm_mul_ps(v23, vol)));
   }
-
-  PcmSound& operator=(const PcmSound & b)
+#endif
+  for (; i < count; i++, mix += 2)
   {
-    deleteData();
-    frequency = b.frequency;
-    samples = b.samples;
-    channels = b.channels;
-    newData(getDataMemorySize());
-    memcpy(data, b.data, getDataMemorySize());
-    return *this;
+    const float * s = data + (pos >> 32) * 2;
+    float t = float(uint32_t(pos) >> 8) * FIXED_FRAC_TO_FLOAT;
+    mix[0] += lerp(s[0], s[2], t) * vol_l;
+    mix[1] += lerp(s[1], s[3], t) * vol_r;
+    pos += advance;
   }
+}
 
-  PcmSound(PcmSound && b);
-  PcmSound& operator=(PcmSound && b);
-  ~PcmSound();
+// sound at the output sample rate with pitch 1.0 needs no interpolation
+static void mix_mono_copy(float * __restrict mix, int count, const float * __restrict data, float vol_l, float vol_r)
+{
+  int i = 0;
+#if SOUND_MIX_SSE
+  const __m128 vl = _mm_set1_ps(vol_l);
+  const __m128 vr = _mm_set1_ps(vol_r);
+  for (; i + 4 <= count; i += 4, mix += 8, data += 4)
+  {
+    __m128 v = _mm_loadu_ps(data);
+    __m128 l = _mm_mul_ps(v, vl);
+    __m128 r = _mm_mul_ps(v, vr);
+    _mm_storeu_ps(mix, _mm_add_ps(_mm_loadu_ps(mix), _mm_unpacklo_ps(l, r)));
+    _mm_storeu_ps(mix + 4, _mm_add_ps(_mm_loadu_ps(mix + 4), _mm_unpackhi_ps(l, r)));
+  }
+#endif
+  for (; i < count; i++, mix += 2, data++)
+  {
+    mix[0] += data[0] * vol_l;
+    mix[1] += data[0] * vol_r;
+  }
+}
 
-  friend void delete_sound(PcmSound * sound);
-};
+static void mix_stereo_copy(float * __restrict mix, int count, const float * __restrict data, float vol_l, float vol_r)
+{
+  int i = 0;
+#if SOUND_MIX_SSE
+  const __m128 vol = _mm_set_ps(vol_r, vol_l, vol_r, vol_l);
+  for (; i + 2 <= count; i += 2, mix += 4, data += 4)
+    _mm_storeu_ps(mix, _mm_add_ps(_mm_loadu_ps(mix), _mm_mul_ps(_mm_loadu_ps(data), vol)));
+#endif
+  for (; i < count; i++, mix += 2, data += 2)
+  {
+    mix[0] += data[0] * vol_l;
+    mix[1] += data[1] * vol_r;
+  }
+}
 
 
 struct PlayingSound
 {
-  const PcmSound * sound;
+  const float * sound; // sound data, it is not deleted while voice uses it
+  int frequency;
   double pos;      // in samples
   double startPos; // in samples
   double stopPos;  // in samples
@@ -160,9 +449,13 @@ struct PlayingSound
   float volumeR;
   float volumeTrendL;
   float volumeTrendR;
-  double timeToStart; // in seconds
+  int startOffset;    // in output frames from the beginning of the current mix block
   int channels;
+  int storage;
   int version;
+  int adpcmBlock;
+  int bus;
+  float adpcmFrames[(ADPCM_BLOCK_FRAMES + 1) * 2];
   bool loop;
   bool stopMode;
   bool waitingStart;
@@ -172,6 +465,25 @@ struct PlayingSound
     memset(this, 0, sizeof(*this));
   }
 
+  // compact storages are decoded right here, ADPCM is decoded by blocks
+  __forceinline float sampleAt(unsigned frame, int ch)
+  {
+    if (storage == SOUND_STORAGE_FLOAT)
+      return sound[frame * channels + ch];
+
+    if (storage == SOUND_STORAGE_INT16)
+      return ((const int16_t *)sound)[frame * channels + ch] * INT16_TO_FLOAT;
+
+    unsigned local = frame - unsigned(adpcmBlock) * ADPCM_BLOCK_FRAMES;
+    if (adpcmBlock < 0 || local > ADPCM_BLOCK_FRAMES)
+    {
+      adpcmBlock = int(frame / ADPCM_BLOCK_FRAMES);
+      adpcm_decode_block((const uint8_t *)sound, adpcmBlock, channels, adpcmFrames);
+      local = frame - unsigned(adpcmBlock) * ADPCM_BLOCK_FRAMES;
+    }
+    return adpcmFrames[local * channels + ch];
+  }
+
   bool isEmpty()
   {
     return !sound && !stopMode && !waitingStart;
@@ -191,8 +503,6 @@ struct PlayingSound
       return;
     }
 
-    version += MAX_PLAYING_SOUNDS;
-
     if (waitingStart)
     {
       waitingStart = false;
@@ -202,14 +512,14 @@ struct PlayingSound
 
     if (channels == 1)
     {
-      float val = sound->getData()[unsigned(pos)];
+      float val = sampleAt(unsigned(pos), 0);
       volumeL *= val;
       volumeR *= val;
     }
     else
     {
-      volumeL *= sound->getData()[unsigned(pos) * 2];
-      volumeR *= sound->getData()[unsigned(pos) * 2 + 1];
+      volumeL *= sampleAt(unsigned(pos), 0);
+      volumeR *= sampleAt(unsigned(pos), 1);
     }
     volumeTrendL = sign(volumeL) * -(1.f / 10000);
     volumeTrendR = sign(volumeR) * -(1.f / 10000);
@@ -217,74 +527,53 @@ struct PlayingSound
     sound = nullptr;
   }
 
-  void mixTo(float * __restrict mix, int count, int frequency, double inv_frequency, double buffer_time)
+  void mixTo(float * __restrict mix, int count, int output_frequency, double inv_frequency)
   {
+    if (waitingStart) // voice is in the scheduled starts queue
+      return;
+
     float wishVolumeL = master_volume * volume * min(1.0f + pan, 1.0f);
     float wishVolumeR = master_volume * volume * min(1.0f - pan, 1.0f);
-    float * __restrict sndData = sound ? sound->getData() : nullptr;
-    if (!sndData)
+    const float * __restrict sndData = sound;
+    if (!sndData && !stopMode)
       return;
 
-    double advance = sound ? double(sound->frequency) * inv_frequency * pitch : 1.0;
+    double advance = double(frequency) * inv_frequency * pitch;
 
-    if (!stopMode && !waitingStart && sound && volumeL > 0.0f && volumeR > 0.0f &&
+    if (!stopMode && sound && storage == SOUND_STORAGE_FLOAT && volumeL > 0.0f && volumeR > 0.0f &&
         wishVolumeL == volumeL && wishVolumeR == volumeR &&
         pos + advance * count < stopPos)
     {
-      if (channels == 1)
-      {
-        for (int i = 0; i < count; i++, mix += 2)
-        {
-          unsigned ip = unsigned(pos);
-          float t = float(pos - ip);
-          float v = lerp(sndData[ip], sndData[ip + 1], t);
-          mix[0] += v * volumeL;
-          mix[1] += v * volumeR;
-          pos += advance;
-        }
-      }
-      else // channels == 2
+      uint64_t posFixed = uint64_t(pos * FIXED_POS_ONE);
+      uint64_t advanceFixed = uint64_t(advance * FIXED_POS_ONE);
+      if (frequency == output_frequency && pitch == 1.0f && !uint32_t(posFixed))
       {
-        for (int i = 0; i < count; i++, mix += 2)
-        {
-          unsigned ip = unsigned(pos);
-          float t = float(pos - ip);
-          float vl = lerp(sndData[ip * 2], sndData[ip * 2 + 2], t);
-          float vr = lerp(sndData[ip * 2 + 1], sndData[ip * 2 + 2 + 1], t);
-          mix[0] += vl * volumeL;
-          mix[1] += vr * volumeR;
-          pos += advance;
-        }
+        const float * src = sndData + (posFixed >> 32) * channels;
+        if (channels == 1)
+          mix_mono_copy(mix, count, src, volumeL, volumeR);
+        else // channels == 2
+          mix_stereo_copy(mix, count, src, volumeL, volumeR);
+        pos += count;
+        return;
       }
 
+      if (channels == 1)
+        mix_mono_steady(mix, count, sndData, posFixed, advanceFixed, volumeL, volumeR);
+      else // channels == 2
+        mix_stereo_steady(mix, count, sndData, posFixed, advanceFixed, volumeL, volumeR);
+      pos = double(posFixed) * (1.0 / FIXED_POS_ONE);
       return;
     }
 
-    if (waitingStart && timeToStart > buffer_time)
-    {
-      timeToStart -= buffer_time;
-      return;
-    }
-
-
     if (channels == 1)
     {
       for (int i = 0; i < count; i++, mix += 2)
       {
-        if (waitingStart)
-        {
-          timeToStart -= inv_frequency;
-          if (timeToStart <= 0.0)
-          {
-            waitingStart = false;
-            pos = startPos;
-          }
-        }
-        else if (!stopMode)
+        if (!stopMode)
         {
           unsigned ip = unsigned(pos);
           float t = float(pos - ip);
-          float v = lerp(sndData[ip], sndData[ip + 1], t);
+          float v = lerp(sampleAt(ip, 0), sampleAt(ip + 1, 0), t);
 
           mix[0] += v * volumeL;
           mix[1] += v * volumeR;
@@ -351,21 +640,12 @@ struct PlayingSound
     {
       for (int i = 0; i < count; i++, mix += 2)
       {
-        if (waitingStart)
-        {
-          timeToStart -= inv_frequency;
-          if (timeToStart <= 0.0)
-          {
-            waitingStart = false;
-            pos = startPos;
-          }
-        }
-        else if (!stopMode)
+        if (!stopMode)
         {
           unsigned ip = unsigned(pos);
           float t = float(pos - ip);
-          float vl = lerp(sndData[ip * 2], sndData[ip * 2 + 2], t);
-          float vr = lerp(sndData[ip * 2 + 1], sndData[ip * 2 + 2 + 1], t);
+          float vl = lerp(sampleAt(ip, 0), sampleAt(ip + 1, 0), t);
+          float vr = lerp(sampleAt(ip, 1), sampleAt(ip + 1, 1), t);
 
           mix[0] += vl * volumeL;
           mix[1] += vr * volumeR;
@@ -434,248 +714,2280 @@ struct PlayingSound
   }
 };
 
-static array<PlayingSound, MAX_PLAYING_SOUNDS> playing_sounds;
+static array<PlayingSound, MAX_PLAYING_SOUNDS> playing_sounds; // owned by mixer
+static array<int, MAX_PLAYING_SOUNDS> active_voices;           // owned by mixer, indices of non-empty playing_sounds
+static int active_voice_count = 0;
 
-static int allocate_playing_sound()
-{
-  for (int i = 1; i < MAX_PLAYING_SOUNDS; i++)
-    if (playing_sounds[i].isEmpty())
-    {
-      playing_sounds[i].version += MAX_PLAYING_SOUNDS;
-      return i;
-    }
-  return -1;
-}
 
-static bool is_handle_valid(PlayingSoundHandle ps)
-{
-  unsigned idx = ps.handle & PLAYING_SOUNDS_MASK;
-  return (playing_sounds[idx].version == (ps.handle & (~PLAYING_SOUNDS_MASK))) && idx > 0;
-}
+//----- streaming music -----
 
-static int handle_to_index(PlayingSoundHandle ps)
-{
-  if (!is_handle_valid(ps))
-    return -1;
-  return ps.handle & PLAYING_SOUNDS_MASK;
-}
+// Music is decoded by the streaming thread into a ring buffer, mixer consumes decoded frames.
+// Ring positions only grow, so a frame index is never reused while mixer may still read it.
 
+#define MUSIC_RING_FRAMES 65536 // power of 2
+#define MUSIC_RING_MASK (MUSIC_RING_FRAMES - 1)
+#define MUSIC_DECODE_CHUNK 4096
+#define MAX_MUSIC_STREAMS 16
+#define MUSIC_NO_END (~uint64_t(0))
 
-static void fill_buffer_cb(float * __restrict out_buf, int frequency, int channels, int samples)
+enum MusicFormat
 {
-  WinAutoLock lock(&sound_cs);
+  MUSIC_NONE,
+  MUSIC_WAV,
+  MUSIC_MP3,
+  MUSIC_FLAC
+};
 
-  memset(out_buf, 0, samples * channels * sizeof(float));
+struct MusicDecoder
+{
+  MusicFormat format = MUSIC_NONE;
+  drwav wav;
+  drmp3 mp3;
+  drflac * flac = nullptr;
+  unsigned channels = 0;
+  unsigned sampleRate = 0;
+
+  bool open(const char * file_name)
+  {
+    const uint8_t * pakData = nullptr;
+    uint64_t pakSize = 0;
+    bool inPak = fs::find_pak_file(file_name, pakData, pakSize);
 
-  double invFrequency = 1.0 / frequency;
-  int step = 256;
+    const char * p = strrchr(file_name, '.');
+    if (p && !stricmp(p, ".wav") && !p[4])
+    {
+      if (inPak ? !drwav_init_memory(&wav, pakData, size_t(pakSize), nullptr) : !drwav_init_file(&wav, file_name, nullptr))
+        return false;
+      format = MUSIC_WAV;
+      channels = wav.channels;
+      sampleRate = wav.sampleRate;
+    }
+    else if (p && !stricmp(p, ".mp3") && !p[4])
+    {
+      if (inPak ? !drmp3_init_memory(&mp3, pakData, size_t(pakSize), nullptr) : !drmp3_init_file(&mp3, file_name, nullptr))
+        return false;
+      format = MUSIC_MP3;
+      channels = mp3.channels;
+      sampleRate = mp3.sampleRate;
+    }
+    else if (p && !stricmp(p, ".flac") && !p[5])
+    {
+      flac = inPak ? drflac_open_memory(pakData, size_t(pakSize), nullptr) : drflac_open_file(file_name, nullptr);
+      if (!flac)
+        return false;
+      format = MUSIC_FLAC;
+      channels = flac->channels;
+      sampleRate = flac->sampleRate;
+    }
+    return format != MUSIC_NONE;
+  }
 
-  while (samples > 0)
+  void close()
   {
-    for (auto && s : playing_sounds)
-      if (!s.isEmpty())
-        s.mixTo(out_buf, min(samples, step), frequency, invFrequency, min(samples, step) * invFrequency);
+    switch (format)
+    {
+      case MUSIC_WAV: drwav_uninit(&wav); break;
+      case MUSIC_MP3: drmp3_uninit(&mp3); break;
+      case MUSIC_FLAC: drflac_close(flac); flac = nullptr; break;
+      default: break;
+    }
+    format = MUSIC_NONE;
+  }
 
-    samples -= step;
-    out_buf += step * channels;
-    total_samples_played += min(samples, step);
-    total_time_played += min(samples, step) * invFrequency;
+  uint64_t read(uint64_t frames, float * out)
+  {
+    switch (format)
+    {
+      case MUSIC_WAV: return drwav_read_pcm_frames_f32(&wav, frames, out);
+      case MUSIC_MP3: return drmp3_read_pcm_frames_f32(&mp3, frames, out);
+      case MUSIC_FLAC: return drflac_read_pcm_frames_f32(flac, frames, out);
+      default: return 0;
+    }
   }
-}
 
+  bool seek(uint64_t frame)
+  {
+    switch (format)
+    {
+      case MUSIC_WAV: return !!drwav_seek_to_pcm_frame(&wav, frame);
+      case MUSIC_MP3: return !!drmp3_seek_to_pcm_frame(&mp3, frame);
+      case MUSIC_FLAC: return !!drflac_seek_to_pcm_frame(flac, frame);
+      default: return false;
+    }
+  }
 
+  // mp3 has to be scanned to get its length, so it is slow
+  uint64_t getLength()
+  {
+    switch (format)
+    {
+      case MUSIC_WAV: return wav.totalPCMFrameCount;
+      case MUSIC_MP3: return drmp3_get_pcm_frame_count(&mp3);
+      case MUSIC_FLAC: return flac->totalPCMFrameCount;
+      default: return 0;
+    }
+  }
+};
 
-static ma_device miniaudio_device;
-static volatile bool device_initialized = false;
-static ma_log ma_log_struct = { 0 };
-static ma_context context = { 0 };
+struct MusicSegment
+{
+  uint64_t ringFrame;   // first ring frame of the segment
+  uint64_t sourceFrame; // position in the file of this ring frame
+};
 
+struct MusicStream
+{
+  int channels = 0;
+  int frequency = 0;
+  vector<float> ring;
+
+  // streaming thread
+  MusicDecoder decoder;
+  uint64_t decodeFrame = 0;
+  bool lengthKnown = false;
+
+  atomic<uint64_t> writeFrame;  // streaming thread: frames before this one are decoded
+  atomic<uint64_t> readFrame;   // mixer: frames before this one are consumed
+  atomic<uint64_t> skipToFrame; // streaming thread: mixer drops frames before this one, set by seek
+  atomic<uint64_t> endFrame;    // streaming thread: end of non-looped music
+  atomic<int64_t> lengthFrames; // streaming thread, -1 while unknown
+  atomic<bool> loop;
+
+  // guarded by music_mutex
+  int64_t seekRequest = -1;
+  vector<MusicSegment> segments;
+
+  // script thread
+  bool playing = false;
+
+  // mixer
+  double frac = 0.0;
+  float volume = 1.0f;
+  float currentVolume = 0.0f;
+  int bus = SOUND_BUS_MUSIC;
+  bool paused = true;
+
+  MusicStream() : writeFrame(0), readFrame(0), skipToFrame(0), endFrame(MUSIC_NO_END), lengthFrames(-1), loop(false) {}
+};
 
-void on_error_log(void * user_data, ma_uint32 level, const char * message)
+// silent music keeps its position going, up to the frames already streamed
+static uint64_t skip_music_frames(MusicStream & m, uint64_t r, double frames, uint64_t w, uint64_t end)
 {
-  G_UNUSED(user_data);
-  if (level <= 1)
-    print_error("%s", message);
-  else
-    print_note("%s", message);
+  m.frac += frames;
+  uint64_t whole = uint64_t(m.frac);
+  m.frac -= double(whole);
+  uint64_t limit = max(min(w, end), r);
+  if (r + whole >= limit)
+  {
+    m.frac = 0.0;
+    return limit;
+  }
+  return r + whole;
 }
 
-static void miniaudio_data_callback(ma_device* p_device, void* p_output, const void* p_input, ma_uint32 frame_count)
+static void mix_music(MusicStream & m, float * __restrict mix, int count, int frequency)
 {
-  G_UNUSED(p_input);
+  uint64_t r = m.readFrame.load(memory_order_relaxed);
+  uint64_t skip = m.skipToFrame.load(memory_order_acquire);
+  if (r < skip)
+  {
+    r = skip;
+    m.frac = 0.0;
+  }
 
-  if (!device_initialized)
+  uint64_t w = m.writeFrame.load(memory_order_acquire);
+  uint64_t end = m.endFrame.load(memory_order_acquire);
+  double advance = double(m.frequency) / frequency;
+
+  // only paused music holds its position, music with zero volume plays silently
+  float wishVolume = m.paused ? 0.0f : master_volume * m.volume;
+  if (m.currentVolume == 0.0f && wishVolume == 0.0f)
   {
-    memset(p_output, 0, frame_count * ma_get_bytes_per_frame(p_device->playback.format, p_device->playback.channels));
+    if (!m.paused)
+      r = skip_music_frames(m, r, count * advance, w, end);
+    m.readFrame.store(r, memory_order_release);
     return;
   }
 
-  fill_buffer_cb((float *)p_output, OUTPUT_SAMPLE_RATE, p_device->playback.channels, frame_count);
+  const float * __restrict ring = m.ring.data();
+  int stride = m.channels == 2 ? 1 : 0;
+
+  for (int i = 0; i < count; i++, mix += 2)
+  {
+    if (r >= end)
+      break;
+    uint64_t next = r + 1 < end ? r + 1 : r;
+    if (next >= w) // underrun, streaming thread is late
+      break;
+
+    const float * s0 = ring + (r & MUSIC_RING_MASK) * m.channels;
+    const float * s1 = ring + (next & MUSIC_RING_MASK) * m.channels;
+    float t = float(m.frac);
+    mix[0] += lerp(s0[0], s1[0], t) * m.currentVolume;
+    mix[1] += lerp(s0[stride], s1[stride], t) * m.currentVolume;
+
+    if (m.currentVolume != wishVolume)
+    {
+      if (fabsf(m.currentVolume - wishVolume) <= ONE_DIV_512)
+        m.currentVolume = wishVolume;
+      else if (m.currentVolume < wishVolume)
+        m.currentVolume += ONE_DIV_512;
+      else
+        m.currentVolume -= ONE_DIV_512;
+    }
+
+    if (m.currentVolume == 0.0f && wishVolume == 0.0f)
+    {
+      if (!m.paused)
+        r = skip_music_frames(m, r, (count - i) * advance, w, end);
+      break;
+    }
+
+    m.frac += advance;
+    uint64_t whole = uint64_t(m.frac);
+    r += whole;
+    m.frac -= double(whole);
+  }
+
+  m.readFrame.store(r, memory_order_release);
 }
 
-void init_sound_lib_internal()
-{
-  if (device_initialized)
-    return;
+static array<MusicStream *, MAX_MUSIC_STREAMS> mixer_music; // owned by mixer
+static int mixer_music_count = 0;
 
-  ma_log_init(nullptr, &ma_log_struct);
-  ma_log_register_callback(&ma_log_struct, {on_error_log, nullptr});
 
-  ma_context_init(NULL, 0, NULL, &context);
-  context.pLog = &ma_log_struct;
+//----- buses and effects -----
 
-  ma_device_config deviceConfig;
+// Voices are mixed into buses, every bus runs its effect chain over the whole mix block and then it is
+// added to the output. Effects keep their state between blocks and change parameters only at block edges.
 
-  deviceConfig = ma_device_config_init(ma_device_type_playback);
-  deviceConfig.playback.format = ma_format_f32;
-  deviceConfig.playback.channels = OUTPUT_CHANNELS;
-  deviceConfig.sampleRate = OUTPUT_SAMPLE_RATE;
-  deviceConfig.dataCallback = miniaudio_data_callback;
-  deviceConfig.pUserData = nullptr;
+struct LowPassFilter
+{
+  bool enabled = false;
+  float cutoff = 0.0f;
+  float b0 = 1.0f, b1 = 0.0f, b2 = 0.0f, a1 = 0.0f, a2 = 0.0f;
+  float z1[2] = { 0.0f, 0.0f };
+  float z2[2] = { 0.0f, 0.0f };
 
-  if (ma_device_init(&context, &deviceConfig, &miniaudio_device) != MA_SUCCESS)
+  void setCutoff(float cutoff_hz, float sample_rate)
   {
-    print_error("SOUND: Failed to open playback device");
-    return;
+    cutoff = cutoff_hz;
+    enabled = cutoff_hz > 0.0f && cutoff_hz < sample_rate * 0.49f;
+    if (!enabled)
+      return;
+
+    // biquad low-pass, Q = 0.707
+    double w0 = 2.0 * M_PI * cutoff_hz / sample_rate;
+    double alpha = sin(w0) / (2.0 * 0.7071);
+    double cw = cos(w0);
+    double a0 = 1.0 + alpha;
+    b0 = float((1.0 - cw) * 0.5 / a0);
+    b1 = float((1.0 - cw) / a0);
+    b2 = b0;
+    a1 = float(-2.0 * cw / a0);
+    a2 = float((1.0 - alpha) / a0);
+  }
+
+  void process(float * __restrict buf, int count)
+  {
+    for (int ch = 0; ch < 2; ch++)
+    {
+      float s1 = z1[ch];
+      float s2 = z2[ch];
+      for (int i = 0; i < count; i++)
+      {
+        float x = buf[i * 2 + ch];
+        float y = b0 * x + s1;
+        s1 = b1 * x - a1 * y + s2;
+        s2 = b2 * x - a2 * y;
+        buf[i * 2 + ch] = y;
+      }
+      z1[ch] = s1;
+      z2[ch] = s2;
+    }
   }
+};
+
+// Schroeder-Moorer reverb with the tuning from Freeverb: 4 damped combs and 2 allpasses per channel
+#define REVERB_COMBS 4
+#define REVERB_ALLPASSES 2
+#define REVERB_COMB_MAX 3600 // enough for 96 kHz output
+#define REVERB_ALLPASS_MAX 1280
+#define REVERB_STEREO_SPREAD 23
+
+static const int reverb_comb_tuning[REVERB_COMBS] = { 1116, 1277, 1422, 1557 }; // at 44100 Hz
+static const int reverb_allpass_tuning[REVERB_ALLPASSES] = { 556, 441 };
+
+struct ReverbEffect
+{
+  bool enabled = false;
+  float wet = 0.0f;
+  float roomSize = 0.0f;
+  float feedback = 0.84f;
+  float damp = 0.2f;
+  float combBuf[2][REVERB_COMBS][REVERB_COMB_MAX];
+  float combStore[2][REVERB_COMBS];
+  int combLen[2][REVERB_COMBS];
+  int combPos[2][REVERB_COMBS];
+  float allpassBuf[2][REVERB_ALLPASSES][REVERB_ALLPASS_MAX];
+  int allpassLen[2][REVERB_ALLPASSES];
+  int allpassPos[2][REVERB_ALLPASSES];
+
+  void set(float wet_level, float room_size, float sample_rate)
+  {
+    bool wasEnabled = enabled;
+    enabled = wet_level > 0.0f;
+    wet = wet_level;
+    roomSize = room_size;
+    feedback = 0.7f + 0.28f * clamp(room_size, 0.0f, 1.0f);
+    if (!enabled || wasEnabled)
+      return;
+
+    memset(combBuf, 0, sizeof(combBuf));
+    memset(combStore, 0, sizeof(combStore));
+    memset(allpassBuf, 0, sizeof(allpassBuf));
+    float scale = sample_rate / 44100.0f;
+    for (int ch = 0; ch < 2; ch++)
+    {
+      for (int i = 0; i < REVERB_COMBS; i++)
+      {
+        combLen[ch][i] = min(int(reverb_comb_tuning[i] * scale) + ch * REVERB_STEREO_SPREAD, REVERB_COMB_MAX);
+        combPos[ch][i] = 0;
+      }
+      for (int i = 0; i < REVERB_ALLPASSES; i++)
+      {
+        allpassLen[ch][i] = min(int(reverb_allpass_tuning[i] * scale) + ch * REVERB_STEREO_SPREAD, REVERB_ALLPASS_MAX);
+        allpassPos[ch][i] = 0;
+      }
+    }
+  }
+
+  void process(float * __restrict buf, int count)
+  {
+    const float inputGain = 0.03f;
+    for (int i = 0; i < count; i++)
+    {
+      float input = (buf[i * 2] + buf[i * 2 + 1]) * inputGain;
+      for (int ch = 0; ch < 2; ch++)
+      {
+        float out = 0.0f;
+        for (int c = 0; c < REVERB_COMBS; c++)
+        {
+          float * cb = combBuf[ch][c];
+          int & pos = combPos[ch][c];
+          float y = cb[pos];
+          combStore[ch][c] = y * (1.0f - damp) + combStore[ch][c] * damp;
+          cb[pos] = input + combStore[ch][c] * feedback;
+          pos = (pos + 1 < combLen[ch][c]) ? pos + 1 : 0;
+          out += y;
+        }
+        for (int a = 0; a < REVERB_ALLPASSES; a++)
+        {
+          float * ab = allpassBuf[ch][a];
+          int & pos = allpassPos[ch][a];
+          float y = ab[pos];
+          ab[pos] = out + y * 0.5f;
+          out = y - out;
+          pos = (pos + 1 < allpassLen[ch][a]) ? pos + 1 : 0;
+        }
+        buf[i * 2 + ch] += out * wet;
+      }
+    }
+  }
+};
+
+// gain is computed once per block from the block peak, so it works as a limiter with one block of look-ahead
+struct Compressor
+{
+  bool enabled = false;
+  float threshold = 1.0f;
+  float ratio = 1.0f;
+  float envelope = 0.0f;
+  float gain = 1.0f;
+
+  void set(float threshold_level, float compression_ratio)
+  {
+    enabled = compression_ratio > 1.0f && threshold_level > 0.0f;
+    threshold = threshold_level;
+    ratio = compression_ratio;
+  }
+
+  void process(float * __restrict buf, int count)
+  {
+    float peak = 0.0f;
+    for (int i = 0; i < count * 2; i++)
+      peak = max(peak, fabsf(buf[i]));
+
+    envelope = max(peak, envelope * 0.9f); // about 50 ms release at 48 kHz
+    float target = 1.0f;
+    if (envelope > threshold)
+      target = threshold * powf(envelope / threshold, 1.0f / ratio) / envelope;
+
+    float g = gain;
+    float dg = (target - gain) / count;
+    for (int i = 0; i < count; i++, g += dg)
+    {
+      buf[i * 2] *= g;
+      buf[i * 2 + 1] *= g;
+    }
+    gain = target;
+  }
+};
+
+struct SoundBus
+{
+  float buffer[MIX_BLOCK_FRAMES * 2];
+  float volume = 1.0f;
+  float currentVolume = 1.0f;
+  bool used = false;
+  LowPassFilter lowPass;
+  ReverbEffect reverb;
+  Compressor compressor;
+
+  float * begin(int count)
+  {
+    if (!used)
+    {
+      memset(buffer, 0, count * 2 * sizeof(float));
+      used = true;
+    }
+    return buffer;
+  }
+
+  void mixTo(float * __restrict out, int count)
+  {
+    if (!used && !reverb.enabled)
+      return;
+    begin(count);
+
+    if (lowPass.enabled)
+      lowPass.process(buffer, count);
+    if (reverb.enabled)
+      reverb.process(buffer, count);
+    if (compressor.enabled)
+      compressor.process(buffer, count);
+
+    float v = currentVolume;
+    float dv = (volume - currentVolume) / count;
+    for (int i = 0; i < count; i++, v += dv)
+    {
+      out[i * 2] += buffer[i * 2] * v;
+      out[i * 2 + 1] += buffer[i * 2 + 1] * v;
+    }
+    currentVolume = volume;
+    used = false;
+  }
+};
+
+static array<SoundBus, MAX_SOUND_BUSES> sound_buses; // owned by mixer
+
+
+//----- command queue -----
+
+// Script thread is the only producer and mixer is the only consumer, so neither side takes a lock.
+// Script thread keeps its own copy of voice versions, mixer reports back voice state through atomics.
+
+#define SOUND_COMMANDS_COUNT 4096 // power of 2
+#define SOUND_COMMANDS_MASK (SOUND_COMMANDS_COUNT - 1)
+
+enum SoundCommandType
+{
+  SOUND_CMD_PLAY,
+  SOUND_CMD_SET_PITCH,
+  SOUND_CMD_SET_VOLUME,
+  SOUND_CMD_SET_PAN,
+  SOUND_CMD_SET_POS,
+  SOUND_CMD_STOP,
+  SOUND_CMD_STOP_ALL,
+  SOUND_CMD_STOP_DATA,
+  SOUND_CMD_REPLACE_DATA,
+  SOUND_CMD_MASTER_VOLUME,
+  SOUND_CMD_MUSIC_ADD,
+  SOUND_CMD_MUSIC_REMOVE,
+  SOUND_CMD_MUSIC_PLAY,
+  SOUND_CMD_MUSIC_PAUSE,
+  SOUND_CMD_MUSIC_VOLUME,
+  SOUND_CMD_MUSIC_BUS,
+  SOUND_CMD_SET_BUS,
+  SOUND_CMD_BUS_VOLUME,
+  SOUND_CMD_BUS_LOWPASS,
+  SOUND_CMD_BUS_REVERB,
+  SOUND_CMD_BUS_COMPRESSOR
+};
+
+struct SoundCommand
+{
+  SoundCommandType type;
+  unsigned handle;
+  const float * data;
+  const float * newData; // SOUND_CMD_REPLACE_DATA
+  MusicStream * music;
+  int frequency;
+  int channels;
+  int storage;
+  float value;
+  float value2;
+  float volume;
+  float pitch;
+  float pan;
+  double start;
+  double stop;
+  double pos;
+  double timeToStart;
+  int64_t startSample; // output sample to start at, -1 if not scheduled
+  bool loop;
+};
+
+static array<SoundCommand, SOUND_COMMANDS_COUNT> sound_commands;
+static atomic<uint32_t> sound_commands_write(0); // published by script thread
+static atomic<uint32_t> sound_commands_read(0);  // published by mixer
+static uint32_t sound_commands_local_write = 0;  // script thread, not published while batching
+static bool sound_commands_batching = false;
+static int sound_commands_dropped = 0;           // script thread
+
+struct VoiceSlot // script thread side of the voice
+{
+  unsigned version;
+  unsigned serial; // order of play calls, for stealing the oldest voice
+  int priority;
+  float volume;
+  bool used;
+  bool stopped;
+};
+
+static array<VoiceSlot, MAX_PLAYING_SOUNDS> voice_slots;
+static vector<int> free_voices;
+static int used_voice_count = 0;
+static int max_voices = DEFAULT_MAX_VOICES;
+static unsigned voice_serial = 0;
+
+static array<atomic<unsigned>, MAX_PLAYING_SOUNDS> voice_stopped_version; // mixer: voice with this version is not playing
+static array<atomic<float>, MAX_PLAYING_SOUNDS> voice_pos_seconds;
+
+// mixer returns handles of finished voices, each slot is here at most once, so the ring never overflows
+static array<unsigned, MAX_PLAYING_SOUNDS> finished_voices;
+static atomic<uint32_t> finished_voices_write(0);
+static atomic<uint32_t> finished_voices_read(0);
+
+struct DeferredSoundData
+{
+  float * data;
+  MusicStream * music;
+  uint32_t fence;
+};
+
+static vector<DeferredSoundData> deferred_sound_data;
+
+
+static void publish_sound_commands()
+{
+  sound_commands_write.store(sound_commands_local_write, memory_order_release);
+}
+
+static bool push_sound_command(const SoundCommand & cmd)
+{
+  uint32_t w = sound_commands_local_write;
+  if (w - sound_commands_read.load(memory_order_acquire) >= SOUND_COMMANDS_COUNT)
+  {
+    sound_commands_dropped++;
+    print_error("SOUND: command queue is full");
+    return false;
+  }
+
+  sound_commands[w & SOUND_COMMANDS_MASK] = cmd;
+  sound_commands_local_write = w + 1;
+  if (!sound_commands_batching)
+    publish_sound_commands();
+  return true;
+}
+
+static bool is_fence_passed(uint32_t fence)
+{
+  return int32_t(sound_commands_read.load(memory_order_acquire) - fence) >= 0;
+}
+
+static void delete_music_stream(MusicStream * music);
+
+static void delete_deferred_sound_data(bool force)
+{
+  for (size_t i = 0; i < deferred_sound_data.size();)
+    if (force || is_fence_passed(deferred_sound_data[i].fence))
+    {
+      delete[] deferred_sound_data[i].data;
+      delete_music_stream(deferred_sound_data[i].music);
+      deferred_sound_data[i] = deferred_sound_data.back();
+      deferred_sound_data.pop_back();
+    }
+    else
+      i++;
+}
+
+static volatile bool device_initialized = false;
+
+static void release_sound_data(float * data)
+{
+  sound_data_pointers.erase(data);
+
+  SoundCommand cmd;
+  memset(&cmd, 0, sizeof(cmd));
+  cmd.type = SOUND_CMD_STOP_DATA;
+  cmd.data = data;
+  if (!device_initialized || !push_sound_command(cmd))
+  {
+    delete[] data;
+    return;
+  }
+  if (sound_commands_batching)
+    publish_sound_commands();
+
+  deferred_sound_data.push_back(DeferredSoundData{data, nullptr, sound_commands_local_write});
+  delete_deferred_sound_data(false);
+}
+
+// 'frames' are encoded to a new buffer, voices playing the previous one continue from the new one,
+// the previous buffer is deleted after mixer processed the command, so mixer never reads a buffer being written
+static void replace_sound_data(PcmSound & sound, const float * frames)
+{
+  float * prev = sound.getData();
+  sound.newData(sound.getDataMemorySize());
+  encode_sound_frames(sound, frames);
+  sound_data_pointers.erase(prev);
+
+  SoundCommand cmd;
+  memset(&cmd, 0, sizeof(cmd));
+  cmd.type = SOUND_CMD_REPLACE_DATA;
+  cmd.data = prev;
+  cmd.newData = sound.getData();
+  if (!device_initialized || !push_sound_command(cmd))
+  {
+    // without the command voices of 'prev' have to be stopped before it is deleted
+    sound_data_pointers.insert(prev);
+    release_sound_data(prev);
+    return;
+  }
+  if (sound_commands_batching)
+    publish_sound_commands();
+
+  deferred_sound_data.push_back(DeferredSoundData{prev, nullptr, sound_commands_local_write});
+  delete_deferred_sound_data(false);
+}
+
+static void free_voice_slot(int idx)
+{
+  voice_slots[idx].used = false;
+  free_voices.push_back(idx);
+  used_voice_count--;
+}
+
+static void collect_finished_voices()
+{
+  uint32_t w = finished_voices_write.load(memory_order_acquire);
+  uint32_t r = finished_voices_read.load(memory_order_relaxed);
+  for (; r != w; r++)
+  {
+    unsigned handle = finished_voices[r & PLAYING_SOUNDS_MASK];
+    int idx = int(handle & PLAYING_SOUNDS_MASK);
+    if (voice_slots[idx].used && voice_slots[idx].version == (handle & (~PLAYING_SOUNDS_MASK)))
+      free_voice_slot(idx);
+  }
+  finished_voices_read.store(r, memory_order_release);
+}
+
+static bool is_voice_stopped(int idx);
+static void push_voice_stop(int idx);
+
+// stops the voice with lowest priority, then the quietest, then the oldest
+static bool steal_voice(int priority)
+{
+  int victim = -1;
+  int playing = 0;
+  for (int i = 1; i < MAX_PLAYING_SOUNDS; i++)
+  {
+    const VoiceSlot & v = voice_slots[i];
+    if (!v.used || is_voice_stopped(i))
+      continue;
+
+    playing++;
+    if (v.priority > priority)
+      continue;
+
+    if (victim < 0)
+    {
+      victim = i;
+      continue;
+    }
+
+    const VoiceSlot & b = voice_slots[victim];
+    if (v.priority < b.priority ||
+        (v.priority == b.priority && (v.volume < b.volume || (v.volume == b.volume && int(v.serial - b.serial) < 0))))
+      victim = i;
+  }
+
+  if (playing < max_voices) // some voices are fading out, they don't count
+    return true;
+
+  if (victim < 0)
+    return false;
+
+  push_voice_stop(victim);
+  return true;
+}
+
+static int allocate_playing_sound(int priority, float volume)
+{
+  collect_finished_voices();
+
+  if (used_voice_count >= max_voices && !steal_voice(priority))
+    return -1;
+
+  if (free_voices.empty())
+    return -1;
+
+  int idx = free_voices.back();
+  free_voices.pop_back();
+  used_voice_count++;
+
+  VoiceSlot & v = voice_slots[idx];
+  v.version += MAX_PLAYING_SOUNDS;
+  v.serial = voice_serial++;
+  v.priority = priority;
+  v.volume = volume;
+  v.used = true;
+  v.stopped = false;
+  return idx;
+}
+
+static bool is_handle_valid(PlayingSoundHandle ps)
+{
+  unsigned idx = ps.handle & PLAYING_SOUNDS_MASK;
+  return idx > 0 && voice_slots[idx].used && voice_slots[idx].version == (ps.handle & (~PLAYING_SOUNDS_MASK));
+}
+
+static int handle_to_index(PlayingSoundHandle ps)
+{
+  if (!is_handle_valid(ps))
+    return -1;
+  return ps.handle & PLAYING_SOUNDS_MASK;
+}
+
+static bool is_voice_stopped(int idx)
+{
+  return voice_slots[idx].stopped || voice_stopped_version[idx].load(memory_order_acquire) == voice_slots[idx].version;
+}
+
+
+//----- scheduled starts -----
+
+// Delayed voices wait in a min-heap ordered by the output sample to start at, mixer pops the ones starting in the
+// current block and mixes them from the exact offset. Stopped voices leave their entries, those are skipped by version.
+
+struct ScheduledStart
+{
+  int64_t sample;
+  unsigned handle;
+};
+
+static bool operator < (const ScheduledStart & a, const ScheduledStart & b)
+{
+  return a.sample > b.sample; // std heap functions keep the largest element on top
+}
+
+static array<ScheduledStart, MAX_PLAYING_SOUNDS> scheduled_starts; // owned by mixer
+static int scheduled_start_count = 0;
+
+static bool is_scheduled_start_valid(const ScheduledStart & e)
+{
+  const PlayingSound & s = playing_sounds[e.handle & PLAYING_SOUNDS_MASK];
+  return s.waitingStart && unsigned(s.version) == (e.handle & (~PLAYING_SOUNDS_MASK));
+}
+
+static void schedule_voice_start(int64_t sample, unsigned handle)
+{
+  if (scheduled_start_count == MAX_PLAYING_SOUNDS)
+  {
+    // every waiting voice has one valid entry, so the queue never overflows after purge
+    auto last = remove_if(scheduled_starts.begin(), scheduled_starts.begin() + scheduled_start_count,
+      [](const ScheduledStart & e) { return !is_scheduled_start_valid(e); });
+    scheduled_start_count = int(last - scheduled_starts.begin());
+    make_heap(scheduled_starts.begin(), last);
+  }
+
+  scheduled_starts[scheduled_start_count++] = ScheduledStart{sample, handle};
+  push_heap(scheduled_starts.begin(), scheduled_starts.begin() + scheduled_start_count);
+}
+
+static void start_scheduled_voices(int64_t block_start, int count, int output_frequency)
+{
+  while (scheduled_start_count > 0 && scheduled_starts[0].sample < block_start + count)
+  {
+    ScheduledStart e = scheduled_starts[0];
+    pop_heap(scheduled_starts.begin(), scheduled_starts.begin() + scheduled_start_count);
+    scheduled_start_count--;
+    if (!is_scheduled_start_valid(e))
+      continue;
+
+    PlayingSound & s = playing_sounds[e.handle & PLAYING_SOUNDS_MASK];
+    s.waitingStart = false;
+    s.pos = s.startPos;
+    s.startOffset = int(max(e.sample - block_start, int64_t(0)));
+    if (e.sample < block_start) // late command, keep the sound in sync with the ones started in time
+    {
+      double skip = double(block_start - e.sample) * s.frequency / output_frequency * s.pitch;
+      s.pos = min(s.startPos + skip, s.stopPos);
+    }
+  }
+}
+
+
+static void execute_sound_command(const SoundCommand & cmd)
+{
+  if (cmd.type == SOUND_CMD_STOP_ALL)
+  {
+    for (int i = 0; i < active_voice_count; i++)
+      playing_sounds[active_voices[i]].setStopMode();
+    return;
+  }
+
+  if (cmd.type == SOUND_CMD_STOP_DATA)
+  {
+    for (int i = 0; i < active_voice_count; i++)
+      if (playing_sounds[active_voices[i]].sound == cmd.data)
+        playing_sounds[active_voices[i]].setStopMode();
+    return;
+  }
+
+  if (cmd.type == SOUND_CMD_REPLACE_DATA)
+  {
+    for (int i = 0; i < active_voice_count; i++)
+    {
+      PlayingSound & s = playing_sounds[active_voices[i]];
+      if (s.sound == cmd.data)
+      {
+        s.sound = cmd.newData;
+        s.adpcmBlock = -1;
+      }
+    }
+    return;
+  }
+
+  if (cmd.type == SOUND_CMD_MASTER_VOLUME)
+  {
+    master_volume = cmd.value;
+    return;
+  }
+
+  if (cmd.music)
+  {
+    MusicStream * m = cmd.music;
+    switch (cmd.type)
+    {
+      case SOUND_CMD_MUSIC_ADD:
+        if (mixer_music_count < MAX_MUSIC_STREAMS)
+          mixer_music[mixer_music_count++] = m;
+        break;
+      case SOUND_CMD_MUSIC_REMOVE:
+        for (int i = 0; i < mixer_music_count; i++)
+          if (mixer_music[i] == m)
+          {
+            mixer_music[i] = mixer_music[--mixer_music_count];
+            break;
+          }
+        break;
+      case SOUND_CMD_MUSIC_PLAY: m->paused = false; m->volume = cmd.value; break;
+      case SOUND_CMD_MUSIC_PAUSE: m->paused = true; break;
+      case SOUND_CMD_MUSIC_VOLUME: m->volume = cmd.value; break;
+      case SOUND_CMD_MUSIC_BUS: m->bus = int(cmd.value); break;
+      default: break;
+    }
+    return;
+  }
+
+  if (cmd.type >= SOUND_CMD_BUS_VOLUME)
+  {
+    SoundBus & bus = sound_buses[cmd.handle];
+    switch (cmd.type)
+    {
+      case SOUND_CMD_BUS_VOLUME: bus.volume = cmd.value; break;
+      case SOUND_CMD_BUS_LOWPASS: bus.lowPass.setCutoff(cmd.value, float(output_sample_rate)); break;
+      case SOUND_CMD_BUS_REVERB: bus.reverb.set(cmd.value, cmd.value2, float(output_sample_rate)); break;
+      case SOUND_CMD_BUS_COMPRESSOR: bus.compressor.set(cmd.value, cmd.value2); break;
+      default: break;
+    }
+    return;
+  }
+
+  unsigned idx = cmd.handle & PLAYING_SOUNDS_MASK;
+  unsigned version = cmd.handle & (~PLAYING_SOUNDS_MASK);
+  PlayingSound & s = playing_sounds[idx];
+
+  if (cmd.type == SOUND_CMD_PLAY)
+  {
+    // script reuses the slot only after mixer removed it from the active list
+    active_voices[active_voice_count++] = int(idx);
+    s.channels = cmd.channels;
+    s.storage = cmd.storage;
+    s.adpcmBlock = -1;
+    s.bus = SOUND_BUS_SFX;
+    s.sound = cmd.data;
+    s.frequency = cmd.frequency;
+    s.version = version;
+    s.volume = cmd.volume;
+    s.pitch = cmd.pitch;
+    s.pan = cmd.pan;
+    s.volumeL = master_volume * cmd.volume * min(1.0f + cmd.pan, 1.0f);
+    s.volumeR = master_volume * cmd.volume * min(1.0f - cmd.pan, 1.0f);
+    s.pos = cmd.pos;
+    s.startPos = cmd.start;
+    s.stopPos = cmd.stop;
+    s.loop = cmd.loop;
+    s.stopMode = false;
+    s.startOffset = 0;
+    s.waitingStart = false;
+
+    int64_t startSample = cmd.startSample;
+    if (startSample < 0 && cmd.timeToStart > 0.0)
+      startSample = total_samples_played.load(memory_order_relaxed) + int64_t(cmd.timeToStart * output_sample_rate + 0.5);
+    if (startSample >= 0)
+    {
+      s.waitingStart = true;
+      schedule_voice_start(startSample, cmd.handle);
+    }
+    return;
+  }
+
+  if (s.version != version || !s.sound || s.stopMode)
+    return;
+
+  switch (cmd.type)
+  {
+    case SOUND_CMD_SET_PITCH: s.pitch = cmd.value; break;
+    case SOUND_CMD_SET_VOLUME: s.volume = cmd.value; break;
+    case SOUND_CMD_SET_PAN: s.pan = cmd.value; break;
+    case SOUND_CMD_SET_POS: s.pos = clamp(floor(s.frequency * double(cmd.value)), s.startPos, s.stopPos); break;
+    case SOUND_CMD_STOP: s.setStopMode(); break;
+    case SOUND_CMD_SET_BUS: s.bus = int(cmd.value); break;
+    default: break;
+  }
+}
+
+static int execute_sound_commands()
+{
+  uint32_t w = sound_commands_write.load(memory_order_acquire);
+  uint32_t r = sound_commands_read.load(memory_order_relaxed);
+  int count = int(w - r);
+  for (; r != w; r++)
+    execute_sound_command(sound_commands[r & SOUND_COMMANDS_MASK]);
+  sound_commands_read.store(r, memory_order_release);
+  return count;
+}
+
+static void publish_voice_states()
+{
+  uint32_t finishedWrite = finished_voices_write.load(memory_order_relaxed);
+  for (int i = 0; i < active_voice_count;)
+  {
+    int idx = active_voices[i];
+    PlayingSound & s = playing_sounds[idx];
+    if (!s.sound || s.stopMode)
+      voice_stopped_version[idx].store(s.version, memory_order_release);
+    voice_pos_seconds[idx].store(s.sound && !s.waitingStart ? float(s.pos / s.frequency) : 0.0f, memory_order_relaxed);
+
+    if (s.isEmpty())
+    {
+      finished_voices[finishedWrite & PLAYING_SOUNDS_MASK] = unsigned(idx) | s.version;
+      finishedWrite++;
+      active_voices[i] = active_voices[--active_voice_count];
+    }
+    else
+      i++;
+  }
+  finished_voices_write.store(finishedWrite, memory_order_release);
+}
+
+
+//----- mixer stats -----
+
+// Mixer accumulates timings of the callbacks and publishes them twice per second, so script reads a stable picture.
+// Underrun is a callback that came much later than the previous buffer was expected to run out.
+
+#define MIXER_STATS_WINDOW_FRAMES (output_sample_rate / 2)
+
+typedef chrono::steady_clock mixer_clock;
+
+struct MixerStatsWindow
+{
+  double mixTimeSum = 0.0;
+  double mixTimeMax = 0.0;
+  int callbacks = 0;
+  int frames = 0;
+  int commandsMax = 0;
+  mixer_clock::time_point lastCallback;
+  bool hasLastCallback = false;
+};
+
+static MixerStatsWindow mixer_stats_window; // owned by mixer
+
+static atomic<float> stats_mix_time_avg_ms(0.0f);
+static atomic<float> stats_mix_time_max_ms(0.0f);
+static atomic<float> stats_mix_load(0.0f);
+static atomic<int> stats_callback_frames(0);
+static atomic<int> stats_commands_max(0);
+static atomic<int> stats_active_voices(0);
+static atomic<int> stats_active_music(0);
+static atomic<int> stats_underruns(0);
+static atomic<int> stats_overloads(0);
+
+static void update_mixer_stats(mixer_clock::time_point start, mixer_clock::time_point finish, int frames, int commands)
+{
+  MixerStatsWindow & w = mixer_stats_window;
+  double mixTime = chrono::duration<double>(finish - start).count();
+  double period = double(frames) / output_sample_rate;
+
+  if (w.hasLastCallback)
+  {
+    double gap = chrono::duration<double>(start - w.lastCallback).count();
+    if (gap > stats_callback_frames.load(memory_order_relaxed) * 2.0 / output_sample_rate + 0.002)
+      stats_underruns.fetch_add(1, memory_order_relaxed);
+  }
+  if (mixTime > period)
+    stats_overloads.fetch_add(1, memory_order_relaxed);
+
+  w.lastCallback = start;
+  w.hasLastCallback = true;
+  w.mixTimeSum += mixTime;
+  w.mixTimeMax = max(w.mixTimeMax, mixTime);
+  w.callbacks++;
+  w.frames += frames;
+  w.commandsMax = max(w.commandsMax, commands);
+  stats_callback_frames.store(frames, memory_order_relaxed);
+
+  if (w.frames < MIXER_STATS_WINDOW_FRAMES)
+    return;
+
+  stats_mix_time_avg_ms.store(float(w.mixTimeSum * 1000.0 / w.callbacks), memory_order_relaxed);
+  stats_mix_time_max_ms.store(float(w.mixTimeMax * 1000.0), memory_order_relaxed);
+  stats_mix_load.store(float(w.mixTimeSum * output_sample_rate / w.frames), memory_order_relaxed);
+  stats_commands_max.store(w.commandsMax, memory_order_relaxed);
+  stats_active_voices.store(active_voice_count, memory_order_relaxed);
+  stats_active_music.store(mixer_music_count, memory_order_relaxed);
+
+  w.mixTimeSum = 0.0;
+  w.mixTimeMax = 0.0;
+  w.callbacks = 0;
+  w.frames = 0;
+  w.commandsMax = 0;
+}
+
+
+static void fill_buffer_cb(float * __restrict out_buf, int frequency, int channels, int samples)
+{
+  mixer_clock::time_point start = mixer_clock::now();
+  int commands = execute_sound_commands();
+  int frames = samples;
+
+  memset(out_buf, 0, samples * channels * sizeof(float));
+
+  double invFrequency = 1.0 / frequency;
+  int64_t blockStart = total_samples_played.load(memory_order_relaxed);
+
+  while (samples > 0)
+  {
+    int count = min(samples, MIX_BLOCK_FRAMES);
+    start_scheduled_voices(blockStart, count, frequency);
+    for (int i = 0; i < active_voice_count; i++)
+    {
+      PlayingSound & s = playing_sounds[active_voices[i]];
+      int offset = s.startOffset;
+      s.startOffset = 0;
+      s.mixTo(sound_buses[s.bus].begin(count) + offset * 2, count - offset, frequency, invFrequency);
+    }
+    for (int i = 0; i < mixer_music_count; i++)
+      mix_music(*mixer_music[i], sound_buses[mixer_music[i]->bus].begin(count), count, frequency);
+    for (int i = 0; i < MAX_SOUND_BUSES; i++)
+      sound_buses[i].mixTo(out_buf, count);
+
+    samples -= count;
+    out_buf += count * channels;
+    total_samples_played += count;
+    blockStart += count;
+    total_time_played = total_time_played + count * invFrequency;
+  }
+
+  publish_voice_states();
+  update_mixer_stats(start, mixer_clock::now(), frames, commands);
+}
+
+
+
+static ma_device miniaudio_device;
+static ma_log ma_log_struct = { 0 };
+static ma_context context = { 0 };
+
+
+void on_error_log(void * user_data, ma_uint32 level, const char * message)
+{
+  G_UNUSED(user_data);
+  if (level <= 1)
+    print_error("%s", message);
+  else
+    print_note("%s", message);
+}
+
+static void miniaudio_data_callback(ma_device* p_device, void* p_output, const void* p_input, ma_uint32 frame_count)
+{
+  G_UNUSED(p_input);
+
+  if (!device_initialized)
+  {
+    memset(p_output, 0, frame_count * ma_get_bytes_per_frame(p_device->playback.format, p_device->playback.channels));
+    return;
+  }
+
+  fill_buffer_cb((float *)p_output, output_sample_rate, p_device->playback.channels, frame_count);
+}
+
+// zero values leave the choice to miniaudio
+static int requested_sample_rate = DEFAULT_OUTPUT_SAMPLE_RATE;
+static int requested_period_frames = 0;
+static int requested_periods = 0;
+static bool requested_low_latency = false;
+static bool context_initialized = false;
+
+static void on_output_sample_rate_changed()
+{
+  for (SoundBus & bus : sound_buses)
+  {
+    bus.lowPass.setCutoff(bus.lowPass.cutoff, float(output_sample_rate));
+    if (bus.reverb.enabled)
+    {
+      bus.reverb.enabled = false;
+      bus.reverb.set(bus.reverb.wet, bus.reverb.roomSize, float(output_sample_rate));
+    }
+  }
+  mixer_stats_window = MixerStatsWindow();
+}
+
+void init_sound_lib_internal()
+{
+  if (device_initialized)
+    return;
+
+  if (!context_initialized)
+  {
+    ma_log_init(nullptr, &ma_log_struct);
+    ma_log_register_callback(&ma_log_struct, {on_error_log, nullptr});
+
+    ma_context_init(NULL, 0, NULL, &context);
+    context.pLog = &ma_log_struct;
+    context_initialized = true;
+  }
+
+  ma_device_config deviceConfig;
+
+  deviceConfig = ma_device_config_init(ma_device_type_playback);
+  deviceConfig.playback.format = ma_format_f32;
+  deviceConfig.playback.channels = OUTPUT_CHANNELS;
+  deviceConfig.sampleRate = requested_sample_rate;
+  deviceConfig.periodSizeInFrames = requested_period_frames;
+  deviceConfig.periods = requested_periods;
+  deviceConfig.noPreSilencedOutputBuffer = true; // mixer clears the buffer itself
+  if (requested_low_latency)
+  {
+    deviceConfig.performanceProfile = ma_performance_profile_low_latency;
+    if (!requested_period_frames)
+      deviceConfig.periodSizeInFrames = LOW_LATENCY_PERIOD_FRAMES;
+    if (!requested_periods)
+      deviceConfig.periods = LOW_LATENCY_PERIODS;
+  }
+  deviceConfig.dataCallback = miniaudio_data_callback;
+  deviceConfig.pUserData = nullptr;
+
+  if (ma_device_init(&context, &deviceConfig, &miniaudio_device) != MA_SUCCESS)
+  {
+    print_error("SOUND: Failed to open playback device");
+    return;
+  }
+
+  if (int(miniaudio_device.sampleRate) != output_sample_rate)
+  {
+    output_sample_rate = int(miniaudio_device.sampleRate);
+    on_output_sample_rate_changed();
+  }
+
+  print_note("Sound device name: %s", miniaudio_device.playback.name);
+  print_note("Sound device: %d Hz, %d x %d frames, latency %.1f ms", int(miniaudio_device.playback.internalSampleRate),
+    int(miniaudio_device.playback.internalPeriods), int(miniaudio_device.playback.internalPeriodSizeInFrames),
+    get_audio_latency());
+
+  if (ma_device_start(&miniaudio_device) != MA_SUCCESS)
+  {
+    print_error("SOUND: Failed to start playback device");
+    ma_device_uninit(&miniaudio_device);
+    return;
+  }
+
+  device_initialized = true;
+}
+
+// device is reopened with the new settings right away if it is already running, voices keep playing
+static void restart_sound_device()
+{
+  if (!device_initialized)
+    return;
+
+  device_initialized = false;
+  ma_device_uninit(&miniaudio_device); // waits for the mixer callback to finish
+  init_sound_lib_internal();
+}
+
+void set_audio_device_config(int sample_rate, int period_frames, int periods)
+{
+  if (sample_rate != 0 && (sample_rate < 8000 || sample_rate > 192000))
+  {
+    print_error("SOUND: invalid sample rate %d, expected 8000..192000 or 0 for default", sample_rate);
+    return;
+  }
+
+  requested_sample_rate = sample_rate ? sample_rate : DEFAULT_OUTPUT_SAMPLE_RATE;
+  requested_period_frames = clamp(period_frames, 0, 65536);
+  requested_periods = clamp(periods, 0, 16);
+  restart_sound_device();
+}
+
+void set_audio_low_latency(bool enabled)
+{
+  requested_low_latency = enabled;
+  restart_sound_device();
+}
+
+float get_audio_latency()
+{
+  if (!device_initialized)
+    return 0.0f;
+
+  const auto & pb = miniaudio_device.playback;
+  return pb.internalSampleRate ? float(pb.internalPeriodSizeInFrames) * pb.internalPeriods * 1000.0f / pb.internalSampleRate : 0.0f;
+}
+
+void initialize()
+{
+  memset(&playing_sounds[0], 0, sizeof(playing_sounds[0]) * playing_sounds.size());
+  memset(&voice_slots[0], 0, sizeof(voice_slots[0]) * voice_slots.size());
+  active_voice_count = 0;
+  used_voice_count = 0;
+  free_voices.clear();
+  for (int i = MAX_PLAYING_SOUNDS - 1; i > 0; i--)
+    free_voices.push_back(i);
+}
+
+static void finalize_music();
+
+void finalize()
+{
+  finalize_music();
+
+  device_initialized = false;
+  ma_device_uninit(&miniaudio_device); // waits for the mixer callback to finish
+  delete_deferred_sound_data(true);
+}
+
+
+PcmSound create_sound_with_storage(int frequency, const das::TArray<float> & data, int storage)
+{
+  if (!device_initialized)
+    init_sound_lib_internal();
+
+  if (frequency < 1 || !data.size)
+    return PcmSound();
+
+  PcmSound s;
+  s.frequency = frequency;
+  s.channels = 1;
+  s.samples = data.size;
+  store_sound_frames(s, storage, (const float *)data.data);
+  return s;
+}
+
+PcmSound create_sound_stereo_with_storage(int frequency, const das::TArray<das::float2> & data, int storage)
+{
+  if (!device_initialized)
+    init_sound_lib_internal();
+
+  if (frequency < 1 || !data.size)
+    return PcmSound();
+
+  PcmSound s;
+  s.frequency = frequency;
+  s.channels = 2;
+  s.samples = data.size;
+  store_sound_frames(s, storage, (const float *)data.data);
+  return s;
+}
+
+PcmSound create_sound(int frequency, const das::TArray<float> & data)
+{
+  return create_sound_with_storage(frequency, data, SOUND_STORAGE_FLOAT);
+}
+
+PcmSound create_sound_stereo(int frequency, const das::TArray<das::float2> & data)
+{
+  return create_sound_stereo_with_storage(frequency, data, SOUND_STORAGE_FLOAT);
+}
+
+
+enum DecodedAllocator
+{
+  DECODED_BY_DRWAV,
+  DECODED_BY_DRMP3,
+  DECODED_BY_DRFLAC,
+  DECODED_FROM_CACHE // allocated with new[]
+};
+
+struct DecodedSound
+{
+  float * data = nullptr;
+  DecodedAllocator allocator = DECODED_BY_DRWAV;
+  unsigned int channels = 0;
+  unsigned int sampleRate = 0;
+  drwav_uint64 frames = 0;
+
+  void release()
+  {
+    switch (allocator)
+    {
+      case DECODED_BY_DRWAV: drwav_free(data, NULL); break;
+      case DECODED_BY_DRMP3: drmp3_free(data, NULL); break;
+      case DECODED_BY_DRFLAC: drflac_free(data, NULL); break;
+      case DECODED_FROM_CACHE: delete[] data; break;
+    }
+    data = nullptr;
+  }
+};
+
+
+//----- resampling -----
+
+// Windowed sinc resampler for converting sounds to the output sample rate at load time.
+// Kernel is tabulated for RESAMPLE_PHASES fractional positions, values between them are interpolated.
+
+#define RESAMPLE_HALF_TAPS 16
+#define RESAMPLE_PHASES 256
+
+static double sinc(double x)
+{
+  if (fabs(x) < 1e-9)
+    return 1.0;
+  return sin(M_PI * x) / (M_PI * x);
+}
+
+static double blackman_window(double t) // t = -1..1
+{
+  if (t <= -1.0 || t >= 1.0)
+    return 0.0;
+  return 0.42 + 0.5 * cos(M_PI * t) + 0.08 * cos(2.0 * M_PI * t);
+}
+
+// does not use logger, can run on any thread
+static void resample_frames(const float * src, int src_frames, int channels, int src_rate, int dst_rate, vector<float> & out)
+{
+  double ratio = double(dst_rate) / src_rate;
+  double cutoff = min(1.0, ratio); // lower the band when downsampling
+  int halfTaps = int(ceil(RESAMPLE_HALF_TAPS / cutoff));
+  int taps = halfTaps * 2;
+
+  vector<float> table((RESAMPLE_PHASES + 1) * taps);
+  for (int p = 0; p <= RESAMPLE_PHASES; p++)
+  {
+    float * k = &table[p * taps];
+    double frac = double(p) / RESAMPLE_PHASES;
+    double sum = 0.0;
+    for (int j = 0; j < taps; j++)
+    {
+      double x = double(j - halfTaps + 1) - frac;
+      double w = cutoff * sinc(cutoff * x) * blackman_window(x / halfTaps);
+      k[j] = float(w);
+      sum += w;
+    }
+    for (int j = 0; j < taps; j++)
+      k[j] = float(k[j] / sum);
+  }
+
+  int dstFrames = max(int(floor(double(src_frames) * ratio)), 1);
+  out.resize(size_t(dstFrames) * channels);
+  double step = double(src_rate) / dst_rate;
+
+  for (int i = 0; i < dstFrames; i++)
+  {
+    double center = i * step;
+    int c = int(center);
+    float phasePos = float((center - c) * RESAMPLE_PHASES);
+    int p = min(int(phasePos), RESAMPLE_PHASES - 1);
+    float t = phasePos - p;
+    const float * k0 = &table[p * taps];
+    const float * k1 = k0 + taps;
+
+    float acc[2] = { 0.0f, 0.0f };
+    int first = c - halfTaps + 1;
+    for (int j = 0; j < taps; j++)
+    {
+      float w = k0[j] + (k1[j] - k0[j]) * t;
+      int f = clamp(first + j, 0, src_frames - 1);
+      for (int ch = 0; ch < channels; ch++)
+        acc[ch] += src[f * channels + ch] * w;
+    }
+
+    for (int ch = 0; ch < channels; ch++)
+      out[size_t(i) * channels + ch] = acc[ch];
+  }
+}
+
+static void resample_decoded_sound(DecodedSound & decoded, int dst_rate)
+{
+  if (!dst_rate || int(decoded.sampleRate) == dst_rate || !decoded.frames)
+    return;
+
+  vector<float> frames;
+  resample_frames(decoded.data, int(decoded.frames), int(decoded.channels), int(decoded.sampleRate), dst_rate, frames);
+  decoded.release();
+  decoded.data = new float[frames.size()];
+  memcpy(decoded.data, frames.data(), frames.size() * sizeof(float));
+  decoded.allocator = DECODED_FROM_CACHE;
+  decoded.frames = frames.size() / decoded.channels;
+  decoded.sampleRate = unsigned(dst_rate);
+}
+
+static bool resample_on_load = false;
+
+void set_sound_resample_on_load(bool enabled)
+{
+  resample_on_load = enabled;
+}
+
+static int get_load_resample_rate()
+{
+  return resample_on_load ? output_sample_rate : 0;
+}
+
+
+//----- decoded sound cache -----
+
+// Decoded .mp3 and .flac files are stored as raw float frames, the file is valid while
+// the time and the size of the source file are the same.
+
+#define SOUND_CACHE_MAGIC 0x43534244 // 'DBSC'
+#define SOUND_DISK_CACHE_LIMIT (uint64_t(1) << 30) // the oldest files are deleted above this size
+#define SOUND_CACHE_VERSION 2
+
+struct SoundCacheHeader
+{
+  uint32_t magic;
+  uint32_t version;
+  uint64_t fileTime;
+  uint64_t fileSize;
+  uint32_t channels;
+  uint32_t sampleRate;
+  uint32_t resampledTo; // 0 - original sample rate
+  uint32_t reserved;
+  uint64_t frames;
+};
+
+static string sound_cache_dir; // empty if cache is disabled
+
+void set_sound_disk_cache_enabled(bool enabled)
+{
+  sound_cache_dir.clear();
+  if (!enabled)
+    return;
+
+  string dir = fs::combine_path(initial_dir, ".dasbox_cache");
+  fs::make_dir(dir.c_str());
+  dir = fs::combine_path(dir, "sound");
+  if (!fs::make_dir(dir.c_str()))
+  {
+    print_error("SOUND: Cannot create cache directory '%s'", dir.c_str());
+    return;
+  }
+  sound_cache_dir = dir;
+}
+
+static bool is_sound_cacheable(const char * file_name)
+{
+  const char * p = strrchr(file_name, '.');
+  return p && (!stricmp(p, ".mp3") || !stricmp(p, ".flac"));
+}
+
+// must be called on the main thread, the name depends on the current directory
+static string get_sound_cache_file_name(const char * file_name)
+{
+  if (sound_cache_dir.empty() || !is_sound_cacheable(file_name))
+    return string();
+
+  string fullName = fs::combine_path(fs::get_current_dir(), file_name);
+  uint64_t hash = 14695981039346656037ull;
+  for (const char * c = fullName.c_str(); *c; c++)
+    hash = (hash ^ uint8_t(*c == '\\' ? '/' : *c)) * 1099511628211ull;
+
+  char buf[32] = { 0 };
+  snprintf(buf, sizeof(buf), "%016llx.pcm", (unsigned long long)hash);
+  return fs::combine_path(sound_cache_dir, buf);
+}
+
+static bool read_sound_cache(const char * file_name, const string & cache_file_name, int resample_rate, DecodedSound & out)
+{
+  FILE * f = fopen(cache_file_name.c_str(), "rb");
+  if (!f)
+    return false;
+
+  SoundCacheHeader header;
+  bool ok = fread(&header, sizeof(header), 1, f) == 1 &&
+    header.magic == SOUND_CACHE_MAGIC && header.version == SOUND_CACHE_VERSION &&
+    header.fileTime == fs::get_file_time(file_name) && header.fileSize == fs::get_file_size(file_name) &&
+    header.resampledTo == uint32_t(resample_rate) &&
+    (header.channels == 1 || header.channels == 2) && header.frames > 0 && header.frames < (1ull << 31);
+
+  if (ok)
+  {
+    size_t count = size_t(header.frames * header.channels);
+    out.data = new float[count];
+    out.allocator = DECODED_FROM_CACHE;
+    if (fread(out.data, sizeof(float), count, f) == count)
+    {
+      out.channels = header.channels;
+      out.sampleRate = header.sampleRate;
+      out.frames = header.frames;
+    }
+    else
+    {
+      out.release();
+      ok = false;
+    }
+  }
+
+  fclose(f);
+  return ok;
+}
+
+static void write_sound_cache(const char * file_name, const string & cache_file_name, int resample_rate,
+  const DecodedSound & decoded)
+{
+  SoundCacheHeader header;
+  memset(&header, 0, sizeof(header));
+  header.magic = SOUND_CACHE_MAGIC;
+  header.version = SOUND_CACHE_VERSION;
+  header.fileTime = fs::get_file_time(file_name);
+  header.fileSize = fs::get_file_size(file_name);
+  header.channels = decoded.channels;
+  header.sampleRate = decoded.sampleRate;
+  header.resampledTo = uint32_t(resample_rate);
+  header.frames = decoded.frames;
+
+  // other thread can read the cache at the same time, so the file appears only when it is complete,
+  // loads of the same file in other threads or instances write their own temporary files
+  string tmpName = fs::get_unique_temp_name(cache_file_name);
+  FILE * f = fopen(tmpName.c_str(), "wb");
+  if (!f)
+    return;
+
+  size_t count = size_t(decoded.frames * decoded.channels);
+  bool ok = fwrite(&header, sizeof(header), 1, f) == 1 && fwrite(decoded.data, sizeof(float), count, f) == count;
+  fclose(f);
+
+  remove(cache_file_name.c_str());
+  if (!ok || rename(tmpName.c_str(), cache_file_name.c_str()) != 0)
+    remove(tmpName.c_str());
+  else
+    fs::trim_dir_files(fs::extract_dir(cache_file_name).c_str(), SOUND_DISK_CACHE_LIMIT);
+}
+
+
+// does not touch playing sounds and logger, so it can run on any thread
+// resample_rate = 0 keeps original sample rate
+static bool decode_sound_file(const char * file_name, const string & cache_file_name, int resample_rate,
+  DecodedSound & out, string & error)
+{
+  if (!cache_file_name.empty() && read_sound_cache(file_name, cache_file_name, resample_rate, out))
+    return true;
+
+  const uint8_t * pakData = nullptr;
+  uint64_t pakSize = 0;
+  bool inPak = fs::find_pak_file(file_name, pakData, pakSize);
+
+  char buf[512] = { 0 };
+  const char * p = strrchr(file_name, '.');
+  if (p && !stricmp(p, ".wav"))
+  {
+    out.data = inPak ?
+      drwav_open_memory_and_read_pcm_frames_f32(pakData, size_t(pakSize), &out.channels, &out.sampleRate, &out.frames, nullptr) :
+      drwav_open_file_and_read_pcm_frames_f32(file_name, &out.channels, &out.sampleRate, &out.frames, nullptr);
+    out.allocator = DECODED_BY_DRWAV;
+  }
+  else if (p && !stricmp(p, ".mp3"))
+  {
+    drmp3_config config = { 0 };
+    out.data = inPak ?
+      drmp3_open_memory_and_read_pcm_frames_f32(pakData, size_t(pakSize), &config, &out.frames, nullptr) :
+      drmp3_open_file_and_read_pcm_frames_f32(file_name, &config, &out.frames, nullptr);
+    out.channels = config.channels;
+    out.sampleRate = config.sampleRate;
+    out.allocator = DECODED_BY_DRMP3;
+  }
+  else if (p && !stricmp(p, ".flac"))
+  {
+    out.data = inPak ?
+      drflac_open_memory_and_read_pcm_frames_f32(pakData, size_t(pakSize), &out.channels, &out.sampleRate, &out.frames, nullptr) :
+      drflac_open_file_and_read_pcm_frames_f32(file_name, &out.channels, &out.sampleRate, &out.frames, nullptr);
+    out.allocator = DECODED_BY_DRFLAC;
+  }
+  else
+  {
+    snprintf(buf, sizeof(buf), "Cannot create sound from '%s', unrecognized file format. Expected .wav, .flac or .mp3",
+      file_name);
+    error = buf;
+    return false;
+  }
+
+  if (!out.data)
+  {
+    snprintf(buf, sizeof(buf), "Cannot create sound from '%s'", file_name);
+    error = buf;
+    return false;
+  }
+
+  if (out.channels != 1 && out.channels != 2)
+  {
+    snprintf(buf, sizeof(buf), "Cannot create sound from '%s', invalid channels count = %d", file_name, int(out.channels));
+    error = buf;
+    out.release();
+    return false;
+  }
+
+  resample_decoded_sound(out, resample_rate);
+
+  if (!cache_file_name.empty() && out.frames > 0)
+    write_sound_cache(file_name, cache_file_name, resample_rate, out);
+
+  return true;
+}
+
+static PcmSound create_sound_from_frames(const DecodedSound & decoded, int storage)
+{
+  PcmSound s;
+  s.channels = int(decoded.channels);
+  s.frequency = int(decoded.sampleRate);
+  s.samples = int(decoded.frames);
+  store_sound_frames(s, storage, decoded.data);
+  return s;
+}
+
+static PcmSound create_sound_from_decoded(DecodedSound & decoded, int storage)
+{
+  PcmSound s = create_sound_from_frames(decoded, storage);
+  decoded.release();
+  return s;
+}
+
+
+//----- memory cache -----
+
+// Decoded files are kept between script reloads, so unchanged sounds are not decoded again.
+// Entries not requested during the whole run of the script are dropped on the next reload. Main thread only.
+
+#define SOUND_MEMORY_CACHE_LIMIT (size_t(256) << 20)
+
+struct SoundMemoryCacheEntry
+{
+  DecodedSound decoded;
+  uint64_t fileTime = 0;
+  uint64_t fileSize = 0;
+  int generation = 0;
+};
+
+static unordered_map<string, SoundMemoryCacheEntry> sound_memory_cache;
+static size_t sound_memory_cache_size = 0;
+static int sound_memory_cache_generation = 0;
+
+static size_t get_decoded_sound_size(const DecodedSound & decoded)
+{
+  return size_t(decoded.frames) * decoded.channels * sizeof(float);
+}
+
+// the key depends on the current directory
+static string get_sound_memory_cache_key(const char * file_name, int resample_rate)
+{
+  char buf[16] = { 0 };
+  snprintf(buf, sizeof(buf), "%d:", resample_rate);
+  return string(buf) + fs::combine_path(fs::get_current_dir(), file_name);
+}
+
+static void erase_cached_sound(unordered_map<string, SoundMemoryCacheEntry>::iterator it)
+{
+  sound_memory_cache_size -= get_decoded_sound_size(it->second.decoded);
+  it->second.decoded.release();
+  sound_memory_cache.erase(it);
+}
+
+static const DecodedSound * find_cached_sound(const string & key, const char * file_name)
+{
+  auto it = sound_memory_cache.find(key);
+  if (it == sound_memory_cache.end())
+    return nullptr;
+
+  if (it->second.fileTime != fs::get_file_time(file_name) || it->second.fileSize != fs::get_file_size(file_name))
+  {
+    erase_cached_sound(it);
+    return nullptr;
+  }
+
+  it->second.generation = sound_memory_cache_generation;
+  return &it->second.decoded;
+}
+
+static void evict_cached_sounds(int older_than_generation, size_t need_size)
+{
+  for (auto it = sound_memory_cache.begin(); it != sound_memory_cache.end();)
+  {
+    if (sound_memory_cache_size + need_size <= SOUND_MEMORY_CACHE_LIMIT && need_size)
+      break;
+    auto cur = it++;
+    if (cur->second.generation < older_than_generation)
+      erase_cached_sound(cur);
+  }
+}
+
+// takes ownership of 'decoded' if it fits into the cache
+static const DecodedSound * add_cached_sound(const string & key, const char * file_name, DecodedSound & decoded)
+{
+  size_t size = get_decoded_sound_size(decoded);
+  if (sound_memory_cache_size + size > SOUND_MEMORY_CACHE_LIMIT)
+    evict_cached_sounds(sound_memory_cache_generation, size);
+  if (sound_memory_cache_size + size > SOUND_MEMORY_CACHE_LIMIT)
+    return nullptr;
+
+  auto it = sound_memory_cache.find(key);
+  if (it != sound_memory_cache.end())
+    erase_cached_sound(it);
+
+  SoundMemoryCacheEntry & e = sound_memory_cache[key];
+  e.decoded = decoded;
+  e.fileTime = fs::get_file_time(file_name);
+  e.fileSize = fs::get_file_size(file_name);
+  e.generation = sound_memory_cache_generation;
+  sound_memory_cache_size += size;
+  decoded.data = nullptr;
+  return &e.decoded;
+}
+
+// called on script reload
+static void on_sound_memory_cache_generation_end()
+{
+  evict_cached_sounds(sound_memory_cache_generation, 0);
+  sound_memory_cache_generation++;
+}
+
+static bool check_sound_file_name(const char * file_name)
+{
+  if (!file_name || !file_name[0])
+  {
+    print_error("Cannot create sound. File name is empty.");
+    return false;
+  }
+
+  if (!fs::is_path_string_valid(file_name))
+  {
+    print_error("Cannot open sound '%s'. Absolute paths or access to the parent directory is prohibited.", file_name);
+    return false;
+  }
+
+  return true;
+}
+
+PcmSound create_sound_from_file_with_storage(const char * file_name, int storage)
+{
+  if (!device_initialized)
+    init_sound_lib_internal();
+
+  if (!check_sound_file_name(file_name))
+    return PcmSound();
+
+  string memoryCacheKey = get_sound_memory_cache_key(file_name, get_load_resample_rate());
+  if (const DecodedSound * cached = find_cached_sound(memoryCacheKey, file_name))
+    return create_sound_from_frames(*cached, storage);
+
+  DecodedSound decoded;
+  string error;
+  if (!decode_sound_file(file_name, get_sound_cache_file_name(file_name), get_load_resample_rate(), decoded, error))
+  {
+    print_error("%s", error.c_str());
+    return PcmSound();
+  }
+
+  if (const DecodedSound * cached = add_cached_sound(memoryCacheKey, file_name, decoded))
+    return create_sound_from_frames(*cached, storage);
+
+  return create_sound_from_decoded(decoded, storage);
+}
+
+PcmSound create_sound_from_file(const char * file_name)
+{
+  return create_sound_from_file_with_storage(file_name, SOUND_STORAGE_FLOAT);
+}
+
+
+struct AsyncSoundLoad
+{
+  string fileName;
+  string filePath; // resolved on the main thread, see fs::get_worker_file_path
+  string cacheFileName;
+  string memoryCacheKey;
+  bool inMemoryCache = false; // nothing to decode, sound is taken from the memory cache
+  int resampleRate = 0;
+  string error;
+  DecodedSound decoded;
+  jobs::Completion done;
+
+  ~AsyncSoundLoad()
+  {
+    if (decoded.data)
+      decoded.release();
+  }
+};
+
+static unordered_map<int, shared_ptr<AsyncSoundLoad>> async_sound_loads;
+static int async_sound_last_handle = 0;
+
+int load_sound_async(const char * file_name)
+{
+  if (!device_initialized)
+    init_sound_lib_internal();
+
+  if (!check_sound_file_name(file_name))
+    return 0;
+
+  shared_ptr<AsyncSoundLoad> load = make_shared<AsyncSoundLoad>();
+  load->fileName = file_name;
+  load->filePath = fs::get_worker_file_path(file_name);
+  load->cacheFileName = get_sound_cache_file_name(file_name);
+  load->resampleRate = get_load_resample_rate();
+  load->memoryCacheKey = get_sound_memory_cache_key(file_name, load->resampleRate);
+  int handle = ++async_sound_last_handle;
+  async_sound_loads[handle] = load;
+
+  if (find_cached_sound(load->memoryCacheKey, file_name))
+  {
+    load->inMemoryCache = true;
+    load->done.set();
+    return handle;
+  }
+
+  jobs::add_job([load]()
+  {
+    decode_sound_file(load->filePath.c_str(), load->cacheFileName, load->resampleRate, load->decoded, load->error);
+    load->done.set();
+  });
+
+  return handle;
+}
+
+bool is_sound_loaded(int handle)
+{
+  auto it = async_sound_loads.find(handle);
+  return it != async_sound_loads.end() && it->second->done.isSet();
+}
+
+PcmSound take_loaded_sound(int handle)
+{
+  auto it = async_sound_loads.find(handle);
+  if (it == async_sound_loads.end())
+  {
+    print_error("take_loaded_sound: invalid handle %d", handle);
+    return PcmSound();
+  }
+
+  shared_ptr<AsyncSoundLoad> load = it->second;
+  async_sound_loads.erase(it);
+  load->done.wait();
+
+  if (load->inMemoryCache)
+  {
+    if (const DecodedSound * cached = find_cached_sound(load->memoryCacheKey, load->fileName.c_str()))
+      return create_sound_from_frames(*cached, SOUND_STORAGE_FLOAT);
+    return create_sound_from_file(load->fileName.c_str()); // file was changed after load_sound_async
+  }
+
+  if (!load->decoded.data)
+  {
+    print_error("%s", load->error.c_str());
+    return PcmSound();
+  }
+
+  if (const DecodedSound * cached = add_cached_sound(load->memoryCacheKey, load->fileName.c_str(), load->decoded))
+    return create_sound_from_frames(*cached, SOUND_STORAGE_FLOAT);
+
+  return create_sound_from_decoded(load->decoded, SOUND_STORAGE_FLOAT);
+}
+
+
+//----- music streaming thread -----
+
+static unordered_map<int, MusicStream *> music_streams; // modified by script thread under music_mutex
+static int music_last_handle = 0;
+// music_mutex guards the bookkeeping shared with the script thread and is held only briefly,
+// files are read and decoded without it
+static mutex music_mutex;
+static vector<MusicStream *> music_service_list; // streaming thread
+static vector<MusicStream *> music_delete_list; // under music_mutex, deleted by the streaming thread
+static thread music_thread;
+static atomic<bool> music_thread_quit(false);
+
+static void delete_music_stream(MusicStream * music)
+{
+  if (!music)
+    return;
+  if (music_thread.joinable())
+  {
+    // the streaming thread can be decoding it right now
+    lock_guard<mutex> lock(music_mutex);
+    music_delete_list.push_back(music);
+    return;
+  }
+  music->decoder.close();
+  delete music;
+}
+
+static void delete_closed_music_streams()
+{
+  vector<MusicStream *> streams;
+  {
+    lock_guard<mutex> lock(music_mutex);
+    streams.swap(music_delete_list);
+  }
+  for (MusicStream * music : streams)
+  {
+    music->decoder.close();
+    delete music;
+  }
+}
+
+// called by the streaming thread without locks, returns true if there is more work to do
+static bool service_music_stream(MusicStream & m)
+{
+  int64_t seekRequest;
+  {
+    lock_guard<mutex> lock(music_mutex);
+    seekRequest = m.seekRequest;
+  }
+
+  if (seekRequest >= 0)
+  {
+    uint64_t frame = uint64_t(seekRequest);
+    if (!m.decoder.seek(frame))
+    {
+      frame = 0;
+      m.decoder.seek(0);
+    }
+    m.decodeFrame = frame;
+
+    uint64_t w = m.writeFrame.load(memory_order_relaxed);
+    lock_guard<mutex> lock(music_mutex);
+    if (m.seekRequest == seekRequest) // a newer request is handled at the next call
+      m.seekRequest = -1;
+    m.segments.clear();
+    m.segments.push_back(MusicSegment{w, frame});
+    m.endFrame.store(MUSIC_NO_END, memory_order_release);
+    m.skipToFrame.store(w, memory_order_release);
+  }
+
+  uint64_t r = m.readFrame.load(memory_order_acquire);
+  {
+    lock_guard<mutex> lock(music_mutex);
+    while (m.segments.size() > 1 && m.segments[1].ringFrame <= r)
+      m.segments.erase(m.segments.begin());
+  }
+
+  if (m.endFrame.load(memory_order_relaxed) != MUSIC_NO_END)
+    return false;
+
+  uint64_t w = m.writeFrame.load(memory_order_relaxed);
+  uint64_t readable = max(r, m.skipToFrame.load(memory_order_relaxed));
+  if (w - r >= MUSIC_RING_FRAMES || w - readable >= MUSIC_RING_FRAMES / 2)
+  {
+    // ring is full enough, good time for slow operations
+    if (!m.lengthKnown)
+    {
+      m.lengthFrames.store(int64_t(m.decoder.getLength()), memory_order_relaxed);
+      m.lengthKnown = true;
+    }
+    return false;
+  }
+
+  uint64_t count = min(uint64_t(MUSIC_DECODE_CHUNK), MUSIC_RING_FRAMES - (w - r));
+  count = min(count, uint64_t(MUSIC_RING_FRAMES - (w & MUSIC_RING_MASK)));
+  uint64_t got = m.decoder.read(count, &m.ring[(w & MUSIC_RING_MASK) * m.channels]);
+  m.decodeFrame += got;
+  w += got;
+  m.writeFrame.store(w, memory_order_release);
+
+  if (got < count) // end of file
+  {
+    if (!m.lengthKnown)
+    {
+      m.lengthFrames.store(int64_t(m.decodeFrame), memory_order_relaxed);
+      m.lengthKnown = true;
+    }
+
+    if (m.loop.load(memory_order_relaxed) && m.decodeFrame > 0 && m.decoder.seek(0))
+    {
+      m.decodeFrame = 0;
+      lock_guard<mutex> lock(music_mutex);
+      m.segments.push_back(MusicSegment{w, 0});
+    }
+    else
+      m.endFrame.store(w, memory_order_release);
+  }
+
+  return true;
+}
+
+static void music_thread_func()
+{
+  while (!music_thread_quit.load(memory_order_relaxed))
+  {
+    bool busy = false;
+    delete_closed_music_streams();
+    {
+      lock_guard<mutex> lock(music_mutex);
+      music_service_list.clear();
+      for (auto && it : music_streams)
+        music_service_list.push_back(it.second);
+    }
+    // closed streams are deleted only by this thread, so the list stays valid
+    for (MusicStream * m : music_service_list)
+      busy |= service_music_stream(*m);
+
+    if (!busy)
+      sf::sleep(sf::milliseconds(5));
+  }
+}
+
+static void push_music_command(MusicStream * music, SoundCommandType type, float value)
+{
+  SoundCommand cmd;
+  memset(&cmd, 0, sizeof(cmd));
+  cmd.type = type;
+  cmd.music = music;
+  cmd.value = value;
+  push_sound_command(cmd);
+}
+
+static MusicStream * get_music_stream(int handle)
+{
+  auto it = music_streams.find(handle);
+  return it == music_streams.end() ? nullptr : it->second;
+}
+
+static void close_music_stream(MusicStream * music)
+{
+  push_music_command(music, SOUND_CMD_MUSIC_REMOVE, 0.0f);
+  if (sound_commands_batching)
+    publish_sound_commands();
+  deferred_sound_data.push_back(DeferredSoundData{nullptr, music, sound_commands_local_write});
+}
+
+static void close_all_music()
+{
+  lock_guard<mutex> lock(music_mutex);
+  for (auto && it : music_streams)
+    close_music_stream(it.second);
+  music_streams.clear();
+}
+
+static void finalize_music()
+{
+  music_thread_quit = true;
+  if (music_thread.joinable())
+    music_thread.join();
+  delete_closed_music_streams();
+  close_all_music();
+}
+
+int open_music(const char * file_name)
+{
+  if (!device_initialized)
+    init_sound_lib_internal();
+
+  if (!device_initialized || !check_sound_file_name(file_name))
+    return 0;
+
+  if (music_streams.size() >= MAX_MUSIC_STREAMS)
+  {
+    print_error("Cannot open music '%s', too many music streams are open (max %d)", file_name, MAX_MUSIC_STREAMS);
+    return 0;
+  }
+
+  MusicStream * m = new MusicStream;
+  if (!m->decoder.open(file_name))
+  {
+    print_error("Cannot open music '%s'. Expected .wav, .flac or .mp3", file_name);
+    delete m;
+    return 0;
+  }
+
+  if ((m->decoder.channels != 1 && m->decoder.channels != 2) || !m->decoder.sampleRate)
+  {
+    print_error("Cannot open music '%s', invalid channels count = %d", file_name, int(m->decoder.channels));
+    delete_music_stream(m);
+    return 0;
+  }
+
+  m->channels = int(m->decoder.channels);
+  m->frequency = int(m->decoder.sampleRate);
+  m->ring.resize(MUSIC_RING_FRAMES * m->channels);
+  m->segments.push_back(MusicSegment{0, 0});
+
+  if (!music_thread.joinable())
+  {
+    music_thread_quit = false;
+    music_thread = thread(music_thread_func);
+  }
+
+  int handle = ++music_last_handle;
+  {
+    lock_guard<mutex> lock(music_mutex);
+    music_streams[handle] = m;
+  }
+  push_music_command(m, SOUND_CMD_MUSIC_ADD, 0.0f);
+  return handle;
+}
+
+void close_music(int handle)
+{
+  MusicStream * m = get_music_stream(handle);
+  if (!m)
+    return;
 
-  print_note("Sound device name: %s", miniaudio_device.playback.name);
+  lock_guard<mutex> lock(music_mutex);
+  music_streams.erase(handle);
+  close_music_stream(m);
+}
 
-  if (ma_device_start(&miniaudio_device) != MA_SUCCESS)
-  {
-    print_error("SOUND: Failed to start playback device");
-    ma_device_uninit(&miniaudio_device);
+void seek_music(int handle, float pos_seconds)
+{
+  MusicStream * m = get_music_stream(handle);
+  if (!m)
     return;
-  }
 
-  device_initialized = true;
+  lock_guard<mutex> lock(music_mutex);
+  m->seekRequest = int64_t(max(pos_seconds, 0.0f) * m->frequency);
 }
 
-void initialize()
+// position is looked up in the segments, every seek and loop starts a new segment
+static double get_music_pos_frames(MusicStream * m)
 {
-  memset(&playing_sounds[0], 0, sizeof(playing_sounds[0]) * playing_sounds.size());
+  if (m->seekRequest >= 0)
+    return double(m->seekRequest);
+
+  uint64_t r = max(m->readFrame.load(memory_order_acquire), m->skipToFrame.load(memory_order_acquire));
+  const MusicSegment * seg = &m->segments[0];
+  for (auto && s : m->segments)
+    if (s.ringFrame <= r)
+      seg = &s;
+
+  return double(seg->sourceFrame + (r - seg->ringFrame));
 }
 
-void finalize()
+static bool is_music_finished(MusicStream * m)
 {
-  device_initialized = false;
-  WinAutoLock lock(&sound_cs);
-  ma_device_uninit(&miniaudio_device);
+  return m->seekRequest < 0 && m->readFrame.load(memory_order_acquire) >= m->endFrame.load(memory_order_acquire);
 }
 
-
-PcmSound create_sound(int frequency, const das::TArray<float> & data)
+void play_music(int handle, float volume, bool loop)
 {
-  if (!device_initialized)
-    init_sound_lib_internal();
+  MusicStream * m = get_music_stream(handle);
+  if (!m)
+    return;
 
-  if (frequency < 1 || !data.size)
-    return PcmSound();
+  {
+    lock_guard<mutex> lock(music_mutex);
+    m->loop = loop;
+    if (is_music_finished(m))
+      m->seekRequest = 0;
+  }
 
-  PcmSound s;
-  s.frequency = frequency;
-  s.channels = 1;
-  s.samples = data.size;
-  s.newData(s.getDataMemorySize());
-  memcpy(s.getData(), data.data, s.getDataMemorySize());
-  s.getData()[data.size] = s.getData()[0];
-  return s;
+  m->playing = true;
+  push_music_command(m, SOUND_CMD_MUSIC_PLAY, clamp(volume, 0.0f, 100000.0f));
 }
 
-PcmSound create_sound_stereo(int frequency, const das::TArray<das::float2> & data)
+void pause_music(int handle)
 {
-  if (!device_initialized)
-    init_sound_lib_internal();
+  MusicStream * m = get_music_stream(handle);
+  if (!m)
+    return;
 
-  if (frequency < 1 || !data.size)
-    return PcmSound();
+  m->playing = false;
+  push_music_command(m, SOUND_CMD_MUSIC_PAUSE, 0.0f);
+}
 
-  PcmSound s;
-  s.frequency = frequency;
-  s.channels = 2;
-  s.samples = data.size;
-  s.newData(s.getDataMemorySize());
-  memcpy(s.getData(), data.data, s.getDataMemorySize());
-  s.getData()[s.samples * 2] = s.getData()[0];
-  s.getData()[s.samples * 2 + 1] = s.getData()[1];
-  return s;
+void stop_music(int handle)
+{
+  pause_music(handle);
+  seek_music(handle, 0.0f);
 }
 
+void set_music_volume(int handle, float volume)
+{
+  MusicStream * m = get_music_stream(handle);
+  if (m)
+    push_music_command(m, SOUND_CMD_MUSIC_VOLUME, clamp(volume, 0.0f, 100000.0f));
+}
 
-PcmSound create_sound_from_file(const char * file_name)
+void set_music_bus(int handle, int bus)
 {
-  if (!device_initialized)
-    init_sound_lib_internal();
+  MusicStream * m = get_music_stream(handle);
+  if (m)
+    push_music_command(m, SOUND_CMD_MUSIC_BUS, float(clamp(bus, 0, MAX_SOUND_BUSES - 1)));
+}
 
-  if (!file_name || !file_name[0])
-  {
-    print_error("Cannot create sound. File name is empty.", file_name);
-    return PcmSound();
-  }
+bool is_music_playing(int handle)
+{
+  MusicStream * m = get_music_stream(handle);
+  if (!m || !m->playing)
+    return false;
 
-  if (!fs::is_path_string_valid(file_name))
-  {
-    print_error("Cannot open sound '%s'. Absolute paths or access to the parent directory is prohibited.", file_name);
-    return PcmSound();
-  }
+  lock_guard<mutex> lock(music_mutex);
+  return !is_music_finished(m);
+}
 
-  PcmSound s;
+float get_music_pos(int handle)
+{
+  MusicStream * m = get_music_stream(handle);
+  if (!m)
+    return 0.0f;
 
-  unsigned int channels;
-  unsigned int sampleRate;
-  drwav_uint64 totalPCMFrameCount;
-  float * pSampleData = nullptr;
+  lock_guard<mutex> lock(music_mutex);
+  return float(get_music_pos_frames(m) / m->frequency);
+}
 
-  const char * p = strrchr(file_name, '.');
-  if (p && !stricmp(p, ".wav") && !p[4])
-    pSampleData = drwav_open_file_and_read_pcm_frames_f32(file_name, &channels, &sampleRate, &totalPCMFrameCount, nullptr);
-  else if (p && !stricmp(p, ".mp3") && !p[4])
-  {
-    drmp3_config config = { 0 };
-    pSampleData = drmp3_open_file_and_read_pcm_frames_f32(file_name, &config, &totalPCMFrameCount, nullptr);
-    channels = config.channels;
-    sampleRate = config.sampleRate;
-  }
-  else if (p && !stricmp(p, ".flac") && !p[4])
-    pSampleData = drwav_open_file_and_read_pcm_frames_f32(file_name, &channels, &sampleRate, &totalPCMFrameCount, nullptr);
-  else
-  {
-    print_error("Cannot create sound from '%s', unrecognized file format. Expected .wav, .flac or .mp3", file_name);
-    return PcmSound();
-  }
+float get_music_duration(int handle)
+{
+  MusicStream * m = get_music_stream(handle);
+  if (!m)
+    return 0.0f;
 
-  if (!pSampleData)
-  {
-    print_error("Cannot create sound from '%s'", file_name);
-    return PcmSound();
-  }
+  int64_t length = m->lengthFrames.load(memory_order_relaxed);
+  return length > 0 ? float(double(length) / m->frequency) : 0.0f;
+}
 
-  if (channels != 1 && channels != 2)
-  {
-    print_error("Cannot create sound from '%s', invalid channels count = %d", int(channels));
-    return PcmSound();
-  }
 
-  s.channels = int(channels);
-  s.frequency = int(sampleRate);
-  s.samples = int(totalPCMFrameCount);
-  s.newData(s.getDataMemorySize());
-  memcpy(s.getData(), pSampleData, channels * s.samples * sizeof(float));
-  if (s.channels == 2)
-  {
-    s.getData()[s.samples * 2] = s.getData()[0];
-    s.getData()[s.samples * 2 + 1] = s.getData()[1];
-  }
-  else
-  {
-    s.getData()[s.samples] = s.getData()[0];
-  }
+// float data is used directly, compact storages are decoded to 'tmp'
+static float * get_sound_frames(const PcmSound & sound, vector<float> & tmp)
+{
+  if (sound.storage == SOUND_STORAGE_FLOAT)
+    return sound.getData();
 
-  drwav_free(pSampleData, NULL);
-  return s;
+  decode_sound_frames(sound, tmp);
+  return tmp.data();
 }
 
-
 void get_sound_data(const PcmSound & sound, das::TArray<float> & out_data)
 {
   if (!sound.getData())
@@ -687,12 +2999,13 @@ void get_sound_data(const PcmSound & sound, das::TArray<float> & out_data)
 
   if (count)
   {
+    vector<float> tmp;
+    float * __restrict soundData = get_sound_frames(sound, tmp);
     if (sound.channels == 1)
-      memcpy(out_data.data, sound.getData(), count * sizeof(float));
+      memcpy(out_data.data, soundData, count * sizeof(float));
     else if (sound.channels == 2)
     {
       float * __restrict ptr = (float *)out_data.data;
-      float * __restrict soundData = (float *)sound.getData();
       for (int i = 0; i < count; i++)
         ptr[i] = (soundData[i * 2] + soundData[i * 2 + 1]) * 0.5f;
     }
@@ -710,12 +3023,13 @@ void get_sound_data_stereo(const PcmSound & sound, das::TArray<das::float2> & ou
 
   if (count)
   {
+    vector<float> tmp;
+    float * __restrict soundData = get_sound_frames(sound, tmp);
     if (sound.channels == 2)
-      memcpy(out_data.data, sound.getData(), count * sizeof(float) * 2);
+      memcpy(out_data.data, soundData, count * sizeof(float) * 2);
     else if (sound.channels == 1)
     {
       float * __restrict ptr = (float *)out_data.data;
-      float * __restrict soundData = (float *)sound.getData();
       for (int i = 0; i < count; i++)
       {
         ptr[i * 2] = soundData[i];
@@ -737,23 +3051,21 @@ void set_sound_data(PcmSound & sound, const das::TArray<float> & in_data)
   if (!count)
     return;
 
+  vector<float> tmp;
+  decode_sound_frames(sound, tmp);
+  float * __restrict soundData = tmp.data();
   if (sound.channels == 1)
-  {
-    memcpy(sound.getData(), in_data.data, count * sizeof(float));
-    sound.getData()[sound.samples] = sound.getData()[0];
-  }
+    memcpy(soundData, in_data.data, count * sizeof(float));
   else if (sound.channels == 2)
   {
     float * __restrict ptr = (float *)in_data.data;
-    float * __restrict soundData = (float *)sound.getData();
     for (int i = 0; i < count; i++)
     {
       soundData[i * 2] = ptr[i];
       soundData[i * 2 + 1] = ptr[i];
     }
-    soundData[sound.samples * 2] = soundData[0];
-    soundData[sound.samples * 2 + 1] = soundData[1];
   }
+  replace_sound_data(sound, soundData);
 }
 
 void set_sound_data_stereo(PcmSound & sound, const das::TArray<das::float2> & in_data)
@@ -768,40 +3080,53 @@ void set_sound_data_stereo(PcmSound & sound, const das::TArray<das::float2> & in
   if (!count)
     return;
 
+  vector<float> tmp;
+  decode_sound_frames(sound, tmp);
+  float * __restrict soundData = tmp.data();
   if (sound.channels == 1)
   {
     float * __restrict ptr = (float *)in_data.data;
-    float * __restrict soundData = (float *)sound.getData();
     for (int i = 0; i < count; i++)
       soundData[i] = (ptr[i * 2] + ptr[i * 2 + 1]) * 0.5f;
-
-    sound.getData()[sound.samples] = sound.getData()[0];
   }
   else if (sound.channels == 2)
-  {
-    memcpy(sound.getData(), in_data.data, 2 * count * sizeof(float));
-    sound.getData()[sound.samples * 2] = sound.getData()[0];
-    sound.getData()[sound.samples * 2 + 1] = sound.getData()[1];
-  }
+    memcpy(soundData, in_data.data, 2 * count * sizeof(float));
+  replace_sound_data(sound, soundData);
 }
 
 void delete_sound(PcmSound * sound)
 {
-  WinAutoLock lock(&sound_cs);
-
-  for (auto && s : playing_sounds)
-    if (s.sound == sound)
-      if (!s.isEmpty())
-        s.setStopMode();
-
   sound->deleteData();
-  sound->data = nullptr;
   sound->samples = 0;
 }
 
+static void stop_all_voices()
+{
+  SoundCommand cmd;
+  memset(&cmd, 0, sizeof(cmd));
+  cmd.type = SOUND_CMD_STOP_ALL;
+  if (device_initialized)
+    push_sound_command(cmd);
+
+  for (int i = 1; i < MAX_PLAYING_SOUNDS; i++)
+    voice_slots[i].stopped = true;
+}
+
 void delete_allocated_sounds()
 {
-  WinAutoLock lock(&sound_cs);
+  async_sound_loads.clear();
+  on_sound_memory_cache_generation_end();
+
+  close_all_music();
+  stop_all_voices();
+  publish_sound_commands();
+  sound_commands_batching = false;
+
+  // mixer must stop all voices before their data is deleted
+  for (int i = 0; i < 200 && device_initialized && !is_fence_passed(sound_commands_local_write); i++)
+    sf::sleep(sf::milliseconds(1));
+
+  delete_deferred_sound_data(true);
   for (auto && data : sound_data_pointers)
     delete[] data;
 
@@ -811,47 +3136,56 @@ void delete_allocated_sounds()
 
 
 PlayingSoundHandle play_sound_internal(const PcmSound & sound, float volume, float pitch, float pan, float start_time, float end_time,
-                                       bool loop, float defer_time_sec)
+                                       bool loop, float defer_time_sec, int priority = 0, int64_t start_sample = -1)
 {
   if (!device_initialized)
     init_sound_lib_internal();
 
-  WinAutoLock lock(&sound_cs);
-
-  int idx = allocate_playing_sound();
-  if (idx < 0 || sound.samples <= 2)
+  if (!device_initialized || sound.samples <= 2 || !sound.getData())
     return PlayingSoundHandle();
 
-  PlayingSound & s = playing_sounds[idx];
+  delete_deferred_sound_data(false);
 
   pitch = clamp(pitch, 0.00001f, 1000.0f);
   pan = clamp(pan, -1.0f, 1.0f);
   volume = clamp(volume, 0.0f, 100000.0f);
 
+  int idx = allocate_playing_sound(priority, volume);
+  if (idx < 0)
+    return PlayingSoundHandle();
+
   double start = clamp(double(int64_t(start_time * sound.frequency)), 0.0, double(sound.samples - 1));
   double stop = clamp(double(int64_t(end_time * sound.frequency)), start, double(sound.samples - 1));
   double pos = start;
   if (defer_time_sec < 0.0f)
     pos = min(double(int(-defer_time_sec * sound.frequency)), stop);
 
-  s.channels = sound.channels;
-  s.sound = &sound;
-  s.volume = volume;
-  s.pitch = pitch;
-  s.pan = pan;
-  s.volumeL = master_volume * volume * min(1.0f + pan, 1.0f);
-  s.volumeR = master_volume * volume * min(1.0f - pan, 1.0f);
-
-  s.pos = pos;
-  s.startPos = start;
-  s.stopPos = stop;
-  s.loop = loop;
-  s.stopMode = false;
-  s.timeToStart = max(defer_time_sec, 0.0f);
-  s.waitingStart = (s.timeToStart != 0.0);
-
   PlayingSoundHandle res;
-  res.handle = idx | s.version;
+  res.handle = idx | voice_slots[idx].version;
+
+  SoundCommand cmd;
+  memset(&cmd, 0, sizeof(cmd));
+  cmd.type = SOUND_CMD_PLAY;
+  cmd.handle = res.handle;
+  cmd.data = sound.getData();
+  cmd.frequency = sound.frequency;
+  cmd.channels = sound.channels;
+  cmd.storage = sound.storage;
+  cmd.volume = volume;
+  cmd.pitch = pitch;
+  cmd.pan = pan;
+  cmd.start = start;
+  cmd.stop = stop;
+  cmd.pos = pos;
+  cmd.loop = loop;
+  cmd.timeToStart = max(defer_time_sec, 0.0f);
+  cmd.startSample = start_sample;
+
+  if (!push_sound_command(cmd))
+  {
+    free_voice_slot(idx);
+    return PlayingSoundHandle();
+  }
 
   return res;
 }
@@ -928,6 +3262,31 @@ PlayingSoundHandle play_sound_deferred_4(const PcmSound & sound, float defer_sec
   return play_sound_internal(sound, volume, pitch, pan, 0.0f, VERY_BIG_NUMBER, false, defer_seconds);
 }
 
+PlayingSoundHandle play_sound_at_1(const PcmSound & sound, int64_t sample_time)
+{
+  return play_sound_internal(sound, 1.0f, 1.0f, 0.0f, 0.0f, VERY_BIG_NUMBER, false, 0.0f, 0, max(sample_time, int64_t(0)));
+}
+
+PlayingSoundHandle play_sound_at_2(const PcmSound & sound, int64_t sample_time, float volume)
+{
+  return play_sound_internal(sound, volume, 1.0f, 0.0f, 0.0f, VERY_BIG_NUMBER, false, 0.0f, 0, max(sample_time, int64_t(0)));
+}
+
+PlayingSoundHandle play_sound_at_3(const PcmSound & sound, int64_t sample_time, float volume, float pitch)
+{
+  return play_sound_internal(sound, volume, pitch, 0.0f, 0.0f, VERY_BIG_NUMBER, false, 0.0f, 0, max(sample_time, int64_t(0)));
+}
+
+PlayingSoundHandle play_sound_at_4(const PcmSound & sound, int64_t sample_time, float volume, float pitch, float pan)
+{
+  return play_sound_internal(sound, volume, pitch, pan, 0.0f, VERY_BIG_NUMBER, false, 0.0f, 0, max(sample_time, int64_t(0)));
+}
+
+PlayingSoundHandle play_sound_loop_at_4(const PcmSound & sound, int64_t sample_time, float volume, float pitch, float pan)
+{
+  return play_sound_internal(sound, volume, pitch, pan, 0.0f, VERY_BIG_NUMBER, true, 0.0f, 0, max(sample_time, int64_t(0)));
+}
+
 PlayingSoundHandle play_sound_deferred_5(const PcmSound & sound, float defer_seconds, float volume, float pitch, float pan,
   float start_time, float end_time)
 {
@@ -935,40 +3294,54 @@ PlayingSoundHandle play_sound_deferred_5(const PcmSound & sound, float defer_sec
 }
 
 
-void set_sound_pitch(PlayingSoundHandle handle, float pitch)
+static void push_voice_command(PlayingSoundHandle handle, SoundCommandType type, float value)
 {
-  WinAutoLock lock(&sound_cs);
-
   int idx = handle_to_index(handle);
-  if (idx < 0)
+  if (idx < 0 || voice_slots[idx].stopped)
     return;
-  playing_sounds[idx].pitch = pitch;
+
+  SoundCommand cmd;
+  memset(&cmd, 0, sizeof(cmd));
+  cmd.type = type;
+  cmd.handle = handle.handle;
+  cmd.value = value;
+  push_sound_command(cmd);
+}
+
+void set_sound_pitch(PlayingSoundHandle handle, float pitch)
+{
+  push_voice_command(handle, SOUND_CMD_SET_PITCH, pitch);
 }
 
 void set_sound_volume(PlayingSoundHandle handle, float volume)
 {
-  WinAutoLock lock(&sound_cs);
+  push_voice_command(handle, SOUND_CMD_SET_VOLUME, volume);
+  int idx = handle_to_index(handle);
+  if (idx >= 0)
+    voice_slots[idx].volume = volume;
+}
 
+void set_sound_priority(PlayingSoundHandle handle, int priority)
+{
   int idx = handle_to_index(handle);
-  if (idx < 0)
-    return;
-  playing_sounds[idx].volume = volume;
+  if (idx >= 0)
+    voice_slots[idx].priority = priority;
 }
 
 void set_sound_pan(PlayingSoundHandle handle, float pan)
 {
-  WinAutoLock lock(&sound_cs);
+  push_voice_command(handle, SOUND_CMD_SET_PAN, pan);
+}
 
-  int idx = handle_to_index(handle);
-  if (idx < 0)
-    return;
-  playing_sounds[idx].pan = pan;
+void set_sound_bus(PlayingSoundHandle handle, int bus)
+{
+  push_voice_command(handle, SOUND_CMD_SET_BUS, float(clamp(bus, 0, MAX_SOUND_BUSES - 1)));
 }
 
 bool is_playing(PlayingSoundHandle handle)
 {
   int idx = handle_to_index(handle);
-  if (idx < 0 || playing_sounds[idx].stopMode)
+  if (idx < 0 || is_voice_stopped(idx))
     return false;
 
   return true;
@@ -976,83 +3349,115 @@ bool is_playing(PlayingSoundHandle handle)
 
 float get_sound_play_pos(PlayingSoundHandle handle)
 {
-  WinAutoLock lock(&sound_cs);
-
   int idx = handle_to_index(handle);
-  if (idx < 0)
+  if (idx < 0 || is_voice_stopped(idx))
     return 0.0f;
 
-  if (!playing_sounds[idx].sound || playing_sounds[idx].stopMode || playing_sounds[idx].waitingStart)
-    return 0.0f;
-
-  return float(playing_sounds[idx].pos / playing_sounds[idx].sound->frequency);
+  return voice_pos_seconds[idx].load(memory_order_relaxed);
 }
 
 void set_sound_play_pos(PlayingSoundHandle handle, float pos_seconds)
 {
-  WinAutoLock lock(&sound_cs);
-
-  int idx = handle_to_index(handle);
-  if (idx < 0)
-    return;
-
-  if (!playing_sounds[idx].sound || playing_sounds[idx].stopMode)
-    return;
+  push_voice_command(handle, SOUND_CMD_SET_POS, pos_seconds);
+}
 
-  double p = floor(playing_sounds[idx].sound->frequency * pos_seconds);
-  playing_sounds[idx].pos = clamp(p, playing_sounds[idx].startPos, playing_sounds[idx].stopPos);
+static void push_voice_stop(int idx)
+{
+  PlayingSoundHandle handle;
+  handle.handle = unsigned(idx) | voice_slots[idx].version;
+  push_voice_command(handle, SOUND_CMD_STOP, 0.0f);
+  voice_slots[idx].stopped = true;
 }
 
 void stop_sound(PlayingSoundHandle handle)
 {
-  WinAutoLock lock(&sound_cs);
-
   int idx = handle_to_index(handle);
-  if (idx < 0)
-    return;
+  if (idx >= 0)
+    push_voice_stop(idx);
+}
 
-  if (!playing_sounds[idx].sound || playing_sounds[idx].stopMode)
-    return;
+void set_max_sound_voices(int count)
+{
+  max_voices = clamp(count, 1, MAX_PLAYING_SOUNDS - 1);
+}
 
-  playing_sounds[idx].setStopMode();
+int get_max_sound_voices()
+{
+  return max_voices;
 }
 
 void stop_all_sounds()
 {
-  WinAutoLock lock(&sound_cs);
-
-  for (auto && s : playing_sounds)
-    if (!s.isEmpty())
-      s.setStopMode();
+  stop_all_voices();
 }
 
+// commands are collected until leave_sound_critical_section, then mixer gets all of them at once
 void enter_sound_critical_section()
 {
-  if (sound_cs_manual_entered)
-    return;
-
-  sound_cs.lock();
-  sound_cs_manual_entered = true;
+  sound_commands_batching = true;
 }
 
 void leave_sound_critical_section()
 {
-  if (sound_cs_manual_entered)
+  if (sound_commands_batching)
   {
-    sound_cs_manual_entered = false;
-    sound_cs.unlock();
+    sound_commands_batching = false;
+    publish_sound_commands();
   }
 }
 
 void set_master_volume(float volume)
 {
-  WinAutoLock lock(&sound_cs);
-  master_volume = volume;
+  SoundCommand cmd;
+  memset(&cmd, 0, sizeof(cmd));
+  cmd.type = SOUND_CMD_MASTER_VOLUME;
+  cmd.value = volume;
+  if (device_initialized)
+    push_sound_command(cmd);
+  else
+    master_volume = volume;
+}
+
+static void push_bus_command(int bus, SoundCommandType type, float value, float value2)
+{
+  if (bus < 0 || bus >= MAX_SOUND_BUSES)
+  {
+    print_error("Invalid sound bus %d, expected 0..%d", bus, MAX_SOUND_BUSES - 1);
+    return;
+  }
+
+  SoundCommand cmd;
+  memset(&cmd, 0, sizeof(cmd));
+  cmd.type = type;
+  cmd.handle = unsigned(bus);
+  cmd.value = value;
+  cmd.value2 = value2;
+  push_sound_command(cmd);
+}
+
+void set_bus_volume(int bus, float volume)
+{
+  push_bus_command(bus, SOUND_CMD_BUS_VOLUME, clamp(volume, 0.0f, 100000.0f), 0.0f);
+}
+
+void set_bus_lowpass(int bus, float cutoff_hz)
+{
+  push_bus_command(bus, SOUND_CMD_BUS_LOWPASS, cutoff_hz, 0.0f);
+}
+
+void set_bus_reverb(int bus, float wet, float room_size)
+{
+  push_bus_command(bus, SOUND_CMD_BUS_REVERB, clamp(wet, 0.0f, 1.0f), room_size);
+}
+
+void set_bus_compressor(int bus, float threshold, float ratio)
+{
+  push_bus_command(bus, SOUND_CMD_BUS_COMPRESSOR, threshold, ratio);
 }
 
 float get_output_sample_rate()
 {
-  return OUTPUT_SAMPLE_RATE;
+  return output_sample_rate;
 }
 
 int64_t get_total_samples_played()
@@ -1065,35 +3470,49 @@ double get_total_time_played()
   return total_time_played;
 }
 
-
-PcmSound::PcmSound(PcmSound && b)
+AudioStats get_audio_stats()
 {
-  WinAutoLock lock(&sound_cs);
+  AudioStats st;
+  st.mixTimeAvgMs = stats_mix_time_avg_ms.load(memory_order_relaxed);
+  st.mixTimeMaxMs = stats_mix_time_max_ms.load(memory_order_relaxed);
+  st.mixLoad = stats_mix_load.load(memory_order_relaxed);
+  st.bufferMs = stats_callback_frames.load(memory_order_relaxed) * 1000.0f / output_sample_rate;
+  st.activeVoices = stats_active_voices.load(memory_order_relaxed);
+  st.activeMusic = stats_active_music.load(memory_order_relaxed);
+  st.underruns = stats_underruns.load(memory_order_relaxed);
+  st.overloads = stats_overloads.load(memory_order_relaxed);
+  st.commandsPerCallbackMax = stats_commands_max.load(memory_order_relaxed);
+  st.commandsPending = int(sound_commands_local_write - sound_commands_read.load(memory_order_relaxed));
+  st.commandsDropped = sound_commands_dropped;
+  st.latencyMs = get_audio_latency();
+  st.deviceSampleRate = device_initialized ? int(miniaudio_device.playback.internalSampleRate) : 0;
+  st.devicePeriodFrames = device_initialized ? int(miniaudio_device.playback.internalPeriodSizeInFrames) : 0;
+  st.devicePeriods = device_initialized ? int(miniaudio_device.playback.internalPeriods) : 0;
+  return st;
+}
 
-  for (auto && s : playing_sounds)
-    if (s.sound == &b)
-      if (!s.isEmpty())
-        s.setStopMode();
 
+// voices use sound data directly, so they are not affected by moving PcmSound
+PcmSound::PcmSound(PcmSound && b)
+{
   frequency = b.frequency;
   samples = b.samples;
   channels = b.channels;
+  storage = b.storage;
   data = b.data;
   b.data = nullptr;
 }
 
 PcmSound& PcmSound::operator=(PcmSound && b)
 {
-  WinAutoLock lock(&sound_cs);
-
-  for (auto && s : playing_sounds)
-    if (s.sound == this || s.sound == &b)
-      if (!s.isEmpty())
-        s.setStopMode();
+  if (this == &b)
+    return *this;
 
+  deleteData();
   frequency = b.frequency;
   samples = b.samples;
   channels = b.channels;
+  storage = b.storage;
   data = b.data;
   b.data = nullptr;
 
@@ -1106,15 +3525,7 @@ PcmSound::~PcmSound()
   if (!data)
     return;
 
-  WinAutoLock lock(&sound_cs);
-
-  for (auto && s : playing_sounds)
-    if (s.sound == this)
-      if (!s.isEmpty())
-        s.setStopMode();
-
   deleteData();
-  data = nullptr;
   samples = 0;
 }
 
@@ -1122,6 +3533,7 @@ PcmSound::~PcmSound()
 
 
 MAKE_TYPE_FACTORY(PcmSound, sound::PcmSound)
+MAKE_TYPE_FACTORY(AudioStats, sound::AudioStats)
 
 
 struct SimNode_DeletePcmSound : SimNode_Delete
@@ -1153,10 +3565,12 @@ struct PcmSoundAnnotation : ManagedStructureAnnotation<sound::PcmSound, true, tr
 {
   PcmSoundAnnotation(ModuleLibrary & ml) : ManagedStructureAnnotation("PcmSound", ml)
   {
+    cppName = " ::sound::PcmSound";
     addProperty<DAS_BIND_MANAGED_PROP(getDuration)>("duration");
     addProperty<DAS_BIND_MANAGED_PROP(getFrequency)>("frequency");
     addProperty<DAS_BIND_MANAGED_PROP(getSamples)>("samples");
     addProperty<DAS_BIND_MANAGED_PROP(getChannels)>("channels");
+    addProperty<DAS_BIND_MANAGED_PROP(getStorage)>("storage");
     addProperty<DAS_BIND_MANAGED_PROP(isValid)>("valid");
   }
 
@@ -1178,6 +3592,36 @@ struct PcmSoundAnnotation : ManagedStructureAnnotation<sound::PcmSound, true, tr
 
 
 
+struct AudioStatsAnnotation : ManagedStructureAnnotation<sound::AudioStats, true, true>
+{
+  AudioStatsAnnotation(ModuleLibrary & ml) : ManagedStructureAnnotation("AudioStats", ml)
+  {
+    cppName = " ::sound::AudioStats";
+    addField<DAS_BIND_MANAGED_FIELD(mixTimeAvgMs)>("mixTimeAvgMs");
+    addField<DAS_BIND_MANAGED_FIELD(mixTimeMaxMs)>("mixTimeMaxMs");
+    addField<DAS_BIND_MANAGED_FIELD(mixLoad)>("mixLoad");
+    addField<DAS_BIND_MANAGED_FIELD(bufferMs)>("bufferMs");
+    addField<DAS_BIND_MANAGED_FIELD(activeVoices)>("activeVoices");
+    addField<DAS_BIND_MANAGED_FIELD(activeMusic)>("activeMusic");
+    addField<DAS_BIND_MANAGED_FIELD(underruns)>("underruns");
+    addField<DAS_BIND_MANAGED_FIELD(overloads)>("overloads");
+    addField<DAS_BIND_MANAGED_FIELD(commandsPerCallbackMax)>("commandsPerCallbackMax");
+    addField<DAS_BIND_MANAGED_FIELD(commandsPending)>("commandsPending");
+    addField<DAS_BIND_MANAGED_FIELD(commandsDropped)>("commandsDropped");
+    addField<DAS_BIND_MANAGED_FIELD(latencyMs)>("latencyMs");
+    addField<DAS_BIND_MANAGED_FIELD(deviceSampleRate)>("deviceSampleRate");
+    addField<DAS_BIND_MANAGED_FIELD(devicePeriodFrames)>("devicePeriodFrames");
+    addField<DAS_BIND_MANAGED_FIELD(devicePeriods)>("devicePeriods");
+  }
+
+  virtual bool isLocal() const override { return true; }
+  virtual bool canCopy() const override { return true; }
+  virtual bool canMove() const override { return true; }
+  virtual bool canBePlacedInContainer() const override { return true; }
+};
+
+
+
 template <>
 struct das::cast <sound::PlayingSoundHandle>
 {
@@ -1230,147 +3674,297 @@ public:
 
     addAnnotation(das::make_smart<PlayingSoundHandleAnnotation>());
     addAnnotation(das::make_smart<PcmSoundAnnotation>(lib));
+    addAnnotation(das::make_smart<AudioStatsAnnotation>(lib));
     addCtorAndUsing<sound::PcmSound>(*this, lib, "PcmSound", "PcmSound");
 
+    addConstant(*this, "SOUND_STORAGE_FLOAT", int(sound::SOUND_STORAGE_FLOAT));
+    addConstant(*this, "SOUND_STORAGE_INT16", int(sound::SOUND_STORAGE_INT16));
+    addConstant(*this, "SOUND_STORAGE_ADPCM", int(sound::SOUND_STORAGE_ADPCM));
+    addConstant(*this, "SOUND_BUS_SFX", int(SOUND_BUS_SFX));
+    addConstant(*this, "SOUND_BUS_MUSIC", int(SOUND_BUS_MUSIC));
+    addConstant(*this, "SOUND_BUS_UI", int(SOUND_BUS_UI));
+    addConstant(*this, "MAX_SOUND_BUSES", int(MAX_SOUND_BUSES));
+
     addExtern<DAS_BIND_FUN(sound::create_sound), SimNode_ExtFuncCallAndCopyOrMove>(*this, lib,
-      "create_sound", SideEffects::modifyExternal, "create_sound")
+      "create_sound", SideEffects::modifyExternal, "sound::create_sound")
       ->args({"frequency", "data"});
 
     addExtern<DAS_BIND_FUN(sound::create_sound_stereo), SimNode_ExtFuncCallAndCopyOrMove>(*this, lib,
-      "create_sound", SideEffects::modifyExternal, "create_sound_stereo")
+      "create_sound", SideEffects::modifyExternal, "sound::create_sound_stereo")
       ->args({"frequency", "data"});
 
     addExtern<DAS_BIND_FUN(sound::create_sound_from_file), SimNode_ExtFuncCallAndCopyOrMove>(*this, lib,
-      "create_sound", SideEffects::modifyExternal, "create_sound_from_file")
+      "create_sound", SideEffects::modifyExternal, "sound::create_sound_from_file")
+      ->args({"file_name"});
+
+    addExtern<DAS_BIND_FUN(sound::create_sound_with_storage), SimNode_ExtFuncCallAndCopyOrMove>(*this, lib,
+      "create_sound", SideEffects::modifyExternal, "sound::create_sound_with_storage")
+      ->args({"frequency", "data", "storage"});
+
+    addExtern<DAS_BIND_FUN(sound::create_sound_stereo_with_storage), SimNode_ExtFuncCallAndCopyOrMove>(*this, lib,
+      "create_sound", SideEffects::modifyExternal, "sound::create_sound_stereo_with_storage")
+      ->args({"frequency", "data", "storage"});
+
+    addExtern<DAS_BIND_FUN(sound::create_sound_from_file_with_storage), SimNode_ExtFuncCallAndCopyOrMove>(*this, lib,
+      "create_sound", SideEffects::modifyExternal, "sound::create_sound_from_file_with_storage")
+      ->args({"file_name", "storage"});
+
+    addExtern<DAS_BIND_FUN(sound::set_sound_disk_cache_enabled)>(*this, lib,
+      "set_sound_disk_cache_enabled", SideEffects::modifyExternal, "sound::set_sound_disk_cache_enabled")
+      ->args({"enabled"});
+
+    addExtern<DAS_BIND_FUN(sound::set_sound_resample_on_load)>(*this, lib,
+      "set_sound_resample_on_load", SideEffects::modifyExternal, "sound::set_sound_resample_on_load")
+      ->args({"enabled"});
+
+    addExtern<DAS_BIND_FUN(sound::load_sound_async)>(*this, lib,
+      "load_sound_async", SideEffects::modifyExternal, "sound::load_sound_async")
+      ->args({"file_name"});
+
+    addExtern<DAS_BIND_FUN(sound::is_sound_loaded)>(*this, lib,
+      "is_sound_loaded", SideEffects::accessExternal, "sound::is_sound_loaded")
+      ->args({"handle"});
+
+    addExtern<DAS_BIND_FUN(sound::take_loaded_sound), SimNode_ExtFuncCallAndCopyOrMove>(*this, lib,
+      "take_loaded_sound", SideEffects::modifyExternal, "sound::take_loaded_sound")
+      ->args({"handle"});
+
+    addExtern<DAS_BIND_FUN(sound::open_music)>(*this, lib,
+      "open_music", SideEffects::modifyExternal, "sound::open_music")
       ->args({"file_name"});
 
+    addExtern<DAS_BIND_FUN(sound::close_music)>(*this, lib,
+      "close_music", SideEffects::modifyExternal, "sound::close_music")
+      ->args({"music"});
+
+    addExtern<DAS_BIND_FUN(sound::play_music)>(*this, lib,
+      "play_music", SideEffects::modifyExternal, "sound::play_music")
+      ->args({"music", "volume", "loop"});
+
+    addExtern<DAS_BIND_FUN(sound::pause_music)>(*this, lib,
+      "pause_music", SideEffects::modifyExternal, "sound::pause_music")
+      ->args({"music"});
+
+    addExtern<DAS_BIND_FUN(sound::stop_music)>(*this, lib,
+      "stop_music", SideEffects::modifyExternal, "sound::stop_music")
+      ->args({"music"});
+
+    addExtern<DAS_BIND_FUN(sound::seek_music)>(*this, lib,
+      "seek_music", SideEffects::modifyExternal, "sound::seek_music")
+      ->args({"music", "pos_seconds"});
+
+    addExtern<DAS_BIND_FUN(sound::set_music_volume)>(*this, lib,
+      "set_music_volume", SideEffects::modifyExternal, "sound::set_music_volume")
+      ->args({"music", "volume"});
+
+    addExtern<DAS_BIND_FUN(sound::set_music_bus)>(*this, lib,
+      "set_music_bus", SideEffects::modifyExternal, "sound::set_music_bus")
+      ->args({"music", "bus"});
+
+    addExtern<DAS_BIND_FUN(sound::is_music_playing)>(*this, lib,
+      "is_music_playing", SideEffects::accessExternal, "sound::is_music_playing")
+      ->args({"music"});
+
+    addExtern<DAS_BIND_FUN(sound::get_music_pos)>(*this, lib,
+      "get_music_pos", SideEffects::accessExternal, "sound::get_music_pos")
+      ->args({"music"});
+
+    addExtern<DAS_BIND_FUN(sound::get_music_duration)>(*this, lib,
+      "get_music_duration", SideEffects::accessExternal, "sound::get_music_duration")
+      ->args({"music"});
+
     addExtern<DAS_BIND_FUN(sound::get_sound_data)>(*this, lib,
-      "get_sound_data", SideEffects::modifyArgumentAndExternal, "get_sound_data")
+      "get_sound_data", SideEffects::modifyArgumentAndExternal, "sound::get_sound_data")
       ->args({"sound", "out_data"});
 
     addExtern<DAS_BIND_FUN(sound::get_sound_data_stereo)>(*this, lib,
-      "get_sound_data", SideEffects::modifyArgumentAndExternal, "get_sound_data_stereo")
+      "get_sound_data", SideEffects::modifyArgumentAndExternal, "sound::get_sound_data_stereo")
       ->args({"sound", "out_data"});
 
     addExtern<DAS_BIND_FUN(sound::set_sound_data)>(*this, lib,
-      "set_sound_data", SideEffects::modifyExternal, "set_sound_data")
+      "set_sound_data", SideEffects::modifyExternal, "sound::set_sound_data")
       ->args({"sound", "in_data"});
 
     addExtern<DAS_BIND_FUN(sound::set_sound_data_stereo)>(*this, lib,
-      "set_sound_data", SideEffects::modifyExternal, "set_sound_data_stereo")
+      "set_sound_data", SideEffects::modifyExternal, "sound::set_sound_data_stereo")
       ->args({"sound", "in_data"});
 
     addExtern<DAS_BIND_FUN(sound::play_sound_1)>(*this, lib,
-      "play_sound", SideEffects::modifyExternal, "play_sound_1")
+      "play_sound", SideEffects::modifyExternal, "sound::play_sound_1")
       ->args({"sound"});
 
     addExtern<DAS_BIND_FUN(sound::play_sound_2)>(*this, lib,
-      "play_sound", SideEffects::modifyExternal, "play_sound_2")
+      "play_sound", SideEffects::modifyExternal, "sound::play_sound_2")
       ->args({"sound", "volume"});
 
     addExtern<DAS_BIND_FUN(sound::play_sound_3)>(*this, lib,
-      "play_sound", SideEffects::modifyExternal, "play_sound_3")
+      "play_sound", SideEffects::modifyExternal, "sound::play_sound_3")
       ->args({"sound", "volume", "pitch"});
 
     addExtern<DAS_BIND_FUN(sound::play_sound_4)>(*this, lib,
-      "play_sound", SideEffects::modifyExternal, "play_sound_4")
+      "play_sound", SideEffects::modifyExternal, "sound::play_sound_4")
       ->args({"sound", "volume", "pitch", "pan"});
 
     addExtern<DAS_BIND_FUN(sound::play_sound_5)>(*this, lib,
-      "play_sound", SideEffects::modifyExternal, "play_sound_5")
+      "play_sound", SideEffects::modifyExternal, "sound::play_sound_5")
       ->args({"sound", "volume", "pitch", "pan", "start_time", "stop_time"});
 
     addExtern<DAS_BIND_FUN(sound::play_sound_loop_1)>(*this, lib,
-      "play_sound_loop", SideEffects::modifyExternal, "play_sound_loop_1")
+      "play_sound_loop", SideEffects::modifyExternal, "sound::play_sound_loop_1")
       ->args({"sound"});
 
     addExtern<DAS_BIND_FUN(sound::play_sound_loop_2)>(*this, lib,
-      "play_sound_loop", SideEffects::modifyExternal, "play_sound_loop_2")
+      "play_sound_loop", SideEffects::modifyExternal, "sound::play_sound_loop_2")
       ->args({"sound", "volume"});
 
     addExtern<DAS_BIND_FUN(sound::play_sound_loop_3)>(*this, lib,
-      "play_sound_loop", SideEffects::modifyExternal, "play_sound_loop_3")
+      "play_sound_loop", SideEffects::modifyExternal, "sound::play_sound_loop_3")
       ->args({"sound", "volume", "pitch"});
 
     addExtern<DAS_BIND_FUN(sound::play_sound_loop_4)>(*this, lib,
-      "play_sound_loop", SideEffects::modifyExternal, "play_sound_loop_4")
+      "play_sound_loop", SideEffects::modifyExternal, "sound::play_sound_loop_4")
       ->args({"sound", "volume", "pitch", "pan"});
 
     addExtern<DAS_BIND_FUN(sound::play_sound_loop_5)>(*this, lib,
-      "play_sound_loop", SideEffects::modifyExternal, "play_sound_loop_5")
+      "play_sound_loop", SideEffects::modifyExternal, "sound::play_sound_loop_5")
       ->args({"sound", "volume", "pitch", "pan", "start_time", "end_time"});
 
     addExtern<DAS_BIND_FUN(sound::play_sound_deferred_1)>(*this, lib,
-      "play_sound_deferred", SideEffects::modifyExternal, "play_sound_deferred_1")
+      "play_sound_deferred", SideEffects::modifyExternal, "sound::play_sound_deferred_1")
       ->args({"sound", "defer_seconds"});
 
     addExtern<DAS_BIND_FUN(sound::play_sound_deferred_2)>(*this, lib,
-      "play_sound_deferred", SideEffects::modifyExternal, "play_sound_deferred_2")
+      "play_sound_deferred", SideEffects::modifyExternal, "sound::play_sound_deferred_2")
       ->args({"sound", "defer_seconds", "volume"});
 
     addExtern<DAS_BIND_FUN(sound::play_sound_deferred_3)>(*this, lib,
-      "play_sound_deferred", SideEffects::modifyExternal, "play_sound_deferred_3")
+      "play_sound_deferred", SideEffects::modifyExternal, "sound::play_sound_deferred_3")
       ->args({"sound", "defer_seconds", "volume", "pitch"});
 
     addExtern<DAS_BIND_FUN(sound::play_sound_deferred_4)>(*this, lib,
-      "play_sound_deferred", SideEffects::modifyExternal, "play_sound_deferred_4")
+      "play_sound_deferred", SideEffects::modifyExternal, "sound::play_sound_deferred_4")
       ->args({"sound", "defer_seconds", "volume", "pitch", "pan"});
 
     addExtern<DAS_BIND_FUN(sound::play_sound_deferred_5)>(*this, lib,
-      "play_sound_deferred", SideEffects::modifyExternal, "play_sound_deferred_5")
+      "play_sound_deferred", SideEffects::modifyExternal, "sound::play_sound_deferred_5")
       ->args({"sound", "defer_seconds", "volume", "pitch", "pan", "start_time", "stop_time"});
 
+    addExtern<DAS_BIND_FUN(sound::play_sound_at_1)>(*this, lib,
+      "play_sound_at", SideEffects::modifyExternal, "sound::play_sound_at_1")
+      ->args({"sound", "sample_time"});
+
+    addExtern<DAS_BIND_FUN(sound::play_sound_at_2)>(*this, lib,
+      "play_sound_at", SideEffects::modifyExternal, "sound::play_sound_at_2")
+      ->args({"sound", "sample_time", "volume"});
+
+    addExtern<DAS_BIND_FUN(sound::play_sound_at_3)>(*this, lib,
+      "play_sound_at", SideEffects::modifyExternal, "sound::play_sound_at_3")
+      ->args({"sound", "sample_time", "volume", "pitch"});
+
+    addExtern<DAS_BIND_FUN(sound::play_sound_at_4)>(*this, lib,
+      "play_sound_at", SideEffects::modifyExternal, "sound::play_sound_at_4")
+      ->args({"sound", "sample_time", "volume", "pitch", "pan"});
+
+    addExtern<DAS_BIND_FUN(sound::play_sound_loop_at_4)>(*this, lib,
+      "play_sound_loop_at", SideEffects::modifyExternal, "sound::play_sound_loop_at_4")
+      ->args({"sound", "sample_time", "volume", "pitch", "pan"});
+
 
     addExtern<DAS_BIND_FUN(sound::set_sound_pitch)>(*this, lib,
-      "set_sound_pitch", SideEffects::modifyExternal, "set_sound_pitch")
+      "set_sound_pitch", SideEffects::modifyExternal, "sound::set_sound_pitch")
       ->args({"sound_handle", "pitch"});
 
     addExtern<DAS_BIND_FUN(sound::set_sound_volume)>(*this, lib,
-      "set_sound_volume", SideEffects::modifyExternal, "set_sound_volume")
+      "set_sound_volume", SideEffects::modifyExternal, "sound::set_sound_volume")
       ->args({"sound_handle", "volume"});
 
     addExtern<DAS_BIND_FUN(sound::set_sound_pan)>(*this, lib,
-      "set_sound_pan", SideEffects::modifyExternal, "set_sound_pan")
+      "set_sound_pan", SideEffects::modifyExternal, "sound::set_sound_pan")
       ->args({"sound_handle", "pan"});
 
+    addExtern<DAS_BIND_FUN(sound::set_sound_bus)>(*this, lib,
+      "set_sound_bus", SideEffects::modifyExternal, "sound::set_sound_bus")
+      ->args({"sound_handle", "bus"});
+
     addExtern<DAS_BIND_FUN(sound::is_playing)>(*this, lib,
-      "is_playing", SideEffects::accessExternal, "is_playing")
+      "is_playing", SideEffects::accessExternal, "sound::is_playing")
       ->args({"sound_handle"});
 
     addExtern<DAS_BIND_FUN(sound::get_sound_play_pos)>(*this, lib,
-      "get_sound_play_pos", SideEffects::accessExternal, "get_sound_play_pos")
+      "get_sound_play_pos", SideEffects::accessExternal, "sound::get_sound_play_pos")
       ->args({"sound_handle"});
 
     addExtern<DAS_BIND_FUN(sound::set_sound_play_pos)>(*this, lib,
-      "set_sound_play_pos", SideEffects::modifyExternal, "set_sound_play_pos")
+      "set_sound_play_pos", SideEffects::modifyExternal, "sound::set_sound_play_pos")
       ->args({"sound_handle", "pos_seconds"});
 
     addExtern<DAS_BIND_FUN(sound::stop_sound)>(*this, lib,
-      "stop_sound", SideEffects::modifyExternal, "stop_sound")
+      "stop_sound", SideEffects::modifyExternal, "sound::stop_sound")
       ->args({"sound_handle"});
 
 
+    addExtern<DAS_BIND_FUN(sound::set_sound_priority)>(*this, lib,
+      "set_sound_priority", SideEffects::modifyExternal, "sound::set_sound_priority")
+      ->args({"sound_handle", "priority"});
+
+    addExtern<DAS_BIND_FUN(sound::set_max_sound_voices)>(*this, lib,
+      "set_max_sound_voices", SideEffects::modifyExternal, "sound::set_max_sound_voices")
+      ->args({"count"});
+
+    addExtern<DAS_BIND_FUN(sound::get_max_sound_voices)>(*this, lib,
+      "get_max_sound_voices", SideEffects::accessExternal, "sound::get_max_sound_voices");
+
     addExtern<DAS_BIND_FUN(sound::stop_all_sounds)>(*this, lib,
-      "stop_all_sounds", SideEffects::modifyExternal, "stop_all_sounds");
+      "stop_all_sounds", SideEffects::modifyExternal, "sound::stop_all_sounds");
 
     addExtern<DAS_BIND_FUN(sound::enter_sound_critical_section)>(*this, lib,
-      "enter_sound_critical_section", SideEffects::modifyExternal, "enter_sound_critical_section");
+      "enter_sound_critical_section", SideEffects::modifyExternal, "sound::enter_sound_critical_section");
 
     addExtern<DAS_BIND_FUN(sound::leave_sound_critical_section)>(*this, lib,
-      "leave_sound_critical_section", SideEffects::modifyExternal, "leave_sound_critical_section");
+      "leave_sound_critical_section", SideEffects::modifyExternal, "sound::leave_sound_critical_section");
 
     addExtern<DAS_BIND_FUN(sound::set_master_volume)>(*this, lib,
-      "set_master_volume", SideEffects::modifyExternal, "set_master_volume")
+      "set_master_volume", SideEffects::modifyExternal, "sound::set_master_volume")
       ->args({"volume"});
 
+    addExtern<DAS_BIND_FUN(sound::set_bus_volume)>(*this, lib,
+      "set_bus_volume", SideEffects::modifyExternal, "sound::set_bus_volume")
+      ->args({"bus", "volume"});
+
+    addExtern<DAS_BIND_FUN(sound::set_bus_lowpass)>(*this, lib,
+      "set_bus_lowpass", SideEffects::modifyExternal, "sound::set_bus_lowpass")
+      ->args({"bus", "cutoff_hz"});
+
+    addExtern<DAS_BIND_FUN(sound::set_bus_reverb)>(*this, lib,
+      "set_bus_reverb", SideEffects::modifyExternal, "sound::set_bus_reverb")
+      ->args({"bus", "wet", "room_size"});
+
+    addExtern<DAS_BIND_FUN(sound::set_bus_compressor)>(*this, lib,
+      "set_bus_compressor", SideEffects::modifyExternal, "sound::set_bus_compressor")
+      ->args({"bus", "threshold", "ratio"});
+
     addExtern<DAS_BIND_FUN(sound::get_output_sample_rate)>(*this, lib,
-      "get_output_sample_rate", SideEffects::accessExternal, "get_output_sample_rate");
+      "get_output_sample_rate", SideEffects::accessExternal, "sound::get_output_sample_rate");
+
+    addExtern<DAS_BIND_FUN(sound::set_audio_device_config)>(*this, lib,
+      "set_audio_device_config", SideEffects::modifyExternal, "sound::set_audio_device_config")
+      ->args({"sample_rate", "period_frames", "periods"});
+
+    addExtern<DAS_BIND_FUN(sound::set_audio_low_latency)>(*this, lib,
+      "set_audio_low_latency", SideEffects::modifyExternal, "sound::set_audio_low_latency")
+      ->args({"enabled"});
+
+    addExtern<DAS_BIND_FUN(sound::get_audio_latency)>(*this, lib,
+      "get_audio_latency", SideEffects::accessExternal, "sound::get_audio_latency");
 
     addExtern<DAS_BIND_FUN(sound::get_total_samples_played)>(*this, lib,
-      "get_total_samples_played", SideEffects::accessExternal, "get_total_samples_played");
+      "get_total_samples_played", SideEffects::accessExternal, "sound::get_total_samples_played");
+
+    addExtern<DAS_BIND_FUN(sound::get_audio_stats), SimNode_ExtFuncCallAndCopyOrMove>(*this, lib,
+      "get_audio_stats", SideEffects::accessExternal, "sound::get_audio_stats");
 
     addExtern<DAS_BIND_FUN(sound::get_total_time_played)>(*this, lib,
-      "get_total_time_played", SideEffects::accessExternal, "get_total_time_played");
+      "get_total_time_played", SideEffects::accessExternal, "sound::get_total_time_played");
 
     // its AOT ready
     //verifyAotReady();
@@ -1378,7 +3972,7 @@ public:
 
   virtual ModuleAotType aotRequire(TextWriter & tw) const override
   {
-    //tw << "#include \"test_profile.h\"\n";
+    tw << "#include \"sound.h\"\n";
     return ModuleAotType::cpp;
   }
 };
@@ -5,13 +5,106 @@
 
 namespace sound
 {
-  struct PcmSound;
+  enum SoundStorage
+  {
+    SOUND_STORAGE_FLOAT,
+    SOUND_STORAGE_INT16,
+    SOUND_STORAGE_ADPCM
+  };
+
+  // definition is here for the AOT generated code
+  struct PcmSound
+  {
+  private:
+    float * data; // raw buffer, format depends on 'storage'
+  public:
+    int frequency;
+    int samples;
+    int channels;
+    int storage;
+
+    float * getData() const
+    {
+      return data;
+    }
+
+    void newData(size_t size_bytes);
+    void deleteData();
+
+    bool isValid() const
+    {
+      return !!data;
+    }
+
+    int getDataMemorySize() const;
+
+    float getDuration() const
+    {
+      return samples / float(frequency);
+    }
+
+    int getFrequency() const
+    {
+      return frequency;
+    }
+
+    int getSamples() const
+    {
+      return samples;
+    }
+
+    int getChannels() const
+    {
+      return channels;
+    }
+
+    int getStorage() const
+    {
+      return storage;
+    }
+
+    PcmSound()
+    {
+      frequency = 44100;
+      samples = 0;
+      channels = 1;
+      storage = SOUND_STORAGE_FLOAT;
+      data = nullptr;
+    }
+
+    PcmSound(const PcmSound & b);
+    PcmSound& operator=(const PcmSound & b);
+    PcmSound(PcmSound && b);
+    PcmSound& operator=(PcmSound && b);
+    ~PcmSound();
+
+    friend void delete_sound(PcmSound * sound);
+  };
 
   struct PlayingSoundHandle
   {
     unsigned handle = 0;
   };
 
+  struct AudioStats
+  {
+    float mixTimeAvgMs = 0.0f;
+    float mixTimeMaxMs = 0.0f;
+    float mixLoad = 0.0f;   // mix time / played time
+    float bufferMs = 0.0f;  // size of the last buffer requested by device
+    int activeVoices = 0;
+    int activeMusic = 0;
+    int underruns = 0;
+    int overloads = 0;      // callbacks that took longer than their buffer plays
+    int commandsPerCallbackMax = 0;
+    int commandsPending = 0;
+    int commandsDropped = 0;
+    float latencyMs = 0.0f; // device buffers, without the latency of OS mixer and hardware
+    int deviceSampleRate = 0;
+    int devicePeriodFrames = 0;
+    int devicePeriods = 0;
+  };
+
 
 
   void initialize();
@@ -20,6 +113,25 @@ namespace sound
   PcmSound create_sound(int frequency, const das::TArray<float> & data);
   PcmSound create_sound_stereo(int frequency, const das::TArray<das::float2> & data);
   PcmSound create_sound_from_file(const char * file_name);
+  PcmSound create_sound_with_storage(int frequency, const das::TArray<float> & data, int storage);
+  PcmSound create_sound_stereo_with_storage(int frequency, const das::TArray<das::float2> & data, int storage);
+  PcmSound create_sound_from_file_with_storage(const char * file_name, int storage);
+  void set_sound_disk_cache_enabled(bool enabled);
+  void set_sound_resample_on_load(bool enabled);
+  int load_sound_async(const char * file_name);
+  bool is_sound_loaded(int handle);
+  PcmSound take_loaded_sound(int handle);
+  int open_music(const char * file_name);
+  void close_music(int handle);
+  void play_music(int handle, float volume, bool loop);
+  void pause_music(int handle);
+  void stop_music(int handle);
+  void seek_music(int handle, float pos_seconds);
+  void set_music_volume(int handle, float volume);
+  void set_music_bus(int handle, int bus);
+  bool is_music_playing(int handle);
+  float get_music_pos(int handle);
+  float get_music_duration(int handle);
   void get_sound_data(const PcmSound & sound, das::TArray<float> & out_data);
   void get_sound_data_stereo(const PcmSound & sound, das::TArray<das::float2> & out_data);
   void set_sound_data(PcmSound & sound, const das::TArray<float> & in_data);
@@ -41,6 +153,11 @@ namespace sound
   PlayingSoundHandle play_sound_deferred_2(const PcmSound & sound, float defer_seconds, float volume);
   PlayingSoundHandle play_sound_deferred_3(const PcmSound & sound, float defer_seconds, float volume, float pitch);
   PlayingSoundHandle play_sound_deferred_4(const PcmSound & sound, float defer_seconds, float volume, float pitch, float pan);
+  PlayingSoundHandle play_sound_at_1(const PcmSound & sound, int64_t sample_time);
+  PlayingSoundHandle play_sound_at_2(const PcmSound & sound, int64_t sample_time, float volume);
+  PlayingSoundHandle play_sound_at_3(const PcmSound & sound, int64_t sample_time, float volume, float pitch);
+  PlayingSoundHandle play_sound_at_4(const PcmSound & sound, int64_t sample_time, float volume, float pitch, float pan);
+  PlayingSoundHandle play_sound_loop_at_4(const PcmSound & sound, int64_t sample_time, float volume, float pitch, float pan);
   PlayingSoundHandle play_sound_deferred_5(const PcmSound & sound, float defer_seconds, float volume, float pitch, float pan,
     float start_time, float end_time);
 
@@ -48,15 +165,27 @@ namespace sound
   void set_sound_pitch(PlayingSoundHandle handle, float pitch);
   void set_sound_volume(PlayingSoundHandle handle, float volume);
   void set_sound_pan(PlayingSoundHandle handle, float pan);
+  void set_sound_bus(PlayingSoundHandle handle, int bus);
+  void set_sound_priority(PlayingSoundHandle handle, int priority);
   float get_sound_play_pos(PlayingSoundHandle handle);
   void set_sound_play_pos(PlayingSoundHandle handle, float pos_seconds);
   void stop_sound(PlayingSoundHandle handle);
   void stop_all_sounds();
+  void set_max_sound_voices(int count);
+  int get_max_sound_voices();
   void enter_sound_critical_section();  // ?
   void leave_sound_critical_section();  // ?
 
   void set_master_volume(float volume);
+  void set_bus_volume(int bus, float volume);
+  void set_bus_lowpass(int bus, float cutoff_hz);
+  void set_bus_reverb(int bus, float wet, float room_size);
+  void set_bus_compressor(int bus, float threshold, float ratio);
   float get_output_sample_rate();
+  void set_audio_device_config(int sample_rate, int period_frames, int periods);
+  void set_audio_low_latency(bool enabled);
+  float get_audio_latency();
   int64_t get_total_samples_played();
   double get_total_time_played();
+  AudioStats get_audio_stats();
 }